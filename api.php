@@ -5,14 +5,276 @@ $servername = "##########";
 $username = "##########";
 $password = "##########";
 
+// Rows per multi-row INSERT, a statement has at most 65535 placeholders (5 per log row)
+$insert_chunk_size = 500;
+
 // Create a connection to your database
 try {
-    $pdo = new PDO("mysql:host=$servername;dbname=$username", $username, $password);
+    $pdo = new PDO("mysql:host=$servername;dbname=$username", $username, $password,
+                   [PDO::ATTR_ERRMODE => PDO::ERRMODE_EXCEPTION]);
 } catch (PDOException $e) {
     $message = ['error' => 'unable to connect to db'];
     exit(json_encode($message));
 }
 
+// Decode one LZ4 block (no frame) of a streamed upload, at most $expected_len bytes come out of it
+function lz4_block_decompress($src, $expected_len) {
+    $src_len = strlen($src);
+    $dst = '';
+    $ip = 0;
+    while ($ip < $src_len) {
+        $token = ord($src[$ip++]);
+        $literal_len = $token >> 4;
+        if ($literal_len == 15) {
+            do {
+                if ($ip >= $src_len) {
+                    return false;
+                }
+                $more = ord($src[$ip++]);
+                $literal_len += $more;
+            } while ($more == 255);
+        }
+        if ($ip + $literal_len > $src_len) {
+            return false;
+        }
+        $dst .= substr($src, $ip, $literal_len);
+        $ip += $literal_len;
+        if ($ip == $src_len) {
+            break;
+        }
+
+        if ($ip + 2 > $src_len) {
+            return false;
+        }
+        $offset = ord($src[$ip]) | (ord($src[$ip + 1]) << 8);
+        $ip += 2;
+        $match_len = ($token & 0x0F) + 4;
+        if (($token & 0x0F) == 15) {
+            do {
+                if ($ip >= $src_len) {
+                    return false;
+                }
+                $more = ord($src[$ip++]);
+                $match_len += $more;
+            } while ($more == 255);
+        }
+        $start = strlen($dst) - $offset;
+        if ($offset == 0 || $start < 0 || strlen($dst) + $match_len > $expected_len) {
+            return false;
+        }
+        // the match may overlap the bytes it produces
+        for ($i = 0; $i < $match_len; $i++) {
+            $dst .= $dst[$start + $i];
+        }
+    }
+    return strlen($dst) == $expected_len ? $dst : false;
+}
+
+// Decode a streamed upload, blocks of [uint16 raw length][uint16 packed length][LZ4 block] (little endian)
+function lz4_blocks_decompress($src) {
+    $dst = '';
+    $position = 0;
+    while ($position < strlen($src)) {
+        if ($position + 4 > strlen($src)) {
+            return false;
+        }
+        $header = unpack('vraw/vpacked', substr($src, $position, 4));
+        $block = lz4_block_decompress(substr($src, $position + 4, $header['packed']), $header['raw']);
+        if ($block === false) {
+            return false;
+        }
+        $dst .= $block;
+        $position += 4 + $header['packed'];
+    }
+    return $dst;
+}
+
+// Request body, decompressed when the master compressed it
+function read_body() {
+    $body = file_get_contents("php://input");
+    $encoding = isset($_SERVER['HTTP_CONTENT_ENCODING']) ? $_SERVER['HTTP_CONTENT_ENCODING'] : '';
+    // the block headers bound every block to 64 KB, the only encoding the master sends
+    if ($encoding == 'x-lz4-blocks') {
+        $body = lz4_blocks_decompress($body);
+    }
+    if ($body === false) {
+        http_response_code(400);
+        exit(json_encode(['error' => 'invalid compressed body']));
+    }
+    return $body;
+}
+
+// Read one MessagePack value at $pos, only the types the master sends (no floats, binaries or extensions)
+function msgpack_read($data, &$pos) {
+    if ($pos >= strlen($data)) {
+        throw new UnexpectedValueException('truncated MessagePack');
+    }
+    $type = ord($data[$pos++]);
+    if ($type < 0x80) {
+        return $type;
+    } elseif ($type >= 0xe0) {
+        return $type - 0x100;
+    } elseif (($type & 0xf0) == 0x80) {
+        return msgpack_read_map($data, $pos, $type & 0x0f);
+    } elseif (($type & 0xf0) == 0x90) {
+        return msgpack_read_array($data, $pos, $type & 0x0f);
+    } elseif (($type & 0xe0) == 0xa0) {
+        return msgpack_read_bytes($data, $pos, $type & 0x1f);
+    }
+    switch ($type) {
+        case 0xc0: return null;
+        case 0xc2: return false;
+        case 0xc3: return true;
+        case 0xcc: return msgpack_read_number($data, $pos, 1, false);
+        case 0xcd: return msgpack_read_number($data, $pos, 2, false);
+        case 0xce: return msgpack_read_number($data, $pos, 4, false);
+        case 0xcf: return msgpack_read_number($data, $pos, 8, false);
+        case 0xd0: return msgpack_read_number($data, $pos, 1, true);
+        case 0xd1: return msgpack_read_number($data, $pos, 2, true);
+        case 0xd2: return msgpack_read_number($data, $pos, 4, true);
+        case 0xd3: return msgpack_read_number($data, $pos, 8, true);
+        case 0xd9: return msgpack_read_bytes($data, $pos, msgpack_read_number($data, $pos, 1, false));
+        case 0xda: return msgpack_read_bytes($data, $pos, msgpack_read_number($data, $pos, 2, false));
+        case 0xdb: return msgpack_read_bytes($data, $pos, msgpack_read_number($data, $pos, 4, false));
+        case 0xdc: return msgpack_read_array($data, $pos, msgpack_read_number($data, $pos, 2, false));
+        case 0xdd: return msgpack_read_array($data, $pos, msgpack_read_number($data, $pos, 4, false));
+        case 0xde: return msgpack_read_map($data, $pos, msgpack_read_number($data, $pos, 2, false));
+        case 0xdf: return msgpack_read_map($data, $pos, msgpack_read_number($data, $pos, 4, false));
+    }
+    throw new UnexpectedValueException('unsupported MessagePack type');
+}
+
+// Big endian integer of $bytes bytes, 64 bit values wrap the way the master's int64_t does
+function msgpack_read_number($data, &$pos, $bytes, $signed) {
+    if ($pos + $bytes > strlen($data)) {
+        throw new UnexpectedValueException('truncated MessagePack');
+    }
+    $value = 0;
+    for ($i = 0; $i < $bytes; $i++) {
+        $value = ($value << 8) | ord($data[$pos++]);
+    }
+    if ($signed && $bytes < 8 && $value >= 1 << (8 * $bytes - 1)) {
+        $value -= 1 << (8 * $bytes);
+    }
+    return $value;
+}
+
+function msgpack_read_bytes($data, &$pos, $len) {
+    if ($pos + $len > strlen($data)) {
+        throw new UnexpectedValueException('truncated MessagePack');
+    }
+    $bytes = substr($data, $pos, $len);
+    $pos += $len;
+    return $bytes;
+}
+
+function msgpack_read_array($data, &$pos, $amount) {
+    // every element takes at least one byte, a larger amount can only come from a broken body
+    if ($amount > strlen($data) - $pos) {
+        throw new UnexpectedValueException('truncated MessagePack');
+    }
+    $array = [];
+    for ($i = 0; $i < $amount; $i++) {
+        $array[] = msgpack_read($data, $pos);
+    }
+    return $array;
+}
+
+function msgpack_read_map($data, &$pos, $amount) {
+    if (2 * $amount > strlen($data) - $pos) {
+        throw new UnexpectedValueException('truncated MessagePack');
+    }
+    $map = [];
+    for ($i = 0; $i < $amount; $i++) {
+        $key = msgpack_read($data, $pos);
+        $map[$key] = msgpack_read($data, $pos);
+    }
+    return $map;
+}
+
+// Same text as format_log_stamp() on the master, a wall-clock time arrives as local time counted like UTC
+function format_log_stamp($time) {
+    if ($time < (1 << 30)) {
+        // boot id and uptime, the master had no wall-clock time yet
+        $uptime = $time & 0xFFFFFF;
+        return sprintf('boot %u +%02u:%02u:%02u', ($time >> 24) & 0x3F, intdiv($uptime, 3600), intdiv($uptime, 60) % 60,
+                       $uptime % 60);
+    }
+    return gmdate('Y-m-d H:i:s', $time);
+}
+
+// Rows of a columnar upload (log_msgpack.h on the master), a stream of blocks
+// {"seq":..,"tags":[..],"tag":[..],"time":[..],"info":[..]} back into the rows of a json upload
+function decode_msgpack_logs($body) {
+    $logs = [];
+    $tags = [];
+    $pos = 0;
+    try {
+        while ($pos < strlen($body)) {
+            $block = msgpack_read($body, $pos);
+            foreach (['tags', 'tag', 'time', 'info'] as $column) {
+                if (!is_array($block) || !isset($block[$column]) || !is_array($block[$column])) {
+                    return false;
+                }
+            }
+            if (count($block['tag']) != count($block['info']) || count($block['time']) != count($block['info'])) {
+                return false;
+            }
+            // the tag names of a block add to those of the blocks before
+            $tags = array_merge($tags, $block['tags']);
+            $time = 0;
+            foreach ($block['info'] as $i => $info) {
+                if (!isset($tags[$block['tag'][$i]])) {
+                    return false;
+                }
+                $time = $i == 0 ? $block['time'][0] : $time + $block['time'][$i];
+                $log = ['TAG' => $tags[$block['tag'][$i]], 'date_time' => format_log_stamp($time), 'info' => $info];
+                if (isset($block['seq'])) {
+                    $log['seq'] = $block['seq'] + $i;
+                }
+                $logs[] = $log;
+            }
+        }
+    } catch (UnexpectedValueException $e) {
+        return false;
+    }
+    return $logs;
+}
+
+// Logs of an upload, json rows or columnar MessagePack blocks depending on the Content-Type
+function decode_logs($body) {
+    $content_type = isset($_SERVER['CONTENT_TYPE']) ? $_SERVER['CONTENT_TYPE'] : '';
+    if (strpos($content_type, 'application/x-msgpack') === 0) {
+        return decode_msgpack_logs($body);
+    }
+    return json_decode($body, true);
+}
+
+// Insert a batch of logs with one multi-row INSERT per chunk, with a node the rows keep their sequence
+// number and rows already stored are skipped
+function insert_logs($pdo, $logs, $chunk_size, $node = null) {
+    $columns = $node === null ? '(TAG, date_time, info)' : '(node, seq, TAG, date_time, info)';
+    $placeholders = $node === null ? '(?, ?, ?)' : '(?, ?, ?, ?, ?)';
+    $statements = [];
+    foreach (array_chunk($logs, max(1, $chunk_size)) as $chunk) {
+        // prepared once per chunk length, that is at most twice per batch
+        $rows = count($chunk);
+        if (!isset($statements[$rows])) {
+            $sql = ($node === null ? 'INSERT' : 'INSERT IGNORE') . " INTO logs $columns VALUES "
+                 . implode(', ', array_fill(0, $rows, $placeholders)) . ';';
+            $statements[$rows] = $pdo->prepare($sql);
+        }
+        $values = [];
+        foreach ($chunk as $log) {
+            if ($node !== null) {
+                array_push($values, $node, $log['seq']);
+            }
+            array_push($values, $log['TAG'], $log['date_time'], $log['info']);
+        }
+        $statements[$rows]->execute($values);
+    }
+}
+
 // Check if the request method is GET or POST
 $request_method = $_SERVER['REQUEST_METHOD'];
 
@@ -27,15 +289,119 @@ if ($request_method == 'GET') {
 
     $message = ['result' => 'log inserted'];
     echo json_encode($message);
-} elseif ($request_method == 'POST') {
-    // Handle the POST request
-    $logs = json_decode(file_get_contents("php://input"), true);
+} elseif ($request_method == 'POST' && isset($_GET['type']) && $_GET['type'] == 'rollups') {
+    // Handle usage rollups of one node, rows of the same node and device/hour or key/day are added up
+    // (usage_rollups has a unique key on (node, seq), usage_device_hour on (node, device, hour),
+    // usage_key_day on (node, ibutton, day))
+    if (!isset($_GET['node'])) {
+        http_response_code(400);
+        exit(json_encode(['error' => 'node missing']));
+    }
+    $node = $_GET['node'];
+    $rollups = json_decode(read_body(), true);
+    if (!is_array($rollups)) {
+        http_response_code(400);
+        exit(json_encode(['error' => 'invalid rollups']));
+    }
 
-    $sql = 'INSERT INTO logs (TAG, date_time, info) VALUES (:TAG, :date_time, :info);';
-    $statement = $pdo->prepare($sql);
+    $row_sql = 'INSERT IGNORE INTO usage_rollups (node, seq, type, period, id, grants, denies, on_seconds)
+                VALUES (:node, :seq, :type, :period, :id, :grants, :denies, :on_seconds);';
+    $device_sql = 'INSERT INTO usage_device_hour (node, device, hour, grants, denies, on_seconds)
+                   VALUES (:node, :id, FROM_UNIXTIME(:period), :grants, :denies, :on_seconds)
+                   ON DUPLICATE KEY UPDATE grants = grants + VALUES(grants), denies = denies + VALUES(denies),
+                                           on_seconds = on_seconds + VALUES(on_seconds);';
+    $key_sql = 'INSERT INTO usage_key_day (node, ibutton, day, grants, denies, on_seconds)
+                VALUES (:node, :id, STR_TO_DATE(:period, \'%Y%m%d\'), :grants, :denies, :on_seconds)
+                ON DUPLICATE KEY UPDATE grants = grants + VALUES(grants), denies = denies + VALUES(denies),
+                                        on_seconds = on_seconds + VALUES(on_seconds);';
+
+    try {
+        $pdo->beginTransaction();
+        $row_statement = $pdo->prepare($row_sql);
+        $device_statement = $pdo->prepare($device_sql);
+        $key_statement = $pdo->prepare($key_sql);
+
+        $inserted = 0;
+        foreach ($rollups as $rollup) {
+            $values = [':node' => $node, ':id' => $rollup['id'], ':period' => $rollup['period'],
+                       ':grants' => $rollup['grants'], ':denies' => $rollup['denies'], ':on_seconds' => $rollup['on_seconds']];
+            // a row of a retried request is already stored and must not be added a second time
+            $row_statement->execute($values + [':seq' => $rollup['seq'], ':type' => $rollup['type']]);
+            if ($row_statement->rowCount() == 0) {
+                continue;
+            }
+            $statement = $rollup['type'] == 'key_day' ? $key_statement : $device_statement;
+            $statement->execute($values);
+            $inserted++;
+        }
+        $pdo->commit();
+    } catch (PDOException $e) {
+        $pdo->rollBack();
+        http_response_code(500);
+        exit(json_encode(['error' => 'unable to insert rollups']));
+    }
+
+    $message = ['result' => 'rollups inserted', 'inserted' => $inserted];
+    echo json_encode($message);
+} elseif ($request_method == 'POST' && isset($_GET['node'])) {
+    // Handle sequence numbered logs of one node, retried and pipelined requests may overlap
+    // (logs has a unique key on (node, seq), upload_nodes holds per node the highest seq up to which no log is missing)
+    $node = $_GET['node'];
+    $acked = isset($_GET['acked']) ? intval($_GET['acked']) : 0;
+    $logs = decode_logs(read_body());
+    if (!is_array($logs)) {
+        http_response_code(400);
+        exit(json_encode(['error' => 'invalid logs']));
+    }
+
+    try {
+        $pdo->beginTransaction();
+
+        // a log that is already stored is skipped, the first copy stays
+        insert_logs($pdo, $logs, $insert_chunk_size, $node);
+
+        // requests of the same node advance its row one after the other
+        $pdo->prepare('INSERT IGNORE INTO upload_nodes (node, committed_seq) VALUES (:node, 0);')->execute([':node' => $node]);
+        $statement = $pdo->prepare('SELECT committed_seq FROM upload_nodes WHERE node = :node FOR UPDATE;');
+        $statement->execute([':node' => $node]);
+        // the node only acknowledges what it was told is stored, anything below that will never be sent again
+        $committed = max(intval($statement->fetchColumn()), $acked);
+
+        // follow the stored numbers up to the first gap, a request that arrived early is counted once the gap is filled
+        $statement = $pdo->prepare('SELECT seq FROM logs WHERE node = :node AND seq > :committed ORDER BY seq;');
+        $statement->execute([':node' => $node, ':committed' => $committed]);
+        while (($seq = $statement->fetchColumn()) !== false && intval($seq) == $committed + 1) {
+            $committed++;
+        }
+        $statement->closeCursor();
+
+        $statement = $pdo->prepare('UPDATE upload_nodes SET committed_seq = :committed WHERE node = :node;');
+        $statement->execute([':node' => $node, ':committed' => $committed]);
+        $pdo->commit();
+    } catch (PDOException $e) {
+        $pdo->rollBack();
+        http_response_code(500);
+        exit(json_encode(['error' => 'unable to insert logs']));
+    }
+
+    $message = ['result' => 'logs inserted', 'committed_seq' => $committed];
+    echo json_encode($message);
+} elseif ($request_method == 'POST') {
+    // Handle the POST request, the whole batch is stored in one transaction or not at all
+    $logs = decode_logs(read_body());
+    if (!is_array($logs)) {
+        http_response_code(400);
+        exit(json_encode(['error' => 'invalid logs']));
+    }
 
-    foreach ($logs as $log) {
-        $statement->execute([':TAG' => $log['TAG'], ':date_time' => $log['date_time'], ':info' => $log['info']]);
+    try {
+        $pdo->beginTransaction();
+        insert_logs($pdo, $logs, $insert_chunk_size);
+        $pdo->commit();
+    } catch (PDOException $e) {
+        $pdo->rollBack();
+        http_response_code(500);
+        exit(json_encode(['error' => 'unable to insert logs']));
     }
 
     $message = ['result' => 'logs inserted'];
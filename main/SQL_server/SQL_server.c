@@ -4,17 +4,44 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_log.h"
-#include "esp_http_client.h"
-#include "new_cert.h"
+#include "esp_mac.h"
 #include "cJSON.h"
 #include "../logger/logger.h"
+#include "../logger/log_compress.h"
+#include "../json_arena/json_arena.h"
+#include "api_client.h"
+#include "log_msgpack.h"
 #include "SQL_server.h"
 
 static SemaphoreHandle_t SQL_server_mutex;
+static char upload_buffer[UPLOAD_BUFFER_SIZE];
+static int upload_used;
+#ifdef CONFIG_LOGGER_COMPRESS_UPLOADS
+static uint8_t upload_packed[sizeof(log_block_header_t) + LOG_COMPRESS_BOUND(UPLOAD_BUFFER_SIZE)];
+static uint32_t upload_compress_table[LOG_COMPRESS_HASH_SIZE];
+#endif
+static log_record_t upload_records[LOGGER_QUERY_CHUNK];
+static log_t upload_log;
+static char upload_url[UPLOAD_URL_LEN];
+static char upload_response[UPLOAD_RESPONSE_LEN];
+static char node_id[UPLOAD_NODE_ID_LEN];
+static bool upload_columnar;
+static uint8_t response_arena_buffer[RESPONSE_JSON_ARENA_SIZE];
 static void url_encode(char *dst, size_t dst_size, const char *src);
+static esp_err_t upload_logs_from_cursor(int max_logs, int *sent, bool *done);
+static esp_err_t skip_uploaded_logs(log_cursor_t *cursor, int amount);
+static const char *upload_node_id();
+static esp_err_t open_upload(const char *url, bool columnar);
+static esp_err_t upload_log_record(const log_record_t *record, uint32_t seq, bool first);
+static esp_err_t upload_log_row(const log_t *log, uint32_t seq, bool first);
+static esp_err_t upload_json_string(const char *text);
+static esp_err_t upload_write(const char *data, int len);
+static esp_err_t flush_upload();
+static esp_err_t finish_upload(esp_err_t ret, int64_t *committed_seq);
 
 esp_err_t init_SQL_server_mutex() {
     SQL_server_mutex = xSemaphoreCreateMutex();
@@ -36,100 +63,41 @@ esp_err_t send_log_to_api(const char *TAG, const char *date_time, const char *in
     char url[350];  // Increased buffer size
     snprintf(url, sizeof(url), "%s?TAG=%s&date_time=%s&info=%s", REST_API_URL, TAG, encoded_date_time, encoded_info);
 
-    esp_http_client_config_t config = {
-        .url = url,
-        .transport_type = HTTP_TRANSPORT_OVER_SSL,
-        .cert_pem = (const char *)new_cert_pem,
-    };
-
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    if (client == NULL) {
-        ESP_LOGE(SQL_SERVER_TAG, "Failed to initialize HTTP client");
-        return ESP_FAIL;
-    }
-
-    esp_err_t err = esp_http_client_open(client, 0);
+    char response_buffer[MAX_HTTP_OUTPUT_BUFFER];
+    int status_code;
+    esp_err_t err = api_client_get(url, response_buffer, sizeof(response_buffer), &status_code);
     if (err != ESP_OK) {
-        ESP_LOGE(SQL_SERVER_TAG, "Failed to open HTTP connection: %s", esp_err_to_name(err));
-        esp_http_client_cleanup(client);
         return err;
     }
-
-    int status_code = esp_http_client_fetch_headers(client);
-    if (status_code < 0) {
-        ESP_LOGE(SQL_SERVER_TAG, "Failed to fetch HTTP headers: %s", esp_err_to_name(status_code));
-        esp_http_client_cleanup(client);
-        return status_code;
-    }
-    char response_buffer[MAX_HTTP_OUTPUT_BUFFER];
-
-    int response_length = esp_http_client_read(client, response_buffer, MAX_HTTP_OUTPUT_BUFFER - 1);
-    if (response_length < 0) {
-        ESP_LOGE(SQL_SERVER_TAG, "Failed to read HTTP response: %s", esp_err_to_name(response_length));
-    } else if (response_length == 0) {
+    if (response_buffer[0] == '\0') {
         ESP_LOGE(SQL_SERVER_TAG, "No data in HTTP response");
     } else {
-        response_buffer[response_length] = '\0';
-        ESP_LOGI(SQL_SERVER_TAG, "HTTP Response: %.*s", response_length, response_buffer);
+        ESP_LOGI(SQL_SERVER_TAG, "HTTP Response: %s", response_buffer);
     }
 
-    //free(response_buffer);
-    esp_http_client_close(client);
-    esp_http_client_cleanup(client);
-
     return ESP_OK;
 }
 
 esp_err_t send_logs_to_api(const log_t *logs, size_t num_logs) {
-    cJSON *logs_array = cJSON_CreateArray();
-    for (size_t i = 0; i < num_logs; i++) {
-        cJSON *log_obj = cJSON_CreateObject();
-        cJSON_AddStringToObject(log_obj, "TAG", logs[i].tag);
-        cJSON_AddStringToObject(log_obj, "date_time", logs[i].date_time);
-        cJSON_AddStringToObject(log_obj, "info", logs[i].info);
-        cJSON_AddItemToArray(logs_array, log_obj);
-    }
-    char *json_payload = cJSON_PrintUnformatted(logs_array);
-
-    esp_http_client_config_t config = {
-        .url = REST_API_URL,
-        .method = HTTP_METHOD_POST,
-        .transport_type = HTTP_TRANSPORT_OVER_SSL,
-        .cert_pem = (const char *)new_cert_pem,
-    };
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    if (client == NULL) {
-        ESP_LOGE(SQL_SERVER_TAG, "Failed to initialize HTTP client");
-        cJSON_Delete(logs_array);
-        free(json_payload);
-        return ESP_FAIL;
-    }
-
-    esp_http_client_set_header(client, "Content-Type", "application/json");
-    esp_http_client_set_post_field(client, json_payload, strlen(json_payload));
-
-    esp_err_t err = esp_http_client_perform(client);
-    if (err != ESP_OK) {
-        ESP_LOGE(SQL_SERVER_TAG, "HTTP request failed: %s", esp_err_to_name(err));
-        cJSON_Delete(logs_array);
-        free(json_payload);
-        esp_http_client_cleanup(client);
-        return err;
+    // lock mutex
+    if (SQL_server_mutex == NULL) {
+        ESP_LOGE(SQL_SERVER_TAG, "failed to send logs, SQL_server_mutex not active");
+        return ESP_FAIL;
     }
+    xSemaphoreTake(SQL_server_mutex, portMAX_DELAY);
 
-    int status_code = esp_http_client_get_status_code(client);
-
-    cJSON_Delete(logs_array);
-    free(json_payload);
-    esp_http_client_cleanup(client);
-
-    if (status_code == 200) {
-        ESP_LOGI(SQL_SERVER_TAG, "Log(s) sent successfully to REST API");
-        return ESP_OK;
-    } else {
-        ESP_LOGE(SQL_SERVER_TAG, "Error sending log(s): HTTP status code %d", status_code);
-        return ESP_FAIL;
+    // rendered logs have no time stamp left to pack, they always go up as json
+    esp_err_t ret = open_upload(REST_API_URL, false);
+    if (ret == ESP_OK) {
+        for (size_t i = 0; i < num_logs && ret == ESP_OK; i++) {
+            ret = upload_log_row(&logs[i], 0, i == 0);
+        }
+        ret = finish_upload(ret, NULL);
     }
+
+    // unlock mutex
+    xSemaphoreGive(SQL_server_mutex);
+    return ret;
 }
 
 void url_encode(char *dst, size_t dst_size, const char *src) {
@@ -153,55 +121,387 @@ esp_err_t send_all_logs_to_api(bool delete_on_success) {
     }
     xSemaphoreTake(SQL_server_mutex, portMAX_DELAY);
 
-    int log_lines = get_log_lines(); // get the total number of log lines
-    int start_line = 1;
-    int total_batches = 0;
-    int successful_batches = 0;
+    // records go from the log store straight into the request body, memory does not grow with the amount of logs
+    int total_requests = 0;
+    int successful_requests = 0;
+    int uploaded_logs = 0;
+    bool done = false;
+    while (!done) {
+        int sent;
+        esp_err_t ret = upload_logs_from_cursor(UPLOAD_LOGS_PER_REQUEST, &sent, &done);
+        if (ret == ESP_OK && sent == 0) {
+            break;
+        }
+
+        total_requests++;
+        uploaded_logs += sent;
+        if (ret != ESP_OK) {
+            // the cursor only moved past what the api committed, the next attempt resends the rest
+            break;
+        }
+        successful_requests++;
+    }
+    ESP_LOGI(SQL_SERVER_TAG, "Total requests: %d, Successful requests: %d, uploaded logs: %d", total_requests, successful_requests, uploaded_logs);
+
+    if (delete_on_success) {
+        // uploaded segments are otherwise only reclaimed when the store needs room
+        reclaim_logs();
+    }
+
+    // unlock mutex
+    xSemaphoreGive(SQL_server_mutex);
+
+    if (successful_requests == total_requests) {
+        return ESP_OK;
+    } else {
+        return ESP_FAIL;
+    }
+}
+
+esp_err_t send_log_batch_to_api(int max_logs, int *sent) {
+    // lock mutex
+    *sent = 0;
+    if(SQL_server_mutex == NULL){
+        ESP_LOGE(SQL_SERVER_TAG, "failed to send log batch, SQL_server_mutex not active");
+        return ESP_FAIL;
+    }
+    xSemaphoreTake(SQL_server_mutex, portMAX_DELAY);
+
+    // one request of at most max_logs, starting after the last log the api acknowledged
+    bool done;
+    esp_err_t ret = upload_logs_from_cursor(MIN(max_logs, UPLOAD_LOGS_PER_REQUEST), sent, &done);
 
-    while (start_line <= log_lines) {
-        int free_heap_size = esp_get_free_heap_size();
-        int max_logs_allocation_size = free_heap_size / 4;
-        int max_logs_in_batch = max_logs_allocation_size / sizeof(log_t);
+    // unlock mutex
+    xSemaphoreGive(SQL_server_mutex);
+    return ret;
+}
 
-        int end_line = start_line + max_logs_in_batch - 1;
-        if (end_line > log_lines) {
-            end_line = log_lines;
+esp_err_t send_rollups_to_api(const log_rollup_t *rollups, size_t num_rollups) {
+    // every node and string of the batch comes from one block, given back after the request
+    json_arena_t arena;
+    json_arena_begin(&arena, NULL, ROLLUP_JSON_ARENA_SIZE);
+    cJSON *rollups_array = cJSON_CreateArray();
+    for (size_t i = 0; i < num_rollups; i++) {
+        cJSON *rollup_obj = cJSON_CreateObject();
+        char id[17];
+        // keys do not fit a json number, send them as hex like the ibuttons in the logs
+        if (rollups[i].type == LOG_ROLLUP_KEY_DAY) {
+            snprintf(id, sizeof(id), "%016llX", (unsigned long long)rollups[i].id);
+        } else {
+            snprintf(id, sizeof(id), "%u", (unsigned)rollups[i].id);
         }
+        cJSON_AddStringToObject(rollup_obj, "type", rollups[i].type == LOG_ROLLUP_KEY_DAY ? "key_day" : "device_hour");
+        cJSON_AddNumberToObject(rollup_obj, "period", rollups[i].period);
+        cJSON_AddStringToObject(rollup_obj, "id", id);
+        cJSON_AddNumberToObject(rollup_obj, "grants", rollups[i].grants);
+        cJSON_AddNumberToObject(rollup_obj, "denies", rollups[i].denies);
+        cJSON_AddNumberToObject(rollup_obj, "on_seconds", rollups[i].on_seconds);
+        cJSON_AddNumberToObject(rollup_obj, "seq", rollups[i].seq);
+        cJSON_AddItemToArray(rollups_array, rollup_obj);
+    }
+    // printed into a buffer of the final size, growing it would leave the smaller ones unused in the arena
+    char *json_payload = cJSON_PrintBuffered(rollups_array, num_rollups * ROLLUP_JSON_LEN + 2, false);
+    cJSON_Delete(rollups_array);
+    if (json_payload == NULL) {
+        json_arena_end(&arena);
+        ESP_LOGE(SQL_SERVER_TAG, "Failed to encode rollups");
+        return ESP_FAIL;
+    }
+
+    // the api skips rows of this node it already has, a retried batch is not counted twice
+    char url[UPLOAD_URL_LEN];
+    snprintf(url, sizeof(url), "%s?type=rollups&node=%s", REST_API_URL, upload_node_id());
+    int status_code;
+    esp_err_t err = api_client_post(url, json_payload, strlen(json_payload), &status_code);
+    cJSON_free(json_payload);
+    json_arena_end(&arena);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (status_code != 200) {
+        ESP_LOGE(SQL_SERVER_TAG, "Error sending rollups: HTTP status code %d", status_code);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
 
-        log_t *logs = (log_t *)malloc(max_logs_in_batch * sizeof(log_t));
-        ESP_LOGI(SQL_SERVER_TAG, "allocated batch: %d, size: %d", total_batches, end_line);
-        if (logs == NULL) {
-            ESP_LOGE(SQL_SERVER_TAG, "Failed to allocate memory for logs");
+esp_err_t send_all_rollups_to_api() {
+    // lock mutex
+    if(SQL_server_mutex == NULL){
+        ESP_LOGE(SQL_SERVER_TAG, "failed to send rollups, SQL_server_mutex not active");
+        return ESP_FAIL;
+    }
+    xSemaphoreTake(SQL_server_mutex, portMAX_DELAY);
+
+    // close the periods that just ended so they go out with this upload
+    persist_log_rollups();
+
+    esp_err_t ret = ESP_OK;
+    log_rollup_t rollups[ROLLUP_BATCH_SIZE];
+    long offset = 0;
+    long sent = 0;
+    int uploaded_rollups = 0;
+    int amount;
+    while ((amount = read_log_rollups(&offset, rollups, ROLLUP_BATCH_SIZE)) > 0) {
+        if (send_rollups_to_api(rollups, amount) != ESP_OK) {
+            ret = ESP_FAIL;
+            break;
+        }
+        sent = offset;
+        uploaded_rollups += amount;
+    }
+    if (amount < 0) {
+        ret = ESP_FAIL;
+    }
+
+    // only what the api acknowledged is dropped, the rest goes out with the next upload
+    if (sent > 0 && drop_log_rollups(sent) != ESP_OK) {
+        ret = ESP_FAIL;
+    }
+    ESP_LOGI(SQL_SERVER_TAG, "uploaded %d usage rollups", uploaded_rollups);
+
+    // unlock mutex
+    xSemaphoreGive(SQL_server_mutex);
+    return ret;
+}
+
+static esp_err_t upload_logs_from_cursor(int max_logs, int *sent, bool *done) {
+    // continue exactly after the last log the api acknowledged
+    log_cursor_t cursor;
+    get_log_upload_cursor(&cursor);
+    log_query_t query;
+    init_log_query(&query);
+    query.next_seq = cursor.seq;
+    query.next_offset = cursor.offset;
+    *sent = 0;
+    *done = true;
+
+    // the first records are read before connecting, nothing left to upload makes no request
+    int found = query_log_records(&query, upload_records, MIN(LOGGER_QUERY_CHUNK, max_logs));
+    if (found <= 0) {
+        return found < 0 ? ESP_FAIL : ESP_OK;
+    }
+
+    // acked is the last sequence number this node knows to be stored, the api never has to wait for anything below it
+    snprintf(upload_url, sizeof(upload_url), "%s?node=%s&acked=%u", REST_API_URL, upload_node_id(), (unsigned)(cursor.log_seq - 1));
+    esp_err_t ret = open_upload(upload_url, UPLOAD_COLUMNAR);
+    int streamed = 0;
+    while (found > 0 && ret == ESP_OK) {
+        for (int i = 0; i < found && ret == ESP_OK; i++) {
+            ret = upload_log_record(&upload_records[i], cursor.log_seq + streamed, streamed == 0);
+            streamed++;
+        }
+        if (query.done || streamed >= max_logs) {
+            break;
+        }
+        found = query_log_records(&query, upload_records, MIN(LOGGER_QUERY_CHUNK, max_logs - streamed));
+        if (found < 0) {
+            ret = ESP_FAIL;
+        }
+    }
+    int64_t committed;
+    if (finish_upload(ret, &committed) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    // an api without sequence numbers stores the whole request or nothing
+    int64_t last = (int64_t)cursor.log_seq + streamed - 1;
+    if (committed < 0 || committed == last) {
+        cursor.seq = query.next_seq;
+        cursor.offset = query.next_offset;
+        cursor.log_seq = last + 1;
+        *sent = streamed;
+        *done = query.done;
+    } else if (committed > last) {
+        // the api knows numbers this node never sent (its nvs was erased), the logs were taken for duplicates
+        ESP_LOGW(SQL_SERVER_TAG, "api committed up to %lld, logs are sent again from there on", (long long)committed);
+        cursor.log_seq = committed + 1;
+        ret = ESP_FAIL;
+    } else if (committed >= (int64_t)cursor.log_seq - 1) {
+        // only the first logs of the request were stored, the next request starts at the first one missing
+        *sent = committed - cursor.log_seq + 1;
+        ESP_LOGW(SQL_SERVER_TAG, "api committed %d of %d logs", *sent, streamed);
+        if (skip_uploaded_logs(&cursor, *sent) != ESP_OK) {
             return ESP_FAIL;
         }
+        cursor.log_seq = committed + 1;
+        ret = ESP_FAIL;
+    } else {
+        ESP_LOGE(SQL_SERVER_TAG, "api committed %lld, less than it acknowledged before", (long long)committed);
+        return ESP_FAIL;
+    }
 
-        esp_err_t parse_result = parse_logs(start_line, end_line, logs, max_logs_in_batch);
-        if (parse_result == ESP_OK) {
-            int logs_to_send = end_line - start_line + 1;
-            esp_err_t send_result = send_logs_to_api(logs, logs_to_send);
-            if (send_result == ESP_OK) {
-                successful_batches++;
-                if (delete_on_success) {
-                    delete_logs(start_line, end_line);
-                    log_lines -= logs_to_send; // Update log_lines after deleting logs
-                    end_line = start_line - 1; // Adjust end_line for next batch calculation
-                }
-            }
+    // only a few bytes go to flash per request
+    if (advance_log_upload_cursor(&cursor) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    return ret;
+}
+
+static esp_err_t skip_uploaded_logs(log_cursor_t *cursor, int amount) {
+    // reads past the logs the api committed, the position after the last of them becomes the cursor
+    log_query_t query;
+    init_log_query(&query);
+    query.next_seq = cursor->seq;
+    query.next_offset = cursor->offset;
+    query.limit = amount;
+    while (!query.done) {
+        if (query_log_records(&query, upload_records, LOGGER_QUERY_CHUNK) < 0) {
+            return ESP_FAIL;
         }
+    }
+    cursor->seq = query.next_seq;
+    cursor->offset = query.next_offset;
+    return ESP_OK;
+}
 
-        free(logs);
-        total_batches++;
-        start_line = end_line + 1;
+static const char *upload_node_id() {
+    // the WiFi station MAC, unique per node without any configuration
+    if (node_id[0] == '\0') {
+        uint8_t mac[6];
+        if (esp_read_mac(mac, ESP_MAC_WIFI_STA) != ESP_OK) {
+            return "unknown";
+        }
+        snprintf(node_id, sizeof(node_id), "%02x%02x%02x%02x%02x%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
     }
+    return node_id;
+}
 
-    ESP_LOGI(SQL_SERVER_TAG, "Total batches: %d, Successful batches: %d", total_batches, successful_batches);
+static esp_err_t open_upload(const char *url, bool columnar) {
+    upload_used = 0;
+    upload_columnar = columnar;
+    const char *content_type = columnar ? LOG_MSGPACK_CONTENT_TYPE : "application/json";
+#ifdef CONFIG_LOGGER_COMPRESS_UPLOADS
+    esp_err_t ret = api_client_stream_open(url, content_type, UPLOAD_CONTENT_ENCODING);
+#else
+    esp_err_t ret = api_client_stream_open(url, content_type, NULL);
+#endif
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (columnar) {
+        log_msgpack_start(upload_write);
+        return ESP_OK;
+    }
+    return upload_write("[", 1);
+}
 
-    // unlock mutex
-    xSemaphoreGive(SQL_server_mutex);
+static esp_err_t upload_log_record(const log_record_t *record, uint32_t seq, bool first) {
+    // the tag and info are rendered the same way for both encodings, columnar blocks keep the time stamp as a number
+    format_log_record(record, &upload_log);
+    if (upload_columnar) {
+        return log_msgpack_add(&upload_log, record->epoch, seq);
+    }
+    return upload_log_row(&upload_log, seq, first);
+}
+
+static esp_err_t upload_log_row(const log_t *log, uint32_t seq, bool first) {
+    // same rows as the cJSON array api.php always took: {"TAG":..,"date_time":..,"info":..}, logs of the store start with their "seq"
+    char row_start[32];
+    int row_start_len = seq > 0 ? snprintf(row_start, sizeof(row_start), "%s{\"seq\":%u,\"TAG\":", first ? "" : ",", (unsigned)seq)
+                                : snprintf(row_start, sizeof(row_start), "%s{\"TAG\":", first ? "" : ",");
+    if (upload_write(row_start, row_start_len) != ESP_OK
+        || upload_json_string(log->tag) != ESP_OK
+        || upload_write(",\"date_time\":", 13) != ESP_OK
+        || upload_json_string(log->date_time) != ESP_OK
+        || upload_write(",\"info\":", 8) != ESP_OK
+        || upload_json_string(log->info) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    return upload_write("}", 1);
+}
+
+static esp_err_t upload_json_string(const char *text) {
+    // quotes, backslashes and control characters are escaped, everything else is copied as is
+    if (upload_write("\"", 1) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    const char *start = text;
+    for (const char *c = text; *c != '\0'; c++) {
+        if (*c != '"' && *c != '\\' && (unsigned char)*c >= 0x20) {
+            continue;
+        }
+        char escaped[8];
+        int escaped_len = *c == '"' || *c == '\\' ? snprintf(escaped, sizeof(escaped), "\\%c", *c)
+                                                  : snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)*c);
+        if (upload_write(start, c - start) != ESP_OK || upload_write(escaped, escaped_len) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        start = c + 1;
+    }
+    if (upload_write(start, strlen(start)) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    return upload_write("\"", 1);
+}
 
-    if (successful_batches == total_batches) {
+static esp_err_t upload_write(const char *data, int len) {
+    while (len > 0) {
+        int amount = MIN(len, UPLOAD_BUFFER_SIZE - upload_used);
+        memcpy(&upload_buffer[upload_used], data, amount);
+        upload_used += amount;
+        data += amount;
+        len -= amount;
+        if (upload_used == UPLOAD_BUFFER_SIZE && flush_upload() != ESP_OK) {
+            return ESP_FAIL;
+        }
+    }
+    return ESP_OK;
+}
+
+static esp_err_t flush_upload() {
+    if (upload_used == 0) {
         return ESP_OK;
+    }
+    esp_err_t ret;
+#ifdef CONFIG_LOGGER_COMPRESS_UPLOADS
+    // every full buffer goes out as one compressed block, the api decompresses them one after the other
+    log_block_header_t *header = (log_block_header_t *)upload_packed;
+    int packed_len = log_compress((const uint8_t *)upload_buffer, upload_used, &upload_packed[sizeof(log_block_header_t)],
+                                  sizeof(upload_packed) - sizeof(log_block_header_t), upload_compress_table);
+    if (packed_len < 0) {
+        ret = ESP_FAIL;
     } else {
+        header->raw_len = upload_used;
+        header->packed_len = packed_len;
+        ret = api_client_stream_write((const char *)upload_packed, sizeof(log_block_header_t) + packed_len);
+    }
+#else
+    ret = api_client_stream_write(upload_buffer, upload_used);
+#endif
+    upload_used = 0;
+    return ret;
+}
+
+static esp_err_t finish_upload(esp_err_t ret, int64_t *committed_seq) {
+    // the array or last block is closed and the rest of the buffer sent, a failed body is cut off so the api never sees half of it
+    if (ret == ESP_OK) {
+        ret = upload_columnar ? log_msgpack_finish() : upload_write("]", 1);
+    }
+    if (ret == ESP_OK && flush_upload() != ESP_OK) {
+        ret = ESP_FAIL;
+    }
+    int status_code;
+    if (api_client_stream_finish(ret == ESP_OK, &status_code, upload_response, sizeof(upload_response)) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    if (status_code != 200) {
+        ESP_LOGE(SQL_SERVER_TAG, "Error sending log(s): HTTP status code %d", status_code);
         return ESP_FAIL;
     }
+    if (committed_seq != NULL) {
+        // {"result":..,"committed_seq":n}, the highest sequence number up to which the api has every log of this node
+        *committed_seq = -1;
+        json_arena_t arena;
+        json_arena_begin(&arena, response_arena_buffer, sizeof(response_arena_buffer));
+        cJSON *response = cJSON_Parse(upload_response);
+        cJSON *committed = cJSON_GetObjectItem(response, "committed_seq");
+        if (cJSON_IsNumber(committed)) {
+            *committed_seq = (int64_t)committed->valuedouble;
+        }
+        cJSON_Delete(response);
+        json_arena_end(&arena);
+    }
+    ESP_LOGI(SQL_SERVER_TAG, "Log(s) sent successfully to REST API");
+    return ESP_OK;
 }
@@ -8,12 +8,32 @@
 #include "esp_err.h"
 #include <stdbool.h>
 #include "../logger/logger.h"
+#include "../logger/log_rollup.h"
 
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 #define SQL_SERVER_TAG "SQL_SERVER"
+#ifdef CONFIG_API_ENDPOINT_OVERRIDE
+#define REST_API_URL CONFIG_API_ENDPOINT_URL    // a stand-in such as tools/api_standin.py
+#else
 #define REST_API_URL "https://a22-access3.studev.groept.be/api.php"
+#endif
 #define MAX_HTTP_OUTPUT_BUFFER 50
+#define UPLOAD_CONTENT_ENCODING "x-lz4-blocks"  // log_block_header_t + LZ4 block per UPLOAD_BUFFER_SIZE of the body
+#ifdef CONFIG_LOGGER_UPLOAD_MSGPACK
+#define UPLOAD_COLUMNAR true        // log records go up as columnar MessagePack blocks, see log_msgpack.h
+#else
+#define UPLOAD_COLUMNAR false
+#endif
+#define UPLOAD_BUFFER_SIZE 2048     // log uploads are streamed through this buffer, one chunk per flush
+#define UPLOAD_LOGS_PER_REQUEST 1000
+#define UPLOAD_URL_LEN 128
+#define UPLOAD_RESPONSE_LEN 128
+#define UPLOAD_NODE_ID_LEN 13       // MAC address in hex
 #define BATCH_SIZE 50
+#define ROLLUP_BATCH_SIZE 32
+#define ROLLUP_JSON_LEN 144             // text of one rollup at most
+#define ROLLUP_JSON_ARENA_SIZE 20480    // cJSON tree (~380 bytes per rollup) and text of a batch, one heap block per request
+#define RESPONSE_JSON_ARENA_SIZE 512    // parsed answer of an upload
 
 esp_err_t init_SQL_server_mutex();
 
@@ -23,4 +43,10 @@ esp_err_t send_logs_to_api(const log_t *logs, size_t num_logs);
 
 esp_err_t send_all_logs_to_api(bool delete_on_success);
 
+esp_err_t send_log_batch_to_api(int max_logs, int *sent);
+
+esp_err_t send_rollups_to_api(const log_rollup_t *rollups, size_t num_rollups);
+
+esp_err_t send_all_rollups_to_api();
+
 #endif //SQL_SERVER_H
\ No newline at end of file
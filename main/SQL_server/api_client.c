@@ -0,0 +1,362 @@
+//
+// Created by Vincent.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/timers.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_http_client.h"
+#include "new_cert.h"
+#include "SQL_server.h"
+#include "api_client.h"
+
+
+// Forward declarations for static functions/params
+static SemaphoreHandle_t api_client_mutex;
+static esp_http_client_handle_t client;
+static TimerHandle_t idle_timer;
+static bool connection_open;
+static int64_t request_start;
+static bool stream_failed;
+static bool server_closes;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static api_client_stats_t stats;
+#ifdef CONFIG_API_ENDPOINT_OVERRIDE
+extern const unsigned char standin_cert_pem_start[] asm("_binary_standin_cert_pem_start");
+#endif
+static esp_err_t perform_request(esp_http_client_method_t method, const char *url, const char *body, int body_len,
+                                 int *status_code, char *response, int response_size);
+static void prepare_request(esp_http_client_method_t method, const char *url, const char *content_type,
+                            const char *content_encoding);
+static void count_request(esp_err_t err);
+static esp_err_t write_all(const char *data, int len);
+static esp_err_t read_answer(int *status_code, char *response, int response_size);
+static void end_request(esp_err_t err);
+static void idle_timer_cb(TimerHandle_t xTimer);
+static esp_err_t api_client_event_handler(esp_http_client_event_t *event);
+
+
+esp_err_t init_api_client(){
+    api_client_mutex = xSemaphoreCreateMutex();
+    if(api_client_mutex == NULL){
+        ESP_LOGE(API_CLIENT_TAG, "FAILED TO CREATE api_client_mutex");
+        return ESP_FAIL;
+    }
+    idle_timer = xTimerCreate("apiIdleTimer", pdMS_TO_TICKS(API_CLIENT_IDLE_CLOSE_MS), pdFALSE, (void *) 0, idle_timer_cb);
+    if(idle_timer == NULL){
+        ESP_LOGE(API_CLIENT_TAG, "Failed to create api idle timer");
+        return ESP_FAIL;
+    }
+
+    // the handle lives as long as the firmware, it only connects with the first request
+    esp_http_client_config_t config = {
+        .url = REST_API_URL,
+        .transport_type = HTTP_TRANSPORT_OVER_SSL,
+#ifdef CONFIG_API_ENDPOINT_OVERRIDE
+        // the stand-in runs on whatever host is at hand, its address is not in the certificate
+        .cert_pem = (const char *)standin_cert_pem_start,
+        .skip_cert_common_name_check = true,
+#else
+        .cert_pem = (const char *)new_cert_pem,
+#endif
+        .timeout_ms = API_CLIENT_TIMEOUT_MS,
+        .buffer_size = API_CLIENT_BUFFER_SIZE,
+        .keep_alive_enable = true,
+        .event_handler = api_client_event_handler,
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        .save_client_session = true,
+#endif
+    };
+    client = esp_http_client_init(&config);
+    if(client == NULL){
+        ESP_LOGE(API_CLIENT_TAG, "Failed to initialize HTTP client");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t api_client_get(const char *url, char *response, int response_size, int *status_code){
+    return perform_request(HTTP_METHOD_GET, url, NULL, 0, status_code, response, response_size);
+}
+
+esp_err_t api_client_post(const char *url, const char *body, int body_len, int *status_code){
+    return perform_request(HTTP_METHOD_POST, url, body, body_len, status_code, NULL, 0);
+}
+
+esp_err_t api_client_stream_open(const char *url, const char *content_type, const char *content_encoding){
+    // lock mutex
+    if(api_client_mutex == NULL || client == NULL){
+        ESP_LOGE(API_CLIENT_TAG, "failed to open stream, api client not initialized");
+        return ESP_FAIL;
+    }
+    xSemaphoreTake(api_client_mutex, portMAX_DELAY);
+
+    prepare_request(HTTP_METHOD_POST, url, content_type, content_encoding);
+    esp_http_client_set_post_field(client, NULL, 0);
+
+    esp_err_t err = ESP_FAIL;
+    for(int attempt = 0; attempt < 2; ++attempt){
+        bool reusing = connection_open;
+        request_start = esp_timer_get_time();
+        // a negative length makes the client send "Transfer-Encoding: chunked", the chunks are framed in api_client_stream_write()
+        err = esp_http_client_open(client, -1);
+        if(err == ESP_OK){
+            break;
+        }
+        esp_http_client_close(client);
+        connection_open = false;
+        if(!reusing){
+            break;
+        }
+        ESP_LOGW(API_CLIENT_TAG, "kept connection failed (%s), reconnecting", esp_err_to_name(err));
+        portENTER_CRITICAL(&stats_lock);
+        stats.reconnects++;
+        portEXIT_CRITICAL(&stats_lock);
+    }
+    if(err != ESP_OK){
+        count_request(err);
+        ESP_LOGE(API_CLIENT_TAG, "failed to open stream: %s", esp_err_to_name(err));
+        // unlock mutex
+        xSemaphoreGive(api_client_mutex);
+        return err;
+    }
+
+    // the mutex stays taken until api_client_stream_finish()
+    stream_failed = false;
+    return ESP_OK;
+}
+
+esp_err_t api_client_stream_write(const char *data, int len){
+    if(stream_failed){
+        return ESP_FAIL;
+    }
+    if(len == 0){
+        // an empty chunk would end the body
+        return ESP_OK;
+    }
+    char size_line[12];
+    int size_len = snprintf(size_line, sizeof(size_line), "%x\r\n", len);
+    if(write_all(size_line, size_len) != ESP_OK || write_all(data, len) != ESP_OK || write_all("\r\n", 2) != ESP_OK){
+        ESP_LOGE(API_CLIENT_TAG, "failed to write stream chunk");
+        stream_failed = true;
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t api_client_stream_finish(bool complete, int *status_code, char *response, int response_size){
+    // an incomplete stream ends without the last chunk, the server throws the body away
+    esp_err_t err = complete && !stream_failed ? write_all("0\r\n\r\n", 5) : ESP_FAIL;
+    if(err == ESP_OK){
+        err = read_answer(status_code, response, response_size);
+    }else{
+        *status_code = -1;
+        if(response != NULL && response_size > 0){
+            response[0] = '\0';
+        }
+    }
+    end_request(err);
+    count_request(err);
+
+    // unlock mutex
+    xSemaphoreGive(api_client_mutex);
+
+    if(err != ESP_OK && complete){
+        ESP_LOGE(API_CLIENT_TAG, "streamed request failed");
+    }
+    return err;
+}
+
+void close_api_client(){
+    // lock mutex
+    if(api_client_mutex == NULL){
+        return;
+    }
+    xSemaphoreTake(api_client_mutex, portMAX_DELAY);
+
+    // frees the TLS buffers, the saved session makes the next connection cheap
+    if(connection_open){
+        esp_http_client_close(client);
+        connection_open = false;
+    }
+
+    // unlock mutex
+    xSemaphoreGive(api_client_mutex);
+}
+
+void get_api_client_stats(api_client_stats_t *stats_copy){
+    portENTER_CRITICAL(&stats_lock);
+    *stats_copy = stats;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+static esp_err_t perform_request(esp_http_client_method_t method, const char *url, const char *body, int body_len,
+                                 int *status_code, char *response, int response_size){
+    // lock mutex
+    if(api_client_mutex == NULL || client == NULL){
+        ESP_LOGE(API_CLIENT_TAG, "failed to send request, api client not initialized");
+        return ESP_FAIL;
+    }
+    xSemaphoreTake(api_client_mutex, portMAX_DELAY);
+
+    prepare_request(method, url, method == HTTP_METHOD_POST ? "application/json" : NULL, NULL);
+
+    // the same open/write/read steps as a stream, esp_http_client_perform() would not pick up a connection a stream kept
+    esp_err_t err = ESP_FAIL;
+    for(int attempt = 0; attempt < 2; ++attempt){
+        bool reusing = connection_open;
+        request_start = esp_timer_get_time();
+        err = esp_http_client_open(client, body_len);
+        if(err == ESP_OK && body_len > 0){
+            err = write_all(body, body_len);
+        }
+        if(err == ESP_OK){
+            err = read_answer(status_code, response, response_size);
+        }else{
+            *status_code = -1;
+        }
+        end_request(err);
+        if(err == ESP_OK || !reusing){
+            break;
+        }
+        // the server or the network closed the kept connection since the last request, once more on a new one
+        ESP_LOGW(API_CLIENT_TAG, "kept connection failed (%s), reconnecting", esp_err_to_name(err));
+        portENTER_CRITICAL(&stats_lock);
+        stats.reconnects++;
+        portEXIT_CRITICAL(&stats_lock);
+    }
+    count_request(err);
+
+    // unlock mutex
+    xSemaphoreGive(api_client_mutex);
+
+    if(err != ESP_OK){
+        ESP_LOGE(API_CLIENT_TAG, "HTTP request failed: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+static void prepare_request(esp_http_client_method_t method, const char *url, const char *content_type,
+                            const char *content_encoding){
+    // headers stay set on the handle between requests, everything request specific is set or removed here
+    server_closes = false;
+    esp_http_client_set_url(client, url);
+    esp_http_client_set_method(client, method);
+    if(content_encoding != NULL){
+        esp_http_client_set_header(client, "Content-Encoding", content_encoding);
+    }else{
+        esp_http_client_delete_header(client, "Content-Encoding");
+    }
+    if(content_type != NULL){
+        esp_http_client_set_header(client, "Content-Type", content_type);
+    }else{
+        esp_http_client_delete_header(client, "Content-Type");
+    }
+}
+
+static void count_request(esp_err_t err){
+    portENTER_CRITICAL(&stats_lock);
+    stats.requests++;
+    if(err != ESP_OK){
+        stats.failures++;
+    }
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+static esp_err_t write_all(const char *data, int len){
+    while(len > 0){
+        int written = esp_http_client_write(client, data, len);
+        if(written <= 0){
+            return ESP_FAIL;
+        }
+        data += written;
+        len -= written;
+        portENTER_CRITICAL(&stats_lock);
+        stats.bytes_sent += written;
+        portEXIT_CRITICAL(&stats_lock);
+    }
+    return ESP_OK;
+}
+
+static esp_err_t read_answer(int *status_code, char *response, int response_size){
+    *status_code = -1;
+    if(response != NULL && response_size > 0){
+        response[0] = '\0';
+    }
+    if(esp_http_client_fetch_headers(client) < 0){
+        return ESP_FAIL;
+    }
+    *status_code = esp_http_client_get_status_code(client);
+    if(response != NULL && response_size > 0){
+        int response_len = esp_http_client_read_response(client, response, response_size - 1);
+        response[response_len > 0 ? response_len : 0] = '\0';
+    }
+    // the body is always read to the end so the connection can be reused, only what fits is kept
+    int flushed;
+    if(esp_http_client_flush_response(client, &flushed) != ESP_OK){
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+static void end_request(esp_err_t err){
+    // a response read to its end leaves the connection ready for the next request, unless the server ends it
+    if(err == ESP_OK && esp_http_client_is_complete_data_received(client) && !server_closes){
+        // uploads that follow each other share it, an idle one is closed before the server drops it
+        xTimerReset(idle_timer, 0);
+        return;
+    }
+    // after an error or a short write the connection is halfway through a request, the next one starts on a new connection
+    esp_http_client_close(client);
+    connection_open = false;
+}
+
+static void idle_timer_cb(TimerHandle_t xTimer){
+    // runs in the timer task, a request that holds the client restarts the timer when it ends
+    if(xSemaphoreTake(api_client_mutex, 0) != pdTRUE){
+        return;
+    }
+    if(connection_open){
+        ESP_LOGD(API_CLIENT_TAG, "closing idle connection");
+        esp_http_client_close(client);
+        connection_open = false;
+    }
+    xSemaphoreGive(api_client_mutex);
+}
+
+static esp_err_t api_client_event_handler(esp_http_client_event_t *event){
+    switch(event->event_id){
+        case HTTP_EVENT_ON_CONNECTED: {
+            // only new connections get here, the time covers DNS, TCP and the TLS handshake
+            uint32_t elapsed_ms = (esp_timer_get_time() - request_start) / 1000;
+            connection_open = true;
+            portENTER_CRITICAL(&stats_lock);
+            stats.handshakes++;
+            stats.handshake_ms_total += elapsed_ms;
+            stats.handshake_ms_last = elapsed_ms;
+            if(elapsed_ms > stats.handshake_ms_max){
+                stats.handshake_ms_max = elapsed_ms;
+            }
+            portEXIT_CRITICAL(&stats_lock);
+            ESP_LOGI(API_CLIENT_TAG, "connected to the api in %u ms", (unsigned)elapsed_ms);
+            break;
+        }
+        case HTTP_EVENT_DISCONNECTED:
+            connection_open = false;
+            break;
+        case HTTP_EVENT_ON_HEADER:
+            // HTTP/1.1 keeps the connection unless the server says otherwise
+            if(strcasecmp(event->header_key, "Connection") == 0 && strcasecmp(event->header_value, "close") == 0){
+                server_closes = true;
+            }
+            break;
+        default:
+            break;
+    }
+    return ESP_OK;
+}
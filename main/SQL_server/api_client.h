@@ -0,0 +1,74 @@
+//
+// Created by Vincent.
+//
+
+/*
+    One long-lived HTTPS client for everything sent to the REST API. The
+    connection stays open between requests (HTTP keep-alive), so batches of
+    an upload share a single TLS handshake. A request that finds the
+    connection closed by the server or lost with WiFi reconnects once by
+    itself, and with CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS the reconnect
+    resumes the TLS session of the last connection instead of a full
+    handshake.
+
+    A connection left idle for API_CLIENT_IDLE_CLOSE_MS is closed, which frees
+    the TLS buffers before the server would drop it. close_api_client()
+    closes it right away.
+
+    Every new connection is counted and timed (DNS, TCP and TLS together),
+    get_api_client_stats() shows whether handshakes became rare.
+
+    With CONFIG_API_ENDPOINT_OVERRIDE the client talks to a stand-in
+    (tools/api_standin.py) and trusts its test certificate instead.
+
+    Requests are serialized by api_client_mutex, the response body is read
+    completely so the connection can be reused.
+
+    Bodies of unknown length are streamed with chunked transfer encoding:
+    api_client_stream_open() holds the client until api_client_stream_finish(),
+    every api_client_stream_write() goes out as one chunk. A stream that ends
+    with its last chunk and a completely read response keeps the connection
+    like any other request, a failed or cut off stream closes it.
+*/
+
+#ifndef API_CLIENT_H
+#define API_CLIENT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define API_CLIENT_TAG "API_CLIENT"
+
+#define API_CLIENT_TIMEOUT_MS 10000
+#define API_CLIENT_BUFFER_SIZE 1024     // rx buffer, also holds the response headers
+#define API_CLIENT_IDLE_CLOSE_MS 4000   // below the usual server keep-alive timeout of 5 s
+
+typedef struct api_client_stats_t {
+    uint32_t requests;
+    uint32_t failures;
+    uint32_t handshakes;            // new connections, the others reused an open one
+    uint32_t handshake_ms_total;
+    uint32_t handshake_ms_last;
+    uint32_t handshake_ms_max;
+    uint32_t reconnects;            // requests retried on a connection the server had closed
+    uint32_t bytes_sent;            // request bodies, chunk framing included, without headers and TLS
+} api_client_stats_t;
+
+esp_err_t init_api_client();
+
+esp_err_t api_client_get(const char *url, char *response, int response_size, int *status_code);
+
+esp_err_t api_client_post(const char *url, const char *body, int body_len, int *status_code);
+
+esp_err_t api_client_stream_open(const char *url, const char *content_type, const char *content_encoding);
+
+esp_err_t api_client_stream_write(const char *data, int len);
+
+esp_err_t api_client_stream_finish(bool complete, int *status_code, char *response, int response_size);
+
+void close_api_client();
+
+void get_api_client_stats(api_client_stats_t *stats_copy);
+
+#endif //API_CLIENT_H
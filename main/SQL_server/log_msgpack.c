@@ -0,0 +1,249 @@
+//
+// Created by Vincent.
+//
+
+#include <string.h>
+#include <time.h>
+#include "esp_log.h"
+#include "log_msgpack.h"
+
+
+// Forward declarations for static functions/params
+static log_msgpack_write_t write_out;
+static char tags[LOG_MSGPACK_MAX_TAGS][sizeof(((log_t *)0)->tag)];
+static int tag_count;
+static int block_first_tag;     // tags from here on are new in the current block
+static int block_rows;
+static uint32_t block_seq;
+static uint8_t block_tag[LOG_MSGPACK_BLOCK_ROWS];
+static int64_t block_time[LOG_MSGPACK_BLOCK_ROWS];
+static uint8_t info_column[LOG_MSGPACK_INFO_SIZE];
+static int info_used;
+static esp_err_t flush_block();
+static esp_err_t write_str(const char *text, int len);
+static esp_err_t write_header(int len, uint8_t *header);
+static int find_tag(const char *tag);
+static int64_t local_seconds(uint32_t epoch);
+static int64_t days_from_civil(int64_t year, int month, int day);
+static int pack_be(uint8_t *dst, uint8_t type, uint64_t value, int bytes);
+
+
+void log_msgpack_start(log_msgpack_write_t write){
+    write_out = write;
+    tag_count = 0;
+    block_first_tag = 0;
+    block_rows = 0;
+    info_used = 0;
+}
+
+esp_err_t log_msgpack_add(const log_t *log, uint32_t stamp, uint32_t seq){
+    // the block goes out first when this log would not fit anymore
+    int info_len = strlen(log->info);
+    if(block_rows == LOG_MSGPACK_BLOCK_ROWS || info_used + MSGPACK_HEADER_MAX + info_len > LOG_MSGPACK_INFO_SIZE){
+        if(flush_block() != ESP_OK){
+            return ESP_FAIL;
+        }
+    }
+
+    int tag = find_tag(log->tag);
+    if(tag < 0){
+        if(tag_count == LOG_MSGPACK_MAX_TAGS){
+            ESP_LOGE(LOG_MSGPACK_TAG, "more than %d tags in one upload", LOG_MSGPACK_MAX_TAGS);
+            return ESP_FAIL;
+        }
+        strncpy(tags[tag_count], log->tag, sizeof(tags[tag_count]) - 1);
+        tags[tag_count][sizeof(tags[tag_count]) - 1] = '\0';
+        tag = tag_count++;
+    }
+
+    if(block_rows == 0){
+        block_seq = seq;
+    }
+    block_tag[block_rows] = tag;
+    block_time[block_rows] = LOG_STAMP_IS_MONOTONIC(stamp) ? stamp : local_seconds(stamp);
+    info_used += msgpack_pack_str_header(&info_column[info_used], info_len);
+    memcpy(&info_column[info_used], log->info, info_len);
+    info_used += info_len;
+    block_rows++;
+    return ESP_OK;
+}
+
+esp_err_t log_msgpack_finish(){
+    return flush_block();
+}
+
+int msgpack_pack_uint(uint8_t *dst, uint64_t value){
+    if(value < 0x80){
+        dst[0] = value;
+        return 1;
+    }
+    if(value <= UINT8_MAX){
+        return pack_be(dst, 0xcc, value, 1);
+    }
+    if(value <= UINT16_MAX){
+        return pack_be(dst, 0xcd, value, 2);
+    }
+    if(value <= UINT32_MAX){
+        return pack_be(dst, 0xce, value, 4);
+    }
+    return pack_be(dst, 0xcf, value, 8);
+}
+
+int msgpack_pack_int(uint8_t *dst, int64_t value){
+    if(value >= 0){
+        return msgpack_pack_uint(dst, value);
+    }
+    if(value >= -32){
+        dst[0] = (uint8_t)value;
+        return 1;
+    }
+    if(value >= INT8_MIN){
+        return pack_be(dst, 0xd0, (uint64_t)value, 1);
+    }
+    if(value >= INT16_MIN){
+        return pack_be(dst, 0xd1, (uint64_t)value, 2);
+    }
+    if(value >= INT32_MIN){
+        return pack_be(dst, 0xd2, (uint64_t)value, 4);
+    }
+    return pack_be(dst, 0xd3, (uint64_t)value, 8);
+}
+
+int msgpack_pack_str_header(uint8_t *dst, uint32_t len){
+    if(len < 32){
+        dst[0] = 0xa0 | len;
+        return 1;
+    }
+    if(len <= UINT8_MAX){
+        return pack_be(dst, 0xd9, len, 1);
+    }
+    if(len <= UINT16_MAX){
+        return pack_be(dst, 0xda, len, 2);
+    }
+    return pack_be(dst, 0xdb, len, 4);
+}
+
+int msgpack_pack_array_header(uint8_t *dst, uint32_t amount){
+    if(amount < 16){
+        dst[0] = 0x90 | amount;
+        return 1;
+    }
+    if(amount <= UINT16_MAX){
+        return pack_be(dst, 0xdc, amount, 2);
+    }
+    return pack_be(dst, 0xdd, amount, 4);
+}
+
+int msgpack_pack_map_header(uint8_t *dst, uint32_t amount){
+    if(amount < 16){
+        dst[0] = 0x80 | amount;
+        return 1;
+    }
+    if(amount <= UINT16_MAX){
+        return pack_be(dst, 0xde, amount, 2);
+    }
+    return pack_be(dst, 0xdf, amount, 4);
+}
+
+static esp_err_t flush_block(){
+    if(block_rows == 0){
+        return ESP_OK;
+    }
+    uint8_t header[MSGPACK_HEADER_MAX];
+    // the numbers of a column are packed here and written at once
+    uint8_t column[LOG_MSGPACK_BLOCK_ROWS * MSGPACK_HEADER_MAX];
+    int len;
+
+    if(write_header(msgpack_pack_map_header(header, block_seq > 0 ? 5 : 4), header) != ESP_OK){
+        return ESP_FAIL;
+    }
+    if(block_seq > 0 && (write_str("seq", 3) != ESP_OK || write_header(msgpack_pack_uint(header, block_seq), header) != ESP_OK)){
+        return ESP_FAIL;
+    }
+
+    if(write_str("tags", 4) != ESP_OK || write_header(msgpack_pack_array_header(header, tag_count - block_first_tag), header) != ESP_OK){
+        return ESP_FAIL;
+    }
+    for(int i = block_first_tag; i < tag_count; ++i){
+        if(write_str(tags[i], strlen(tags[i])) != ESP_OK){
+            return ESP_FAIL;
+        }
+    }
+
+    len = 0;
+    for(int i = 0; i < block_rows; ++i){
+        len += msgpack_pack_uint(&column[len], block_tag[i]);
+    }
+    if(write_str("tag", 3) != ESP_OK || write_header(msgpack_pack_array_header(header, block_rows), header) != ESP_OK
+            || write_out((const char *)column, len) != ESP_OK){
+        return ESP_FAIL;
+    }
+
+    // logs come in order, the differences are mostly a few seconds
+    len = 0;
+    for(int i = 0; i < block_rows; ++i){
+        len += msgpack_pack_int(&column[len], i == 0 ? block_time[0] : block_time[i] - block_time[i - 1]);
+    }
+    if(write_str("time", 4) != ESP_OK || write_header(msgpack_pack_array_header(header, block_rows), header) != ESP_OK
+            || write_out((const char *)column, len) != ESP_OK){
+        return ESP_FAIL;
+    }
+
+    if(write_str("info", 4) != ESP_OK || write_header(msgpack_pack_array_header(header, block_rows), header) != ESP_OK
+            || write_out((const char *)info_column, info_used) != ESP_OK){
+        return ESP_FAIL;
+    }
+
+    block_first_tag = tag_count;
+    block_rows = 0;
+    info_used = 0;
+    return ESP_OK;
+}
+
+static esp_err_t write_str(const char *text, int len){
+    uint8_t header[MSGPACK_HEADER_MAX];
+    if(write_header(msgpack_pack_str_header(header, len), header) != ESP_OK){
+        return ESP_FAIL;
+    }
+    return write_out(text, len);
+}
+
+static esp_err_t write_header(int len, uint8_t *header){
+    return write_out((const char *)header, len);
+}
+
+static int find_tag(const char *tag){
+    for(int i = 0; i < tag_count; ++i){
+        if(strcmp(tags[i], tag) == 0){
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int64_t local_seconds(uint32_t epoch){
+    // the wall-clock time shown in the log, counted as if it were UTC
+    time_t time = epoch;
+    struct tm timeinfo;
+    localtime_r(&time, &timeinfo);
+    return days_from_civil(timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday) * 86400
+           + timeinfo.tm_hour * 3600 + timeinfo.tm_min * 60 + timeinfo.tm_sec;
+}
+
+static int64_t days_from_civil(int64_t year, int month, int day){
+    // days since 1970-01-01 in the proleptic Gregorian calendar, with March as the first month of a year
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    int64_t year_of_era = year - era * 400;
+    int64_t day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+}
+
+static int pack_be(uint8_t *dst, uint8_t type, uint64_t value, int bytes){
+    dst[0] = type;
+    for(int i = 0; i < bytes; ++i){
+        dst[bytes - i] = value >> (8 * i);
+    }
+    return bytes + 1;
+}
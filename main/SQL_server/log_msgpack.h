@@ -0,0 +1,60 @@
+//
+// Created by Vincent.
+//
+
+/*
+    Columnar MessagePack encoding of log uploads, selected instead of json
+    rows with CONFIG_LOGGER_UPLOAD_MSGPACK. The body is a stream of
+    MessagePack maps, one per block of at most LOG_MSGPACK_BLOCK_ROWS logs:
+
+        {"seq":  sequence number of the first log (only logs of the store),
+         "tags": [tag names first used in this block],
+         "tag":  [per log the index of its tag in the tags of all blocks so far],
+         "time": [local time of the first log in seconds, then per log the difference to the one before],
+         "info": [per log its info]}
+
+    A time below LOG_EPOCH_VALID_MIN is a monotonic stamp (boot id and
+    uptime, see log_record.h) and not a local time. api.php renders both
+    the way format_log_stamp() does, without knowing the time zone of the
+    node.
+
+    Keys and tag names go once per block or request instead of on every
+    row, most tags and times fit a single byte and strings are copied
+    without escaping. A block is written out when it is full or its info
+    column is, the memory used does not depend on the amount of logs.
+*/
+
+#ifndef LOG_MSGPACK_H
+#define LOG_MSGPACK_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "../logger/log_record.h"
+
+#define LOG_MSGPACK_TAG "LOG_MSGPACK"
+
+#define LOG_MSGPACK_CONTENT_TYPE "application/x-msgpack"
+#define LOG_MSGPACK_BLOCK_ROWS 32
+#define LOG_MSGPACK_INFO_SIZE 2048      // packed info strings of one block
+#define LOG_MSGPACK_MAX_TAGS 24         // distinct tag names per request
+#define MSGPACK_HEADER_MAX 9            // longest type byte + length or number
+
+typedef esp_err_t (*log_msgpack_write_t)(const char *data, int len);
+
+void log_msgpack_start(log_msgpack_write_t write);
+
+esp_err_t log_msgpack_add(const log_t *log, uint32_t stamp, uint32_t seq);
+
+esp_err_t log_msgpack_finish();
+
+int msgpack_pack_uint(uint8_t *dst, uint64_t value);
+
+int msgpack_pack_int(uint8_t *dst, int64_t value);
+
+int msgpack_pack_str_header(uint8_t *dst, uint32_t len);
+
+int msgpack_pack_array_header(uint8_t *dst, uint32_t amount);
+
+int msgpack_pack_map_header(uint8_t *dst, uint32_t amount);
+
+#endif //LOG_MSGPACK_H
@@ -0,0 +1,233 @@
+//
+// Created by Vincent.
+//
+
+#include <time.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "../logger/logger.h"
+#include "../wifi_events/wifi_events.h"
+#include "SQL_server.h"
+#include "log_uploader.h"
+
+
+// Forward declarations for static functions/params
+static EventGroupHandle_t uploader_events;
+static TaskHandle_t uploader_task_handle;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static log_uploader_stats_t stats = {
+    .batch_size = LOG_UPLOADER_START_BATCH,
+    .paused = true,
+};
+#ifdef CONFIG_LOGGER_UPLOADER
+static void adapt_batch_size(int sent, uint32_t elapsed_ms);
+static uint32_t backoff_delay(int failures);
+#endif
+
+
+esp_err_t init_log_uploader(){
+    // created before WiFi connects, so the first connect event is not missed
+    uploader_events = xEventGroupCreate();
+    if(uploader_events == NULL){
+        ESP_LOGE(LOG_UPLOADER_TAG, "FAILED TO CREATE uploader_events");
+        return ESP_FAIL;
+    }
+    xEventGroupSetBits(uploader_events, LOG_UPLOADER_RUN_BIT);
+    return ESP_OK;
+}
+
+#ifdef CONFIG_LOGGER_UPLOADER
+void log_uploader_task(void *pvParameters){
+    if(uploader_events == NULL){
+        ESP_LOGE(LOG_UPLOADER_TAG, "log uploader not initialized, logs are only uploaded at midnight");
+        vTaskDelete(NULL);
+    }
+    uploader_task_handle = xTaskGetCurrentTaskHandle();
+
+    int failures = 0;
+    const EventBits_t run_bits = LOG_UPLOADER_WIFI_UP_BIT | LOG_UPLOADER_RUN_BIT;
+    while(1){
+        // paused while WiFi is down or the uploader is held, failures until then were not the server's fault
+        EventBits_t bits = xEventGroupGetBits(uploader_events);
+        if((bits & run_bits) != run_bits){
+            if((bits & LOG_UPLOADER_WIFI_UP_BIT) == 0){
+                ESP_LOGI(LOG_UPLOADER_TAG, "WiFi is down, uploads paused");
+                failures = 0;
+            }
+            xEventGroupSetBits(uploader_events, LOG_UPLOADER_IDLE_BIT);
+            xEventGroupWaitBits(uploader_events, run_bits, pdFALSE, pdTRUE, portMAX_DELAY);
+            xEventGroupClearBits(uploader_events, LOG_UPLOADER_IDLE_BIT);
+            // a wake-up given while waiting here would cut the next interval short
+            ulTaskNotifyTake(pdTRUE, 0);
+        }
+
+        portENTER_CRITICAL(&stats_lock);
+        int batch_size = stats.batch_size;
+        portEXIT_CRITICAL(&stats_lock);
+
+        int sent;
+        int64_t start = esp_timer_get_time();
+        esp_err_t ret = send_log_batch_to_api(batch_size, &sent);
+        uint32_t elapsed_ms = (esp_timer_get_time() - start) / 1000;
+
+        uint32_t delay_ms;
+        if(ret == ESP_OK){
+            failures = 0;
+            if(sent > 0){
+                adapt_batch_size(sent, elapsed_ms);
+            }
+            delay_ms = LOG_UPLOADER_INTERVAL_MS;
+            if(sent >= batch_size){
+                // a full batch means more logs are waiting, the next one follows at the drain rate
+                uint32_t gap_ms = (uint32_t)sent * 1000 / LOG_UPLOADER_DRAIN_RATE;
+                delay_ms = gap_ms > elapsed_ms ? gap_ms - elapsed_ms : 0;
+            }
+        }else{
+            failures++;
+            delay_ms = backoff_delay(failures);
+            ESP_LOGW(LOG_UPLOADER_TAG, "upload failed %d times in a row, retrying in %u ms", failures, (unsigned)delay_ms);
+        }
+
+        portENTER_CRITICAL(&stats_lock);
+        if(sent > 0 || ret != ESP_OK){
+            stats.requests++;
+        }
+        stats.uploaded_logs += ret == ESP_OK ? sent : 0;
+        if(ret != ESP_OK){
+            stats.failures++;
+            // a request that timed out may simply have been too large
+            stats.batch_size = stats.batch_size / 2 > LOG_UPLOADER_MIN_BATCH ? stats.batch_size / 2 : LOG_UPLOADER_MIN_BATCH;
+        }
+        stats.backoff_ms = ret == ESP_OK ? 0 : delay_ms;
+        portEXIT_CRITICAL(&stats_lock);
+
+        if(delay_ms > 0){
+            // a lost WiFi connection ends the wait early, the task then pauses above
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(delay_ms));
+        }
+    }
+}
+#endif
+
+void log_uploader_wifi_connected(){
+    if(uploader_events == NULL){
+        return;
+    }
+    portENTER_CRITICAL(&stats_lock);
+    stats.paused = false;
+    portEXIT_CRITICAL(&stats_lock);
+    xEventGroupSetBits(uploader_events, LOG_UPLOADER_WIFI_UP_BIT);
+}
+
+void log_uploader_wifi_lost(){
+    if(uploader_events == NULL){
+        return;
+    }
+    portENTER_CRITICAL(&stats_lock);
+    stats.paused = true;
+    portEXIT_CRITICAL(&stats_lock);
+    xEventGroupClearBits(uploader_events, LOG_UPLOADER_WIFI_UP_BIT);
+    if(uploader_task_handle != NULL){
+        xTaskNotifyGive(uploader_task_handle);
+    }
+}
+
+esp_err_t log_uploader_hold(){
+    if(uploader_events == NULL){
+        return ESP_FAIL;
+    }
+    xEventGroupClearBits(uploader_events, LOG_UPLOADER_RUN_BIT);
+    if(uploader_task_handle == NULL){
+        // no task running, nothing to wait for
+        return ESP_OK;
+    }
+
+    // a request in flight is finished first, a wait between requests ends right away
+    xTaskNotifyGive(uploader_task_handle);
+    EventBits_t bits = xEventGroupWaitBits(uploader_events, LOG_UPLOADER_IDLE_BIT, pdFALSE, pdTRUE,
+                                           pdMS_TO_TICKS(LOG_UPLOADER_HOLD_TIMEOUT_MS));
+    if((bits & LOG_UPLOADER_IDLE_BIT) == 0){
+        ESP_LOGW(LOG_UPLOADER_TAG, "uploader still busy after %u ms", (unsigned)LOG_UPLOADER_HOLD_TIMEOUT_MS);
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
+
+void log_uploader_release(){
+    if(uploader_events == NULL){
+        return;
+    }
+    xEventGroupSetBits(uploader_events, LOG_UPLOADER_RUN_BIT);
+}
+
+void log_uploader_connectivity_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data){
+    if(event_id == WIFI_CONNECTIVITY_ONLINE){
+        log_uploader_wifi_connected();
+    } else if(event_id == WIFI_CONNECTIVITY_OFFLINE){
+        log_uploader_wifi_lost();
+    }
+}
+
+void get_log_uploader_stats(log_uploader_stats_t *stats_copy){
+    portENTER_CRITICAL(&stats_lock);
+    *stats_copy = stats;
+    portEXIT_CRITICAL(&stats_lock);
+
+    // the lag is counted from the log store when asked for, not kept up to date on every record
+    uint32_t oldest_epoch;
+    stats_copy->lag_logs = get_log_upload_lag(&oldest_epoch);
+    stats_copy->lag_seconds = -1;
+    if(stats_copy->lag_logs == 0){
+        stats_copy->lag_seconds = 0;
+    }else if(stats_copy->lag_logs > 0 && !LOG_STAMP_IS_MONOTONIC(oldest_epoch)){
+        time_t now = time(NULL);
+        if(now >= LOG_EPOCH_VALID_MIN){
+            stats_copy->lag_seconds = now > oldest_epoch ? now - oldest_epoch : 0;
+        }
+    }
+}
+
+#ifdef CONFIG_LOGGER_UPLOADER
+static void adapt_batch_size(int sent, uint32_t elapsed_ms){
+    if(elapsed_ms == 0){
+        elapsed_ms = 1;
+    }
+    uint32_t throughput = sent * 1000 / elapsed_ms;
+
+    portENTER_CRITICAL(&stats_lock);
+    // smoothed over about eight requests, one slow request does not halve the batch
+    stats.rtt_ms = stats.rtt_ms == 0 ? elapsed_ms : (7 * stats.rtt_ms + elapsed_ms) / 8;
+    stats.logs_per_second = stats.logs_per_second == 0 ? throughput : (7 * stats.logs_per_second + throughput) / 8;
+
+    // the batch that takes LOG_UPLOADER_TARGET_MS at the measured throughput, only a full batch shows that more would fit
+    uint32_t target = stats.logs_per_second * LOG_UPLOADER_TARGET_MS / 1000;
+    uint32_t batch_size = stats.batch_size;
+    if(sent >= batch_size && target > batch_size){
+        batch_size = target < 2 * batch_size ? target : 2 * batch_size;
+    }else if(target < batch_size && stats.rtt_ms > LOG_UPLOADER_TARGET_MS){
+        batch_size = target;
+    }
+    if(batch_size < LOG_UPLOADER_MIN_BATCH){
+        batch_size = LOG_UPLOADER_MIN_BATCH;
+    }
+    if(batch_size > LOG_UPLOADER_MAX_BATCH){
+        batch_size = LOG_UPLOADER_MAX_BATCH;
+    }
+    stats.batch_size = batch_size;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+static uint32_t backoff_delay(int failures){
+    // doubles per failure up to the maximum, half of it is random ("equal jitter")
+    uint32_t delay_ms = LOG_UPLOADER_BACKOFF_MAX_MS;
+    if(failures < 16 && (LOG_UPLOADER_BACKOFF_BASE_MS << (failures - 1)) < LOG_UPLOADER_BACKOFF_MAX_MS){
+        delay_ms = LOG_UPLOADER_BACKOFF_BASE_MS << (failures - 1);
+    }
+    return delay_ms / 2 + esp_random() % (delay_ms / 2 + 1);
+}
+#endif
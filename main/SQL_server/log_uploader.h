@@ -0,0 +1,94 @@
+//
+// Created by Vincent.
+//
+
+/*
+    Continuous upload of the log store. Instead of the whole day going up at
+    midnight, the uploader task sends what is new every
+    LOG_UPLOADER_INTERVAL_MS, and sooner as long as a request came back full.
+    Every request moves the upload cursor, the midnight upload only finds the
+    rest and reclaims the uploaded segments.
+
+    The store is the spool of the uploader: logs that could not go up during
+    an outage stay in it behind the cursor. Catching up on them is paced to
+    LOG_UPLOADER_DRAIN_RATE logs per second, a full batch is followed by a
+    gap long enough to keep the average below it.
+
+    The batch size follows the measured request time and throughput (both
+    smoothed): a batch should take about LOG_UPLOADER_TARGET_MS, long enough
+    that the handshake and round trip are a small part of it, short enough
+    not to hold the api client and the log store for long. It at most
+    doubles per request and shrinks as soon as requests get slow or fail.
+
+    A failed request is retried after an exponential backoff with jitter, so
+    a server that comes back is not hit by every node at the same moment.
+    While WiFi is down (WIFI_CONNECTIVITY_EVENT, see wifi_events.h) the task does not run at
+    all, the first request after a reconnect goes out immediately.
+
+    log_uploader_hold() stops the task between two requests until
+    log_uploader_release(), for tests that send batches themselves.
+
+    The lag, logs not uploaded yet and the age of the oldest of them, is
+    part of get_log_uploader_stats().
+*/
+
+#ifndef LOG_UPLOADER_H
+#define LOG_UPLOADER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "esp_bit_defs.h"
+#include "esp_err.h"
+#include "esp_event.h"
+#include "SQL_server.h"
+#include "api_client.h"
+
+#define LOG_UPLOADER_TAG "LOG_UPLOADER"
+
+#ifdef CONFIG_LOGGER_UPLOADER
+#define LOG_UPLOADER_INTERVAL_MS (CONFIG_LOGGER_UPLOAD_INTERVAL_S * 1000)
+#define LOG_UPLOADER_BACKOFF_MAX_MS (CONFIG_LOGGER_UPLOAD_BACKOFF_MAX_S * 1000)
+#define LOG_UPLOADER_DRAIN_RATE CONFIG_LOGGER_UPLOAD_DRAIN_RATE    // logs per second while catching up
+#endif
+#define LOG_UPLOADER_BACKOFF_BASE_MS 2000
+#define LOG_UPLOADER_TARGET_MS 2000     // wanted duration of one request
+#define LOG_UPLOADER_START_BATCH 64
+#define LOG_UPLOADER_MIN_BATCH 16
+#define LOG_UPLOADER_MAX_BATCH UPLOAD_LOGS_PER_REQUEST
+#define LOG_UPLOADER_HOLD_TIMEOUT_MS (API_CLIENT_TIMEOUT_MS * 3)   // a request in flight, its retry and reading the store
+#define LOG_UPLOADER_WIFI_UP_BIT BIT0
+#define LOG_UPLOADER_RUN_BIT BIT1       // cleared by log_uploader_hold()
+#define LOG_UPLOADER_IDLE_BIT BIT2      // the task waits and sends nothing
+
+typedef struct log_uploader_stats_t {
+    uint32_t requests;
+    uint32_t failures;
+    uint32_t uploaded_logs;
+    uint32_t batch_size;        // logs per request right now
+    uint32_t rtt_ms;            // smoothed duration of a request
+    uint32_t logs_per_second;   // smoothed throughput of a request
+    uint32_t backoff_ms;        // wait after the last failure, 0 while requests succeed
+    bool paused;                // WiFi is down
+    int lag_logs;               // not uploaded yet, -1 if the log store is not ready
+    int lag_seconds;            // age of the oldest of them, -1 while it has no wall-clock time
+} log_uploader_stats_t;
+
+esp_err_t init_log_uploader();
+
+void log_uploader_task(void *pvParameters);
+
+void log_uploader_wifi_connected();
+
+void log_uploader_wifi_lost();
+
+esp_err_t log_uploader_hold();
+
+void log_uploader_release();
+
+void log_uploader_connectivity_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
+
+void get_log_uploader_stats(log_uploader_stats_t *stats_copy);
+
+#endif //LOG_UPLOADER_H
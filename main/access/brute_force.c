@@ -0,0 +1,174 @@
+//
+// Created by Vincent.
+//
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "../logger/logger.h"
+#include "brute_force.h"
+
+
+// Forward declarations for static functions/params
+typedef struct device_window_t {
+    uint32_t newest_bucket;     // uptime / bucket length of the newest bucket
+    uint8_t counts[BRUTE_FORCE_BUCKETS];
+    uint16_t total;
+    bool alerted;
+} device_window_t;
+typedef struct key_alert_t {
+    uint64_t key;
+    uint32_t window;    // window of the alert + 1, 0 for an empty slot
+} key_alert_t;
+static portMUX_TYPE brute_force_lock = portMUX_INITIALIZER_UNLOCKED;
+static device_window_t device_windows[BRUTE_FORCE_MAX_DEVICES];
+static uint32_t lockout_until[BRUTE_FORCE_MAX_DEVICES];    // uptime in seconds
+static uint8_t key_sketch[2][BRUTE_FORCE_SKETCH_DEPTH][BRUTE_FORCE_SKETCH_WIDTH];   // current and previous window
+static uint32_t sketch_window;
+static key_alert_t recent_alerts[BRUTE_FORCE_RECENT_ALERTS];
+static int next_alert;
+static uint32_t uptime_seconds();
+static uint16_t count_device_deny(device_window_t *window, uint32_t now);
+static uint32_t count_key_deny(uint64_t key, uint32_t now);
+static bool key_alerted(uint64_t key, uint32_t window);
+
+
+bool brute_force_locked(int device){
+    if(device < 0 || device >= BRUTE_FORCE_MAX_DEVICES){
+        return false;
+    }
+    // a single word read, no lock on the grant path
+    return lockout_until[device] > uptime_seconds();
+}
+
+void brute_force_record_deny(int device, uint64_t key){
+    if(device < 0 || device >= BRUTE_FORCE_MAX_DEVICES){
+        return;
+    }
+    uint32_t now = uptime_seconds();
+    bool device_alert = false;
+    bool key_alert = false;
+
+    portENTER_CRITICAL(&brute_force_lock);
+    device_window_t *window = &device_windows[device];
+    uint16_t device_denies = count_device_deny(window, now);
+    if(device_denies >= BRUTE_FORCE_DEVICE_THRESHOLD && !window->alerted){
+        window->alerted = true;
+        device_alert = true;
+        if(BRUTE_FORCE_LOCKOUT_S > 0){
+            lockout_until[device] = now + BRUTE_FORCE_LOCKOUT_S;
+        }
+    }else if(device_denies < BRUTE_FORCE_DEVICE_THRESHOLD){
+        window->alerted = false;
+    }
+
+    uint32_t key_denies = count_key_deny(key, now);
+    if(key_denies >= BRUTE_FORCE_KEY_THRESHOLD && !key_alerted(key, sketch_window)){
+        recent_alerts[next_alert] = (key_alert_t){ key, sketch_window + 1 };
+        next_alert = (next_alert + 1) % BRUTE_FORCE_RECENT_ALERTS;
+        key_alert = true;
+    }
+    portEXIT_CRITICAL(&brute_force_lock);
+
+    // alerts are rare, logging them outside the critical section keeps the deny path short
+    if(device_alert){
+        ESP_LOGW(BRUTE_FORCE_TAG, "device %d: %d denied swipes in %d s%s", device, device_denies, BRUTE_FORCE_WINDOW_S,
+                 BRUTE_FORCE_LOCKOUT_S > 0 ? ", locked out" : "");
+        log_event(LOG_TAG_ACCESS, LOG_EVENT_BRUTE_FORCE_DEVICE, device, device_denies, NULL);
+    }
+    if(key_alert){
+        ESP_LOGW(BRUTE_FORCE_TAG, "key %016llX: %u denied swipes in %d s", (unsigned long long)key, (unsigned)key_denies, BRUTE_FORCE_WINDOW_S);
+        log_event(LOG_TAG_ACCESS, LOG_EVENT_BRUTE_FORCE_KEY, device, key, NULL);
+    }
+}
+
+void brute_force_clear_lockout(int device){
+    if(device < 0 || device >= BRUTE_FORCE_MAX_DEVICES){
+        return;
+    }
+    portENTER_CRITICAL(&brute_force_lock);
+    lockout_until[device] = 0;
+    memset(&device_windows[device], 0, sizeof(device_window_t));
+    portEXIT_CRITICAL(&brute_force_lock);
+}
+
+void brute_force_reset(){
+    portENTER_CRITICAL(&brute_force_lock);
+    memset(device_windows, 0, sizeof(device_windows));
+    memset(lockout_until, 0, sizeof(lockout_until));
+    memset(key_sketch, 0, sizeof(key_sketch));
+    memset(recent_alerts, 0, sizeof(recent_alerts));
+    sketch_window = 0;
+    next_alert = 0;
+    portEXIT_CRITICAL(&brute_force_lock);
+}
+
+static uint32_t uptime_seconds(){
+    return esp_timer_get_time() / 1000000;
+}
+
+static uint16_t count_device_deny(device_window_t *window, uint32_t now){
+    // expire the buckets that slid out of the window, at most BRUTE_FORCE_BUCKETS of them
+    uint32_t bucket = now / (BRUTE_FORCE_WINDOW_S / BRUTE_FORCE_BUCKETS);
+    uint32_t steps = bucket - window->newest_bucket;
+    if(steps >= BRUTE_FORCE_BUCKETS){
+        memset(window->counts, 0, sizeof(window->counts));
+        window->total = 0;
+    }else{
+        for(uint32_t i = 1; i <= steps; ++i){
+            uint8_t *count = &window->counts[(window->newest_bucket + i) % BRUTE_FORCE_BUCKETS];
+            window->total -= *count;
+            *count = 0;
+        }
+    }
+    window->newest_bucket = bucket;
+
+    uint8_t *count = &window->counts[bucket % BRUTE_FORCE_BUCKETS];
+    if(*count < UINT8_MAX){
+        (*count)++;
+        window->total++;
+    }
+    return window->total;
+}
+
+static uint32_t count_key_deny(uint64_t key, uint32_t now){
+    uint32_t window = now / BRUTE_FORCE_WINDOW_S;
+    if(window != sketch_window){
+        // the current window becomes the previous one, an older one is useless
+        if(window == sketch_window + 1){
+            memcpy(key_sketch[1], key_sketch[0], sizeof(key_sketch[0]));
+        }else{
+            memset(key_sketch[1], 0, sizeof(key_sketch[1]));
+        }
+        memset(key_sketch[0], 0, sizeof(key_sketch[0]));
+        sketch_window = window;
+    }
+
+    // the previous window only counts for the part that still lies within the sliding window
+    uint32_t remaining = BRUTE_FORCE_WINDOW_S - now % BRUTE_FORCE_WINDOW_S;
+    uint32_t estimate = UINT32_MAX;
+    for(int row = 0; row < BRUTE_FORCE_SKETCH_DEPTH; ++row){
+        uint64_t hash = (key ^ (0x9E3779B97F4A7C15ULL * (row + 1))) * 0xBF58476D1CE4E5B9ULL;
+        int column = (hash >> 57) % BRUTE_FORCE_SKETCH_WIDTH;
+        uint8_t *cell = &key_sketch[0][row][column];
+        if(*cell < UINT8_MAX){
+            (*cell)++;
+        }
+        uint32_t count = *cell + key_sketch[1][row][column] * remaining / BRUTE_FORCE_WINDOW_S;
+        if(count < estimate){
+            estimate = count;
+        }
+    }
+    return estimate;
+}
+
+static bool key_alerted(uint64_t key, uint32_t window){
+    // reported in this or the previous window, which still overlaps the sliding window
+    for(int i = 0; i < BRUTE_FORCE_RECENT_ALERTS; ++i){
+        if(recent_alerts[i].key == key && recent_alerts[i].window != 0 && recent_alerts[i].window >= window){
+            return true;
+        }
+    }
+    return false;
+}
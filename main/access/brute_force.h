@@ -0,0 +1,49 @@
+//
+// Created by Vincent.
+//
+
+/*
+    Brute force detection for denied iButton swipes. Every denied swipe is
+    counted per device in a sliding window of BRUTE_FORCE_BUCKETS counting
+    buckets, and per key in a count-min sketch over the current and previous
+    window (the previous one weighted by how much of it still overlaps). Both
+    are O(1) per swipe and need no allocation, so the nrf message handler
+    calls them directly. Grants only look at the lockout table.
+
+    Crossing a threshold logs an alert once per window and, with
+    CONFIG_BRUTE_FORCE_LOCKOUT, makes the device refuse every key for
+    BRUTE_FORCE_LOCKOUT_S.
+*/
+
+#ifndef BRUTE_FORCE_H
+#define BRUTE_FORCE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define BRUTE_FORCE_TAG "BRUTE_FORCE"
+
+#define BRUTE_FORCE_WINDOW_S CONFIG_BRUTE_FORCE_WINDOW_S
+#define BRUTE_FORCE_DEVICE_THRESHOLD CONFIG_BRUTE_FORCE_DEVICE_THRESHOLD
+#define BRUTE_FORCE_KEY_THRESHOLD CONFIG_BRUTE_FORCE_KEY_THRESHOLD
+#ifdef CONFIG_BRUTE_FORCE_LOCKOUT
+#define BRUTE_FORCE_LOCKOUT_S CONFIG_BRUTE_FORCE_LOCKOUT_S
+#else
+#define BRUTE_FORCE_LOCKOUT_S 0
+#endif
+#define BRUTE_FORCE_MAX_DEVICES 100 // device numbers are two digits
+#define BRUTE_FORCE_BUCKETS 6
+#define BRUTE_FORCE_SKETCH_DEPTH 4
+#define BRUTE_FORCE_SKETCH_WIDTH 128
+#define BRUTE_FORCE_RECENT_ALERTS 4 // keys already reported in this window
+
+bool brute_force_locked(int device);
+
+void brute_force_record_deny(int device, uint64_t key);
+
+void brute_force_clear_lockout(int device);
+
+void brute_force_reset();
+
+#endif //BRUTE_FORCE_H
@@ -0,0 +1,84 @@
+//
+// Created by Vincent.
+//
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "../logger/log_clock.h"
+#include "occupancy.h"
+
+
+// Forward declarations for static functions/params
+typedef struct session_t {
+    uint64_t key;
+    uint32_t since;
+    bool active;
+} session_t;
+static portMUX_TYPE occupancy_lock = portMUX_INITIALIZER_UNLOCKED;
+static session_t sessions[OCCUPANCY_MAX_DEVICES];
+static uint32_t correct_stamp(uint32_t stamp);
+
+
+void occupancy_granted(int device, uint64_t key){
+    if(device < 0 || device >= OCCUPANCY_MAX_DEVICES){
+        return;
+    }
+    uint32_t now = log_clock_now();
+
+    portENTER_CRITICAL(&occupancy_lock);
+    // a new grant on a device that is still on hands it over to the new key
+    sessions[device].key = key;
+    sessions[device].since = now;
+    sessions[device].active = true;
+    portEXIT_CRITICAL(&occupancy_lock);
+}
+
+void occupancy_released(int device){
+    if(device < 0 || device >= OCCUPANCY_MAX_DEVICES){
+        return;
+    }
+    portENTER_CRITICAL(&occupancy_lock);
+    sessions[device].active = false;
+    portEXIT_CRITICAL(&occupancy_lock);
+}
+
+bool get_device_occupancy(int device, occupancy_t *occupancy){
+    if(device < 0 || device >= OCCUPANCY_MAX_DEVICES){
+        return false;
+    }
+    portENTER_CRITICAL(&occupancy_lock);
+    session_t session = sessions[device];
+    portEXIT_CRITICAL(&occupancy_lock);
+
+    if(!session.active){
+        return false;
+    }
+    occupancy->device = device;
+    occupancy->key = session.key;
+    occupancy->since = correct_stamp(session.since);
+    return true;
+}
+
+int get_occupancy(occupancy_t *occupancy, int max_entries){
+    int amount = 0;
+    for(int device = 0; device < OCCUPANCY_MAX_DEVICES && amount < max_entries; ++device){
+        if(get_device_occupancy(device, &occupancy[amount])){
+            amount++;
+        }
+    }
+    return amount;
+}
+
+void occupancy_reset(){
+    portENTER_CRITICAL(&occupancy_lock);
+    memset(sessions, 0, sizeof(sessions));
+    portEXIT_CRITICAL(&occupancy_lock);
+}
+
+static uint32_t correct_stamp(uint32_t stamp){
+    // sessions that started before the time was synced get their real start once it is
+    log_record_t record = {.epoch = stamp};
+    log_clock_correct(&record);
+    return record.epoch;
+}
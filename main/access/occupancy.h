@@ -0,0 +1,44 @@
+//
+// Created by Vincent.
+//
+
+/*
+    Who is using which machine right now. The nrf message handler records the
+    key of every granted swipe and clears the device when its TURNOFF is
+    acknowledged, so the table always holds the open sessions and a query is
+    a copy of at most OCCUPANCY_MAX_DEVICES entries, the logs are never read.
+
+    The session start is a log clock stamp: a monotonic stamp until the time
+    is synced, corrected into an epoch on the next query once it is.
+    The table lives in RAM only, after a reboot every device counts as free
+    until it is granted again.
+*/
+
+#ifndef OCCUPANCY_H
+#define OCCUPANCY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define OCCUPANCY_TAG "OCCUPANCY"
+
+#define OCCUPANCY_MAX_DEVICES 100   // device numbers are two digits
+
+typedef struct occupancy_t {
+    uint16_t device;
+    uint64_t key;
+    uint32_t since;     // log clock stamp of the grant
+} occupancy_t;
+
+void occupancy_granted(int device, uint64_t key);
+
+void occupancy_released(int device);
+
+bool get_device_occupancy(int device, occupancy_t *occupancy);
+
+int get_occupancy(occupancy_t *occupancy, int max_entries);
+
+void occupancy_reset();
+
+#endif //OCCUPANCY_H
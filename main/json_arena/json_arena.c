@@ -0,0 +1,166 @@
+//
+// Created by Vincent.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "cJSON.h"
+#include "json_arena.h"
+
+
+// Forward declarations for static functions/params
+static portMUX_TYPE arena_lock = portMUX_INITIALIZER_UNLOCKED;
+static json_arena_t *scopes[JSON_ARENA_MAX_SCOPES];
+static json_arena_stats_t stats;
+static void *arena_malloc(size_t size);
+static void arena_free(void *ptr);
+static json_arena_t *task_arena();
+
+
+esp_err_t init_json_arena(){
+    // outside of a scope the hooks are plain malloc/free, installing them early changes nothing else
+    cJSON_Hooks hooks = {
+        .malloc_fn = arena_malloc,
+        .free_fn = arena_free,
+    };
+    cJSON_InitHooks(&hooks);
+    return ESP_OK;
+}
+
+esp_err_t json_arena_begin(json_arena_t *arena, void *buffer, size_t size){
+    memset(arena, 0, sizeof(json_arena_t));
+    arena->task = xTaskGetCurrentTaskHandle();
+    arena->buffer = buffer;
+    arena->size = size;
+    if(buffer == NULL){
+        // one block for the whole scope, without it every allocation falls back to the heap
+        arena->buffer = malloc(size);
+        arena->owns_buffer = arena->buffer != NULL;
+        if(arena->buffer == NULL){
+            ESP_LOGW(JSON_ARENA_TAG, "no %u bytes for a json arena, cJSON uses the heap", (unsigned)size);
+            arena->size = 0;
+        }
+    }
+
+    portENTER_CRITICAL(&arena_lock);
+    int slot = -1;
+    for(int i = 0; i < JSON_ARENA_MAX_SCOPES; ++i){
+        if(scopes[i] != NULL && scopes[i]->task == arena->task){
+            // one scope per task, a nested one would hand out memory the outer one frees
+            slot = -2;
+            break;
+        }
+        if(scopes[i] == NULL && slot == -1){
+            slot = i;
+        }
+    }
+    if(slot >= 0){
+        scopes[slot] = arena;
+        stats.scopes++;
+    }
+    portEXIT_CRITICAL(&arena_lock);
+
+    if(slot < 0){
+        ESP_LOGE(JSON_ARENA_TAG, "%s", slot == -2 ? "json arena scope already open in this task" : "too many json arena scopes");
+        if(arena->owns_buffer){
+            free(arena->buffer);
+        }
+        arena->buffer = NULL;
+        arena->size = 0;
+        arena->owns_buffer = false;
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+void json_arena_reset(json_arena_t *arena){
+    // everything allocated so far is given up, the scope stays open
+    arena->used = 0;
+}
+
+void json_arena_end(json_arena_t *arena){
+    portENTER_CRITICAL(&arena_lock);
+    for(int i = 0; i < JSON_ARENA_MAX_SCOPES; ++i){
+        if(scopes[i] == arena){
+            scopes[i] = NULL;
+        }
+    }
+    if(arena->peak > stats.peak_bytes){
+        stats.peak_bytes = arena->peak;
+    }
+    portEXIT_CRITICAL(&arena_lock);
+
+    if(arena->fallbacks > 0){
+        ESP_LOGW(JSON_ARENA_TAG, "%u cJSON allocations did not fit an arena of %u bytes", (unsigned)arena->fallbacks,
+                 (unsigned)arena->size);
+    }
+    if(arena->owns_buffer){
+        free(arena->buffer);
+    }
+    arena->buffer = NULL;
+    arena->size = 0;
+    arena->owns_buffer = false;
+}
+
+void get_json_arena_stats(json_arena_stats_t *stats_copy){
+    portENTER_CRITICAL(&arena_lock);
+    *stats_copy = stats;
+    portEXIT_CRITICAL(&arena_lock);
+}
+
+static void *arena_malloc(size_t size){
+    json_arena_t *arena = task_arena();
+    if(arena == NULL){
+        return malloc(size);
+    }
+
+    // only the owner task allocates from its arena, the bump itself needs no lock
+    size_t start = (arena->used + JSON_ARENA_ALIGN - 1) & ~(size_t)(JSON_ARENA_ALIGN - 1);
+    if(start + size > arena->size){
+        arena->fallbacks++;
+        portENTER_CRITICAL(&arena_lock);
+        stats.fallbacks++;
+        portEXIT_CRITICAL(&arena_lock);
+        return malloc(size);
+    }
+    arena->used = start + size;
+    if(arena->used > arena->peak){
+        arena->peak = arena->used;
+    }
+    portENTER_CRITICAL(&arena_lock);
+    stats.allocations++;
+    portEXIT_CRITICAL(&arena_lock);
+    return &arena->buffer[start];
+}
+
+static void arena_free(void *ptr){
+    // memory of an open arena goes back with json_arena_end(), anything else was a malloc
+    uint8_t *p = ptr;
+    bool in_arena = false;
+    portENTER_CRITICAL(&arena_lock);
+    for(int i = 0; i < JSON_ARENA_MAX_SCOPES; ++i){
+        if(scopes[i] != NULL && p >= scopes[i]->buffer && p < scopes[i]->buffer + scopes[i]->size){
+            in_arena = true;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&arena_lock);
+    if(!in_arena){
+        free(ptr);
+    }
+}
+
+static json_arena_t *task_arena(){
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    json_arena_t *arena = NULL;
+    portENTER_CRITICAL(&arena_lock);
+    for(int i = 0; i < JSON_ARENA_MAX_SCOPES; ++i){
+        if(scopes[i] != NULL && scopes[i]->task == task){
+            arena = scopes[i];
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&arena_lock);
+    return arena;
+}
@@ -0,0 +1,68 @@
+//
+// Created by Vincent.
+//
+
+/*
+    Arena allocation for cJSON. Every cJSON node, key and value string is
+    a malloc of its own, a request that parses or builds a document leaves
+    dozens of small holes in the heap between the allocations other tasks
+    made meanwhile. Inside a json_arena_begin() / json_arena_end() scope the
+    cJSON allocations of the calling task are cut from one buffer instead,
+    cJSON_Delete() and cJSON_free() do nothing there, and the whole buffer
+    is given back at once when the scope ends.
+
+    init_json_arena() installs the hooks once with cJSON_InitHooks(). They
+    are global, but only the task that opened a scope allocates from it,
+    cJSON outside of any scope uses malloc/free as before. An allocation
+    that does not fit anymore goes to the heap (counted as a fallback) and
+    is freed normally.
+
+    The buffer is the caller's (a static one for handlers that never run
+    at the same time) or, with buffer NULL, one heap block for the scope.
+    Nothing cJSON returned inside a scope may be used after json_arena_end(),
+    strings printed there are copied or sent before it.
+*/
+
+#ifndef JSON_ARENA_H
+#define JSON_ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+
+#define JSON_ARENA_TAG "JSON_ARENA"
+
+#define JSON_ARENA_MAX_SCOPES 4     // tasks with a scope open at the same time
+#define JSON_ARENA_ALIGN 8          // cJSON nodes hold a double
+
+typedef struct json_arena_t {
+    uint8_t *buffer;
+    size_t size;
+    size_t used;
+    size_t peak;
+    uint32_t fallbacks;
+    bool owns_buffer;
+    TaskHandle_t task;
+} json_arena_t;
+
+typedef struct json_arena_stats_t {
+    uint32_t scopes;
+    uint32_t allocations;           // taken from an arena
+    uint32_t fallbacks;             // did not fit their arena and went to the heap
+    uint32_t peak_bytes;            // most any scope used
+} json_arena_stats_t;
+
+esp_err_t init_json_arena();
+
+esp_err_t json_arena_begin(json_arena_t *arena, void *buffer, size_t size);
+
+void json_arena_reset(json_arena_t *arena);
+
+void json_arena_end(json_arena_t *arena);
+
+void get_json_arena_stats(json_arena_stats_t *stats_copy);
+
+#endif //JSON_ARENA_H
@@ -0,0 +1,95 @@
+//
+// Created by Vincent.
+//
+
+#include <time.h>
+#include <stdatomic.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "log_clock.h"
+
+
+// Forward declarations for static functions/params
+static uint32_t boot_id;
+static _Atomic uint64_t clock_sync;    // boot id << 32 | wall-clock epoch at uptime 0, 0 if unknown
+static nvs_handle_t clock_nvs_handle;
+static bool clock_nvs_open;
+static uint32_t uptime_seconds();
+
+
+esp_err_t init_log_clock(){
+    if(nvs_open(LOG_CLOCK_NVS_NAMESPACE, NVS_READWRITE, &clock_nvs_handle) != ESP_OK){
+        ESP_LOGE(LOG_CLOCK_TAG, "Failed to open nvs namespace %s", LOG_CLOCK_NVS_NAMESPACE);
+        return ESP_FAIL;
+    }
+    clock_nvs_open = true;
+
+    uint32_t last_boot = 0;
+    nvs_get_u32(clock_nvs_handle, LOG_CLOCK_NVS_BOOT_KEY, &last_boot);
+    boot_id = last_boot + 1;
+    if(nvs_set_u32(clock_nvs_handle, LOG_CLOCK_NVS_BOOT_KEY, boot_id) != ESP_OK || nvs_commit(clock_nvs_handle) != ESP_OK){
+        ESP_LOGE(LOG_CLOCK_TAG, "Failed to store boot id");
+    }
+
+    // the offset of an earlier boot still corrects the records it left behind
+    uint64_t packed;
+    if(nvs_get_u64(clock_nvs_handle, LOG_CLOCK_NVS_SYNC_KEY, &packed) == ESP_OK){
+        atomic_store(&clock_sync, packed);
+    }
+    ESP_LOGI(LOG_CLOCK_TAG, "boot %u", (unsigned)boot_id);
+    return ESP_OK;
+}
+
+uint32_t log_clock_now(){
+    time_t now = time(NULL);
+    if(now >= LOG_EPOCH_VALID_MIN){
+        return now;
+    }
+    return LOG_MONOTONIC_STAMP(boot_id, uptime_seconds());
+}
+
+uint32_t log_clock_boot_id(){
+    return boot_id;
+}
+
+bool log_clock_is_synced(){
+    return time(NULL) >= LOG_EPOCH_VALID_MIN;
+}
+
+esp_err_t log_clock_synced(){
+    time_t now = time(NULL);
+    if(now < LOG_EPOCH_VALID_MIN){
+        return ESP_ERR_INVALID_STATE;
+    }
+    uint64_t packed = ((uint64_t)boot_id << 32) | (uint32_t)(now - uptime_seconds());
+    atomic_store(&clock_sync, packed);
+
+    if(!clock_nvs_open || nvs_set_u64(clock_nvs_handle, LOG_CLOCK_NVS_SYNC_KEY, packed) != ESP_OK || nvs_commit(clock_nvs_handle) != ESP_OK){
+        ESP_LOGE(LOG_CLOCK_TAG, "Failed to store clock offset, records of this boot are only corrected until reboot");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+bool log_clock_can_correct(){
+    return atomic_load(&clock_sync) != 0;
+}
+
+bool log_clock_correct(log_record_t *record){
+    uint64_t packed = atomic_load(&clock_sync);
+    uint32_t epoch = record->epoch;
+    if(packed == 0 || !LOG_STAMP_IS_MONOTONIC(epoch)){
+        return false;
+    }
+    if(LOG_STAMP_BOOT(epoch) != ((packed >> 32) & LOG_STAMP_BOOT_MASK)){
+        // another boot that never synced, its offset is unknown
+        return false;
+    }
+    record->epoch = (uint32_t)packed + LOG_STAMP_UPTIME(epoch);
+    return true;
+}
+
+static uint32_t uptime_seconds(){
+    return esp_timer_get_time() / 1000000;
+}
@@ -0,0 +1,43 @@
+//
+// Created by Vincent.
+//
+
+/*
+    Timestamps for log records. Every boot gets an id (a counter in nvs). As
+    long as the system time is not set, records are stamped with the boot id
+    and the uptime (see LOG_MONOTONIC_STAMP), so logging never has to wait for
+    SNTP. When the time is synced the offset between uptime and wall-clock
+    time of this boot is stored in nvs, and log_clock_correct() turns stamps of
+    this boot into real epochs, also after a reboot that came before the
+    logger got around to it.
+*/
+
+#ifndef LOG_CLOCK_H
+#define LOG_CLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "log_record.h"
+
+#define LOG_CLOCK_TAG "LOG_CLOCK"
+
+#define LOG_CLOCK_NVS_NAMESPACE "logger"
+#define LOG_CLOCK_NVS_BOOT_KEY "boot_id"
+#define LOG_CLOCK_NVS_SYNC_KEY "clock_sync"
+
+esp_err_t init_log_clock();
+
+uint32_t log_clock_now();
+
+uint32_t log_clock_boot_id();
+
+bool log_clock_is_synced();
+
+esp_err_t log_clock_synced();
+
+bool log_clock_can_correct();
+
+bool log_clock_correct(log_record_t *record);
+
+#endif //LOG_CLOCK_H
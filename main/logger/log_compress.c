@@ -0,0 +1,187 @@
+//
+// Created by Vincent.
+//
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "log_compress.h"
+
+
+// Forward declarations for static functions/params
+static portMUX_TYPE compress_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static log_compress_stats_t compress_stats;
+static uint32_t read32(const uint8_t *p);
+static uint32_t hash32(uint32_t value);
+static int write_length(uint8_t *dst, int pos, int dst_cap, int length);
+static int emit_sequence(uint8_t *dst, int pos, int dst_cap, const uint8_t *literals, int literal_len, int offset, int match_len);
+
+
+int log_compress(const uint8_t *src, int src_len, uint8_t *dst, int dst_cap, uint32_t *table){
+    int64_t start = esp_timer_get_time();
+    // positions + 1, 0 marks an empty slot
+    memset(table, 0, LOG_COMPRESS_HASH_SIZE * sizeof(uint32_t));
+
+    int pos = 0;
+    int ip = 0;
+    int anchor = 0;
+    while(src_len > LOG_COMPRESS_MATCH_LIMIT && ip < src_len - LOG_COMPRESS_MATCH_LIMIT && pos >= 0){
+        uint32_t sequence = read32(&src[ip]);
+        uint32_t h = hash32(sequence);
+        int ref = (int)table[h] - 1;
+        table[h] = ip + 1;
+        if(ref < 0 || ip - ref > LOG_COMPRESS_MAX_OFFSET || read32(&src[ref]) != sequence){
+            ip++;
+            continue;
+        }
+
+        int match_len = LOG_COMPRESS_MIN_MATCH;
+        while(ip + match_len < src_len - LOG_COMPRESS_LAST_LITERALS && src[ref + match_len] == src[ip + match_len]){
+            match_len++;
+        }
+        pos = emit_sequence(dst, pos, dst_cap, &src[anchor], ip - anchor, ip - ref, match_len);
+        ip += match_len;
+        anchor = ip;
+    }
+    if(pos >= 0){
+        // the rest are literals without a match
+        pos = emit_sequence(dst, pos, dst_cap, &src[anchor], src_len - anchor, 0, 0);
+    }
+
+    if(pos >= 0){
+        uint32_t elapsed = esp_timer_get_time() - start;
+        portENTER_CRITICAL(&compress_stats_lock);
+        compress_stats.raw_bytes += src_len;
+        compress_stats.packed_bytes += pos;
+        compress_stats.compress_us += elapsed;
+        portEXIT_CRITICAL(&compress_stats_lock);
+    }
+    return pos;
+}
+
+int log_decompress(const uint8_t *src, int src_len, uint8_t *dst, int dst_cap){
+    int64_t start = esp_timer_get_time();
+    int ip = 0;
+    int op = 0;
+    while(ip < src_len){
+        uint8_t token = src[ip++];
+
+        int literal_len = token >> 4;
+        if(literal_len == 15){
+            uint8_t more;
+            do{
+                if(ip >= src_len){
+                    return -1;
+                }
+                more = src[ip++];
+                literal_len += more;
+            }while(more == 255);
+        }
+        if(literal_len > src_len - ip || literal_len > dst_cap - op){
+            return -1;
+        }
+        memcpy(&dst[op], &src[ip], literal_len);
+        ip += literal_len;
+        op += literal_len;
+        if(ip == src_len){
+            // the last sequence has no match
+            break;
+        }
+
+        if(src_len - ip < 2){
+            return -1;
+        }
+        int offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        int match_len = (token & 0x0F) + LOG_COMPRESS_MIN_MATCH;
+        if((token & 0x0F) == 15){
+            uint8_t more;
+            do{
+                if(ip >= src_len){
+                    return -1;
+                }
+                more = src[ip++];
+                match_len += more;
+            }while(more == 255);
+        }
+        if(offset == 0 || offset > op || match_len > dst_cap - op){
+            return -1;
+        }
+        // byte by byte, the match may overlap the bytes it produces
+        for(int i = 0; i < match_len; ++i){
+            dst[op + i] = dst[op - offset + i];
+        }
+        op += match_len;
+    }
+
+    uint32_t elapsed = esp_timer_get_time() - start;
+    portENTER_CRITICAL(&compress_stats_lock);
+    compress_stats.unpacked_bytes += op;
+    compress_stats.decompress_us += elapsed;
+    portEXIT_CRITICAL(&compress_stats_lock);
+    return op;
+}
+
+void get_log_compress_stats(log_compress_stats_t *stats_copy){
+    portENTER_CRITICAL(&compress_stats_lock);
+    *stats_copy = compress_stats;
+    portEXIT_CRITICAL(&compress_stats_lock);
+}
+
+static uint32_t read32(const uint8_t *p){
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t hash32(uint32_t value){
+    return (value * 2654435761U) >> (32 - LOG_COMPRESS_HASH_BITS);
+}
+
+static int write_length(uint8_t *dst, int pos, int dst_cap, int length){
+    // lengths of 15 and more continue in bytes of 255
+    while(length >= 255){
+        if(pos >= dst_cap){
+            return -1;
+        }
+        dst[pos++] = 255;
+        length -= 255;
+    }
+    if(pos >= dst_cap){
+        return -1;
+    }
+    dst[pos++] = length;
+    return pos;
+}
+
+static int emit_sequence(uint8_t *dst, int pos, int dst_cap, const uint8_t *literals, int literal_len, int offset, int match_len){
+    if(pos >= dst_cap){
+        return -1;
+    }
+    int token_pos = pos++;
+    uint8_t token = (literal_len < 15 ? literal_len : 15) << 4;
+    if(literal_len >= 15 && (pos = write_length(dst, pos, dst_cap, literal_len - 15)) < 0){
+        return -1;
+    }
+    if(literal_len > dst_cap - pos){
+        return -1;
+    }
+    memcpy(&dst[pos], literals, literal_len);
+    pos += literal_len;
+
+    if(match_len > 0){
+        if(dst_cap - pos < 2){
+            return -1;
+        }
+        dst[pos++] = offset & 0xFF;
+        dst[pos++] = offset >> 8;
+        int extra = match_len - LOG_COMPRESS_MIN_MATCH;
+        token |= extra < 15 ? extra : 15;
+        if(extra >= 15 && (pos = write_length(dst, pos, dst_cap, extra - 15)) < 0){
+            return -1;
+        }
+    }
+    dst[token_pos] = token;
+    return pos;
+}
@@ -0,0 +1,53 @@
+//
+// Created by Vincent.
+//
+
+/*
+    Block compression for sealed log segments and upload payloads, in the
+    LZ4 block format (no frame): a sequence is a token byte (literal length
+    in the high, match length - 4 in the low nibble, 15 meaning more length
+    bytes follow), the literals and a 2 byte little endian match offset. The
+    last 5 bytes of a block are always literals. Any LZ4 block decoder reads
+    it, api.php carries a small one of its own.
+
+    The compressor is greedy with a LOG_COMPRESS_HASH_SIZE entry hash table,
+    fast rather than small: log records and json rows repeat so much that
+    the greedy matches already get most of the gain. The table is the
+    caller's, a static one next to its block buffers, so compressing a
+    block does not touch the heap.
+
+    Bytes in and out and the time spent are counted, get_log_compress_stats()
+    reports the ratio and the CPU cost per KB.
+*/
+
+#ifndef LOG_COMPRESS_H
+#define LOG_COMPRESS_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#define LOG_COMPRESS_TAG "LOG_COMPRESS"
+
+#define LOG_COMPRESS_HASH_BITS 10
+#define LOG_COMPRESS_HASH_SIZE (1 << LOG_COMPRESS_HASH_BITS)
+#define LOG_COMPRESS_MIN_MATCH 4
+#define LOG_COMPRESS_LAST_LITERALS 5    // a block ends with at least this many literals
+#define LOG_COMPRESS_MATCH_LIMIT 12     // no match starts in the last 12 bytes of a block
+#define LOG_COMPRESS_MAX_OFFSET 65535
+#define LOG_COMPRESS_BOUND(len) ((len) + (len) / 255 + 16)  // worst case size of incompressible input
+
+typedef struct log_compress_stats_t {
+    uint32_t raw_bytes;         // compressed so far
+    uint32_t packed_bytes;      // what they were compressed to
+    uint32_t compress_us;
+    uint32_t unpacked_bytes;    // decompressed so far
+    uint32_t decompress_us;
+} log_compress_stats_t;
+
+int log_compress(const uint8_t *src, int src_len, uint8_t *dst, int dst_cap, uint32_t *table);
+
+int log_decompress(const uint8_t *src, int src_len, uint8_t *dst, int dst_cap);
+
+void get_log_compress_stats(log_compress_stats_t *stats_copy);
+
+#endif //LOG_COMPRESS_H
@@ -0,0 +1,231 @@
+//
+// Created by Vincent.
+//
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/timers.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "logger.h"
+#include "log_limiter.h"
+
+
+// Forward declarations for static functions/params
+typedef struct log_bucket_t {
+    uint8_t limit;              // index into limits
+    uint16_t device;
+    int32_t tokens;             // in 1/1000 token
+    int64_t last_refill;        // us
+    int64_t last_used;          // us, the least recently used bucket is reused when the table is full
+    uint32_t sample_counter;
+} log_bucket_t;
+typedef struct log_summary_slot_t {
+    uint8_t tag_id;
+    uint8_t event;
+    uint16_t device;
+    uint32_t suppressed;
+} log_summary_slot_t;
+static const log_limit_t default_limits[] = {
+    // per device, device pings arrive continuously, a few per minute are enough to see a device is alive
+    { LOG_TAG_NRF_MESSAGE_HANDLER, LOG_EVENT_PING_OK, 6, 10, 1 },
+    { LOG_TAG_NRF_MESSAGE_HANDLER, LOG_EVENT_PING_ERROR, 30, 30, 1 },
+    { LOG_TAG_NRF_MESSAGE_HANDLER, LOG_EVENT_SEND_TURNON, 30, 30, 1 },
+    { LOG_TAG_NRF_MESSAGE_HANDLER, LOG_EVENT_SEND_TURNOFF, 30, 30, 1 },
+};
+static portMUX_TYPE limiter_lock = portMUX_INITIALIZER_UNLOCKED;
+static log_limit_t limits[LOG_LIMITER_MAX_LIMITS];
+static int amount_limits;
+static log_bucket_t buckets[LOG_LIMITER_BUCKETS];
+static int amount_buckets;
+static log_summary_slot_t summaries[LOG_LIMITER_SUMMARY_SLOTS];
+static int amount_summaries;
+static TimerHandle_t summary_timer;
+static log_limit_t *find_limit(log_tag_id tag_id, log_event_code event);
+static log_bucket_t *find_bucket(int limit, uint16_t device, int64_t now);
+static bool take_token(const log_limit_t *limit, log_bucket_t *bucket, int64_t now);
+static void count_suppressed(log_tag_id tag_id, log_event_code event, uint16_t device);
+static void summary_timer_cb(TimerHandle_t xTimer);
+
+
+esp_err_t init_log_limiter(){
+    for(int i = 0; i < sizeof(default_limits) / sizeof(default_limits[0]); ++i){
+        const log_limit_t *limit = &default_limits[i];
+        set_log_limit(limit->tag_id, limit->event, limit->rate_per_min, limit->burst, limit->sample_n);
+    }
+
+    if(summary_timer == NULL){
+        summary_timer = xTimerCreate("logSummaryTimer", pdMS_TO_TICKS(LOG_SUMMARY_INTERVAL_MIN * 60 * 1000),
+                                     pdTRUE, (void *) 0, summary_timer_cb);
+        if(summary_timer == NULL || xTimerStart(summary_timer, 0) != pdPASS){
+            ESP_LOGE(LOG_LIMITER_TAG, "Failed to create log summary timer");
+            return ESP_FAIL;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t set_log_limit(log_tag_id tag_id, log_event_code event, uint16_t rate_per_min, uint16_t burst, uint16_t sample_n){
+    if(sample_n == 0 || (rate_per_min > 0 && burst == 0)){
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&limiter_lock);
+    log_limit_t *limit = find_limit(tag_id, event);
+    if(limit == NULL){
+        if(amount_limits >= LOG_LIMITER_MAX_LIMITS){
+            portEXIT_CRITICAL(&limiter_lock);
+            ESP_LOGE(LOG_LIMITER_TAG, "no room for another log limit");
+            return ESP_FAIL;
+        }
+        limit = &limits[amount_limits++];
+    }
+    limit->tag_id = tag_id;
+    limit->event = event;
+    limit->rate_per_min = rate_per_min;
+    limit->burst = burst;
+    limit->sample_n = sample_n;
+    // the devices start over with a full bucket under the new limit
+    int index = limit - limits;
+    for(int i = 0; i < amount_buckets; ){
+        if(buckets[i].limit == index){
+            buckets[i] = buckets[--amount_buckets];
+        }else{
+            i++;
+        }
+    }
+    portEXIT_CRITICAL(&limiter_lock);
+    return ESP_OK;
+}
+
+bool log_limiter_allow(log_tag_id tag_id, log_event_code event, uint16_t device){
+    portENTER_CRITICAL(&limiter_lock);
+    log_limit_t *limit = find_limit(tag_id, event);
+    if(limit == NULL){
+        portEXIT_CRITICAL(&limiter_lock);
+        return true;
+    }
+
+    // every device has its own bucket, one chatty device does not silence the others
+    int64_t now = esp_timer_get_time();
+    log_bucket_t *bucket = find_bucket(limit - limits, device, now);
+
+    // sampling first, the bucket then caps what is left of a burst
+    bool allowed = (bucket->sample_counter++ % limit->sample_n) == 0;
+    if(allowed && limit->rate_per_min > 0){
+        allowed = take_token(limit, bucket, now);
+    }
+    if(!allowed){
+        count_suppressed(tag_id, event, device);
+    }
+    portEXIT_CRITICAL(&limiter_lock);
+    return allowed;
+}
+
+void flush_log_summaries(){
+    // copy out first, log_event must not be called inside the critical section
+    log_summary_slot_t slots[LOG_LIMITER_SUMMARY_SLOTS];
+    portENTER_CRITICAL(&limiter_lock);
+    int amount = amount_summaries;
+    memcpy(slots, summaries, amount * sizeof(log_summary_slot_t));
+    amount_summaries = 0;
+    portEXIT_CRITICAL(&limiter_lock);
+
+    for(int i = 0; i < amount; ++i){
+        log_event(slots[i].tag_id, LOG_EVENT_SUMMARY, slots[i].device,
+                  LOG_SUMMARY_KEY(slots[i].event, LOG_SUMMARY_INTERVAL_MIN, slots[i].suppressed), NULL);
+    }
+}
+
+static log_limit_t *find_limit(log_tag_id tag_id, log_event_code event){
+    for(int i = 0; i < amount_limits; ++i){
+        if(limits[i].tag_id == tag_id && limits[i].event == event){
+            return &limits[i];
+        }
+    }
+    return NULL;
+}
+
+static log_bucket_t *find_bucket(int limit, uint16_t device, int64_t now){
+    log_bucket_t *oldest = NULL;
+    for(int i = 0; i < amount_buckets; ++i){
+        log_bucket_t *bucket = &buckets[i];
+        if(bucket->limit == limit && bucket->device == device){
+            bucket->last_used = now;
+            return bucket;
+        }
+        if(oldest == NULL || bucket->last_used < oldest->last_used){
+            oldest = bucket;
+        }
+    }
+
+    // a new device starts with a full bucket, when all are taken the one idle the longest is handed over
+    log_bucket_t *bucket = amount_buckets < LOG_LIMITER_BUCKETS ? &buckets[amount_buckets++] : oldest;
+    *bucket = (log_bucket_t){
+        .limit = limit,
+        .device = device,
+        .tokens = limits[limit].burst * 1000,
+        .last_refill = now,
+        .last_used = now,
+    };
+    return bucket;
+}
+
+static bool take_token(const log_limit_t *limit, log_bucket_t *bucket, int64_t now){
+    int64_t added = (now - bucket->last_refill) * limit->rate_per_min / 60000;
+    if(added > 0){
+        // only advance by the time that was turned into tokens, fractions carry over
+        bucket->last_refill += added * 60000 / limit->rate_per_min;
+        if(bucket->tokens + added >= limit->burst * 1000){
+            bucket->tokens = limit->burst * 1000;
+            bucket->last_refill = now;
+        }else{
+            bucket->tokens += added;
+        }
+    }
+    if(bucket->tokens < 1000){
+        return false;
+    }
+    bucket->tokens -= 1000;
+    return true;
+}
+
+static void count_suppressed(log_tag_id tag_id, log_event_code event, uint16_t device){
+    log_summary_slot_t *shared = NULL;
+    for(int i = 0; i < amount_summaries; ++i){
+        log_summary_slot_t *slot = &summaries[i];
+        if(slot->tag_id != tag_id || slot->event != event){
+            continue;
+        }
+        if(slot->device == device){
+            slot->suppressed++;
+            return;
+        }
+        if(slot->device == LOG_LIMITER_ANY_DEVICE){
+            shared = slot;
+        }
+    }
+
+    if(amount_summaries < LOG_LIMITER_SUMMARY_SLOTS){
+        summaries[amount_summaries++] = (log_summary_slot_t){ tag_id, event, device, 1 };
+        return;
+    }
+
+    // table full, fold the device into a slot shared by all devices of this event
+    if(shared == NULL){
+        for(int i = 0; i < amount_summaries && shared == NULL; ++i){
+            if(summaries[i].tag_id == tag_id && summaries[i].event == event){
+                shared = &summaries[i];
+                shared->device = LOG_LIMITER_ANY_DEVICE;
+            }
+        }
+    }
+    if(shared != NULL){
+        shared->suppressed++;
+    }
+}
+
+static void summary_timer_cb(TimerHandle_t xTimer){
+    // the logger task writes them, log_event() could block all timers here
+    logger_summaries_due();
+}
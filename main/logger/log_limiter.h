@@ -0,0 +1,51 @@
+//
+// Created by Vincent.
+//
+
+/*
+    Rate limiting for high-frequency log sources. A limit applies to one tag and
+    event type and combines 1-in-N sampling with a token bucket. Every device
+    gets its own bucket and sample counter under that limit, so the defaults are
+    sized for a single device. Up to LOG_LIMITER_BUCKETS devices are tracked,
+    beyond that the bucket idle the longest is reused with a full burst. Events
+    that are held back are counted per tag, event and device, and written as
+    one summary record per interval instead, e.g.
+    "PING_OK device 12: 3600 suppressed in last 60 min".
+
+    log_event() asks log_limiter_allow() before a record is built, events
+    without a limit (access, logins, ...) always pass.
+*/
+
+#ifndef LOG_LIMITER_H
+#define LOG_LIMITER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "log_record.h"
+
+#define LOG_LIMITER_TAG "LOG_LIMITER"
+
+#define LOG_LIMITER_MAX_LIMITS 8
+#define LOG_LIMITER_BUCKETS 32         // limited tag/event and device pairs tracked at once
+#define LOG_LIMITER_SUMMARY_SLOTS 32
+#define LOG_LIMITER_ANY_DEVICE LOG_SUMMARY_ANY_DEVICE  // summary slot shared by all devices once the table is full
+#define LOG_SUMMARY_INTERVAL_MIN CONFIG_LOGGER_SUMMARY_INTERVAL_MIN
+
+typedef struct log_limit_t {
+    uint8_t tag_id;
+    uint8_t event;
+    uint16_t rate_per_min;  // token bucket refill, 0 for no bucket
+    uint16_t burst;         // token bucket size
+    uint16_t sample_n;      // keep 1 in sample_n events, 1 for no sampling
+} log_limit_t;
+
+esp_err_t init_log_limiter();
+
+esp_err_t set_log_limit(log_tag_id tag_id, log_event_code event, uint16_t rate_per_min, uint16_t burst, uint16_t sample_n);
+
+bool log_limiter_allow(log_tag_id tag_id, log_event_code event, uint16_t device);
+
+void flush_log_summaries();
+
+#endif //LOG_LIMITER_H
@@ -0,0 +1,123 @@
+//
+// Created by Vincent.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <time.h>
+#include "log_query.h"
+
+
+// Forward declarations for static functions/params
+static esp_err_t parse_query_time(const char *value, bool end_of_day, uint32_t *epoch);
+static esp_err_t parse_query_number(const char *value, int base, unsigned long long *number);
+
+
+void init_log_query(log_query_t *query){
+    memset(query, 0, sizeof(log_query_t));
+    query->to_epoch = UINT32_MAX;
+    query->tag_id = LOG_QUERY_ANY;
+    query->device = LOG_QUERY_ANY;
+    query->limit = LOG_QUERY_ANY;
+}
+
+esp_err_t set_log_query_filter(log_query_t *query, const char *name, const char *value){
+    unsigned long long number;
+    if(strcmp(name, "from") == 0){
+        return parse_query_time(value, false, &query->from_epoch);
+    }else if(strcmp(name, "to") == 0){
+        return parse_query_time(value, true, &query->to_epoch);
+    }else if(strcmp(name, "tag") == 0){
+        for(int tag_id = 0; tag_id < LOG_TAG_COUNT; ++tag_id){
+            if(strcasecmp(value, log_tag_name(tag_id)) == 0){
+                query->tag_id = tag_id;
+                return ESP_OK;
+            }
+        }
+        return ESP_ERR_INVALID_ARG;
+    }else if(strcmp(name, "device") == 0){
+        if(parse_query_number(value, 10, &number) != ESP_OK || number > UINT16_MAX){
+            return ESP_ERR_INVALID_ARG;
+        }
+        query->device = number;
+    }else if(strcmp(name, "key") == 0 || strcmp(name, "ibutton") == 0){
+        if(parse_query_number(value, name[0] == 'k' ? 10 : 16, &number) != ESP_OK){
+            return ESP_ERR_INVALID_ARG;
+        }
+        query->match_key = true;
+        query->key = number;
+    }else if(strcmp(name, "limit") == 0 || strcmp(name, "offset") == 0){
+        if(parse_query_number(value, 10, &number) != ESP_OK || number > INT32_MAX){
+            return ESP_ERR_INVALID_ARG;
+        }
+        if(name[0] == 'l'){
+            query->limit = number;
+        }else{
+            query->offset = number;
+        }
+    }else{
+        return ESP_ERR_NOT_FOUND;
+    }
+    return ESP_OK;
+}
+
+bool log_query_matches(const log_query_t *query, const log_record_t *record){
+    if(record->epoch < query->from_epoch || record->epoch > query->to_epoch){
+        return false;
+    }
+    if(query->tag_id != LOG_QUERY_ANY && record->tag_id != query->tag_id){
+        return false;
+    }
+    if(query->device != LOG_QUERY_ANY && record->device != query->device){
+        return false;
+    }
+    if(query->match_key && record->key != query->key){
+        return false;
+    }
+    return true;
+}
+
+bool log_query_overlaps(const log_query_t *query, uint32_t min_epoch, uint32_t max_epoch){
+    return min_epoch <= query->to_epoch && max_epoch >= query->from_epoch;
+}
+
+static esp_err_t parse_query_time(const char *value, bool end_of_day, uint32_t *epoch){
+    struct tm timeinfo = { 0 };
+    const char *end = strptime(value, "%Y-%m-%dT%H:%M:%S", &timeinfo);
+    if(end == NULL || *end != '\0'){
+        memset(&timeinfo, 0, sizeof(timeinfo));
+        end = strptime(value, "%Y-%m-%d", &timeinfo);
+        if(end != NULL && *end == '\0' && end_of_day){
+            // a bare date as upper bound includes the whole day
+            timeinfo.tm_hour = 23;
+            timeinfo.tm_min = 59;
+            timeinfo.tm_sec = 59;
+        }
+    }
+    if(end != NULL && *end == '\0'){
+        timeinfo.tm_isdst = -1;
+        *epoch = mktime(&timeinfo);
+        return ESP_OK;
+    }
+
+    unsigned long long number;
+    if(parse_query_number(value, 10, &number) != ESP_OK || number > UINT32_MAX){
+        return ESP_ERR_INVALID_ARG;
+    }
+    *epoch = number;
+    return ESP_OK;
+}
+
+static esp_err_t parse_query_number(const char *value, int base, unsigned long long *number){
+    char *end;
+    if(value[0] == '\0' || value[0] == '-'){
+        return ESP_ERR_INVALID_ARG;
+    }
+    *number = strtoull(value, &end, base);
+    if(*end != '\0'){
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
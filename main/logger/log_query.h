@@ -0,0 +1,53 @@
+//
+// Created by Vincent.
+//
+
+/*
+    Filters over the log store. A query is built from "name=value" filters:
+    from=, to=      epoch seconds, YYYY-mm-dd or YYYY-mm-ddTHH:MM:SS (local time, inclusive)
+    tag=            tag name, e.g. ACCESS or NRF_MESSAGE_HANDLER
+    device=         device number
+    key=            user ID or error code, decimal
+    ibutton=        iButton key, hex
+    limit=, offset= paging over the matching logs
+
+    A query keeps its position between calls to query_logs() so large results
+    are read in pages without scanning the store again. Segments whose time
+    range does not overlap from/to are skipped without being opened.
+*/
+
+#ifndef LOG_QUERY_H
+#define LOG_QUERY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "log_record.h"
+
+#define LOG_QUERY_ANY -1
+
+typedef struct log_query_t {
+    uint32_t from_epoch;
+    uint32_t to_epoch;
+    int tag_id;             // LOG_QUERY_ANY or a log_tag_id
+    int device;             // LOG_QUERY_ANY or a device number
+    bool match_key;
+    uint64_t key;
+    int offset;             // matching logs still to skip
+    int limit;              // matching logs still to return, LOG_QUERY_ANY for all
+
+    // position in the store, kept between pages
+    uint32_t next_seq;
+    long next_offset;
+    bool done;
+} log_query_t;
+
+void init_log_query(log_query_t *query);
+
+esp_err_t set_log_query_filter(log_query_t *query, const char *name, const char *value);
+
+bool log_query_matches(const log_query_t *query, const log_record_t *record);
+
+bool log_query_overlaps(const log_query_t *query, uint32_t min_epoch, uint32_t max_epoch);
+
+#endif //LOG_QUERY_H
@@ -0,0 +1,282 @@
+//
+// Created by Vincent.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <time.h>
+#include "esp_err.h"
+#include "log_record.h"
+
+
+// Forward declarations for static functions/params
+static const char *log_tag_names[LOG_TAG_COUNT] = {
+    [LOG_TAG_UNKNOWN] = "UNKNOWN",
+    [LOG_TAG_LOGGER] = "LOGGER",
+    [LOG_TAG_NRF_MESSAGE_HANDLER] = "NRF_MESSAGE_HANDLER",
+    [LOG_TAG_TCP] = "TCP",
+    [LOG_TAG_HTTPS_SERVER] = "https_server",
+    [LOG_TAG_ACCESS] = "ACCESS",
+    [LOG_TAG_SQL_SERVER] = "SQL_SERVER",
+    [LOG_TAG_WIFI_EVENTS] = "WIFI_EVENTS",
+    [LOG_TAG_SNTP] = "SNTP",
+    [LOG_TAG_TEST] = "TEST",
+};
+static const char *log_event_formats[LOG_EVENT_COUNT] = {
+    [LOG_EVENT_TEXT] = "%.*s",
+    [LOG_EVENT_PING_OK] = "received PING from device: %d, successful",
+    [LOG_EVENT_PING_ERROR] = "received PING from device: %d, error code: %llu",
+    [LOG_EVENT_SEND_TURNON] = "sending TURNON to device: %d",
+    [LOG_EVENT_SEND_TURNOFF] = "sending TURNOFF to device: %d",
+    [LOG_EVENT_ACCESS_GRANTED] = "received ACCESS from device: %d, ibutton: %016llX, access granted",
+    [LOG_EVENT_ACCESS_DENIED] = "received ACCESS from device: %d, ibutton: %016llX, access denied",
+    [LOG_EVENT_LOGIN] = "Succesfull TCP login by ID: %llu",
+    [LOG_EVENT_TURNON_REQUEST] = "TURNON message received from ID: %llu",
+    [LOG_EVENT_TURNOFF_REQUEST] = "TURNOFF message received from ID: %llu",
+    [LOG_EVENT_SYNC_REQUEST] = "SYNC message received from ID: %llu",
+    [LOG_EVENT_ACCESSLEVEL_REQUEST] = "ACCESSLEVEL message received from ID: %llu",
+    [LOG_EVENT_SHOW_KEYS_REQUEST] = "SHOW KEYS message received from ID: %llu",
+    [LOG_EVENT_SHOW_DEVICES_REQUEST] = "SHOW DEVICES message received from ID: %llu",
+    [LOG_EVENT_SHOW_LOGS_REQUEST] = "SHOW LOGS message received from ID: %llu",
+    [LOG_EVENT_SUMMARY] = "%s %s: %u suppressed in last %u min",
+    [LOG_EVENT_BRUTE_FORCE_DEVICE] = "brute force suspected on device: %d, %llu denied swipes",
+    [LOG_EVENT_BRUTE_FORCE_KEY] = "brute force suspected on device: %d, ibutton: %016llX keeps getting denied",
+    [LOG_EVENT_ACCESS_LOCKED] = "received ACCESS from device: %d, ibutton: %016llX, device locked out",
+    [LOG_EVENT_SHOW_OCCUPANCY_REQUEST] = "SHOW OCCUPANCY message received from ID: %llu",
+};
+static const char *log_event_names[LOG_EVENT_COUNT] = {
+    [LOG_EVENT_TEXT] = "TEXT",
+    [LOG_EVENT_PING_OK] = "PING_OK",
+    [LOG_EVENT_PING_ERROR] = "PING_ERROR",
+    [LOG_EVENT_SEND_TURNON] = "SEND_TURNON",
+    [LOG_EVENT_SEND_TURNOFF] = "SEND_TURNOFF",
+    [LOG_EVENT_ACCESS_GRANTED] = "ACCESS_GRANTED",
+    [LOG_EVENT_ACCESS_DENIED] = "ACCESS_DENIED",
+    [LOG_EVENT_LOGIN] = "LOGIN",
+    [LOG_EVENT_TURNON_REQUEST] = "TURNON_REQUEST",
+    [LOG_EVENT_TURNOFF_REQUEST] = "TURNOFF_REQUEST",
+    [LOG_EVENT_SYNC_REQUEST] = "SYNC_REQUEST",
+    [LOG_EVENT_ACCESSLEVEL_REQUEST] = "ACCESSLEVEL_REQUEST",
+    [LOG_EVENT_SHOW_KEYS_REQUEST] = "SHOW_KEYS_REQUEST",
+    [LOG_EVENT_SHOW_DEVICES_REQUEST] = "SHOW_DEVICES_REQUEST",
+    [LOG_EVENT_SHOW_LOGS_REQUEST] = "SHOW_LOGS_REQUEST",
+    [LOG_EVENT_SUMMARY] = "SUMMARY",
+    [LOG_EVENT_BRUTE_FORCE_DEVICE] = "BRUTE_FORCE_DEVICE",
+    [LOG_EVENT_BRUTE_FORCE_KEY] = "BRUTE_FORCE_KEY",
+    [LOG_EVENT_ACCESS_LOCKED] = "ACCESS_LOCKED",
+    [LOG_EVENT_SHOW_OCCUPANCY_REQUEST] = "SHOW_OCCUPANCY_REQUEST",
+};
+static void format_log_info(const log_record_t *record, char *info, size_t info_size);
+static bool scan_log_info(const char *format, const char *info, log_record_t *record);
+
+
+log_tag_id log_tag_from_name(const char *tag){
+    for(int i = 1; i < LOG_TAG_COUNT; ++i){
+        if(strcmp(tag, log_tag_names[i]) == 0){
+            return i;
+        }
+    }
+    return LOG_TAG_UNKNOWN;
+}
+
+const char *log_tag_name(log_tag_id tag_id){
+    if(tag_id >= LOG_TAG_COUNT){
+        return log_tag_names[LOG_TAG_UNKNOWN];
+    }
+    return log_tag_names[tag_id];
+}
+
+const char *log_event_name(log_event_code event){
+    if(event >= LOG_EVENT_COUNT){
+        return "UNKNOWN";
+    }
+    return log_event_names[event];
+}
+
+void set_log_record_text(log_record_t *record, const char *text){
+    size_t text_len = text == NULL ? 0 : strlen(text);
+    if(text_len > LOG_RECORD_TEXT_LEN){
+        text_len = LOG_RECORD_TEXT_LEN;
+    }
+    memcpy(record->text, text, text_len);
+    record->text_len = text_len;
+}
+
+size_t log_record_size(const log_record_t *record){
+    return LOG_RECORD_HEADER_LEN + record->text_len;
+}
+
+esp_err_t fwrite_log_record(FILE *file, const log_record_t *record){
+    size_t size = log_record_size(record);
+    if(fwrite(record, 1, size, file) != size){
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t fread_log_record(FILE *file, log_record_t *record){
+    if(fread(record, 1, LOG_RECORD_HEADER_LEN, file) != LOG_RECORD_HEADER_LEN){
+        return ESP_FAIL;
+    }
+    if(record->text_len > LOG_RECORD_TEXT_LEN){
+        // corrupt record, the rest of the file cannot be framed anymore
+        return ESP_FAIL;
+    }
+    if(fread(record->text, 1, record->text_len, file) != record->text_len){
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+void format_log_record(const log_record_t *record, log_t *log){
+    time_t epoch = record->epoch;
+    struct tm timeinfo;
+    localtime_r(&epoch, &timeinfo);
+
+    if(!LOG_STAMP_IS_MONOTONIC(record->epoch) && timeinfo.tm_mon == 3 && timeinfo.tm_mday == 1){
+        strncpy(log->tag, "APRILFOOLS", sizeof(log->tag));
+        strncpy(log->info, "OH NO SEEMS LIKE ALIENS STOLE OUR LOGS", sizeof(log->info));
+    }else{
+        strncpy(log->tag, log_tag_name(record->tag_id), sizeof(log->tag) - 1);
+        log->tag[sizeof(log->tag) - 1] = '\0';
+        format_log_info(record, log->info, sizeof(log->info));
+    }
+    format_log_stamp(record->epoch, log->date_time, sizeof(log->date_time));
+}
+
+void format_log_stamp(uint32_t stamp, char *buffer, size_t buffer_size){
+    if(LOG_STAMP_IS_MONOTONIC(stamp)){
+        // no wall-clock time for this stamp (yet), show when it happened relative to its boot
+        uint32_t uptime = LOG_STAMP_UPTIME(stamp);
+        snprintf(buffer, buffer_size, "boot %u +%02u:%02u:%02u", (unsigned)LOG_STAMP_BOOT(stamp),
+                 (unsigned)(uptime / 3600), (unsigned)(uptime / 60 % 60), (unsigned)(uptime % 60));
+        return;
+    }
+
+    time_t epoch = stamp;
+    struct tm timeinfo;
+    localtime_r(&epoch, &timeinfo);
+    strftime(buffer, buffer_size, "%Y-%m-%d %H:%M:%S", &timeinfo);
+}
+
+int format_log_line(const log_record_t *record, char *buffer, size_t buffer_size){
+    log_t log;
+    format_log_record(record, &log);
+    return snprintf(buffer, buffer_size, "%s,%s,%s", log.tag, log.date_time, log.info);
+}
+
+bool parse_log_info(const char *info, log_record_t *record){
+    // turns a rendered message back into its event, only if rendering it again gives the same text
+    char rendered[LOG_LINE_LEN];
+    for(int event = LOG_EVENT_TEXT + 1; event < LOG_EVENT_COUNT; ++event){
+        if(event == LOG_EVENT_SUMMARY){
+            continue;
+        }
+        log_record_t parsed = *record;
+        parsed.event = event;
+        parsed.device = 0;
+        parsed.key = 0;
+        parsed.text_len = 0;
+        if(!scan_log_info(log_event_formats[event], info, &parsed)){
+            continue;
+        }
+        format_log_info(&parsed, rendered, sizeof(rendered));
+        if(strcmp(rendered, info) == 0){
+            *record = parsed;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t ibutton_to_key(const char *ibutton){
+    return strtoull(ibutton, NULL, 16);
+}
+
+static void format_log_info(const log_record_t *record, char *info, size_t info_size){
+    if(record->event >= LOG_EVENT_COUNT){
+        snprintf(info, info_size, "unknown event %d", record->event);
+        return;
+    }
+
+    switch(record->event){
+        case LOG_EVENT_TEXT:
+            snprintf(info, info_size, log_event_formats[record->event], record->text_len, record->text);
+            break;
+        case LOG_EVENT_PING_ERROR:
+        case LOG_EVENT_ACCESS_GRANTED:
+        case LOG_EVENT_ACCESS_DENIED:
+        case LOG_EVENT_BRUTE_FORCE_DEVICE:
+        case LOG_EVENT_BRUTE_FORCE_KEY:
+        case LOG_EVENT_ACCESS_LOCKED:
+            snprintf(info, info_size, log_event_formats[record->event], record->device, (unsigned long long)record->key);
+            break;
+        case LOG_EVENT_SUMMARY: {
+            char device[16] = "all devices";
+            if(record->device != LOG_SUMMARY_ANY_DEVICE){
+                snprintf(device, sizeof(device), "device %d", record->device);
+            }
+            snprintf(info, info_size, log_event_formats[record->event], log_event_name(LOG_SUMMARY_EVENT(record->key)), device,
+                     (unsigned)LOG_SUMMARY_COUNT(record->key), (unsigned)LOG_SUMMARY_MINUTES(record->key));
+            break;
+        }
+        case LOG_EVENT_PING_OK:
+        case LOG_EVENT_SEND_TURNON:
+        case LOG_EVENT_SEND_TURNOFF:
+            snprintf(info, info_size, log_event_formats[record->event], record->device);
+            break;
+        default:
+            snprintf(info, info_size, log_event_formats[record->event], (unsigned long long)record->key);
+            break;
+    }
+
+    // short text can be attached to any structured event
+    if(record->event != LOG_EVENT_TEXT && record->text_len > 0){
+        size_t len = strlen(info);
+        snprintf(info + len, info_size - len, " (%.*s)", record->text_len, record->text);
+    }
+}
+
+static bool scan_log_info(const char *format, const char *info, log_record_t *record){
+    while(*format != '\0'){
+        if(*format != '%'){
+            if(*format++ != *info++){
+                return false;
+            }
+            continue;
+        }
+
+        // the formats only use %d for the device and %llu / %016llX for the key
+        format++;
+        while(*format >= '0' && *format <= '9'){
+            format++;
+        }
+        bool is_long = false;
+        while(*format == 'l'){
+            is_long = true;
+            format++;
+        }
+        char conversion = *format++;
+        if(!(conversion == 'X' ? isxdigit((unsigned char)*info) : isdigit((unsigned char)*info))){
+            // strtoull() would also take a sign or blanks
+            return false;
+        }
+        char *end;
+        unsigned long long value = strtoull(info, &end, conversion == 'X' ? 16 : 10);
+        if(end == info){
+            return false;
+        }
+        info = end;
+        if(!is_long && conversion == 'd' && value <= UINT16_MAX){
+            record->device = value;
+        }else if(is_long && (conversion == 'u' || conversion == 'X')){
+            record->key = value;
+        }else{
+            return false;
+        }
+    }
+    return *info == '\0';
+}
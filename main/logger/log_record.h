@@ -0,0 +1,131 @@
+//
+// Created by Vincent.
+//
+
+/*
+    record format (little endian, packed):
+    4 bytes epoch (seconds), or a monotonic stamp before the clock is synced
+    1 byte tag id
+    1 byte event code
+    2 bytes device number
+    8 bytes key (iButton key, or the user ID / error code depending on the event)
+    1 byte text length
+    0-LOG_RECORD_TEXT_LEN bytes of optional text (not null terminated on flash)
+
+    Records are only rendered to text when logs are displayed or uploaded.
+
+    Epochs below LOG_EPOCH_VALID_MIN (2004) are never wall-clock time. Until
+    SNTP syncs, records carry the boot id in the top bits and the uptime in
+    seconds in the low 24 bits instead. Once the boot's wall-clock offset is
+    known the logger patches them in place (see log_clock.h), stamps of boots
+    that never synced stay as they are.
+*/
+
+#ifndef LOG_RECORD_H
+#define LOG_RECORD_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define LOG_RECORD_TEXT_LEN 40
+#define LOG_RECORD_HEADER_LEN (offsetof(log_record_t, text))
+#define LOG_LINE_LEN 200 // rendered "TAG,date_time,info" line
+
+// monotonic timestamps, 6 bit boot id and 24 bit uptime (194 days)
+#define LOG_EPOCH_VALID_MIN (1UL << 30)
+#define LOG_STAMP_BOOT_MASK 0x3F
+#define LOG_STAMP_UPTIME_MAX 0xFFFFFF
+#define LOG_MONOTONIC_STAMP(boot, uptime) ((((uint32_t)(boot) & LOG_STAMP_BOOT_MASK) << 24) | ((uptime) < LOG_STAMP_UPTIME_MAX ? (uint32_t)(uptime) : LOG_STAMP_UPTIME_MAX))
+#define LOG_STAMP_IS_MONOTONIC(epoch) ((epoch) < LOG_EPOCH_VALID_MIN)
+#define LOG_STAMP_BOOT(epoch) (((epoch) >> 24) & LOG_STAMP_BOOT_MASK)
+#define LOG_STAMP_UPTIME(epoch) ((epoch) & LOG_STAMP_UPTIME_MAX)
+
+// summary records pack the suppressed event, the interval and the count into the key
+#define LOG_SUMMARY_KEY(event, minutes, count) (((uint64_t)(event) << 48) | ((uint64_t)((minutes) & 0xFFFF) << 32) | (uint32_t)(count))
+#define LOG_SUMMARY_EVENT(key) ((uint8_t)((key) >> 48))
+#define LOG_SUMMARY_MINUTES(key) ((uint16_t)((key) >> 32))
+#define LOG_SUMMARY_COUNT(key) ((uint32_t)(key))
+#define LOG_SUMMARY_ANY_DEVICE 0xFFFF
+
+typedef enum{
+    LOG_TAG_UNKNOWN,
+    LOG_TAG_LOGGER,
+    LOG_TAG_NRF_MESSAGE_HANDLER,
+    LOG_TAG_TCP,
+    LOG_TAG_HTTPS_SERVER,
+    LOG_TAG_ACCESS,
+    LOG_TAG_SQL_SERVER,
+    LOG_TAG_WIFI_EVENTS,
+    LOG_TAG_SNTP,
+    LOG_TAG_TEST,
+    LOG_TAG_COUNT
+} log_tag_id;
+
+typedef enum{
+    LOG_EVENT_TEXT,                 // free text, rendered as is
+    LOG_EVENT_PING_OK,              // device
+    LOG_EVENT_PING_ERROR,           // device, key = error code
+    LOG_EVENT_SEND_TURNON,          // device
+    LOG_EVENT_SEND_TURNOFF,         // device
+    LOG_EVENT_ACCESS_GRANTED,       // device, key
+    LOG_EVENT_ACCESS_DENIED,        // device, key
+    LOG_EVENT_LOGIN,                // key = user ID
+    LOG_EVENT_TURNON_REQUEST,       // key = user ID
+    LOG_EVENT_TURNOFF_REQUEST,      // key = user ID
+    LOG_EVENT_SYNC_REQUEST,         // key = user ID
+    LOG_EVENT_ACCESSLEVEL_REQUEST,  // key = user ID
+    LOG_EVENT_SHOW_KEYS_REQUEST,    // key = user ID
+    LOG_EVENT_SHOW_DEVICES_REQUEST, // key = user ID
+    LOG_EVENT_SHOW_LOGS_REQUEST,    // key = user ID
+    LOG_EVENT_SUMMARY,              // device, key = LOG_SUMMARY_KEY of the suppressed event
+    LOG_EVENT_BRUTE_FORCE_DEVICE,   // device, key = denied swipes in the window
+    LOG_EVENT_BRUTE_FORCE_KEY,      // device, key
+    LOG_EVENT_ACCESS_LOCKED,        // device, key
+    LOG_EVENT_SHOW_OCCUPANCY_REQUEST,   // key = user ID
+    LOG_EVENT_COUNT
+} log_event_code;
+
+typedef struct __attribute__((packed)) log_record_t {
+    uint32_t epoch;
+    uint8_t tag_id;
+    uint8_t event;
+    uint16_t device;
+    uint64_t key;
+    uint8_t text_len;
+    char text[LOG_RECORD_TEXT_LEN];
+} log_record_t;
+
+typedef struct log_t {
+    char tag[20];
+    char date_time[50];
+    char info[220];
+} log_t;
+
+log_tag_id log_tag_from_name(const char *tag);
+
+const char *log_tag_name(log_tag_id tag_id);
+
+const char *log_event_name(log_event_code event);
+
+void set_log_record_text(log_record_t *record, const char *text);
+
+size_t log_record_size(const log_record_t *record);
+
+esp_err_t fwrite_log_record(FILE *file, const log_record_t *record);
+
+esp_err_t fread_log_record(FILE *file, log_record_t *record);
+
+void format_log_record(const log_record_t *record, log_t *log);
+
+void format_log_stamp(uint32_t stamp, char *buffer, size_t buffer_size);
+
+int format_log_line(const log_record_t *record, char *buffer, size_t buffer_size);
+
+bool parse_log_info(const char *info, log_record_t *record);
+
+uint64_t ibutton_to_key(const char *ibutton);
+
+#endif //LOG_RECORD_H
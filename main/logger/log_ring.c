@@ -0,0 +1,130 @@
+//
+// Created by Vincent.
+//
+
+#include <string.h>
+#include "log_ring.h"
+
+
+// Forward declarations for static functions/params
+static uint32_t entry_size(uint16_t len);
+static log_ring_entry_t *entry_at(log_ring_t *ring, uint32_t pos);
+static log_ring_entry_t *claim_oldest(log_ring_t *ring);
+static void release_oldest(log_ring_t *ring, log_ring_entry_t *entry);
+
+
+esp_err_t log_ring_init(log_ring_t *ring, uint8_t *buffer, uint32_t size){
+    if(!LOG_RING_SIZE_VALID(size)){
+        // positions are masked with size - 1, any other size corrupts entries
+        return ESP_ERR_INVALID_SIZE;
+    }
+    ring->buffer = buffer;
+    ring->size = size;
+    atomic_store(&ring->head, 0);
+    atomic_store(&ring->tail, 0);
+    // no header may look committed before it was written, positions are never odd
+    memset(buffer, 0xFF, size);
+    return ESP_OK;
+}
+
+esp_err_t log_ring_push(log_ring_t *ring, const void *data, uint16_t len, uint8_t tag_id){
+    uint32_t need = entry_size(len);
+    if(need > ring->size / 2){
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    uint32_t head, pad;
+    do{
+        head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        uint32_t contiguous = ring->size - (head & (ring->size - 1));
+        pad = contiguous < need ? contiguous : 0;
+        if((head - tail) + pad + need > ring->size){
+            return ESP_ERR_NO_MEM;
+        }
+    }while(!atomic_compare_exchange_weak_explicit(&ring->head, &head, head + pad + need, memory_order_acq_rel, memory_order_relaxed));
+
+    if(pad > 0){
+        // fill the end of the buffer with a skip entry, the real entry starts at the beginning
+        log_ring_entry_t *skip = entry_at(ring, head);
+        skip->len = pad;
+        skip->skip = 1;
+        atomic_store_explicit(&skip->commit, head, memory_order_release);
+        head += pad;
+    }
+
+    log_ring_entry_t *entry = entry_at(ring, head);
+    entry->len = len;
+    entry->tag_id = tag_id;
+    entry->skip = 0;
+    memcpy((uint8_t *)entry + sizeof(log_ring_entry_t), data, len);
+    atomic_store_explicit(&entry->commit, head, memory_order_release);
+    return ESP_OK;
+}
+
+esp_err_t log_ring_drop_oldest(log_ring_t *ring, uint8_t *tag_id){
+    while(1){
+        log_ring_entry_t *entry = claim_oldest(ring);
+        if(entry == NULL){
+            return ESP_FAIL;
+        }
+        bool skip = entry->skip;
+        *tag_id = entry->tag_id;
+        release_oldest(ring, entry);
+        if(!skip){
+            return ESP_OK;
+        }
+    }
+}
+
+int log_ring_pop(log_ring_t *ring, void *data, uint16_t max_len){
+    while(1){
+        log_ring_entry_t *entry = claim_oldest(ring);
+        if(entry == NULL){
+            return 0;
+        }
+        uint16_t len = entry->skip ? 0 : entry->len;
+        if(len > max_len){
+            len = 0;
+        }
+        memcpy(data, (uint8_t *)entry + sizeof(log_ring_entry_t), len);
+        release_oldest(ring, entry);
+        if(len > 0){
+            return len;
+        }
+    }
+}
+
+uint32_t log_ring_used(log_ring_t *ring){
+    return atomic_load(&ring->head) - atomic_load(&ring->tail);
+}
+
+static uint32_t entry_size(uint16_t len){
+    return (sizeof(log_ring_entry_t) + len + LOG_RING_ALIGN - 1) & ~(LOG_RING_ALIGN - 1);
+}
+
+static log_ring_entry_t *entry_at(log_ring_t *ring, uint32_t pos){
+    return (log_ring_entry_t *)&ring->buffer[pos & (ring->size - 1)];
+}
+
+static log_ring_entry_t *claim_oldest(log_ring_t *ring){
+    // the consumer and producers dropping the oldest entry compete for it, whoever claims it owns it
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if(tail == atomic_load_explicit(&ring->head, memory_order_acquire)){
+        return NULL;
+    }
+    log_ring_entry_t *entry = entry_at(ring, tail);
+    uint32_t commit = tail;
+    if(!atomic_compare_exchange_strong_explicit(&entry->commit, &commit, LOG_RING_UNCOMMITTED, memory_order_acq_rel, memory_order_relaxed)){
+        // not yet published, or already claimed by someone else
+        return NULL;
+    }
+    return entry;
+}
+
+static void release_oldest(log_ring_t *ring, log_ring_entry_t *entry){
+    uint32_t size = entry->skip ? entry->len : entry_size(entry->len);
+    // wipe the entry so stale bytes can never look like a committed header on a later lap
+    memset(entry, 0xFF, size);
+    atomic_fetch_add_explicit(&ring->tail, size, memory_order_release);
+}
@@ -0,0 +1,54 @@
+//
+// Created by Vincent.
+//
+
+/*
+    Lock-free multi-producer, single-consumer ring buffer sized in bytes.
+
+    Producers reserve space by a compare-and-swap on head, copy their entry in
+    and publish it by storing the entry position in its header. The consumer
+    only takes an entry whose header carries its own position, so half written
+    entries are never read. Entries never wrap, if an entry does not fit before
+    the end of the buffer the remainder is reserved as a skip entry.
+
+    Positions are free running 32 bit counters, the buffer size must be a power
+    of two.
+*/
+
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "esp_err.h"
+
+#define LOG_RING_ALIGN 8
+#define LOG_RING_UNCOMMITTED 0xFFFFFFFF
+#define LOG_RING_SIZE_VALID(size) ((size) >= 2 * LOG_RING_ALIGN && ((size) & ((size) - 1)) == 0)
+
+typedef struct log_ring_entry_t {
+    _Atomic uint32_t commit;    // position of the entry once it is fully written
+    uint16_t len;               // payload length, or the reserved length of a skip entry
+    uint8_t tag_id;
+    uint8_t skip;
+} log_ring_entry_t;
+
+typedef struct log_ring_t {
+    uint8_t *buffer;
+    uint32_t size;
+    _Atomic uint32_t head;      // next free position, advanced by producers
+    _Atomic uint32_t tail;      // oldest unread position, advanced by the consumer or by drop-oldest
+} log_ring_t;
+
+esp_err_t log_ring_init(log_ring_t *ring, uint8_t *buffer, uint32_t size);
+
+esp_err_t log_ring_push(log_ring_t *ring, const void *data, uint16_t len, uint8_t tag_id);
+
+esp_err_t log_ring_drop_oldest(log_ring_t *ring, uint8_t *tag_id);
+
+int log_ring_pop(log_ring_t *ring, void *data, uint16_t max_len);
+
+uint32_t log_ring_used(log_ring_t *ring);
+
+#endif //LOG_RING_H
@@ -0,0 +1,440 @@
+//
+// Created by Vincent.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/unistd.h>
+#include <sys/stat.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "log_record.h"
+#include "log_rollup.h"
+
+
+// Forward declarations for static functions/params
+#define LOG_ROLLUP_MAX_PROBES 8    // keeps the key lookup O(1), a crowded table spills into LOG_ROLLUP_OTHER_KEY
+typedef struct rollup_counters_t {
+    uint16_t grants;
+    uint16_t denies;
+    uint32_t on_seconds;
+} rollup_counters_t;
+typedef struct rollup_key_slot_t {
+    uint64_t key;
+    bool used;
+    rollup_counters_t counters;
+} rollup_key_slot_t;
+typedef struct rollup_device_state_t {
+    uint64_t key;           // last key that was granted access
+    int64_t on_since;       // uptime in us of the TURNON ack, 0 while off
+} rollup_device_state_t;
+static SemaphoreHandle_t rollup_mutex;      // counters
+static SemaphoreHandle_t rollup_file_mutex; // rollup file
+static TaskHandle_t rollup_task_handle;
+static rollup_counters_t open_hours[LOG_ROLLUP_MAX_DEVICES];
+static uint32_t open_hour;                  // 0 until the time is synced
+static rollup_key_slot_t open_days[LOG_ROLLUP_MAX_KEYS];
+static rollup_counters_t open_other_keys;
+static uint32_t open_day;
+static time_t open_day_end;
+static rollup_counters_t closed_hours[LOG_ROLLUP_MAX_DEVICES];
+static uint32_t closed_hour;
+static bool closed_hours_pending;
+static rollup_key_slot_t closed_days[LOG_ROLLUP_MAX_KEYS];
+static rollup_counters_t closed_other_keys;
+static uint32_t closed_day;
+static bool closed_days_pending;
+static bool closed_overwritten;
+static rollup_device_state_t device_states[LOG_ROLLUP_MAX_DEVICES];
+static log_rollup_t persist_buffer[2 * LOG_ROLLUP_TABLE_ROWS];   // closed and open periods
+static nvs_handle_t rollup_nvs_handle;
+static bool rollup_nvs_open;
+static uint32_t next_seq = 1;
+static void check_rollover(time_t now);
+static rollup_counters_t *find_key(uint64_t key);
+static int collect_hours(log_rollup_t *rollups, int max_rollups, uint32_t hour, const rollup_counters_t *hours);
+static int collect_days(log_rollup_t *rollups, int max_rollups, uint32_t day, const rollup_key_slot_t *days, const rollup_counters_t *other_keys);
+static esp_err_t write_rollups(const char *filename, const char *mode, const log_rollup_t *rollups, int amount);
+static esp_err_t number_rollups(log_rollup_t *rollups, int amount);
+static esp_err_t restore_checkpoint();
+
+
+esp_err_t init_log_rollups(){
+    if(rollup_mutex == NULL){
+        rollup_mutex = xSemaphoreCreateMutex();
+        rollup_file_mutex = xSemaphoreCreateMutex();
+        if(rollup_mutex == NULL || rollup_file_mutex == NULL){
+            ESP_LOGE(LOG_ROLLUP_TAG, "FAILED TO CREATE rollup mutexes");
+            return ESP_FAIL;
+        }
+    }
+
+    // sequence numbers continue across reboots, the server would skip a number it saw before
+    if(!rollup_nvs_open){
+        if(nvs_open(LOG_ROLLUP_NVS_NAMESPACE, NVS_READWRITE, &rollup_nvs_handle) != ESP_OK){
+            ESP_LOGE(LOG_ROLLUP_TAG, "Failed to open nvs namespace %s", LOG_ROLLUP_NVS_NAMESPACE);
+            return ESP_FAIL;
+        }
+        rollup_nvs_open = true;
+        nvs_get_u32(rollup_nvs_handle, LOG_ROLLUP_NVS_SEQ_KEY, &next_seq);
+    }
+    return restore_checkpoint();
+}
+
+void log_rollup_task(void *pvParameters){
+    rollup_task_handle = xTaskGetCurrentTaskHandle();
+    while(1){
+        // woken early when an hour or day was closed
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(LOG_ROLLUP_CHECKPOINT_MIN * 60 * 1000));
+        persist_log_rollups();
+    }
+}
+
+void rollup_access(uint16_t device, uint64_t key, bool granted){
+    if(rollup_mutex == NULL || device >= LOG_ROLLUP_MAX_DEVICES){
+        return;
+    }
+    xSemaphoreTake(rollup_mutex, portMAX_DELAY);
+    check_rollover(time(NULL));
+
+    rollup_counters_t *key_counters = find_key(key);
+    if(granted){
+        open_hours[device].grants++;
+        key_counters->grants++;
+        device_states[device].key = key;
+    }else{
+        open_hours[device].denies++;
+        key_counters->denies++;
+    }
+    xSemaphoreGive(rollup_mutex);
+}
+
+void rollup_device_state(uint16_t device, bool on){
+    if(rollup_mutex == NULL || device >= LOG_ROLLUP_MAX_DEVICES){
+        return;
+    }
+    xSemaphoreTake(rollup_mutex, portMAX_DELAY);
+    check_rollover(time(NULL));
+
+    rollup_device_state_t *state = &device_states[device];
+    if(on){
+        if(state->on_since == 0){
+            state->on_since = esp_timer_get_time();
+        }
+    }else if(state->on_since != 0){
+        uint32_t seconds = (esp_timer_get_time() - state->on_since) / 1000000;
+        open_hours[device].on_seconds += seconds;
+        find_key(state->key)->on_seconds += seconds;
+        state->on_since = 0;
+    }
+    xSemaphoreGive(rollup_mutex);
+}
+
+esp_err_t persist_log_rollups(){
+    if(rollup_mutex == NULL){
+        return ESP_FAIL;
+    }
+    esp_err_t ret = ESP_OK;
+    xSemaphoreTake(rollup_file_mutex, portMAX_DELAY);
+
+    // the counters are copied out so the handler never waits for flash
+    xSemaphoreTake(rollup_mutex, portMAX_DELAY);
+    check_rollover(time(NULL));
+    int closed = 0;
+    bool hours_closed = closed_hours_pending;
+    bool days_closed = closed_days_pending;
+    if(hours_closed){
+        closed += collect_hours(&persist_buffer[closed], LOG_ROLLUP_MAX_DEVICES, closed_hour, closed_hours);
+        closed_hours_pending = false;
+    }
+    if(days_closed){
+        closed += collect_days(&persist_buffer[closed], LOG_ROLLUP_MAX_KEYS + 1, closed_day, closed_days, &closed_other_keys);
+        closed_days_pending = false;
+    }
+    int amount = closed + collect_hours(&persist_buffer[closed], LOG_ROLLUP_MAX_DEVICES, open_hour, open_hours);
+    amount += collect_days(&persist_buffer[amount], LOG_ROLLUP_MAX_KEYS + 1, open_day, open_days, &open_other_keys);
+    bool overwritten = closed_overwritten;
+    closed_overwritten = false;
+    xSemaphoreGive(rollup_mutex);
+
+    if(overwritten){
+        ESP_LOGW(LOG_ROLLUP_TAG, "a closed period was replaced before it was persisted");
+    }
+    if(closed > 0 && number_rollups(persist_buffer, closed) != ESP_OK){
+        // without numbers they can not go out safely, they are tried again with the next checkpoint
+        xSemaphoreTake(rollup_mutex, portMAX_DELAY);
+        closed_hours_pending |= hours_closed;
+        closed_days_pending |= days_closed;
+        xSemaphoreGive(rollup_mutex);
+        write_rollups(LOG_ROLLUP_CHECKPOINT_FILENAME, "w", &persist_buffer[closed], amount - closed);
+        xSemaphoreGive(rollup_file_mutex);
+        return ESP_FAIL;
+    }
+
+    // the checkpoint takes the closed periods first, an older checkpoint still holds them as open and
+    // would count them again after a reboot, by their numbers the server skips a row it got from the file
+    if(write_rollups(LOG_ROLLUP_CHECKPOINT_FILENAME, "w", persist_buffer, amount) != ESP_OK){
+        ret = ESP_FAIL;
+    }
+    if(closed > 0){
+        // then the rollup file, and a checkpoint of only the open periods once they are in there
+        if(write_rollups(LOG_ROLLUP_FILENAME, "a", persist_buffer, closed) != ESP_OK
+                || write_rollups(LOG_ROLLUP_CHECKPOINT_FILENAME, "w", &persist_buffer[closed], amount - closed) != ESP_OK){
+            ret = ESP_FAIL;
+        }
+    }
+
+    xSemaphoreGive(rollup_file_mutex);
+    return ret;
+}
+
+int get_open_log_rollups(log_rollup_t *rollups, int max_rollups){
+    if(rollup_mutex == NULL){
+        return ESP_FAIL;
+    }
+    xSemaphoreTake(rollup_mutex, portMAX_DELAY);
+    int amount = collect_hours(rollups, max_rollups, open_hour, open_hours);
+    amount += collect_days(&rollups[amount], max_rollups - amount, open_day, open_days, &open_other_keys);
+    xSemaphoreGive(rollup_mutex);
+    return amount;
+}
+
+int read_log_rollups(long *offset, log_rollup_t *rollups, int max_rollups){
+    if(rollup_file_mutex == NULL){
+        return ESP_FAIL;
+    }
+    xSemaphoreTake(rollup_file_mutex, portMAX_DELAY);
+
+    FILE *file = fopen(LOG_ROLLUP_FILENAME, "r");
+    if(file == NULL){
+        // nothing persisted yet
+        xSemaphoreGive(rollup_file_mutex);
+        return 0;
+    }
+    int amount = 0;
+    if(fseek(file, *offset, SEEK_SET) == 0){
+        amount = fread(rollups, sizeof(log_rollup_t), max_rollups, file);
+        *offset += amount * sizeof(log_rollup_t);
+    }
+    fclose(file);
+
+    xSemaphoreGive(rollup_file_mutex);
+    return amount;
+}
+
+esp_err_t drop_log_rollups(long offset){
+    if(rollup_file_mutex == NULL){
+        return ESP_FAIL;
+    }
+    xSemaphoreTake(rollup_file_mutex, portMAX_DELAY);
+
+    // rollups persisted after the upload started are kept
+    esp_err_t ret = ESP_OK;
+    struct stat st;
+    if(stat(LOG_ROLLUP_FILENAME, &st) != 0){
+        xSemaphoreGive(rollup_file_mutex);
+        return ESP_OK;
+    }
+    if(offset >= st.st_size){
+        if(unlink(LOG_ROLLUP_FILENAME) != 0){
+            ret = ESP_FAIL;
+        }
+        xSemaphoreGive(rollup_file_mutex);
+        return ret;
+    }
+
+    FILE *file = fopen(LOG_ROLLUP_FILENAME, "r");
+    FILE *temp_file = fopen(LOG_ROLLUP_TEMP_FILENAME, "w");
+    if(file == NULL || temp_file == NULL){
+        ESP_LOGE(LOG_ROLLUP_TAG, "Failed to open rollup files");
+        if(file != NULL){
+            fclose(file);
+        }
+        if(temp_file != NULL){
+            fclose(temp_file);
+        }
+        xSemaphoreGive(rollup_file_mutex);
+        return ESP_FAIL;
+    }
+    fseek(file, offset, SEEK_SET);
+    log_rollup_t rollup;
+    while(fread(&rollup, sizeof(rollup), 1, file) == 1){
+        fwrite(&rollup, sizeof(rollup), 1, temp_file);
+    }
+    fclose(file);
+    fclose(temp_file);
+
+    // spiffs can not rename onto an existing file
+    if(unlink(LOG_ROLLUP_FILENAME) != 0 || rename(LOG_ROLLUP_TEMP_FILENAME, LOG_ROLLUP_FILENAME) != 0){
+        ESP_LOGE(LOG_ROLLUP_TAG, "Failed to replace rollup file");
+        ret = ESP_FAIL;
+    }
+    xSemaphoreGive(rollup_file_mutex);
+    return ret;
+}
+
+static void check_rollover(time_t now){
+    // called with rollup_mutex held, without a synced time everything stays in the open periods
+    if(now < LOG_EPOCH_VALID_MIN){
+        return;
+    }
+
+    uint32_t hour = now - now % 3600;
+    if(open_hour == 0){
+        // counts from before the sync belong to the first synced hour
+        open_hour = hour;
+    }else if(hour != open_hour){
+        closed_overwritten |= closed_hours_pending;
+        memcpy(closed_hours, open_hours, sizeof(open_hours));
+        closed_hour = open_hour;
+        closed_hours_pending = true;
+        memset(open_hours, 0, sizeof(open_hours));
+        open_hour = hour;
+        if(rollup_task_handle != NULL){
+            xTaskNotifyGive(rollup_task_handle);
+        }
+    }
+
+    // local days, only looked up once a day
+    if(open_day != 0 && now < open_day_end){
+        return;
+    }
+    struct tm timeinfo;
+    localtime_r(&now, &timeinfo);
+    uint32_t day = (timeinfo.tm_year + 1900) * 10000 + (timeinfo.tm_mon + 1) * 100 + timeinfo.tm_mday;
+    timeinfo.tm_mday++;
+    timeinfo.tm_hour = 0;
+    timeinfo.tm_min = 0;
+    timeinfo.tm_sec = 0;
+    timeinfo.tm_isdst = -1;
+    open_day_end = mktime(&timeinfo);
+
+    if(open_day != 0 && day != open_day){
+        closed_overwritten |= closed_days_pending;
+        memcpy(closed_days, open_days, sizeof(open_days));
+        closed_other_keys = open_other_keys;
+        closed_day = open_day;
+        closed_days_pending = true;
+        memset(open_days, 0, sizeof(open_days));
+        memset(&open_other_keys, 0, sizeof(open_other_keys));
+        if(rollup_task_handle != NULL){
+            xTaskNotifyGive(rollup_task_handle);
+        }
+    }
+    open_day = day;
+}
+
+static rollup_counters_t *find_key(uint64_t key){
+    uint32_t slot = (uint32_t)((key ^ (key >> 32)) * 2654435761u);
+    for(int probe = 0; probe < LOG_ROLLUP_MAX_PROBES; ++probe){
+        rollup_key_slot_t *entry = &open_days[(slot + probe) & (LOG_ROLLUP_MAX_KEYS - 1)];
+        if(!entry->used){
+            entry->used = true;
+            entry->key = key;
+            return &entry->counters;
+        }
+        if(entry->key == key){
+            return &entry->counters;
+        }
+    }
+    return &open_other_keys;
+}
+
+static int collect_hours(log_rollup_t *rollups, int max_rollups, uint32_t hour, const rollup_counters_t *hours){
+    int amount = 0;
+    for(int device = 0; device < LOG_ROLLUP_MAX_DEVICES && amount < max_rollups && hour != 0; ++device){
+        const rollup_counters_t *counters = &hours[device];
+        if(counters->grants == 0 && counters->denies == 0 && counters->on_seconds == 0){
+            continue;
+        }
+        rollups[amount++] = (log_rollup_t){ LOG_ROLLUP_DEVICE_HOUR, 0, hour, device, counters->grants, counters->denies, counters->on_seconds };
+    }
+    return amount;
+}
+
+static int collect_days(log_rollup_t *rollups, int max_rollups, uint32_t day, const rollup_key_slot_t *days, const rollup_counters_t *other_keys){
+    int amount = 0;
+    for(int slot = 0; slot < LOG_ROLLUP_MAX_KEYS && amount < max_rollups && day != 0; ++slot){
+        const rollup_key_slot_t *entry = &days[slot];
+        if(!entry->used){
+            continue;
+        }
+        rollups[amount++] = (log_rollup_t){ LOG_ROLLUP_KEY_DAY, 0, day, entry->key,
+                                            entry->counters.grants, entry->counters.denies, entry->counters.on_seconds };
+    }
+    if(amount < max_rollups && day != 0 && (other_keys->grants != 0 || other_keys->denies != 0 || other_keys->on_seconds != 0)){
+        rollups[amount++] = (log_rollup_t){ LOG_ROLLUP_KEY_DAY, 0, day, LOG_ROLLUP_OTHER_KEY,
+                                            other_keys->grants, other_keys->denies, other_keys->on_seconds };
+    }
+    return amount;
+}
+
+static esp_err_t write_rollups(const char *filename, const char *mode, const log_rollup_t *rollups, int amount){
+    FILE *file = fopen(filename, mode);
+    if(file == NULL){
+        ESP_LOGE(LOG_ROLLUP_TAG, "Failed to open %s", filename);
+        return ESP_FAIL;
+    }
+    esp_err_t ret = ESP_OK;
+    if(amount > 0 && fwrite(rollups, sizeof(log_rollup_t), amount, file) != amount){
+        ESP_LOGE(LOG_ROLLUP_TAG, "Failed to write rollups to %s", filename);
+        ret = ESP_FAIL;
+    }
+    fclose(file);
+    return ret;
+}
+
+static esp_err_t number_rollups(log_rollup_t *rollups, int amount){
+    // rows that already have a number keep it
+    int unnumbered = 0;
+    for(int i = 0; i < amount; ++i){
+        unnumbered += rollups[i].seq == 0;
+    }
+    if(unnumbered == 0){
+        return ESP_OK;
+    }
+
+    // the numbers are stored before any row carrying them reaches the file, a reboot never hands them out again
+    uint32_t seq = next_seq;
+    if(!rollup_nvs_open || nvs_set_u32(rollup_nvs_handle, LOG_ROLLUP_NVS_SEQ_KEY, seq + unnumbered) != ESP_OK
+            || nvs_commit(rollup_nvs_handle) != ESP_OK){
+        ESP_LOGE(LOG_ROLLUP_TAG, "Failed to store rollup sequence number");
+        return ESP_FAIL;
+    }
+    next_seq = seq + unnumbered;
+    for(int i = 0; i < amount; ++i){
+        if(rollups[i].seq == 0){
+            rollups[i].seq = seq++;
+        }
+    }
+    return ESP_OK;
+}
+
+static esp_err_t restore_checkpoint(){
+    // the open periods of the last boot become rows of their own, the server adds them up,
+    // closed periods in it keep their numbers, the server skips them if they were uploaded already
+    FILE *file = fopen(LOG_ROLLUP_CHECKPOINT_FILENAME, "r");
+    if(file == NULL){
+        return ESP_OK;
+    }
+    int amount = fread(persist_buffer, sizeof(log_rollup_t), sizeof(persist_buffer) / sizeof(log_rollup_t), file);
+    fclose(file);
+
+    esp_err_t ret = ESP_OK;
+    if(amount > 0){
+        ESP_LOGI(LOG_ROLLUP_TAG, "restored %d rollups from checkpoint", amount);
+        ret = number_rollups(persist_buffer, amount);
+        if(ret == ESP_OK){
+            ret = write_rollups(LOG_ROLLUP_FILENAME, "a", persist_buffer, amount);
+        }
+    }
+    if(ret == ESP_OK){
+        unlink(LOG_ROLLUP_CHECKPOINT_FILENAME);
+    }
+    return ret;
+}
@@ -0,0 +1,80 @@
+//
+// Created by Vincent.
+//
+
+/*
+    Usage rollups, counted on the node instead of derived from raw logs:
+    grants, denies and on-time per device per hour and per iButton key per day.
+
+    The nrf message handler only bumps counters in RAM (a table indexed by
+    device, and a small hash table of keys). When an hour or day ends the open
+    table is swapped into a closed copy, the rollup task appends its non-zero
+    entries to LOG_ROLLUP_FILENAME as fixed 25 byte records and checkpoints the
+    open tables every LOG_ROLLUP_CHECKPOINT_MIN, so a reboot loses at most that
+    much. A closed period is written to the checkpoint before it is appended
+    to the rollup file, so the checkpoint never holds an older, open copy of
+    a period that is already in the file. A checkpoint found at boot is moved
+    to the rollup file, the server adds up rows of the same node, device and
+    hour.
+
+    Every row in the rollup file carries a sequence number of the node, kept
+    in nvs, the server adds a row only the first time it sees its number, so
+    a retried upload is not counted twice.
+
+    On-time is counted from the TURNON to the TURNOFF acknowledgement of a
+    device and booked in the hour and day in which the device turned off.
+    Counts made before the time is synced go to the first synced hour and day.
+*/
+
+#ifndef LOG_ROLLUP_H
+#define LOG_ROLLUP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define LOG_ROLLUP_TAG "LOG_ROLLUP"
+
+#define LOG_ROLLUP_FILENAME "/spiffs/rollup.bin"
+#define LOG_ROLLUP_CHECKPOINT_FILENAME "/spiffs/rollup_open.bin"
+#define LOG_ROLLUP_TEMP_FILENAME "/spiffs/rollup.tmp"
+#define LOG_ROLLUP_MAX_DEVICES 100  // device numbers are two digits
+#define LOG_ROLLUP_MAX_KEYS 64      // power of two, keys beyond this are counted as LOG_ROLLUP_OTHER_KEY
+#define LOG_ROLLUP_OTHER_KEY 0
+#define LOG_ROLLUP_TABLE_ROWS (LOG_ROLLUP_MAX_DEVICES + LOG_ROLLUP_MAX_KEYS + 1)   // rows of one hour and one day
+#define LOG_ROLLUP_CHECKPOINT_MIN 5
+#define LOG_ROLLUP_NVS_NAMESPACE "logger"
+#define LOG_ROLLUP_NVS_SEQ_KEY "rollup_seq"
+
+typedef enum{
+    LOG_ROLLUP_DEVICE_HOUR,     // period = epoch of the start of the hour, id = device
+    LOG_ROLLUP_KEY_DAY          // period = local date as YYYYMMDD, id = iButton key
+} log_rollup_type_t;
+
+typedef struct __attribute__((packed)) log_rollup_t {
+    uint8_t type;
+    uint32_t seq;       // 0 for the open periods in the checkpoint, numbered when written to the rollup file
+    uint32_t period;
+    uint64_t id;
+    uint16_t grants;
+    uint16_t denies;
+    uint32_t on_seconds;
+} log_rollup_t;
+
+esp_err_t init_log_rollups();
+
+void log_rollup_task(void *pvParameters);
+
+void rollup_access(uint16_t device, uint64_t key, bool granted);
+
+void rollup_device_state(uint16_t device, bool on);
+
+esp_err_t persist_log_rollups();
+
+int get_open_log_rollups(log_rollup_t *rollups, int max_rollups);
+
+int read_log_rollups(long *offset, log_rollup_t *rollups, int max_rollups);
+
+esp_err_t drop_log_rollups(long offset);
+
+#endif //LOG_ROLLUP_H
@@ -0,0 +1,1082 @@
+//
+// Created by Vincent.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/unistd.h>
+#include <sys/stat.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "../spiffs/spiffs.h"
+#include "log_clock.h"
+#include "log_compress.h"
+#include "log_segments.h"
+
+
+typedef struct segment_reader_t {
+    FILE *file;
+    bool compressed;
+    long offset;        // uncompressed offset of the next record
+    int block_len;      // record bytes of the current block in block_buffer, compressed segments only
+    int block_pos;
+} segment_reader_t;
+
+// Forward declarations for static functions/params
+static log_segment_t segments[LOG_MAX_SEGMENTS];
+static int amount_segments;
+static int total_records;
+static uint8_t append_buffer[LOG_APPEND_BUFFER_LEN];
+static uint8_t block_buffer[LOG_SEGMENT_BLOCK_SIZE];
+static uint8_t packed_buffer[LOG_COMPRESS_BOUND(LOG_SEGMENT_BLOCK_SIZE)];
+static uint32_t compress_table[LOG_COMPRESS_HASH_SIZE];
+static log_cursor_t upload_cursor;
+static nvs_handle_t cursor_nvs_handle;
+static bool cursor_nvs_open;
+static esp_err_t load_manifest();
+static esp_err_t write_manifest();
+static esp_err_t start_new_segment(uint32_t seq);
+static esp_err_t drop_segment_at(int index);
+static long segment_size(uint32_t seq);
+static void scan_segment(log_segment_t *segment);
+static void index_record(log_segment_t *segment, const log_record_t *record);
+static void reset_segment_index(log_segment_t *segment);
+static esp_err_t remove_segment_records(log_segment_t *segment, int start_record, int end_record, uint32_t *cursor_offset);
+static esp_err_t correct_compressed_segment(log_segment_t *segment, int *corrected);
+static esp_err_t compress_segment(log_segment_t *segment);
+static esp_err_t replace_segment_file(const char *path);
+static esp_err_t open_segment_reader(segment_reader_t *reader, const log_segment_t *segment, long offset);
+static esp_err_t read_segment_record(segment_reader_t *reader, log_record_t *record);
+static esp_err_t load_segment_block(segment_reader_t *reader, const log_block_header_t *header);
+static void close_segment_reader(segment_reader_t *reader);
+static esp_err_t load_upload_cursor();
+static esp_err_t store_upload_cursor();
+static esp_err_t migrate_legacy_logs(uint32_t seq);
+
+
+esp_err_t init_log_segments(){
+    amount_segments = 0;
+    total_records = 0;
+
+    if(load_manifest() != ESP_OK){
+        // no manifest yet, convert the single text log file of older firmware into the first segment
+        struct stat st;
+        if(stat(LEGACY_LOGSFILENAME, &st) == 0 && migrate_legacy_logs(0) == ESP_OK){
+            amount_segments = 1;
+        }
+    }
+
+    // drop segments that went missing and rescan the active segment, its count and time range in the manifest are stale
+    for(int i = amount_segments - 1; i >= 0; --i){
+        long bytes = segment_size(segments[i].seq);
+        if(bytes < 0){
+            ESP_LOGW(LOG_SEGMENTS_TAG, "segment %u listed in manifest but missing", (unsigned)segments[i].seq);
+            memmove(&segments[i], &segments[i + 1], (amount_segments - i - 1) * sizeof(log_segment_t));
+            --amount_segments;
+            continue;
+        }
+        if(!segments[i].compressed){
+            // the manifest holds the uncompressed size of compressed segments
+            segments[i].bytes = bytes;
+        }
+    }
+    if(amount_segments > 0){
+        scan_segment(&segments[amount_segments - 1]);
+    }
+
+    if(amount_segments == 0){
+        if(start_new_segment(0) != ESP_OK){
+            return ESP_FAIL;
+        }
+    }
+
+    for(int i = 0; i < amount_segments; ++i){
+        total_records += segments[i].records;
+    }
+
+    if(load_upload_cursor() != ESP_OK){
+        ESP_LOGW(LOG_SEGMENTS_TAG, "no upload cursor, all logs will be uploaded");
+    }
+
+    ESP_LOGI(LOG_SEGMENTS_TAG, "log store ready, %d segments, %d logs", amount_segments, total_records);
+    return write_manifest();
+}
+
+esp_err_t append_log_record(const log_record_t *record){
+    return append_log_records(record, 1);
+}
+
+esp_err_t append_log_records(const log_record_t *records, int amount){
+    if(amount_segments == 0){
+        ESP_LOGE(LOG_SEGMENTS_TAG, "failed to append log, log store not initialized");
+        return ESP_FAIL;
+    }
+
+    if(segments[amount_segments - 1].bytes >= LOG_SEGMENT_MAX_BYTES){
+        if(rotate_log_segment() != ESP_OK){
+            return ESP_FAIL;
+        }
+    }
+
+    // the whole batch goes to the active segment, it may grow past LOG_SEGMENT_MAX_BYTES by at most one batch
+    log_segment_t *active = &segments[amount_segments - 1];
+    char path[LOG_SEGMENT_PATH_LEN];
+    log_segment_path(active->seq, path, sizeof(path));
+    FILE *file = fopen(path, "a");
+    if(file == NULL){
+        ESP_LOGE(LOG_SEGMENTS_TAG, "Failed to open segment %s for writing", path);
+        return ESP_FAIL;
+    }
+
+    esp_err_t ret = ESP_OK;
+    size_t used = 0;
+    int written = 0;
+    for(int i = 0; i < amount && ret == ESP_OK; ++i){
+        size_t size = log_record_size(&records[i]);
+        memcpy(&append_buffer[used], &records[i], size);
+        used += size;
+        index_record(active, &records[i]);
+
+        // flush when the next record might not fit, normally only once at the end of the batch
+        if(i == amount - 1 || used + sizeof(log_record_t) > LOG_APPEND_BUFFER_LEN){
+            if(fwrite(append_buffer, 1, used, file) != used){
+                ESP_LOGE(LOG_SEGMENTS_TAG, "Failed to write records to %s", path);
+                ret = ESP_FAIL;
+                break;
+            }
+            active->bytes += used;
+            active->records += i + 1 - written;
+            total_records += i + 1 - written;
+            written = i + 1;
+            used = 0;
+        }
+    }
+    fclose(file);
+    return ret;
+}
+
+esp_err_t rotate_log_segment(){
+    log_segment_t *active = &segments[amount_segments - 1];
+    if(active->records == 0){
+        // nothing to seal, keep writing to the empty segment
+        return ESP_OK;
+    }
+    uint32_t next_seq = active->seq + 1;
+
+    // retention, make room by dropping the oldest segment
+    if(amount_segments >= LOG_MAX_SEGMENTS){
+        bool uploaded = segments[0].seq < upload_cursor.seq;
+        ESP_LOGW(LOG_SEGMENTS_TAG, "log store is full, oldest segment %u dropped (%d logs, %s)", (unsigned)segments[0].seq,
+                 segments[0].records, uploaded ? "uploaded" : "not uploaded yet");
+        if(drop_segment_at(0) != ESP_OK){
+            return ESP_FAIL;
+        }
+    }
+
+    if(start_new_segment(next_seq) != ESP_OK){
+        return ESP_FAIL;
+    }
+    ESP_LOGI(LOG_SEGMENTS_TAG, "sealed segment %u, now writing segment %u", (unsigned)(next_seq - 1), (unsigned)next_seq);
+#ifdef CONFIG_LOGGER_COMPRESS_SEGMENTS
+    // sealed segments do not change anymore, a failure only leaves the segment uncompressed
+    compress_segment(&segments[amount_segments - 2]);
+#endif
+    return write_manifest();
+}
+
+int get_log_segments(log_segment_t *segments_copy, int max_segments){
+    int amount = amount_segments < max_segments ? amount_segments : max_segments;
+    memcpy(segments_copy, segments, amount * sizeof(log_segment_t));
+    return amount;
+}
+
+int query_log_segments(log_query_t *query, log_record_t *records, int max_records){
+    int found = 0;
+    for(int i = 0; i < amount_segments && found < max_records && query->limit != 0; ++i){
+        log_segment_t *segment = &segments[i];
+        if(segment->seq < query->next_seq){
+            continue;
+        }
+        if(segment->seq > query->next_seq){
+            query->next_seq = segment->seq;
+            query->next_offset = 0;
+        }
+        // the time index lets whole segments be skipped without opening them
+        if(segment->records == 0 || !log_query_overlaps(query, segment->min_epoch, segment->max_epoch)){
+            continue;
+        }
+
+        segment_reader_t reader;
+        if(open_segment_reader(&reader, segment, query->next_offset) != ESP_OK){
+            return ESP_FAIL;
+        }
+
+        log_record_t record;
+        bool end_of_segment = false;
+        while(found < max_records && query->limit != 0){
+            if(read_segment_record(&reader, &record) != ESP_OK){
+                end_of_segment = true;
+                break;
+            }
+            query->next_offset = reader.offset;
+            if(!log_query_matches(query, &record)){
+                continue;
+            }
+            if(query->offset > 0){
+                query->offset--;
+                continue;
+            }
+            records[found++] = record;
+            if(query->limit > 0){
+                query->limit--;
+            }
+        }
+        close_segment_reader(&reader);
+
+        // the active segment keeps growing, its end is only a position to continue from
+        if(end_of_segment && i < amount_segments - 1){
+            query->next_seq = segment->seq + 1;
+            query->next_offset = 0;
+        }
+    }
+
+    if(found < max_records || query->limit == 0){
+        query->done = true;
+    }
+    return found;
+}
+
+esp_err_t correct_next_log_segment(uint32_t *seq){
+    log_segment_t *segment = NULL;
+    for(int i = 0; i < amount_segments && segment == NULL; ++i){
+        if(segments[i].seq >= *seq){
+            segment = &segments[i];
+        }
+    }
+    if(segment == NULL){
+        return ESP_ERR_NOT_FOUND;
+    }
+    *seq = segment->seq + 1;
+    if(!LOG_STAMP_IS_MONOTONIC(segment->min_epoch) || segment->records == 0){
+        // the time index says every record already has a wall-clock time
+        return ESP_OK;
+    }
+
+    esp_err_t ret = ESP_OK;
+    int corrected = 0;
+    if(segment->compressed){
+        // compressed records cannot be patched in place, the segment is rewritten instead
+        ret = correct_compressed_segment(segment, &corrected);
+        if(corrected > 0){
+            ESP_LOGI(LOG_SEGMENTS_TAG, "corrected %d timestamps in segment %u", corrected, (unsigned)segment->seq);
+            if(write_manifest() != ESP_OK){
+                return ESP_FAIL;
+            }
+        }
+        return ret;
+    }
+
+    char path[LOG_SEGMENT_PATH_LEN];
+    log_segment_path(segment->seq, path, sizeof(path));
+    FILE *file = fopen(path, "r+");
+    if(file == NULL){
+        ESP_LOGE(LOG_SEGMENTS_TAG, "Failed to open file: %s", path);
+        return ESP_FAIL;
+    }
+
+    // the epoch has a fixed size, patch it in place instead of copying the segment
+    log_record_t record;
+    long position = ftell(file);
+    reset_segment_index(segment);
+    while(fread_log_record(file, &record) == ESP_OK){
+        long next = ftell(file);
+        if(log_clock_correct(&record)){
+            if(fseek(file, position, SEEK_SET) != 0 || fwrite(&record.epoch, 1, sizeof(record.epoch), file) != sizeof(record.epoch)){
+                ESP_LOGE(LOG_SEGMENTS_TAG, "Failed to correct timestamp in %s", path);
+                ret = ESP_FAIL;
+            }
+            fseek(file, next, SEEK_SET);
+            corrected++;
+        }
+        index_record(segment, &record);
+        position = next;
+    }
+    fclose(file);
+
+    if(corrected > 0){
+        ESP_LOGI(LOG_SEGMENTS_TAG, "corrected %d timestamps in segment %u", corrected, (unsigned)segment->seq);
+        if(write_manifest() != ESP_OK){
+            return ESP_FAIL;
+        }
+    }
+    return ret;
+}
+
+int count_segment_logs(){
+    return total_records;
+}
+
+esp_err_t read_log_record(int logline, log_record_t *record){
+    if(logline < 1){
+        return ESP_FAIL;
+    }
+    for(int i = 0; i < amount_segments; ++i){
+        if(logline <= segments[i].records){
+            return read_segment_records(segments[i].seq, logline, record, 1) == 1 ? ESP_OK : ESP_FAIL;
+        }
+        logline -= segments[i].records;
+    }
+    return ESP_FAIL;
+}
+
+int read_segment_records(uint32_t seq, int start_record, log_record_t *records, int max_records){
+    log_segment_t *segment = NULL;
+    for(int i = 0; i < amount_segments && segment == NULL; ++i){
+        if(segments[i].seq == seq){
+            segment = &segments[i];
+        }
+    }
+    if(segment == NULL){
+        ESP_LOGE(LOG_SEGMENTS_TAG, "segment %u not found", (unsigned)seq);
+        return ESP_FAIL;
+    }
+
+    segment_reader_t reader;
+    if(open_segment_reader(&reader, segment, 0) != ESP_OK){
+        return ESP_FAIL;
+    }
+    // records are variable length, walk up to the first requested one
+    int current = 0;
+    int found = 0;
+    while(found < max_records && read_segment_record(&reader, &records[found]) == ESP_OK){
+        current++;
+        if(current >= start_record){
+            found++;
+        }
+    }
+    close_segment_reader(&reader);
+    return found;
+}
+
+esp_err_t delete_log_segment(uint32_t seq){
+    for(int i = 0; i < amount_segments; ++i){
+        if(segments[i].seq == seq){
+            if(drop_segment_at(i) != ESP_OK){
+                return ESP_FAIL;
+            }
+            return write_manifest();
+        }
+    }
+    ESP_LOGW(LOG_SEGMENTS_TAG, "segment %u not found", (unsigned)seq);
+    return ESP_FAIL;
+}
+
+esp_err_t delete_log_records(int start_line, int end_line){
+    if(start_line < 1 || start_line > end_line || end_line > total_records){
+        ESP_LOGE(LOG_SEGMENTS_TAG, "Invalid log range: %d to %d", start_line, end_line);
+        return ESP_FAIL;
+    }
+
+    int first_line[LOG_MAX_SEGMENTS];
+    int offset = 1;
+    for(int i = 0; i < amount_segments; ++i){
+        first_line[i] = offset;
+        offset += segments[i].records;
+    }
+
+    // walk backwards so removing a segment does not shift the segments still to be handled
+    esp_err_t ret = ESP_OK;
+    for(int i = amount_segments - 1; i >= 0; --i){
+        int seg_start = first_line[i];
+        int seg_end = seg_start + segments[i].records - 1;
+        if(segments[i].records == 0 || seg_end < start_line || seg_start > end_line){
+            continue;
+        }
+
+        int local_start = (start_line > seg_start ? start_line : seg_start) - seg_start + 1;
+        int local_end = (end_line < seg_end ? end_line : seg_end) - seg_start + 1;
+        if(local_start == 1 && local_end == segments[i].records){
+            // whole segment covered, a single unlink
+            if(drop_segment_at(i) != ESP_OK){
+                ret = ESP_FAIL;
+            }
+            continue;
+        }
+
+        // the upload cursor may point into the rewritten segment, it moves along with its records
+        bool cursor_in_segment = segments[i].seq == upload_cursor.seq && upload_cursor.offset > 0;
+        if(remove_segment_records(&segments[i], local_start, local_end, cursor_in_segment ? &upload_cursor.offset : NULL) != ESP_OK){
+            ret = ESP_FAIL;
+            continue;
+        }
+        if(cursor_in_segment){
+            store_upload_cursor();
+        }
+        total_records -= local_end - local_start + 1;
+        scan_segment(&segments[i]);
+    }
+
+    if(write_manifest() != ESP_OK){
+        return ESP_FAIL;
+    }
+    return ret;
+}
+
+esp_err_t clear_log_segments(){
+    uint32_t next_seq = amount_segments > 0 ? segments[amount_segments - 1].seq + 1 : 0;
+    esp_err_t ret = ESP_OK;
+    while(amount_segments > 0){
+        char path[LOG_SEGMENT_PATH_LEN];
+        log_segment_path(segments[amount_segments - 1].seq, path, sizeof(path));
+        if(unlink(path) != 0){
+            ESP_LOGE(LOG_SEGMENTS_TAG, "Failed to remove segment %s", path);
+            ret = ESP_FAIL;
+        }
+        --amount_segments;
+    }
+    total_records = 0;
+
+    if(start_new_segment(next_seq) != ESP_OK || write_manifest() != ESP_OK){
+        return ESP_FAIL;
+    }
+
+    // nothing is left to upload
+    upload_cursor.seq = next_seq;
+    upload_cursor.offset = 0;
+    if(store_upload_cursor() != ESP_OK){
+        return ESP_FAIL;
+    }
+    return ret;
+}
+
+void get_upload_cursor(log_cursor_t *cursor){
+    *cursor = upload_cursor;
+}
+
+esp_err_t set_upload_cursor(const log_cursor_t *cursor){
+    if(cursor->seq < upload_cursor.seq || (cursor->seq == upload_cursor.seq && cursor->offset < upload_cursor.offset)
+            || cursor->log_seq < upload_cursor.log_seq){
+        ESP_LOGE(LOG_SEGMENTS_TAG, "upload cursor can only move forward");
+        return ESP_FAIL;
+    }
+    upload_cursor = *cursor;
+    return store_upload_cursor();
+}
+
+esp_err_t reclaim_uploaded_segments(){
+    // sealed segments before the cursor are fully uploaded, a single unlink each
+    int reclaimed = 0;
+    while(amount_segments > 1 && segments[0].seq < upload_cursor.seq){
+        if(drop_segment_at(0) != ESP_OK){
+            return ESP_FAIL;
+        }
+        reclaimed++;
+    }
+
+    // the segment the cursor points into is kept until everything in it was uploaded and it was sealed
+    if(amount_segments > 1 && segments[0].seq == upload_cursor.seq && upload_cursor.offset >= segments[0].bytes){
+        upload_cursor.seq = segments[1].seq;
+        upload_cursor.offset = 0;
+        if(drop_segment_at(0) != ESP_OK || store_upload_cursor() != ESP_OK){
+            return ESP_FAIL;
+        }
+        reclaimed++;
+    }
+
+    if(reclaimed == 0){
+        return ESP_OK;
+    }
+    ESP_LOGI(LOG_SEGMENTS_TAG, "reclaimed %d uploaded segments", reclaimed);
+    return write_manifest();
+}
+
+int count_pending_logs(uint32_t *oldest_epoch){
+    // everything from the upload cursor on, only the segment the cursor points into is read
+    int pending = 0;
+    *oldest_epoch = 0;
+    for(int i = 0; i < amount_segments; ++i){
+        log_segment_t *segment = &segments[i];
+        if(segment->seq < upload_cursor.seq || segment->records == 0){
+            continue;
+        }
+        if(segment->seq > upload_cursor.seq || upload_cursor.offset == 0){
+            if(pending == 0){
+                *oldest_epoch = segment->min_epoch;
+            }
+            pending += segment->records;
+            continue;
+        }
+
+        segment_reader_t reader;
+        if(open_segment_reader(&reader, segment, upload_cursor.offset) != ESP_OK){
+            return ESP_FAIL;
+        }
+        log_record_t record;
+        while(read_segment_record(&reader, &record) == ESP_OK){
+            if(pending == 0){
+                *oldest_epoch = record.epoch;
+            }
+            pending++;
+        }
+        close_segment_reader(&reader);
+    }
+    return pending;
+}
+
+void log_segment_path(uint32_t seq, char *path, size_t path_size){
+    snprintf(path, path_size, LOG_SEGMENT_PATH_FORMAT, (unsigned)seq);
+}
+
+static esp_err_t load_manifest(){
+    FILE *file = fopen(LOG_MANIFEST_FILENAME, "r");
+    if(file == NULL){
+        ESP_LOGW(LOG_SEGMENTS_TAG, "no log manifest found");
+        return ESP_FAIL;
+    }
+
+    char buffer[48];
+    if(fgets(buffer, sizeof(buffer), file) == NULL || (strncmp(buffer, LOG_MANIFEST_VERSION, strlen(LOG_MANIFEST_VERSION)) != 0
+            && strncmp(buffer, LOG_MANIFEST_VERSION_UNCOMPRESSED, strlen(LOG_MANIFEST_VERSION_UNCOMPRESSED)) != 0)){
+        // segments of an older text format, they cannot be read as records
+        ESP_LOGW(LOG_SEGMENTS_TAG, "log manifest has an unsupported format, discarding its segments");
+        while(fgets(buffer, sizeof(buffer), file) != NULL){
+            unsigned seq;
+            if(sscanf(buffer, "%u,", &seq) == 1){
+                char path[LOG_SEGMENT_PATH_LEN];
+                log_segment_path(seq, path, sizeof(path));
+                unlink(path);
+            }
+        }
+        fclose(file);
+        return ESP_FAIL;
+    }
+
+    while(fgets(buffer, sizeof(buffer), file) != NULL && amount_segments < LOG_MAX_SEGMENTS){
+        unsigned seq, min_epoch, max_epoch;
+        int records;
+        long raw_bytes;
+        int fields = sscanf(buffer, "%u,%d,%u,%u,%ld", &seq, &records, &min_epoch, &max_epoch, &raw_bytes);
+        if(fields != 2 && fields != 4 && fields != 5){
+            ESP_LOGW(LOG_SEGMENTS_TAG, "skipping invalid manifest line '%s'", buffer);
+            continue;
+        }
+        log_segment_t *segment = &segments[amount_segments];
+        segment->seq = seq;
+        segment->records = records;
+        segment->bytes = 0;
+        segment->min_epoch = min_epoch;
+        segment->max_epoch = max_epoch;
+        // only compressed segments list their uncompressed size
+        segment->compressed = fields == 5;
+        if(segment->compressed){
+            segment->bytes = raw_bytes;
+        }
+        if(fields == 2){
+            // manifest written before segments had a time range
+            scan_segment(segment);
+        }
+        ++amount_segments;
+    }
+
+    fclose(file);
+    return ESP_OK;
+}
+
+static esp_err_t write_manifest(){
+    // only written on rotation and deletion, never per log
+    FILE *file = fopen(LOG_MANIFEST_TEMP_FILENAME, "w");
+    if(file == NULL){
+        ESP_LOGE(LOG_SEGMENTS_TAG, "Failed to open manifest for writing");
+        return ESP_FAIL;
+    }
+    fprintf(file, "%s\n", LOG_MANIFEST_VERSION);
+    for(int i = 0; i < amount_segments; ++i){
+        fprintf(file, "%u,%d,%u,%u", (unsigned)segments[i].seq, segments[i].records,
+                (unsigned)segments[i].min_epoch, (unsigned)segments[i].max_epoch);
+        if(segments[i].compressed){
+            fprintf(file, ",%ld", segments[i].bytes);
+        }
+        fprintf(file, "\n");
+    }
+    fclose(file);
+
+    // SPIFFS cannot rename onto an existing file
+    unlink(LOG_MANIFEST_FILENAME);
+    if(rename(LOG_MANIFEST_TEMP_FILENAME, LOG_MANIFEST_FILENAME) != 0){
+        ESP_LOGE(LOG_SEGMENTS_TAG, "Failed to rename the temp manifest");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t start_new_segment(uint32_t seq){
+    char path[LOG_SEGMENT_PATH_LEN];
+    log_segment_path(seq, path, sizeof(path));
+    if(delete_file_content(path) != ESP_OK){
+        ESP_LOGE(LOG_SEGMENTS_TAG, "Failed to create segment %s", path);
+        return ESP_FAIL;
+    }
+    segments[amount_segments].seq = seq;
+    segments[amount_segments].records = 0;
+    segments[amount_segments].bytes = 0;
+    segments[amount_segments].compressed = false;
+    reset_segment_index(&segments[amount_segments]);
+    ++amount_segments;
+    return ESP_OK;
+}
+
+static esp_err_t drop_segment_at(int index){
+    char path[LOG_SEGMENT_PATH_LEN];
+    log_segment_path(segments[index].seq, path, sizeof(path));
+
+    total_records -= segments[index].records;
+    if(index == amount_segments - 1){
+        // the active segment stays in place, only its content goes
+        if(segments[index].seq == upload_cursor.seq && upload_cursor.offset > 0){
+            upload_cursor.offset = 0;
+            store_upload_cursor();
+        }
+        segments[index].records = 0;
+        segments[index].bytes = 0;
+        reset_segment_index(&segments[index]);
+        return delete_file_content(path);
+    }
+
+    if(unlink(path) != 0){
+        ESP_LOGE(LOG_SEGMENTS_TAG, "Failed to remove segment %s", path);
+        total_records += segments[index].records;
+        return ESP_FAIL;
+    }
+    memmove(&segments[index], &segments[index + 1], (amount_segments - index - 1) * sizeof(log_segment_t));
+    --amount_segments;
+    return ESP_OK;
+}
+
+static long segment_size(uint32_t seq){
+    char path[LOG_SEGMENT_PATH_LEN];
+    log_segment_path(seq, path, sizeof(path));
+    struct stat st;
+    if(stat(path, &st) != 0){
+        return -1;
+    }
+    return st.st_size;
+}
+
+static void scan_segment(log_segment_t *segment){
+    segment->records = 0;
+    reset_segment_index(segment);
+
+    segment_reader_t reader;
+    if(open_segment_reader(&reader, segment, 0) != ESP_OK){
+        return;
+    }
+
+    log_record_t record;
+    while(read_segment_record(&reader, &record) == ESP_OK){
+        index_record(segment, &record);
+        segment->records++;
+    }
+
+    close_segment_reader(&reader);
+}
+
+static void index_record(log_segment_t *segment, const log_record_t *record){
+    if(record->epoch < segment->min_epoch){
+        segment->min_epoch = record->epoch;
+    }
+    if(record->epoch > segment->max_epoch){
+        segment->max_epoch = record->epoch;
+    }
+}
+
+static void reset_segment_index(log_segment_t *segment){
+    // an empty range, the first indexed record sets both ends
+    segment->min_epoch = UINT32_MAX;
+    segment->max_epoch = 0;
+}
+
+static esp_err_t remove_segment_records(log_segment_t *segment, int start_record, int end_record, uint32_t *cursor_offset){
+    segment_reader_t reader;
+    if(open_segment_reader(&reader, segment, 0) != ESP_OK){
+        return ESP_FAIL;
+    }
+    FILE *temp_file = fopen(LOG_SEGMENT_TEMP_FILENAME, "w");
+    if(temp_file == NULL){
+        ESP_LOGE(LOG_SEGMENTS_TAG, "Failed to open temporary file");
+        close_segment_reader(&reader);
+        return ESP_FAIL;
+    }
+
+    // the records are written back uncompressed, a compressed segment is compressed again below
+    int current_record = 0;
+    log_record_t record;
+    long written = 0;
+    long new_cursor_offset = 0;
+    while(read_segment_record(&reader, &record) == ESP_OK){
+        current_record++;
+        if(current_record < start_record || current_record > end_record){
+            fwrite_log_record(temp_file, &record);
+            written += log_record_size(&record);
+        }
+        if(cursor_offset != NULL && reader.offset <= *cursor_offset){
+            // records up to the cursor end at this position in the new file
+            new_cursor_offset = written;
+        }
+    }
+
+    close_segment_reader(&reader);
+    fclose(temp_file);
+
+    char path[LOG_SEGMENT_PATH_LEN];
+    log_segment_path(segment->seq, path, sizeof(path));
+    if(replace_segment_file(path) != ESP_OK){
+        return ESP_FAIL;
+    }
+    bool was_compressed = segment->compressed;
+    segment->compressed = false;
+    segment->bytes = written;
+    if(cursor_offset != NULL){
+        *cursor_offset = new_cursor_offset;
+    }
+    if(was_compressed){
+        compress_segment(segment);
+    }
+    return ESP_OK;
+}
+
+static esp_err_t correct_compressed_segment(log_segment_t *segment, int *corrected){
+    segment_reader_t reader;
+    if(open_segment_reader(&reader, segment, 0) != ESP_OK){
+        return ESP_FAIL;
+    }
+    FILE *temp_file = fopen(LOG_SEGMENT_TEMP_FILENAME, "w");
+    if(temp_file == NULL){
+        ESP_LOGE(LOG_SEGMENTS_TAG, "Failed to open temporary file");
+        close_segment_reader(&reader);
+        return ESP_FAIL;
+    }
+
+    esp_err_t ret = ESP_OK;
+    log_record_t record;
+    reset_segment_index(segment);
+    while(read_segment_record(&reader, &record) == ESP_OK){
+        if(log_clock_correct(&record)){
+            (*corrected)++;
+        }
+        if(fwrite_log_record(temp_file, &record) != ESP_OK){
+            ret = ESP_FAIL;
+        }
+        index_record(segment, &record);
+    }
+    close_segment_reader(&reader);
+    fclose(temp_file);
+
+    if(*corrected == 0 || ret != ESP_OK){
+        // nothing of this boot in the segment, the compressed file stays
+        unlink(LOG_SEGMENT_TEMP_FILENAME);
+        return ret;
+    }
+    char path[LOG_SEGMENT_PATH_LEN];
+    log_segment_path(segment->seq, path, sizeof(path));
+    if(replace_segment_file(path) != ESP_OK){
+        return ESP_FAIL;
+    }
+    segment->compressed = false;
+    compress_segment(segment);
+    return ESP_OK;
+}
+
+static esp_err_t compress_segment(log_segment_t *segment){
+    char path[LOG_SEGMENT_PATH_LEN];
+    log_segment_path(segment->seq, path, sizeof(path));
+    FILE *file = fopen(path, "r");
+    if(file == NULL){
+        ESP_LOGE(LOG_SEGMENTS_TAG, "Failed to open file: %s", path);
+        return ESP_FAIL;
+    }
+    FILE *temp_file = fopen(LOG_SEGMENT_TEMP_FILENAME, "w");
+    if(temp_file == NULL){
+        ESP_LOGE(LOG_SEGMENTS_TAG, "Failed to open temporary file");
+        fclose(file);
+        return ESP_FAIL;
+    }
+
+    esp_err_t ret = ESP_OK;
+    long raw_bytes = 0;
+    long packed_bytes = 0;
+    int used = 0;
+    bool more = true;
+    log_record_t record;
+    while(more && ret == ESP_OK){
+        more = fread_log_record(file, &record) == ESP_OK;
+        int size = more ? log_record_size(&record) : 0;
+
+        // a block ends in front of the record that does not fit anymore, records never span two blocks
+        if(used > 0 && (!more || used + size > LOG_SEGMENT_BLOCK_SIZE)){
+            int packed = log_compress(block_buffer, used, packed_buffer, sizeof(packed_buffer), compress_table);
+            log_block_header_t header = {
+                .raw_len = used,
+                .packed_len = packed,
+            };
+            if(packed < 0 || fwrite(&header, sizeof(header), 1, temp_file) != 1 || fwrite(packed_buffer, 1, packed, temp_file) != packed){
+                ESP_LOGE(LOG_SEGMENTS_TAG, "Failed to compress segment %s", path);
+                ret = ESP_FAIL;
+            }
+            raw_bytes += used;
+            packed_bytes += sizeof(header) + packed;
+            used = 0;
+        }
+        if(more){
+            memcpy(&block_buffer[used], &record, size);
+            used += size;
+        }
+    }
+    fclose(file);
+    fclose(temp_file);
+
+    if(ret != ESP_OK || packed_bytes >= raw_bytes){
+        // a segment that would not shrink stays uncompressed
+        unlink(LOG_SEGMENT_TEMP_FILENAME);
+        return ret;
+    }
+    if(replace_segment_file(path) != ESP_OK){
+        return ESP_FAIL;
+    }
+    segment->compressed = true;
+    segment->bytes = raw_bytes;
+    ESP_LOGI(LOG_SEGMENTS_TAG, "compressed segment %u from %ld to %ld bytes", (unsigned)segment->seq, raw_bytes, packed_bytes);
+    return ESP_OK;
+}
+
+static esp_err_t replace_segment_file(const char *path){
+    // SPIFFS cannot rename onto an existing file
+    if(unlink(path) != 0){
+        ESP_LOGE(LOG_SEGMENTS_TAG, "Failed to remove the original file: %s", path);
+        unlink(LOG_SEGMENT_TEMP_FILENAME);
+        return ESP_FAIL;
+    }
+    if(rename(LOG_SEGMENT_TEMP_FILENAME, path) != 0){
+        ESP_LOGE(LOG_SEGMENTS_TAG, "Failed to rename the temporary file to the original file");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t open_segment_reader(segment_reader_t *reader, const log_segment_t *segment, long offset){
+    char path[LOG_SEGMENT_PATH_LEN];
+    log_segment_path(segment->seq, path, sizeof(path));
+    reader->file = fopen(path, "r");
+    if(reader->file == NULL){
+        ESP_LOGE(LOG_SEGMENTS_TAG, "Failed to open file: %s", path);
+        return ESP_FAIL;
+    }
+    reader->compressed = segment->compressed;
+    reader->offset = 0;
+    reader->block_len = 0;
+    reader->block_pos = 0;
+
+    if(!reader->compressed){
+        fseek(reader->file, offset, SEEK_SET);
+        reader->offset = offset;
+        return ESP_OK;
+    }
+
+    // whole blocks are skipped by their header, only the block holding the offset is decompressed
+    log_block_header_t header;
+    while(reader->offset < offset && fread(&header, sizeof(header), 1, reader->file) == 1){
+        if(reader->offset + header.raw_len > offset){
+            if(load_segment_block(reader, &header) != ESP_OK){
+                close_segment_reader(reader);
+                return ESP_FAIL;
+            }
+            reader->block_pos = offset - reader->offset;
+            reader->offset = offset;
+            break;
+        }
+        fseek(reader->file, header.packed_len, SEEK_CUR);
+        reader->offset += header.raw_len;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t read_segment_record(segment_reader_t *reader, log_record_t *record){
+    if(!reader->compressed){
+        if(fread_log_record(reader->file, record) != ESP_OK){
+            return ESP_FAIL;
+        }
+        reader->offset = ftell(reader->file);
+        return ESP_OK;
+    }
+
+    if(reader->block_pos >= reader->block_len){
+        log_block_header_t header;
+        if(fread(&header, sizeof(header), 1, reader->file) != 1 || load_segment_block(reader, &header) != ESP_OK){
+            return ESP_FAIL;
+        }
+    }
+    int left = reader->block_len - reader->block_pos;
+    if(left < LOG_RECORD_HEADER_LEN){
+        return ESP_FAIL;
+    }
+    memcpy(record, &block_buffer[reader->block_pos], LOG_RECORD_HEADER_LEN);
+    if(record->text_len > LOG_RECORD_TEXT_LEN || LOG_RECORD_HEADER_LEN + record->text_len > left){
+        // corrupt record, the rest of the block cannot be framed anymore
+        return ESP_FAIL;
+    }
+    memcpy(record->text, &block_buffer[reader->block_pos + LOG_RECORD_HEADER_LEN], record->text_len);
+    reader->block_pos += log_record_size(record);
+    reader->offset += log_record_size(record);
+    return ESP_OK;
+}
+
+static esp_err_t load_segment_block(segment_reader_t *reader, const log_block_header_t *header){
+    if(header->raw_len > LOG_SEGMENT_BLOCK_SIZE || header->packed_len > sizeof(packed_buffer)
+            || fread(packed_buffer, 1, header->packed_len, reader->file) != header->packed_len){
+        ESP_LOGE(LOG_SEGMENTS_TAG, "invalid compressed block in segment");
+        return ESP_FAIL;
+    }
+    if(log_decompress(packed_buffer, header->packed_len, block_buffer, LOG_SEGMENT_BLOCK_SIZE) != header->raw_len){
+        ESP_LOGE(LOG_SEGMENTS_TAG, "Failed to decompress block");
+        return ESP_FAIL;
+    }
+    reader->block_len = header->raw_len;
+    reader->block_pos = 0;
+    return ESP_OK;
+}
+
+static void close_segment_reader(segment_reader_t *reader){
+    fclose(reader->file);
+}
+
+static esp_err_t load_upload_cursor(){
+    // default: nothing uploaded yet
+    upload_cursor.seq = segments[0].seq;
+    upload_cursor.offset = 0;
+    upload_cursor.log_seq = 1;
+
+    if(!cursor_nvs_open){
+        if(nvs_open(LOG_CURSOR_NVS_NAMESPACE, NVS_READWRITE, &cursor_nvs_handle) != ESP_OK){
+            ESP_LOGE(LOG_SEGMENTS_TAG, "Failed to open nvs namespace %s", LOG_CURSOR_NVS_NAMESPACE);
+            return ESP_FAIL;
+        }
+        cursor_nvs_open = true;
+    }
+
+    log_cursor_t stored;
+    size_t stored_size = sizeof(stored);
+    uint64_t packed;
+    if(nvs_get_blob(cursor_nvs_handle, LOG_CURSOR_NVS_KEY, &stored, &stored_size) == ESP_OK && stored_size == sizeof(stored)){
+        // the sequence numbers always continue, the server knows this node by them
+        upload_cursor.log_seq = stored.log_seq;
+    }else if(nvs_get_u64(cursor_nvs_handle, LOG_CURSOR_NVS_LEGACY_KEY, &packed) == ESP_OK){
+        stored.seq = packed >> 32;
+        stored.offset = packed & 0xFFFFFFFF;
+        stored.log_seq = 1;
+    }else{
+        return ESP_FAIL;
+    }
+
+    // a cursor past the store belongs to a store that was wiped, start over
+    if(stored.seq > segments[amount_segments - 1].seq){
+        ESP_LOGW(LOG_SEGMENTS_TAG, "upload cursor %u:%u is past the log store, reset", (unsigned)stored.seq, (unsigned)stored.offset);
+        return store_upload_cursor();
+    }
+    if(stored.seq >= upload_cursor.seq){
+        upload_cursor = stored;
+    }
+    ESP_LOGI(LOG_SEGMENTS_TAG, "logs uploaded up to segment %u offset %u, next upload sequence number %u",
+             (unsigned)upload_cursor.seq, (unsigned)upload_cursor.offset, (unsigned)upload_cursor.log_seq);
+    return ESP_OK;
+}
+
+static esp_err_t store_upload_cursor(){
+    // a single 12 byte nvs entry, the position and the sequence number can not get out of step
+    if(!cursor_nvs_open){
+        return ESP_FAIL;
+    }
+    if(nvs_set_blob(cursor_nvs_handle, LOG_CURSOR_NVS_KEY, &upload_cursor, sizeof(upload_cursor)) != ESP_OK
+            || nvs_commit(cursor_nvs_handle) != ESP_OK){
+        ESP_LOGE(LOG_SEGMENTS_TAG, "Failed to store upload cursor");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t migrate_legacy_logs(uint32_t seq){
+    FILE *file = fopen(LEGACY_LOGSFILENAME, "r");
+    if(file == NULL){
+        return ESP_FAIL;
+    }
+    char path[LOG_SEGMENT_PATH_LEN];
+    log_segment_path(seq, path, sizeof(path));
+    FILE *segment = fopen(path, "w");
+    if(segment == NULL){
+        ESP_LOGE(LOG_SEGMENTS_TAG, "Failed to create segment %s", path);
+        fclose(file);
+        return ESP_FAIL;
+    }
+
+    // legacy lines are "TAG,YYYY-mm-dd HH:MM:SS,info"
+    char buffer[256];
+    int records = 0;
+    int parsed = 0;
+    int truncated = 0;
+    while(fgets(buffer, sizeof(buffer), file) != NULL){
+        buffer[strcspn(buffer, "\n")] = '\0';
+        char *tag = strtok(buffer, ",");
+        char *date_time = strtok(NULL, ",");
+        char *info = strtok(NULL, "");
+        if(tag == NULL || date_time == NULL){
+            continue;
+        }
+
+        struct tm timeinfo = { 0 };
+        strptime(date_time, "%Y-%m-%d %H:%M:%S", &timeinfo);
+        timeinfo.tm_isdst = -1;
+
+        log_record_t record = {
+            .epoch = mktime(&timeinfo),
+            .tag_id = log_tag_from_name(tag),
+            .event = LOG_EVENT_TEXT,
+        };
+        if(info == NULL){
+            info = "";
+        }
+        if(parse_log_info(info, &record)){
+            // the messages the firmware used to log become events again, nothing is cut off
+            parsed++;
+        }else{
+            // the text is all that is kept, a tag this firmware does not know goes in front of it
+            char text[LOG_LINE_LEN];
+            if(record.tag_id == LOG_TAG_UNKNOWN){
+                snprintf(text, sizeof(text), "%s: %s", tag, info);
+            }else{
+                snprintf(text, sizeof(text), "%s", info);
+            }
+            if(strlen(text) > LOG_RECORD_TEXT_LEN){
+                truncated++;
+            }
+            set_log_record_text(&record, text);
+        }
+        if(fwrite_log_record(segment, &record) == ESP_OK){
+            records++;
+        }
+    }
+
+    fclose(file);
+    fclose(segment);
+    unlink(LEGACY_LOGSFILENAME);
+
+    segments[0].seq = seq;
+    segments[0].bytes = 0;
+    segments[0].compressed = false;
+    scan_segment(&segments[0]);
+    ESP_LOGI(LOG_SEGMENTS_TAG, "migrated %s to segment %u (%d logs, %d as events)", LEGACY_LOGSFILENAME, (unsigned)seq,
+             records, parsed);
+    if(truncated > 0){
+        ESP_LOGW(LOG_SEGMENTS_TAG, "%d migrated logs were cut to %d characters", truncated, LOG_RECORD_TEXT_LEN);
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,112 @@
+//
+// Created by Vincent.
+//
+
+/*
+    The log store is split into rolling segment files (logs_000123.seg) of
+    binary log records (see log_record.h) that are only ever appended to. The
+    newest segment is the active one, all older segments are sealed and
+    immutable. A small manifest lists the segments in
+    order with their record count and time range, so the store can be rebuilt
+    at boot without scanning the files and queries can skip whole segments.
+    Uploads only move a persistent cursor (segment, byte offset, upload
+    sequence number) forward. The
+    uploaded segments stay readable until they are reclaimed, by unlinking
+    whole segments, which avoids rewriting the log file on every trim. The
+    one exception are monotonic timestamps (see log_clock.h), they are patched
+    in place once the wall-clock time is known.
+
+    Sealed segments are LZ4 compressed (see log_compress.h) into blocks of
+    at most LOG_SEGMENT_BLOCK_SIZE record bytes, each behind a
+    log_block_header_t, and only decompressed block by block while they are
+    read. Offsets and sizes always count the uncompressed records, so cursors
+    and queries do not notice whether a segment is compressed. A segment
+    that would not shrink stays as it is.
+
+    None of these functions lock, the logger serializes access with logger_mutex.
+*/
+
+#ifndef LOG_SEGMENTS_H
+#define LOG_SEGMENTS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "log_record.h"
+#include "log_query.h"
+
+#define LOG_SEGMENTS_TAG "LOG_SEGMENTS"
+
+#define LOG_SEGMENT_PATH_FORMAT "/spiffs/logs_%06u.seg"
+#define LOG_SEGMENT_PATH_LEN 32
+#define LOG_MANIFEST_FILENAME "/spiffs/logs.man"
+#define LOG_MANIFEST_TEMP_FILENAME "/spiffs/logs.man.tmp"
+#define LOG_MANIFEST_VERSION "LOGSTORE 3"
+#define LOG_MANIFEST_VERSION_UNCOMPRESSED "LOGSTORE 2" // same lines, no segment is compressed
+#define LOG_SEGMENT_TEMP_FILENAME "/spiffs/logs.seg.tmp"
+#define LEGACY_LOGSFILENAME "/spiffs/logs.txt"
+#define LOG_SEGMENT_MAX_BYTES 16384 // segment is sealed once it grows past this size
+#define LOG_MAX_SEGMENTS 40         // retention, oldest segment is dropped when a new one is needed
+#define LOG_APPEND_BUFFER_LEN 2048  // records of one batch are encoded here and written with a single fwrite
+#define LOG_SEGMENT_BLOCK_SIZE 2048 // uncompressed bytes per compressed block, blocks end at a record boundary
+#define LOG_CURSOR_NVS_NAMESPACE "logger"
+#define LOG_CURSOR_NVS_KEY "upload_pos"            // log_cursor_t as a blob
+#define LOG_CURSOR_NVS_LEGACY_KEY "upload_cursor"   // seq and offset packed in a u64, no sequence numbers yet
+
+typedef struct log_segment_t {
+    uint32_t seq;
+    int records;
+    long bytes;             // of the uncompressed records
+    uint32_t min_epoch;     // time index, lets queries skip the segment
+    uint32_t max_epoch;
+    bool compressed;
+} log_segment_t;
+
+typedef struct __attribute__((packed)) log_block_header_t {
+    uint16_t raw_len;       // record bytes in the block
+    uint16_t packed_len;    // compressed bytes that follow
+} log_block_header_t;
+
+typedef struct log_cursor_t {
+    uint32_t seq;       // segment of the first log not yet uploaded
+    uint32_t offset;    // byte offset of that log in the segment
+    uint32_t log_seq;   // upload sequence number that log gets, every log of this node is numbered once from 1 on
+} log_cursor_t;
+
+esp_err_t init_log_segments();
+
+esp_err_t append_log_record(const log_record_t *record);
+
+esp_err_t append_log_records(const log_record_t *records, int amount);
+
+esp_err_t rotate_log_segment();
+
+int get_log_segments(log_segment_t *segments_copy, int max_segments);
+
+int query_log_segments(log_query_t *query, log_record_t *records, int max_records);
+
+esp_err_t correct_next_log_segment(uint32_t *seq);
+
+int count_segment_logs();
+
+esp_err_t read_log_record(int logline, log_record_t *record);
+
+int read_segment_records(uint32_t seq, int start_record, log_record_t *records, int max_records);
+
+esp_err_t delete_log_segment(uint32_t seq);
+
+esp_err_t delete_log_records(int start_line, int end_line);
+
+esp_err_t clear_log_segments();
+
+void get_upload_cursor(log_cursor_t *cursor);
+
+esp_err_t set_upload_cursor(const log_cursor_t *cursor);
+
+esp_err_t reclaim_uploaded_segments();
+
+int count_pending_logs(uint32_t *oldest_epoch);
+
+void log_segment_path(uint32_t seq, char *path, size_t path_size);
+
+#endif //LOG_SEGMENTS_H
@@ -0,0 +1,217 @@
+//
+// Created by Vincent.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "log_ring.h"
+#include "log_syslog.h"
+#include "log_sink.h"
+
+
+_Static_assert(LOG_RING_SIZE_VALID(LOG_SINK_QUEUE_SIZE), "LOGGER_SINK_QUEUE_SIZE must be a power of two");
+
+
+// Forward declarations for static functions/params
+typedef struct sink_state_t {
+    log_sink_t sink;
+    log_ring_t ring;
+    uint8_t *ring_buffer;
+    log_record_t *batch;
+    TaskHandle_t task;
+    _Atomic uint32_t records_written;
+    _Atomic uint32_t write_failures;
+    _Atomic uint32_t dropped;
+    uint32_t queue_high_water;
+} sink_state_t;
+static sink_state_t sinks[LOG_SINK_MAX];
+static _Atomic int sink_count;
+static void log_sink_task(void *pvParameters);
+static int fill_batch(sink_state_t *state, int batch_size);
+#ifdef CONFIG_LOGGER_SINK_CONSOLE
+static esp_err_t write_console(const log_record_t *records, int amount, int *written);
+static const log_sink_t console_sink = {
+    .name = "console",
+    .write = write_console,
+    .batch_max = 8,
+    .interval_ms = 0,
+    .retry_max_ms = 1000,
+    .stack_size = 1024*3,
+    .priority = 1,
+};
+#endif
+#ifdef CONFIG_LOGGER_SINK_SYSLOG
+static const log_sink_t syslog_sink = {
+    .name = "syslog",
+    .write = send_log_records_to_syslog,
+    .batch_max = LOG_SINK_BATCH_MAX,
+    .interval_ms = LOG_SYSLOG_INTERVAL_MS,
+    .retry_max_ms = 60 * 1000,
+    .stack_size = 1024*4,
+    .priority = 1,
+};
+#endif
+
+
+esp_err_t init_log_sinks(){
+    esp_err_t ret = ESP_OK;
+#ifdef CONFIG_LOGGER_SINK_CONSOLE
+    if(register_log_sink(&console_sink) != ESP_OK){
+        ret = ESP_FAIL;
+    }
+#endif
+#ifdef CONFIG_LOGGER_SINK_SYSLOG
+    if(register_log_sink(&syslog_sink) != ESP_OK){
+        ret = ESP_FAIL;
+    }
+#endif
+    return ret;
+}
+
+esp_err_t register_log_sink(const log_sink_t *sink){
+    if(sink->write == NULL || sink->batch_max == 0 || sink->batch_max > LOG_SINK_BATCH_MAX){
+        ESP_LOGE(LOG_SINK_TAG, "invalid log sink %s", sink->name);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // sinks are registered at start up, one at a time
+    int index = atomic_load(&sink_count);
+    if(index >= LOG_SINK_MAX){
+        ESP_LOGE(LOG_SINK_TAG, "no room for log sink %s", sink->name);
+        return ESP_ERR_NO_MEM;
+    }
+
+    sink_state_t *state = &sinks[index];
+    state->sink = *sink;
+    state->ring_buffer = malloc(LOG_SINK_QUEUE_SIZE);
+    state->batch = malloc(sink->batch_max * sizeof(log_record_t));
+    if(state->ring_buffer == NULL || state->batch == NULL){
+        ESP_LOGE(LOG_SINK_TAG, "failed to allocate queue of log sink %s", sink->name);
+        free(state->ring_buffer);
+        free(state->batch);
+        return ESP_ERR_NO_MEM;
+    }
+    if(log_ring_init(&state->ring, state->ring_buffer, LOG_SINK_QUEUE_SIZE) != ESP_OK){
+        ESP_LOGE(LOG_SINK_TAG, "queue size of log sink %s must be a power of two", sink->name);
+        free(state->ring_buffer);
+        free(state->batch);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if(xTaskCreate(log_sink_task, "log_sink_task", sink->stack_size, state, sink->priority, &state->task) != pdPASS){
+        ESP_LOGE(LOG_SINK_TAG, "failed to create worker of log sink %s", sink->name);
+        free(state->ring_buffer);
+        free(state->batch);
+        return ESP_FAIL;
+    }
+
+    // the fan-out only sees the sink once it is complete
+    atomic_store(&sink_count, index + 1);
+    ESP_LOGI(LOG_SINK_TAG, "log sink %s registered", sink->name);
+    return ESP_OK;
+}
+
+void log_sinks_fan_out(const log_record_t *records, int amount){
+    // called by the logger task only, a full sink ring never makes it wait
+    int count = atomic_load(&sink_count);
+    for(int i = 0; i < count; ++i){
+        sink_state_t *state = &sinks[i];
+        for(int j = 0; j < amount; ++j){
+            if(log_ring_push(&state->ring, &records[j], log_record_size(&records[j]), records[j].tag_id) != ESP_OK){
+                atomic_fetch_add(&state->dropped, 1);
+            }
+        }
+        uint32_t used = log_ring_used(&state->ring);
+        if(used > state->queue_high_water){
+            state->queue_high_water = used;
+        }
+        xTaskNotifyGive(state->task);
+    }
+}
+
+int get_log_sink_stats(log_sink_stats_t *stats, int max_sinks){
+    int count = atomic_load(&sink_count);
+    int amount = 0;
+    for(int i = 0; i < count && amount < max_sinks; ++i){
+        stats[amount].name = sinks[i].sink.name;
+        stats[amount].records_written = atomic_load(&sinks[i].records_written);
+        stats[amount].write_failures = atomic_load(&sinks[i].write_failures);
+        stats[amount].dropped = atomic_load(&sinks[i].dropped);
+        stats[amount].queue_high_water = sinks[i].queue_high_water;
+        amount++;
+    }
+    return amount;
+}
+
+static void log_sink_task(void *pvParameters){
+    sink_state_t *state = pvParameters;
+    const log_sink_t *sink = &state->sink;
+    int batch_size = 0;
+    uint32_t retry_ms = 0;
+    TickType_t last_write = xTaskGetTickCount();
+
+    while(1){
+        if(batch_size == 0 && log_ring_used(&state->ring) == 0){
+            // sleep until the logger hands over records
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+
+        // pacing, records arriving in the meantime go out with the same write
+        TickType_t wait = pdMS_TO_TICKS(retry_ms > 0 ? retry_ms : sink->interval_ms);
+        TickType_t elapsed = xTaskGetTickCount() - last_write;
+        if(elapsed < wait){
+            vTaskDelay(wait - elapsed);
+        }
+
+        // a failed batch is kept and topped up, it is retried as a whole
+        batch_size = fill_batch(state, batch_size);
+        if(batch_size == 0){
+            continue;
+        }
+        int written = 0;
+        esp_err_t ret = sink->write(state->batch, batch_size, &written);
+        last_write = xTaskGetTickCount();
+        if(ret == ESP_OK){
+            atomic_fetch_add(&state->records_written, batch_size);
+            batch_size = 0;
+            retry_ms = 0;
+        }else{
+            if(written > 0 && written < batch_size){
+                // what went out before the failure is not sent again, only the rest is retried
+                atomic_fetch_add(&state->records_written, written);
+                memmove(state->batch, &state->batch[written], (batch_size - written) * sizeof(log_record_t));
+                batch_size -= written;
+            }
+            atomic_fetch_add(&state->write_failures, 1);
+            retry_ms = retry_ms == 0 ? (sink->interval_ms > 0 ? sink->interval_ms : 100) : retry_ms * 2;
+            if(retry_ms > sink->retry_max_ms){
+                retry_ms = sink->retry_max_ms;
+            }
+            ESP_LOGW(LOG_SINK_TAG, "log sink %s failed to write %d records, retry in %u ms", sink->name, batch_size, (unsigned)retry_ms);
+        }
+    }
+}
+
+static int fill_batch(sink_state_t *state, int batch_size){
+    while(batch_size < state->sink.batch_max && log_ring_pop(&state->ring, &state->batch[batch_size], sizeof(log_record_t)) > 0){
+        batch_size++;
+    }
+    return batch_size;
+}
+
+#ifdef CONFIG_LOGGER_SINK_CONSOLE
+static esp_err_t write_console(const log_record_t *records, int amount, int *written){
+    char line[LOG_LINE_LEN];
+    for(int i = 0; i < amount; ++i){
+        format_log_line(&records[i], line, sizeof(line));
+        printf("%s\n", line);
+    }
+    *written = amount;
+    return ESP_OK;
+}
+#endif
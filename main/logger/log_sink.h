@@ -0,0 +1,67 @@
+//
+// Created by Vincent.
+//
+
+/*
+    Log sinks, the places records go to besides the log store. Flash stays
+    the primary sink: the logger task writes every batch to the store itself
+    and then hands it to log_sinks_fan_out(), which copies the records onto
+    the ring of every registered sink without ever waiting. A sink whose ring
+    is full loses the record, counted in its own stats.
+
+    Every sink has a worker task that drains its ring in batches of up to
+    batch_max records with at least interval_ms between two writes, and keeps
+    a failed batch to retry it with a doubling delay up to retry_max_ms, less
+    the records the write reported as sent before it failed. A
+    slow or offline sink (a syslog collector that is down) so only ever holds
+    up itself, never the store or the producers calling log_event().
+
+    Sinks keep nothing on flash of their own, what a sink loses during an
+    outage is still in the log store. The REST API is not a sink: the log
+    uploader (log_uploader.h) sends the store itself from its cursor, with
+    sequence numbers the api deduplicates, so it gets every record.
+*/
+
+#ifndef LOG_SINK_H
+#define LOG_SINK_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "log_record.h"
+
+#define LOG_SINK_TAG "LOG_SINK"
+
+#define LOG_SINK_MAX 6
+#define LOG_SINK_QUEUE_SIZE CONFIG_LOGGER_SINK_QUEUE_SIZE  // bytes per sink, power of two
+#define LOG_SINK_BATCH_MAX 32
+
+// written is set to the records that went out, also when the write failed part way
+typedef esp_err_t (*log_sink_write_t)(const log_record_t *records, int amount, int *written);
+
+typedef struct log_sink_t {
+    const char *name;
+    log_sink_write_t write;
+    uint16_t batch_max;         // records per write, at most LOG_SINK_BATCH_MAX
+    uint32_t interval_ms;       // minimum time between two writes, records pile up in between
+    uint32_t retry_max_ms;      // longest delay between retries of a failed batch
+    uint32_t stack_size;        // of the worker task
+    uint8_t priority;           // of the worker task
+} log_sink_t;
+
+typedef struct log_sink_stats_t {
+    const char *name;
+    uint32_t records_written;
+    uint32_t write_failures;
+    uint32_t dropped;           // records lost to a full sink ring
+    uint32_t queue_high_water;  // most bytes ever waiting in the sink ring
+} log_sink_stats_t;
+
+esp_err_t init_log_sinks();
+
+esp_err_t register_log_sink(const log_sink_t *sink);
+
+void log_sinks_fan_out(const log_record_t *records, int amount);
+
+int get_log_sink_stats(log_sink_stats_t *stats, int max_sinks);
+
+#endif //LOG_SINK_H
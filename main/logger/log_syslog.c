@@ -0,0 +1,175 @@
+//
+// Created by Vincent.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "esp_log.h"
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+#include "log_clock.h"
+#include "log_syslog.h"
+
+
+// Forward declarations for static functions/params
+static int syslog_sock = -1;
+static struct sockaddr_in collector_addr;
+static uint32_t syslog_seq;
+static esp_err_t open_syslog_socket();
+static void close_syslog_socket();
+static esp_err_t send_datagram(const void *data, size_t len);
+static log_syslog_severity_t record_severity(const log_record_t *record);
+#ifdef CONFIG_LOGGER_SYSLOG_BINARY
+static esp_err_t send_binary(const log_record_t *records, int amount, int *written);
+#else
+static esp_err_t send_rfc5424(const log_record_t *records, int amount, int *written);
+#endif
+
+
+esp_err_t send_log_records_to_syslog(const log_record_t *records, int amount, int *written){
+    // only called by the worker of the syslog sink, the socket needs no lock
+    *written = 0;
+    if(syslog_sock < 0 && open_syslog_socket() != ESP_OK){
+        return ESP_FAIL;
+    }
+#ifdef CONFIG_LOGGER_SYSLOG_BINARY
+    return send_binary(records, amount, written);
+#else
+    return send_rfc5424(records, amount, written);
+#endif
+}
+
+int format_syslog_message(const log_record_t *record, uint32_t seq, char *buffer, size_t buffer_size){
+    log_t log;
+    format_log_record(record, &log);
+    int priority = LOG_SYSLOG_FACILITY * 8 + record_severity(record);
+
+    if(LOG_STAMP_IS_MONOTONIC(record->epoch)){
+        return snprintf(buffer, buffer_size, "<%d>1 - %s %s - %s [meta sequenceId=\"%u\"][boot@" LOG_SYSLOG_ENTERPRISE " id=\"%u\" uptime=\"%u\"] %s",
+                        priority, LOG_SYSLOG_NODE_NAME, log_tag_name(record->tag_id), log_event_name(record->event), (unsigned)seq,
+                        (unsigned)LOG_STAMP_BOOT(record->epoch), (unsigned)LOG_STAMP_UPTIME(record->epoch), log.info);
+    }
+
+    // syslog wants UTC, the rendered date_time is local time
+    time_t epoch = record->epoch;
+    struct tm timeinfo;
+    gmtime_r(&epoch, &timeinfo);
+    char timestamp[24];
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", &timeinfo);
+    return snprintf(buffer, buffer_size, "<%d>1 %s %s %s - %s [meta sequenceId=\"%u\"] %s",
+                    priority, timestamp, LOG_SYSLOG_NODE_NAME, log_tag_name(record->tag_id), log_event_name(record->event),
+                    (unsigned)seq, log.info);
+}
+
+#ifdef CONFIG_LOGGER_SYSLOG_BINARY
+static esp_err_t send_binary(const log_record_t *records, int amount, int *written){
+    uint8_t datagram[LOG_SYSLOG_DATAGRAM_MAX];
+    log_syslog_header_t *header = (log_syslog_header_t *)datagram;
+    int i = 0;
+    while(i < amount){
+        memcpy(header->magic, LOG_SYSLOG_MAGIC, sizeof(header->magic));
+        header->version = LOG_SYSLOG_VERSION;
+        header->boot_id = log_clock_boot_id();
+        header->seq = syslog_seq + 1;
+        strncpy(header->node, LOG_SYSLOG_NODE_NAME, sizeof(header->node));
+
+        // records keep their flash format, the collector decodes them like the store does
+        size_t len = sizeof(log_syslog_header_t);
+        int count = 0;
+        while(i < amount && count < 255 && len + log_record_size(&records[i]) <= sizeof(datagram)){
+            memcpy(datagram + len, &records[i], log_record_size(&records[i]));
+            len += log_record_size(&records[i]);
+            count++;
+            i++;
+        }
+        header->count = count;
+
+        if(send_datagram(datagram, len) != ESP_OK){
+            // the records of earlier datagrams are out, the worker keeps the rest
+            return ESP_FAIL;
+        }
+        syslog_seq++;
+        *written = i;
+    }
+    return ESP_OK;
+}
+#else
+static esp_err_t send_rfc5424(const log_record_t *records, int amount, int *written){
+    char message[LOG_LINE_LEN + 128];
+    for(int i = 0; i < amount; ++i){
+        int len = format_syslog_message(&records[i], syslog_seq + 1, message, sizeof(message));
+        if(len >= sizeof(message)){
+            len = sizeof(message) - 1;
+        }
+        if(send_datagram(message, len) != ESP_OK){
+            // the records before this one are out, the worker keeps the rest
+            return ESP_FAIL;
+        }
+        syslog_seq++;
+        *written = i + 1;
+    }
+    return ESP_OK;
+}
+#endif
+
+static esp_err_t send_datagram(const void *data, size_t len){
+    if(sendto(syslog_sock, data, len, 0, (struct sockaddr *)&collector_addr, sizeof(collector_addr)) < 0){
+        ESP_LOGW(LOG_SYSLOG_TAG, "failed to send to collector: errno %d", errno);
+        // resolve the collector again on the next batch, the network may have changed
+        close_syslog_socket();
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t open_syslog_socket(){
+    if(strlen(LOG_SYSLOG_HOST) == 0){
+        ESP_LOGE(LOG_SYSLOG_TAG, "no collector configured");
+        return ESP_FAIL;
+    }
+
+    struct addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_DGRAM,
+    };
+    struct addrinfo *result = NULL;
+    if(getaddrinfo(LOG_SYSLOG_HOST, NULL, &hints, &result) != 0 || result == NULL){
+        ESP_LOGW(LOG_SYSLOG_TAG, "failed to resolve collector %s", LOG_SYSLOG_HOST);
+        return ESP_FAIL;
+    }
+    memcpy(&collector_addr, result->ai_addr, sizeof(collector_addr));
+    collector_addr.sin_port = htons(LOG_SYSLOG_PORT);
+    freeaddrinfo(result);
+
+    syslog_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if(syslog_sock < 0){
+        ESP_LOGE(LOG_SYSLOG_TAG, "failed to create socket: errno %d", errno);
+        return ESP_FAIL;
+    }
+    ESP_LOGI(LOG_SYSLOG_TAG, "streaming logs to %s:%d", inet_ntoa(collector_addr.sin_addr), LOG_SYSLOG_PORT);
+    return ESP_OK;
+}
+
+static void close_syslog_socket(){
+    if(syslog_sock >= 0){
+        close(syslog_sock);
+        syslog_sock = -1;
+    }
+}
+
+static log_syslog_severity_t record_severity(const log_record_t *record){
+    switch(record->event){
+        case LOG_EVENT_BRUTE_FORCE_DEVICE:
+        case LOG_EVENT_BRUTE_FORCE_KEY:
+        case LOG_EVENT_PING_ERROR:
+            return LOG_SYSLOG_WARNING;
+        case LOG_EVENT_ACCESS_DENIED:
+        case LOG_EVENT_ACCESS_LOCKED:
+        case LOG_EVENT_LOGIN:
+        case LOG_EVENT_ACCESSLEVEL_REQUEST:
+            return LOG_SYSLOG_NOTICE;
+        default:
+            return LOG_SYSLOG_INFO;
+    }
+}
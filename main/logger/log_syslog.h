@@ -0,0 +1,68 @@
+//
+// Created by Vincent.
+//
+
+/*
+    Live log stream over UDP, a log sink (see log_sink.h) for watching the
+    logs of several labs at one collector without waiting for an upload.
+
+    RFC 5424: one message per datagram (RFC 5426), facility local0,
+        <PRI>1 TIMESTAMP NODE TAG - EVENT [meta sequenceId="n"] info
+    where records without wall-clock time get a NILVALUE timestamp and a
+    [boot@32473 id="b" uptime="s"] element instead.
+
+    Binary: a log_syslog_header_t followed by up to 255 records in their
+    flash format, as many as fit in LOG_SYSLOG_DATAGRAM_MAX bytes.
+
+    Sequence numbers start at 1 every boot and let the collector count lost
+    datagrams. Nothing is resent, a failed batch is only retried by the sink
+    when none of it went out.
+*/
+
+#ifndef LOG_SYSLOG_H
+#define LOG_SYSLOG_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "log_record.h"
+
+#define LOG_SYSLOG_TAG "LOG_SYSLOG"
+
+#ifdef CONFIG_LOGGER_SINK_SYSLOG
+#define LOG_SYSLOG_HOST CONFIG_LOGGER_SYSLOG_HOST
+#define LOG_SYSLOG_PORT CONFIG_LOGGER_SYSLOG_PORT
+#define LOG_SYSLOG_NODE_NAME CONFIG_LOGGER_SYSLOG_NODE_NAME
+#define LOG_SYSLOG_INTERVAL_MS CONFIG_LOGGER_SYSLOG_INTERVAL_MS
+#else
+#define LOG_SYSLOG_HOST ""
+#define LOG_SYSLOG_PORT 514
+#define LOG_SYSLOG_NODE_NAME "access-master"
+#define LOG_SYSLOG_INTERVAL_MS 200
+#endif
+#define LOG_SYSLOG_DATAGRAM_MAX 1024    // stays below the MTU, datagrams are never fragmented
+#define LOG_SYSLOG_FACILITY 16          // local0
+#define LOG_SYSLOG_ENTERPRISE "32473"   // example enterprise number of RFC 5424 for the boot element
+#define LOG_SYSLOG_MAGIC "LG"
+#define LOG_SYSLOG_VERSION 1
+#define LOG_SYSLOG_NODE_LEN 16
+
+typedef enum{
+    LOG_SYSLOG_WARNING = 4,
+    LOG_SYSLOG_NOTICE = 5,
+    LOG_SYSLOG_INFO = 6,
+} log_syslog_severity_t;
+
+typedef struct __attribute__((packed)) log_syslog_header_t {
+    char magic[2];                  // LOG_SYSLOG_MAGIC
+    uint8_t version;
+    uint8_t count;                  // records that follow
+    uint32_t boot_id;
+    uint32_t seq;                   // datagram number of this boot
+    char node[LOG_SYSLOG_NODE_LEN]; // not null terminated when full
+} log_syslog_header_t;
+
+esp_err_t send_log_records_to_syslog(const log_record_t *records, int amount, int *written);
+
+int format_syslog_message(const log_record_t *record, uint32_t seq, char *buffer, size_t buffer_size);
+
+#endif //LOG_SYSLOG_H
@@ -3,21 +3,63 @@
 //
 
 #include <time.h>
+#include <string.h>
+#include <stdatomic.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "esp_system.h"
 #include "esp_log.h"
-#include "sntp.c"
+#include "esp_timer.h"
+#include "sntp.h"
 #include "../spiffs/spiffs.h"
 #include "../SQL_server/SQL_server.h"
+#include "../SQL_server/log_uploader.h"
+#include "log_segments.h"
+#include "log_limiter.h"
+#include "log_clock.h"
+#include "log_rollup.h"
+#include "log_sink.h"
 #include "logger.h"
 
 
 // Forward declarations for static functions/params
-static int LOG_LINES;
 static SemaphoreHandle_t logger_mutex;
-static QueueHandle_t logger_queue;
+static TaskHandle_t logger_task_handle;
+static SemaphoreHandle_t logger_space;
+static log_ring_t logger_ring;
+static log_ring_t logger_priority_ring;
+static uint8_t logger_ring_buffer[LOGGER_RING_SIZE] __attribute__((aligned(LOG_RING_ALIGN)));
+static uint8_t logger_priority_ring_buffer[LOGGER_PRIORITY_RING_SIZE] __attribute__((aligned(LOG_RING_ALIGN)));
+_Static_assert(LOG_RING_SIZE_VALID(LOGGER_RING_SIZE), "LOGGER_RING_SIZE must be a power of two");
+_Static_assert(LOG_RING_SIZE_VALID(LOGGER_PRIORITY_RING_SIZE), "LOGGER_PRIORITY_RING_SIZE must be a power of two");
+static bool logger_ring_active;
+static _Atomic int blocked_producers;
+static _Atomic uint32_t dropped_records[LOG_TAG_COUNT];
+static uint32_t ring_high_water;
+static logger_overflow_policy_t overflow_policy =
+#if defined(CONFIG_LOGGER_OVERFLOW_DROP_NEWEST)
+    LOGGER_OVERFLOW_DROP_NEWEST;
+#elif defined(CONFIG_LOGGER_OVERFLOW_DROP_OLDEST)
+    LOGGER_OVERFLOW_DROP_OLDEST;
+#elif defined(CONFIG_LOGGER_OVERFLOW_BLOCK)
+    LOGGER_OVERFLOW_BLOCK;
+#else
+    LOGGER_OVERFLOW_PRIORITY_LANE;
+#endif
+static log_record_t batch[LOGGER_BATCH_MAX];
+static logger_stats_t stats;
+static int64_t rate_window_start;
+static uint32_t rate_window_records;
+static _Atomic bool correction_restart;
+static _Atomic bool summaries_due;
+static int receive_batch(TickType_t wait);
+static int drain_rings(int batch_size);
+static void wake_blocked_producers();
+static bool is_security_event(log_event_code event);
+static esp_err_t push_record(const log_record_t *record, size_t size);
+static void update_logger_stats(int batch_size, esp_err_t result);
+static bool correct_next_segment(uint32_t *seq);
 
 
 void logger_task(void *pvParameters){
@@ -28,105 +70,333 @@ void logger_task(void *pvParameters){
         destruct_logger_task();
     }
 
-    // init queue
-    if(init_logger_queue() != ESP_OK){
+    // init ring buffer
+    logger_task_handle = xTaskGetCurrentTaskHandle();
+    if(init_logger_ring() != ESP_OK){
         destruct_logger_task();
     }
 
-    // init log file
-    if(create_file_if_not_exists(LOGSFILENAME) == -1){
+    // init boot id, without it records of different boots can not be told apart
+    if(init_log_clock() != ESP_OK){
+        ESP_LOGE(LOGGER_TAG, "no boot id, timestamps before the time sync will not be corrected");
+    }
+
+    // init log segments
+    if(init_log_segments() != ESP_OK){
         destruct_logger_task();
     };
-    LOG_LINES = count_lines(LOGSFILENAME);
 
-    // init sntp
-    set_time_using_sntp();
+    // init the extra sinks, each one gets its own queue and worker
+    if(init_log_sinks() != ESP_OK){
+        ESP_LOGE(LOGGER_TAG, "not all log sinks started, records only go to flash");
+    }
+
+    // init rate limits, a failure only costs the summaries
+    init_log_limiter();
+
+    // init usage rollups, counted by the nrf message handler and persisted by their own task
+    if(init_log_rollups() == ESP_OK){
+        xTaskCreate(log_rollup_task, "log_rollup_task", 1024*3, NULL, 1, NULL);
+    }
+
+    // sync the time in the background, records are stamped with the uptime until then
+    if(init_time_service(logger_time_synced) != ESP_OK){
+        ESP_LOGE(LOGGER_TAG, "no time service, logs keep their uptime stamps");
+    }
 
     // create midnight task
     xTaskCreate(midnight_task, "midnight_task", 1024*4, NULL, 1, NULL);
 
-    // receive messages on queue
-	const char queue_item[LOGGER_QUEUE_ITEM_LEN];
+#ifdef CONFIG_LOGGER_UPLOADER
+    // trickle new logs to the api, midnight then only finds the rest
+    xTaskCreate(log_uploader_task, "log_uploader_task", 1024*4, NULL, 1, NULL);
+#endif
+
+    // records of an earlier boot that synced may still wait for their correction
+    bool correcting = log_clock_can_correct();
+    uint32_t correction_seq = 0;
+
+    // receive records from the ring buffer
+    rate_window_start = esp_timer_get_time();
 	while(1){
-		if (xQueueReceive(logger_queue, (void *)&queue_item, portMAX_DELAY) == pdTRUE) {
+        if(atomic_exchange(&correction_restart, false) && log_clock_synced() != ESP_ERR_INVALID_STATE){
+            correcting = true;
+            correction_seq = 0;
+        }
+        if(atomic_exchange(&summaries_due, false)){
+            // the summaries go through the ring like any record, the logger task never waits on it
+            flush_log_summaries();
+        }
+
+        // don't sleep while there are timestamps left to correct
+        int batch_size = receive_batch(correcting ? 0 : portMAX_DELAY);
+        if(batch_size > 0){
             // lock mutex
             xSemaphoreTake(logger_mutex, portMAX_DELAY);
-            
-			// handle message from logger_queue
-            while(MAX_LOG_LINES <= LOG_LINES){
-                delete_first_line(LOGSFILENAME);
-                --LOG_LINES;
-                ESP_LOGW(LOGGER_TAG, "logs file is full, oldest log deleted to make space");
+
+            // records that waited in the ring during the time sync get their wall-clock time here
+            for(int i = 0; i < batch_size; ++i){
+                log_clock_correct(&batch[i]);
             }
-            if(write_new_line(LOGSFILENAME, (const char *)&queue_item) == 0){
-                ++LOG_LINES;
-                ESP_LOGI(LOGGER_TAG, "succesfully logged '%s' to logs file", queue_item);
+
+			// write the whole batch at once, retention is handled by the segment rotation
+            esp_err_t ret = append_log_records(batch, batch_size);
+            if(ret == ESP_OK){
+                ESP_LOGI(LOGGER_TAG, "succesfully logged %d records to logs file", batch_size);
             }else{
-                ESP_LOGE(LOGGER_TAG, "failed to log '%s' to logs file", queue_item);
+                ESP_LOGE(LOGGER_TAG, "failed to log %d records to logs file", batch_size);
             }
+            for(int i = 0; i < batch_size; ++i){
+                // records are binary, their tag and event say what was (not) written
+                ESP_LOGD(LOGGER_TAG, "%s %s %s, device %d", ret == ESP_OK ? "logged" : "failed to log",
+                         log_tag_name(batch[i].tag_id), log_event_name(batch[i].event), batch[i].device);
+            }
+            update_logger_stats(batch_size, ret);
 
             // unlock mutex
             xSemaphoreGive(logger_mutex);
+
+            // the other sinks get a copy, none of them can make the logger wait
+            log_sinks_fan_out(batch, batch_size);
+        }
+        if(correcting){
+            correcting = correct_next_segment(&correction_seq);
         }
 	}
     destruct_logger_task();
 }
 
-esp_err_t init_logger_queue(){
-	// initialize queue
-    logger_queue = xQueueCreate(LOGGER_QUEUE_LEN, LOGGER_QUEUE_ITEM_LEN);
+static int receive_batch(TickType_t wait){
+    // wait for the first record, then drain whatever else arrives within the linger time
+    int batch_size = drain_rings(0);
+    if (batch_size == 0) {
+        ulTaskNotifyTake(pdTRUE, wait);
+        batch_size = drain_rings(0);
+        if (batch_size == 0) {
+            return 0;
+        }
+    }
+    TickType_t start = xTaskGetTickCount();
+    TickType_t linger = pdMS_TO_TICKS(LOGGER_BATCH_LINGER_MS);
+    while (batch_size < LOGGER_BATCH_MAX) {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= linger) {
+            break;
+        }
+        ulTaskNotifyTake(pdTRUE, linger - elapsed);
+        batch_size = drain_rings(batch_size);
+    }
+
+    // room was made in the ring, let blocked producers retry before the batch is written
+    wake_blocked_producers();
+    return batch_size;
+}
+
+static int drain_rings(int batch_size){
+    uint32_t used = log_ring_used(&logger_ring) + log_ring_used(&logger_priority_ring);
+    if(used > ring_high_water){
+        ring_high_water = used;
+    }
 
-	if (logger_queue == NULL) {
-        ESP_LOGE(LOGGER_TAG, "FAILED TO CREATE logger_queue");
+    // security events first, they are the ones the priority lane must not lose
+    while (batch_size < LOGGER_BATCH_MAX && log_ring_pop(&logger_priority_ring, &batch[batch_size], sizeof(log_record_t)) > 0) {
+        batch_size++;
+    }
+    while (batch_size < LOGGER_BATCH_MAX && log_ring_pop(&logger_ring, &batch[batch_size], sizeof(log_record_t)) > 0) {
+        batch_size++;
+    }
+    return batch_size;
+}
+
+static void wake_blocked_producers(){
+    int waiting = atomic_load(&blocked_producers);
+    for (int i = 0; i < waiting; i++) {
+        xSemaphoreGive(logger_space);
+    }
+}
+
+static bool correct_next_segment(uint32_t *seq){
+    // one segment per pass, new records are not held up behind the whole store
+    xSemaphoreTake(logger_mutex, portMAX_DELAY);
+    esp_err_t ret = correct_next_log_segment(seq);
+    xSemaphoreGive(logger_mutex);
+    return ret != ESP_ERR_NOT_FOUND;
+}
+
+void logger_time_synced(){
+    // called from the SNTP callback, the logger task stores the offset and corrects the records of this boot between batches
+    atomic_store(&correction_restart, true);
+    if(logger_task_handle != NULL){
+        xTaskNotifyGive(logger_task_handle);
+    }
+}
+
+void logger_summaries_due(){
+    // called from the timer task, which must not wait for ring space under the block policy
+    atomic_store(&summaries_due, true);
+    if(logger_task_handle != NULL){
+        xTaskNotifyGive(logger_task_handle);
+    }
+}
+
+static void update_logger_stats(int batch_size, esp_err_t result){
+    // called with logger_mutex held
+    if(result != ESP_OK){
+        stats.write_failures++;
+        return;
+    }
+    stats.records_written += batch_size;
+    stats.batches_written++;
+
+    int bucket = 0;
+    while((batch_size >> (bucket + 1)) > 0 && bucket < LOGGER_BATCH_BUCKETS - 1){
+        bucket++;
+    }
+    stats.batch_size_histogram[bucket]++;
+
+    rate_window_records += batch_size;
+    int64_t elapsed = esp_timer_get_time() - rate_window_start;
+    if(elapsed >= 1000000){
+        stats.records_per_second = (uint32_t)(rate_window_records * 1000000LL / elapsed);
+        if(stats.records_per_second > stats.peak_records_per_second){
+            stats.peak_records_per_second = stats.records_per_second;
+        }
+        rate_window_start += elapsed;
+        rate_window_records = 0;
+    }
+}
+
+esp_err_t init_logger_ring(){
+    // initialize ring buffers
+    logger_space = xSemaphoreCreateCounting(LOGGER_BLOCKED_PRODUCERS_MAX, 0);
+    if (logger_space == NULL) {
+        ESP_LOGE(LOGGER_TAG, "FAILED TO CREATE logger_space");
         return ESP_FAIL;
     }
+    if(log_ring_init(&logger_ring, logger_ring_buffer, LOGGER_RING_SIZE) != ESP_OK
+            || log_ring_init(&logger_priority_ring, logger_priority_ring_buffer, LOGGER_PRIORITY_RING_SIZE) != ESP_OK){
+        ESP_LOGE(LOGGER_TAG, "logger ring sizes must be powers of two");
+        return ESP_FAIL;
+    }
+    logger_ring_active = true;
     return ESP_OK;
 }
 
+void set_logger_overflow_policy(logger_overflow_policy_t policy){
+    overflow_policy = policy;
+}
+
 esp_err_t log_item(char *tag, char *info){
-    if(logger_queue == NULL){
-        ESP_LOGE(LOGGER_TAG, "logging not possible, logger_queue not active");
-        return ESP_FAIL;
+    log_tag_id tag_id = log_tag_from_name(tag);
+    if(tag_id != LOG_TAG_UNKNOWN){
+        return log_event(tag_id, LOG_EVENT_TEXT, 0, 0, info);
     }
 
-    char log_message[LOGGER_QUEUE_ITEM_LEN];
+    // keep the name of tags without an id in the text
+    char text[LOG_RECORD_TEXT_LEN + 1];
+    snprintf(text, sizeof(text), "%s: %s", tag, info);
+    return log_event(tag_id, LOG_EVENT_TEXT, 0, 0, text);
+}
 
-    time_t now;
-    struct tm timeinfo;
-    char time_buffer[32];
+esp_err_t log_event(log_tag_id tag_id, log_event_code event, uint16_t device, uint64_t key, const char *text){
+    if(!logger_ring_active){
+        ESP_LOGE(LOGGER_TAG, "logging not possible, logger ring not active");
+        return ESP_FAIL;
+    }
 
-    time(&now);
-    localtime_r(&now, &timeinfo);
-    strftime(time_buffer, sizeof(time_buffer), "%Y-%m-%d %H:%M:%S", &timeinfo);
-    if(timeinfo.tm_mon == 3 && timeinfo.tm_mday == 1){
-        tag = "APRILFOOLS";
-        info = "OH NO SEEMS LIKE ALIENS STOLE OUR LOGS";
+    // rate limited events are only counted, they come back as a summary record
+    if(!log_limiter_allow(tag_id, event, device)){
+        return ESP_OK;
     }
 
-    // Calculate the length of the resulting string
-    size_t result_len = strlen(tag) + 1 + strlen(time_buffer) + 1 + strlen(info) + 1;
+    // no formatting here, records are rendered when they are displayed or uploaded
+    log_record_t record = {
+        .epoch = log_clock_now(),
+        .tag_id = tag_id,
+        .event = event,
+        .device = device,
+        .key = key,
+    };
+    set_log_record_text(&record, text);
 
-    if (result_len > LOGGER_QUEUE_ITEM_LEN) {
-        ESP_LOGE(LOGGER_TAG, "log_item message is to long (%d > %d)", result_len, LOGGER_QUEUE_ITEM_LEN);
+    // put record on the ring buffer
+    if (push_record(&record, log_record_size(&record)) != ESP_OK) {
+        atomic_fetch_add(&dropped_records[tag_id < LOG_TAG_COUNT ? tag_id : LOG_TAG_UNKNOWN], 1);
+        ESP_LOGE(LOGGER_TAG, "logger ring full, record dropped");
         return ESP_FAIL;
     }
+    xTaskNotifyGive(logger_task_handle);
+    return ESP_OK;
+}
 
-    // Concatenate the strings
-    snprintf((char *)&log_message, result_len, "%s,%s,%s", tag, time_buffer, info);
+static esp_err_t push_record(const log_record_t *record, size_t size){
+    if(overflow_policy == LOGGER_OVERFLOW_PRIORITY_LANE && is_security_event(record->event)){
+        // fall back to the shared ring if the priority lane itself is full
+        if(log_ring_push(&logger_priority_ring, record, size, record->tag_id) == ESP_OK){
+            return ESP_OK;
+        }
+    }
 
-    // Fill the remaining space with null characters
-    memset(&log_message + result_len - 1, '\0', LOGGER_QUEUE_ITEM_LEN - result_len + 1);
+    esp_err_t ret = log_ring_push(&logger_ring, record, size, record->tag_id);
+    if(ret != ESP_ERR_NO_MEM){
+        return ret;
+    }
 
-    // put log_message on logger_queue
-    if (xQueueSend(logger_queue, (void *)(&log_message), 0) != pdTRUE) {
-        ESP_LOGE(LOGGER_TAG, "logger_queue full");
-        return ESP_FAIL;
+    switch(overflow_policy){
+        case LOGGER_OVERFLOW_DROP_OLDEST: {
+            uint8_t dropped_tag;
+            while(ret == ESP_ERR_NO_MEM && log_ring_drop_oldest(&logger_ring, &dropped_tag) == ESP_OK){
+                atomic_fetch_add(&dropped_records[dropped_tag < LOG_TAG_COUNT ? dropped_tag : LOG_TAG_UNKNOWN], 1);
+                ret = log_ring_push(&logger_ring, record, size, record->tag_id);
+            }
+            break;
+        }
+        case LOGGER_OVERFLOW_BLOCK: {
+            if(xTaskGetCurrentTaskHandle() == logger_task_handle){
+                // the logger task would only wait for itself
+                break;
+            }
+            TickType_t start = xTaskGetTickCount();
+            TickType_t timeout = pdMS_TO_TICKS(LOGGER_BLOCK_TIMEOUT_MS);
+            atomic_fetch_add(&blocked_producers, 1);
+            while(ret == ESP_ERR_NO_MEM){
+                TickType_t elapsed = xTaskGetTickCount() - start;
+                if(elapsed >= timeout){
+                    break;
+                }
+                xTaskNotifyGive(logger_task_handle);
+                xSemaphoreTake(logger_space, timeout - elapsed);
+                ret = log_ring_push(&logger_ring, record, size, record->tag_id);
+            }
+            atomic_fetch_sub(&blocked_producers, 1);
+            break;
+        }
+        default:
+            break;
+    }
+    return ret;
+}
+
+static bool is_security_event(log_event_code event){
+    switch(event){
+        case LOG_EVENT_ACCESS_GRANTED:
+        case LOG_EVENT_ACCESS_DENIED:
+        case LOG_EVENT_LOGIN:
+        case LOG_EVENT_ACCESSLEVEL_REQUEST:
+        case LOG_EVENT_BRUTE_FORCE_DEVICE:
+        case LOG_EVENT_BRUTE_FORCE_KEY:
+        case LOG_EVENT_ACCESS_LOCKED:
+            return true;
+        default:
+            return false;
     }
-    return ESP_OK;
 }
 
 void midnight_task(void *pvParameters) {
     while (1) {
+        // midnight is meaningless before the first sync
+        wait_for_valid_time(portMAX_DELAY);
+
         time_t now;
         struct tm timeinfo;
         time(&now);
@@ -142,16 +412,17 @@ void midnight_task(void *pvParameters) {
         // Run the function
         run_at_midnight();
 
-        // Sleep for 2 minutes to avoid running the task again if there are slight time drifts
+        // Sleep for 2 minutes to avoid running the task again if there are slight time drifts, the time service re-syncs on its own
         vTaskDelay(120 * 1000 / portTICK_PERIOD_MS);
-
-        // Reset time to reduce drift
-        set_time_using_sntp();
     }
 }
 
 esp_err_t run_at_midnight() {
     ESP_LOGI(LOGGER_TAG, "MIDNIGHT TIMER GOING OFF");
+    // usage rollups first, they are small and answer most questions without the raw logs
+    if(send_all_rollups_to_api() != ESP_OK){
+        ESP_LOGE(LOGGER_TAG, "failed to push usage rollups to api");
+    }
     // push daily logs to mysql server and delete logs that where succesfully pushed
     if(send_all_logs_to_api(true) == ESP_OK){
         ESP_LOGI(LOGGER_TAG, "succesfully pushed all logs to api");
@@ -167,9 +438,10 @@ void destruct_logger_task(){
         vSemaphoreDelete(logger_mutex);
         logger_mutex = NULL;
     }
-    if(logger_queue != NULL){
-        vQueueDelete(logger_queue);
-        logger_queue = NULL;
+    logger_ring_active = false;
+    if(logger_space != NULL){
+        vSemaphoreDelete(logger_space);
+        logger_space = NULL;
     }
 	ESP_LOGE(LOGGER_TAG, "destoying logger task");
 	vTaskDelete(NULL);
@@ -183,12 +455,11 @@ int get_log(int logline, char *buffer, size_t buffer_size){
     }
     xSemaphoreTake(logger_mutex, portMAX_DELAY);
 
-    if(logline <= LOG_LINES){
-        read_line_from_file(LOGSFILENAME, logline, buffer, buffer_size);
-
-        int count = 0;
-        while (buffer[count] != '\0' && buffer[count] != '\n') {
-            count++;
+    log_record_t record;
+    if(logline <= count_segment_logs() && read_log_record(logline, &record) == ESP_OK){
+        int count = format_log_line(&record, buffer, buffer_size);
+        if(count >= buffer_size){
+            count = buffer_size - 1;
         }
         // unlock mutex
         xSemaphoreGive(logger_mutex);
@@ -203,50 +474,97 @@ int get_log(int logline, char *buffer, size_t buffer_size){
 }
 
 esp_err_t parse_logs(int start_line, int end_line, log_t *logs, int max_logs) {
+    // lock mutex
+    if(logger_mutex == NULL){
+        ESP_LOGE(LOGGER_TAG, "failed to parse logs, logger_mutex not active");
+        return ESP_FAIL;
+    }
+    xSemaphoreTake(logger_mutex, portMAX_DELAY);
 
     int logs_stored = 0;
-
     for (int i = start_line; i <= end_line && logs_stored < max_logs; i++) {
-        char buffer[300];
-
-        int read_count = get_log(i, buffer, sizeof(buffer));
-        if (read_count == -1) {
+        log_record_t record;
+        if (read_log_record(i, &record) != ESP_OK) {
+            xSemaphoreGive(logger_mutex);
             return ESP_FAIL;
         }
+        format_log_record(&record, &logs[logs_stored]);
+        logs_stored++;
+    }
 
-        // Parse the line as CSV
-        char *token = strtok(buffer, ",");
-        if (token == NULL) {
-            continue;
-        }
-        strncpy(logs[logs_stored].tag, token, sizeof(logs[logs_stored].tag) - 1);
-        logs[logs_stored].tag[sizeof(logs[logs_stored].tag) - 1] = '\0';
+    // unlock mutex
+    xSemaphoreGive(logger_mutex);
+    return ESP_OK;
+}
 
-        token = strtok(NULL, ",");
-        if (token == NULL) {
-            continue;
-        }
-        strncpy(logs[logs_stored].date_time, token, sizeof(logs[logs_stored].date_time) - 1);
-        logs[logs_stored].date_time[sizeof(logs[logs_stored].date_time) - 1] = '\0';
+int parse_segment_logs(uint32_t seq, int start_line, log_t *logs, int max_logs) {
+    // lock mutex
+    if(logger_mutex == NULL){
+        ESP_LOGE(LOGGER_TAG, "failed to parse segment logs, logger_mutex not active");
+        return ESP_FAIL;
+    }
+    xSemaphoreTake(logger_mutex, portMAX_DELAY);
 
-        token = strtok(NULL, ",");
-        if (token == NULL) {
-            continue;
+    // the segment may be compressed, the log store reads it a few records at a time
+    log_record_t records[LOGGER_QUERY_CHUNK];
+    int logs_stored = 0;
+    while (logs_stored < max_logs) {
+        int wanted = max_logs - logs_stored < LOGGER_QUERY_CHUNK ? max_logs - logs_stored : LOGGER_QUERY_CHUNK;
+        int found = read_segment_records(seq, start_line + logs_stored, records, wanted);
+        if (found < 0) {
+            xSemaphoreGive(logger_mutex);
+            return ESP_FAIL;
+        }
+        for (int i = 0; i < found; ++i) {
+            format_log_record(&records[i], &logs[logs_stored++]);
+        }
+        if (found < wanted) {
+            break;
         }
-        strncpy(logs[logs_stored].info, token, sizeof(logs[logs_stored].info) - 1);
-        logs[logs_stored].info[sizeof(logs[logs_stored].info) - 1] = '\0';
+    }
 
-        logs_stored++;
+    // unlock mutex
+    xSemaphoreGive(logger_mutex);
+    return logs_stored;
+}
+
+int query_log_records(log_query_t *query, log_record_t *records, int max_records){
+    // lock mutex
+    if(logger_mutex == NULL){
+        ESP_LOGE(LOGGER_TAG, "failed to query logs, logger_mutex not active");
+        return ESP_FAIL;
     }
+    xSemaphoreTake(logger_mutex, portMAX_DELAY);
 
-    return ESP_OK;
+    int ret = query_log_segments(query, records, max_records);
+
+    // unlock mutex
+    xSemaphoreGive(logger_mutex);
+    return ret;
+}
+
+int query_logs(log_query_t *query, log_t *logs, int max_logs){
+    // records are rendered outside the mutex, a few at a time to keep the stack small
+    log_record_t records[LOGGER_QUERY_CHUNK];
+    int logs_stored = 0;
+    while(logs_stored < max_logs && !query->done){
+        int wanted = max_logs - logs_stored < LOGGER_QUERY_CHUNK ? max_logs - logs_stored : LOGGER_QUERY_CHUNK;
+        int found = query_log_records(query, records, wanted);
+        if(found < 0){
+            return ESP_FAIL;
+        }
+        for(int i = 0; i < found; ++i){
+            format_log_record(&records[i], &logs[logs_stored++]);
+        }
+    }
+    return logs_stored;
 }
 
 int get_log_lines(){
     // lock mutex
     xSemaphoreTake(logger_mutex, portMAX_DELAY);
 
-    int ret = LOG_LINES;
+    int ret = count_segment_logs();
 
     // unlock mutex
     xSemaphoreGive(logger_mutex);
@@ -266,16 +584,15 @@ esp_err_t delete_logs(int start_log, int end_log) {
     }
     xSemaphoreTake(logger_mutex, portMAX_DELAY);
 
-    // Check if end_log is larger than LOG_LINES
-    if (end_log > LOG_LINES) {
-        ESP_LOGE(LOGGER_TAG, "Invalid log range: end_log cannot be larger than LOG_LINES");
+    // Check if end_log is larger than the amount of logs
+    if (end_log > count_segment_logs()) {
+        ESP_LOGE(LOGGER_TAG, "Invalid log range: end_log cannot be larger than the amount of logs");
         xSemaphoreGive(logger_mutex);
         return ESP_FAIL;
     }
 
-    esp_err_t ret = delete_lines_from_file(LOGSFILENAME, start_log, end_log);
+    esp_err_t ret = delete_log_records(start_log, end_log);
     if (ret == ESP_OK) {
-        LOG_LINES -= (end_log - start_log + 1);
         ESP_LOGI(LOGGER_TAG, "Successfully deleted logs %d to %d", start_log, end_log);
     } else {
         ESP_LOGE(LOGGER_TAG, "Failed to delete logs %d to %d", start_log, end_log);
@@ -295,9 +612,8 @@ esp_err_t clear_logs(){
     }
     xSemaphoreTake(logger_mutex, portMAX_DELAY);
 
-    esp_err_t ret = delete_file_content(LOGSFILENAME);
+    esp_err_t ret = clear_log_segments();
     if(ret == ESP_OK){
-        LOG_LINES = 0;
         ESP_LOGI(LOGGER_TAG, "succesfully cleared all logs");
     }else{
         ESP_LOGW(LOGGER_TAG, "failed to clear all logs");
@@ -308,9 +624,138 @@ esp_err_t clear_logs(){
     return ret;
 }
 
+esp_err_t seal_logs(){
+    // lock mutex
+    if(logger_mutex == NULL){
+        ESP_LOGE(LOGGER_TAG, "failed to seal logs, logger_mutex not active");
+        return ESP_FAIL;
+    }
+    xSemaphoreTake(logger_mutex, portMAX_DELAY);
+
+    esp_err_t ret = rotate_log_segment();
+
+    // unlock mutex
+    xSemaphoreGive(logger_mutex);
+    return ret;
+}
+
+int get_log_segment_list(log_segment_t *segments_copy, int max_segments){
+    // lock mutex
+    if(logger_mutex == NULL){
+        ESP_LOGE(LOGGER_TAG, "failed to list log segments, logger_mutex not active");
+        return ESP_FAIL;
+    }
+    xSemaphoreTake(logger_mutex, portMAX_DELAY);
+
+    int ret = get_log_segments(segments_copy, max_segments);
+
+    // unlock mutex
+    xSemaphoreGive(logger_mutex);
+    return ret;
+}
+
+esp_err_t drop_log_segment(uint32_t seq){
+    // lock mutex
+    if(logger_mutex == NULL){
+        ESP_LOGE(LOGGER_TAG, "failed to drop log segment, logger_mutex not active");
+        return ESP_FAIL;
+    }
+    xSemaphoreTake(logger_mutex, portMAX_DELAY);
+
+    esp_err_t ret = delete_log_segment(seq);
+    if(ret == ESP_OK){
+        ESP_LOGI(LOGGER_TAG, "succesfully dropped log segment %u", (unsigned)seq);
+    }
+
+    // unlock mutex
+    xSemaphoreGive(logger_mutex);
+    return ret;
+}
+
+void get_log_upload_cursor(log_cursor_t *cursor){
+    // lock mutex
+    if(logger_mutex == NULL){
+        memset(cursor, 0, sizeof(log_cursor_t));
+        return;
+    }
+    xSemaphoreTake(logger_mutex, portMAX_DELAY);
+
+    get_upload_cursor(cursor);
+
+    // unlock mutex
+    xSemaphoreGive(logger_mutex);
+}
+
+esp_err_t advance_log_upload_cursor(const log_cursor_t *cursor){
+    // lock mutex
+    if(logger_mutex == NULL){
+        ESP_LOGE(LOGGER_TAG, "failed to advance upload cursor, logger_mutex not active");
+        return ESP_FAIL;
+    }
+    xSemaphoreTake(logger_mutex, portMAX_DELAY);
+
+    esp_err_t ret = set_upload_cursor(cursor);
+
+    // unlock mutex
+    xSemaphoreGive(logger_mutex);
+    return ret;
+}
+
+esp_err_t reclaim_logs(){
+    // lock mutex
+    if(logger_mutex == NULL){
+        ESP_LOGE(LOGGER_TAG, "failed to reclaim logs, logger_mutex not active");
+        return ESP_FAIL;
+    }
+    xSemaphoreTake(logger_mutex, portMAX_DELAY);
+
+    esp_err_t ret = reclaim_uploaded_segments();
+
+    // unlock mutex
+    xSemaphoreGive(logger_mutex);
+    return ret;
+}
+
+int get_log_upload_lag(uint32_t *oldest_epoch){
+    // lock mutex
+    if(logger_mutex == NULL){
+        *oldest_epoch = 0;
+        return ESP_FAIL;
+    }
+    xSemaphoreTake(logger_mutex, portMAX_DELAY);
+
+    int ret = count_pending_logs(oldest_epoch);
+
+    // unlock mutex
+    xSemaphoreGive(logger_mutex);
+    return ret;
+}
+
+void get_logger_stats(logger_stats_t *stats_copy){
+    // lock mutex
+    if(logger_mutex == NULL){
+        memset(stats_copy, 0, sizeof(logger_stats_t));
+        return;
+    }
+    xSemaphoreTake(logger_mutex, portMAX_DELAY);
+
+    *stats_copy = stats;
+    for(int i = 0; i < LOG_TAG_COUNT; ++i){
+        stats_copy->dropped[i] = atomic_load(&dropped_records[i]);
+    }
+    stats_copy->ring_high_water = ring_high_water;
+    // the window is only closed when records arrive, an idle logger reports its real rate
+    int64_t elapsed = esp_timer_get_time() - rate_window_start;
+    if(elapsed >= 2000000){
+        stats_copy->records_per_second = (uint32_t)(rate_window_records * 1000000LL / elapsed);
+    }
+
+    // unlock mutex
+    xSemaphoreGive(logger_mutex);
+}
+
 void test_logger(){
-    delete_file_content(LOGSFILENAME);
-    LOG_LINES = 0;
+    clear_logs();
 
     for (int log = 1; log < 203; ++log){
         char info[50];
@@ -322,5 +767,11 @@ void test_logger(){
     }
 
     vTaskDelay(5000 / portTICK_PERIOD_MS);
-    pretty_print_file_content(LOGSFILENAME);
+    log_segment_t segments_copy[LOG_MAX_SEGMENTS];
+    int amount = get_log_segment_list(segments_copy, LOG_MAX_SEGMENTS);
+    for (int i = 0; i < amount; ++i){
+        char path[LOG_SEGMENT_PATH_LEN];
+        log_segment_path(segments_copy[i].seq, path, sizeof(path));
+        pretty_print_file_content(path);
+    }
 }
\ No newline at end of file
@@ -5,27 +5,56 @@
 #ifndef LOGGER_H
 #define LOGGER_H
 
+#include <stdint.h>
 #include "esp_err.h"
+#include "log_record.h"
+#include "log_segments.h"
+#include "log_ring.h"
+#include "log_query.h"
 
 #define LOGGER_TAG "LOGGER"
 
-#define LOGGER_QUEUE_LEN 20
-#define LOGGER_QUEUE_ITEM_LEN 200 // should be smaller then 255 for pretty_print_file_content() in spiffs.h to work correctly
-#define LOGSFILENAME "/spiffs/logs.txt"
-#define MAX_LOG_LINES 200
-
-typedef struct log_t {
-    char tag[20];
-    char date_time[50];
-    char info[220];
-} log_t;
+#define LOGGER_RING_SIZE CONFIG_LOGGER_RING_SIZE                    // bytes, records are stored with their real length
+#define LOGGER_PRIORITY_RING_SIZE CONFIG_LOGGER_PRIORITY_RING_SIZE  // bytes, security events only
+#define LOGGER_BLOCK_TIMEOUT_MS CONFIG_LOGGER_BLOCK_TIMEOUT_MS
+#define LOGGER_BLOCKED_PRODUCERS_MAX 16     // producers that can wait for room at the same time
+#define LOGGER_BATCH_MAX 32         // group commit: records written with one open and one write
+#define LOGGER_BATCH_LINGER_MS 20   // how long to wait for more records after the first one arrived
+#define LOGGER_BATCH_BUCKETS 6      // batch size histogram: 1, 2-3, 4-7, 8-15, 16-31, 32+
+#define LOGGER_QUERY_CHUNK 8        // records read per mutex hold by query_logs
+
+typedef enum logger_overflow_policy_t {
+    LOGGER_OVERFLOW_DROP_NEWEST,
+    LOGGER_OVERFLOW_DROP_OLDEST,
+    LOGGER_OVERFLOW_BLOCK,
+    LOGGER_OVERFLOW_PRIORITY_LANE,
+} logger_overflow_policy_t;
+
+typedef struct logger_stats_t {
+    uint32_t records_written;
+    uint32_t batches_written;
+    uint32_t write_failures;
+    uint32_t batch_size_histogram[LOGGER_BATCH_BUCKETS];
+    uint32_t records_per_second;        // over the last measured second
+    uint32_t peak_records_per_second;
+    uint32_t dropped[LOG_TAG_COUNT];    // records lost to a full ring, per tag
+    uint32_t ring_high_water;           // most bytes ever waiting in the ring
+} logger_stats_t;
 
 void logger_task(void *pvParameters);
 
-esp_err_t init_logger_queue();
+esp_err_t init_logger_ring();
+
+void set_logger_overflow_policy(logger_overflow_policy_t policy);
 
 esp_err_t log_item(char *tag, char *info);
 
+esp_err_t log_event(log_tag_id tag_id, log_event_code event, uint16_t device, uint64_t key, const char *text);
+
+void logger_time_synced();
+
+void logger_summaries_due();
+
 void midnight_task(void *pvParameters);
 
 esp_err_t run_at_midnight();
@@ -36,10 +65,32 @@ int get_log(int logline, char *buffer, size_t buffer_size);
 
 esp_err_t parse_logs(int start_line, int end_line, log_t *logs, int max_logs);
 
+int query_log_records(log_query_t *query, log_record_t *records, int max_records);
+
+int query_logs(log_query_t *query, log_t *logs, int max_logs);
+
 int get_log_lines();
 
 esp_err_t delete_logs(int start_log, int end_log);
 
 esp_err_t clear_logs();
 
+esp_err_t seal_logs();
+
+int get_log_segment_list(log_segment_t *segments_copy, int max_segments);
+
+int parse_segment_logs(uint32_t seq, int start_line, log_t *logs, int max_logs);
+
+esp_err_t drop_log_segment(uint32_t seq);
+
+void get_log_upload_cursor(log_cursor_t *cursor);
+
+esp_err_t advance_log_upload_cursor(const log_cursor_t *cursor);
+
+esp_err_t reclaim_logs();
+
+int get_log_upload_lag(uint32_t *oldest_epoch);
+
+void get_logger_stats(logger_stats_t *stats_copy);
+
 #endif //LOGGER_H
\ No newline at end of file
@@ -3,59 +3,122 @@
 //
 
 #include <string.h>
+#include <stdlib.h>
+#include <sys/time.h>
 #include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-#include "esp_system.h"
-#include "esp_wifi.h"
-#include "esp_event.h"
+#include "freertos/event_groups.h"
 #include "esp_log.h"
-#include "nvs_flash.h"
-#include "lwip/err.h"
-#include "lwip/sys.h"
-#include "lwip/apps/sntp.h"
+#include "esp_timer.h"
+#include "esp_sntp.h"
+#include "../wifi_events/wifi_events.h"
 #include "sntp.h"
 
-static bool sntp_initialized = false;
 
-static void initialize_sntp(void) {
+// Forward declarations for static functions/params
+static EventGroupHandle_t time_event_group;
+static portMUX_TYPE time_lock = portMUX_INITIALIZER_UNLOCKED;
+static time_service_status_t status;
+static int64_t last_sync_uptime;    // us
+static int64_t last_sync_wall;      // us
+static uint32_t drift_samples;
+static time_sync_listener_t sync_listener;
+static void time_sync_cb(struct timeval *tv);
+
+
+esp_err_t init_time_service(time_sync_listener_t listener) {
+    if (time_event_group != NULL) {
+        return ESP_OK;
+    }
+    time_event_group = xEventGroupCreate();
+    if (time_event_group == NULL) {
+        ESP_LOGE(SNTP_TAG, "Failed to create time event group");
+        return ESP_FAIL;
+    }
+    sync_listener = listener;
+
+    // the timezone does not depend on the sync, set it right away
+    setenv("TZ", SNTP_TIMEZONE, 1);
+    tzset();
+
     ESP_LOGI(SNTP_TAG, "Initializing SNTP");
-    sntp_setoperatingmode(SNTP_OPMODE_POLL);
-    sntp_setservername(0, "pool.ntp.org");
-    sntp_init();
-    sntp_initialized = true;
+    esp_sntp_setoperatingmode(SNTP_OPMODE_POLL);
+    esp_sntp_setservername(0, SNTP_SERVER);
+    sntp_set_time_sync_notification_cb(time_sync_cb);
+    sntp_set_sync_interval(SNTP_RESYNC_INTERVAL_MIN * 60 * 1000);
+    esp_sntp_init();
+    return ESP_OK;
+}
+
+EventGroupHandle_t get_time_event_group(void) {
+    return time_event_group;
+}
+
+bool time_is_valid(void) {
+    return time_event_group != NULL && (xEventGroupGetBits(time_event_group) & TIME_VALID_BIT) != 0;
+}
+
+bool wait_for_valid_time(TickType_t timeout) {
+    if (time_event_group == NULL) {
+        return false;
+    }
+    return (xEventGroupWaitBits(time_event_group, TIME_VALID_BIT, pdFALSE, pdTRUE, timeout) & TIME_VALID_BIT) != 0;
 }
 
-esp_err_t set_time_using_sntp(void) {
-    if (!sntp_initialized) {
-        initialize_sntp();
+esp_err_t request_time_sync(void) {
+    // sends a request now instead of at the next poll, the result arrives through the callback
+    if (time_event_group == NULL || !sntp_restart()) {
+        return ESP_FAIL;
     }
+    return ESP_OK;
+}
 
-    // Wait for the system time to be set
-    time_t now = 0;
-    struct tm timeinfo = { 0 };
-    int retry = 0;
-    const int retry_count = 10;
-
-    while (timeinfo.tm_year < (2016 - 1900) && ++retry < retry_count) {
-        ESP_LOGI(SNTP_TAG, "Waiting for system time to be set... (%d/%d)", retry, retry_count);
-        vTaskDelay(2000 / portTICK_PERIOD_MS);
-        time(&now);
-        localtime_r(&now, &timeinfo);
+void time_service_connectivity_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data) {
+    // back online, ask for the time now instead of at the next poll
+    if (event_id == WIFI_CONNECTIVITY_ONLINE) {
+        request_time_sync();
     }
+}
 
-    if (retry < retry_count) {
-        // Set the timezone information for Belgium
-        setenv("TZ", "CET-1CEST,M3.5.0,M10.5.0/3", 1); // indicating the transition to summer time on the last Sunday of March (M3.5.0) and the transition back to winter time on the last Sunday of October (M10.5.0/3)
-        tzset();
+int32_t get_time_drift_ppm(void) {
+    portENTER_CRITICAL(&time_lock);
+    int32_t drift = status.drift_ppm;
+    portEXIT_CRITICAL(&time_lock);
+    return drift;
+}
 
-        // Update the timeinfo structure with the new time
-        time(&now);
-        localtime_r(&now, &timeinfo);
+void get_time_service_status(time_service_status_t *status_copy) {
+    portENTER_CRITICAL(&time_lock);
+    *status_copy = status;
+    portEXIT_CRITICAL(&time_lock);
+}
 
-        ESP_LOGI(SNTP_TAG, "System time set using SNTP");
-        return ESP_OK;
-    } else {
-        ESP_LOGE(SNTP_TAG, "Failed to set system time using SNTP");
-        return ESP_FAIL;
+static void time_sync_cb(struct timeval *tv) {
+    // runs in the lwip task, only bookkeeping here
+    int64_t uptime = esp_timer_get_time();
+    int64_t wall = (int64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+
+    portENTER_CRITICAL(&time_lock);
+    if (status.syncs > 0) {
+        // the clock ran for elapsed us since the last sync, the server says it should have been wall - last_sync_wall
+        int64_t elapsed = uptime - last_sync_uptime;
+        int64_t step = wall - (last_sync_wall + elapsed);
+        status.last_step_ms = step / 1000;
+        if (elapsed >= (int64_t)SNTP_DRIFT_MIN_INTERVAL_S * 1000000) {
+            int32_t drift = step * 1000000 / elapsed;
+            // smooth out the jitter of single measurements
+            status.drift_ppm = drift_samples > 0 ? (3 * status.drift_ppm + drift) / 4 : drift;
+            drift_samples++;
+        }
     }
-}
\ No newline at end of file
+    last_sync_uptime = uptime;
+    last_sync_wall = wall;
+    status.valid = true;
+    status.syncs++;
+    status.last_sync = tv->tv_sec;
+    portEXIT_CRITICAL(&time_lock);
+
+    xEventGroupSetBits(time_event_group, TIME_VALID_BIT);
+    if (sync_listener != NULL) {
+        sync_listener();
+    }
+}
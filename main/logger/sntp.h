@@ -2,13 +2,58 @@
 // Created by Vincent.
 //
 
+/*
+    Time service. SNTP runs in the background: lwip polls the server and
+    re-syncs every SNTP_RESYNC_INTERVAL_MIN on its own, nothing waits for it.
+    Every sync sets TIME_VALID_BIT in the time event group and updates the
+    drift estimate of the local clock against the server. Tasks that need
+    wall-clock time wait for the bit, everything else just carries on.
+*/
+
 #ifndef SNTP_H
 #define SNTP_H
 
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "esp_bit_defs.h"
 #include "esp_err.h"
+#include "esp_event.h"
 
 #define SNTP_TAG "SNTP"
 
-esp_err_t set_time_using_sntp(void);
+#define SNTP_SERVER "pool.ntp.org"
+#define SNTP_TIMEZONE "CET-1CEST,M3.5.0,M10.5.0/3"  // Belgium, summer time from the last Sunday of March to the last Sunday of October
+#define SNTP_RESYNC_INTERVAL_MIN 60
+#define SNTP_DRIFT_MIN_INTERVAL_S 600   // syncs closer together than this say nothing about the drift
+#define TIME_VALID_BIT BIT0
+
+typedef void (*time_sync_listener_t)(void);
+
+typedef struct time_service_status_t {
+    bool valid;
+    uint32_t syncs;
+    time_t last_sync;
+    int32_t last_step_ms;   // how far the local clock was off at the last sync
+    int32_t drift_ppm;      // local clock against the server, positive when it runs slow
+} time_service_status_t;
+
+esp_err_t init_time_service(time_sync_listener_t listener);
+
+EventGroupHandle_t get_time_event_group(void);
+
+bool time_is_valid(void);
+
+bool wait_for_valid_time(TickType_t timeout);
+
+esp_err_t request_time_sync(void);
+
+void time_service_connectivity_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
+
+int32_t get_time_drift_ppm(void);
+
+void get_time_service_status(time_service_status_t *status);
 
-#endif //SNTP_H
\ No newline at end of file
+#endif //SNTP_H
@@ -18,6 +18,8 @@
 
 #include "services/service_message_handler.h"
 #include "SQL_server/SQL_server.h"
+#include "SQL_server/api_client.h"
+#include "SQL_server/log_uploader.h"
 #include "logger/sntp.h"
 #include "mirf/mirf.h"
 #include "nrf/nrf.h"
@@ -28,6 +30,7 @@
 #include "services/tcp_server/tcp_server.h"
 #include "services/https_server/https_server.h"
 #include "wifi_events/wifi_events.h"
+#include "json_arena/json_arena.h"
 
 
 #ifdef CONFIG_RUN_TESTS
@@ -48,6 +51,9 @@ void app_main() {
     // Create event loop with default settings
     ESP_ERROR_CHECK(esp_event_loop_create_default());
 
+    // cJSON allocates through the arena hooks from the first request on
+    ESP_ERROR_CHECK(init_json_arena());
+
     // clear spiffs
     //ESP_ERROR_CHECK(clear_spiffs());
 
@@ -56,14 +62,19 @@ void app_main() {
      */
     static httpd_handle_t server = NULL;
 #ifdef CONFIG_EXAMPLE_CONNECT_WIFI
-    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &connect_handler, &server));
-    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &disconnect_handler, &server));
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_CONNECTIVITY_EVENT, WIFI_CONNECTIVITY_ONLINE, &connect_handler, &server));
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_CONNECTIVITY_EVENT, WIFI_CONNECTIVITY_OFFLINE, &disconnect_handler, &server));
 #endif // CONFIG_EXAMPLE_CONNECT_WIFI
 #ifdef CONFIG_EXAMPLE_CONNECT_ETHERNET
     ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_ETH_GOT_IP, &connect_handler, &server));
     ESP_ERROR_CHECK(esp_event_handler_register(ETH_EVENT, ETHERNET_EVENT_DISCONNECTED, &disconnect_handler, &server));
 #endif // CONFIG_EXAMPLE_CONNECT_ETHERNET
 
+    // the log uploader and the time service follow the WiFi connection from its first event on
+    init_log_uploader();
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_CONNECTIVITY_EVENT, ESP_EVENT_ANY_ID, &log_uploader_connectivity_handler, NULL));
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_CONNECTIVITY_EVENT, WIFI_CONNECTIVITY_ONLINE, &time_service_connectivity_handler, NULL));
+
     // Connect to Wi-Fi or Ethernet
     ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_events_handler, NULL));
     ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &wifi_events_handler, NULL));
@@ -80,6 +91,7 @@ void app_main() {
 
         // init REST API connection
         init_SQL_server_mutex();
+        init_api_client();
 
         // start logger
         xTaskCreate(logger_task, "logger_task", 1024*4, NULL, 2, NULL);
@@ -117,6 +129,21 @@ void app_main() {
     RUN_TEST(test_log_item);
     RUN_TEST(stress_test_log_item);
     RUN_TEST(test_delete_logs);
+    RUN_TEST(test_seal_and_drop_log_segment);
+    RUN_TEST(test_log_record_size);
+    RUN_TEST(test_parse_log_info);
+    RUN_TEST(test_group_commit);
+    RUN_TEST(test_ring_overflow_policies);
+    RUN_TEST(test_query_logs);
+    RUN_TEST(test_upload_cursor);
+    RUN_TEST(test_log_limiter);
+    RUN_TEST(test_log_limiter_per_device);
+    RUN_TEST(test_monotonic_timestamps);
+    RUN_TEST(test_time_service);
+    RUN_TEST(test_usage_rollups);
+    RUN_TEST(test_log_sinks);
+    RUN_TEST(test_syslog_format);
+    RUN_TEST(test_log_compression);
 
 #endif
 
@@ -131,6 +158,8 @@ void app_main() {
     RUN_TEST(test_change_key_access_level);
     RUN_TEST(test_change_device_access_level);
     RUN_TEST(test_has_access);
+    RUN_TEST(test_brute_force_detector);
+    RUN_TEST(test_occupancy);
     RUN_TEST(test_delete_all_keys);
     RUN_TEST(test_delete_all_devices);
 
@@ -161,6 +190,15 @@ void app_main() {
     esp_log_level_set("*", ESP_LOG_NONE);
     vTaskDelay(2000 / portTICK_PERIOD_MS);
     RUN_TEST(test_send_log_to_api);
+    RUN_TEST(test_api_client_reuses_connection);
+    RUN_TEST(test_send_logs_to_api_streamed);
+    RUN_TEST(test_log_msgpack_blocks);
+    RUN_TEST(test_json_arena_soak);
+    RUN_TEST(test_send_log_batch_to_api);
+    RUN_TEST(test_send_log_batch_reuses_connection);
+#ifdef CONFIG_TEST_UPLOAD_BENCHMARK
+    RUN_TEST(test_upload_benchmark);
+#endif
 
 #endif
 
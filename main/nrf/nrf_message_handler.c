@@ -13,7 +13,10 @@
 #include "driver/gpio.h"
 #include "nrf.h"
 #include "../logger/logger.h"
+#include "../logger/log_rollup.h"
 #include "../access/access.h"
+#include "../access/brute_force.h"
+#include "../access/occupancy.h"
 #include "nrf_message_handler.h"
 
 void nrf_message_handler_task(void *pvParameters){
@@ -25,7 +28,6 @@ void nrf_message_handler_task(void *pvParameters){
 			// handle message from nrf_message_handler_queue
 			nrf_message_type type = queue_item[0] - '0';
             int device = (queue_item[1] - '0') * 10 + (queue_item[2] - '0');
-            char log_message[LOGGER_QUEUE_ITEM_LEN];
             switch (type){
                 case ACCESS_TYPE:
                 
@@ -36,25 +38,43 @@ void nrf_message_handler_task(void *pvParameters){
                         ibutton[i * 2 + 1] = hex_chars[queue_item[i+3] & 0x0F];
                     }
                     ibutton[16] = 0;
+                    uint64_t key = 0;
+                    for (int i = 0; i < 8; ++i) {
+                        key = (key << 8) | (uint8_t)queue_item[i+3];
+                    }
 
                     if(queue_item[NRF_DATA_LEN - 1] == 'X'){
                         // handling of ACK message (for logging purposes)
                         if(queue_item[3] == '1'){
-                            snprintf(log_message, LOGGER_QUEUE_ITEM_LEN, "sending TURNON to device: %d", device);
-                            log_item(NRF_MESSAGE_HANDLER_TAG, (char *)log_message);
+                            log_event(LOG_TAG_NRF_MESSAGE_HANDLER, LOG_EVENT_SEND_TURNON, device, 0, NULL);
+                            rollup_device_state(device, true);
                         }else if(queue_item[3] == '0'){
-                            snprintf(log_message, LOGGER_QUEUE_ITEM_LEN, "sending TURNOFF to device: %d", device);
-                            log_item(NRF_MESSAGE_HANDLER_TAG, (char *)log_message);
+                            log_event(LOG_TAG_NRF_MESSAGE_HANDLER, LOG_EVENT_SEND_TURNOFF, device, 0, NULL);
+                            rollup_device_state(device, false);
+                            occupancy_released(device);
                         }
                     }else{
                         // handling of actual access message
-                        if (has_access(device, ibutton) == 0){
+                        if (brute_force_locked(device)){
+                            ESP_LOGW(NRF_MESSAGE_HANDLER_TAG, "received ACCESS from device: %d, ibutton: %s, device locked out", device, ibutton);
+                            log_event(LOG_TAG_NRF_MESSAGE_HANDLER, LOG_EVENT_ACCESS_LOCKED, device, key, NULL);
+                            rollup_access(device, key, false);
+
+                            // send turn off message
+                            send_nrf_message(device, TURNOFF);
+                        } else if (has_access(device, ibutton) == 0){
                             ESP_LOGI(NRF_MESSAGE_HANDLER_TAG, "received ACCESS from device: %d, ibutton: %s, access granted", device, ibutton);
+                            log_event(LOG_TAG_NRF_MESSAGE_HANDLER, LOG_EVENT_ACCESS_GRANTED, device, key, NULL);
+                            rollup_access(device, key, true);
+                            occupancy_granted(device, key);
 
                             // send turn on message
                             send_nrf_message(device, TURNON);
                         } else {
                             ESP_LOGW(NRF_MESSAGE_HANDLER_TAG, "received ACCESS from device: %d, ibutton: %s, access denied", device, ibutton);
+                            log_event(LOG_TAG_NRF_MESSAGE_HANDLER, LOG_EVENT_ACCESS_DENIED, device, key, NULL);
+                            rollup_access(device, key, false);
+                            brute_force_record_deny(device, key);
                     
                             // send turn off message
                             send_nrf_message(device, TURNOFF);
@@ -65,12 +85,10 @@ void nrf_message_handler_task(void *pvParameters){
                     int error_code = queue_item[3] - '0';
                     if (error_code == 1){
                         ESP_LOGI(NRF_MESSAGE_HANDLER_TAG, "received PING from device: %d, successful", device);
-                        snprintf(log_message, LOGGER_QUEUE_ITEM_LEN, "received PING from device: %d, successful", device);
-                        log_item(NRF_MESSAGE_HANDLER_TAG, (char *)log_message);
+                        log_event(LOG_TAG_NRF_MESSAGE_HANDLER, LOG_EVENT_PING_OK, device, 0, NULL);
                     } else {
                         ESP_LOGW(NRF_MESSAGE_HANDLER_TAG, "received PING from device: %d, error code: %d", device, error_code);
-                        snprintf(log_message, LOGGER_QUEUE_ITEM_LEN, "received PING from device: %d, error code: %d", device, error_code);
-                        log_item(NRF_MESSAGE_HANDLER_TAG, (char *)log_message);
+                        log_event(LOG_TAG_NRF_MESSAGE_HANDLER, LOG_EVENT_PING_ERROR, device, error_code, NULL);
                     }
                     break;
                 default:
@@ -8,6 +8,9 @@
 #include <esp_system.h>
 #include <nvs_flash.h>
 #include <sys/param.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
 #include "esp_netif.h"
 #include "esp_eth.h"
 #include "protocol_examples_common.h"
@@ -15,14 +18,30 @@
 #include "../service_message_handler.h"
 #include "../../logger/logger.h"
 #include "../../access/access.h"
+#include "../../access/occupancy.h"
+#include "../../json_arena/json_arena.h"
 #include <esp_https_server.h>
 #include "esp_tls.h"
 #include "https_server.h"
 
 
 // Forward declarations for static functions/params
+typedef struct post_message_t {
+    bool pending;               // the request was valid, the message still has to be handled
+    message_type_service type;
+    void *args;                 // NULL or one of the members below
+    union {
+        turnon_turnoff_service_args_t turnon_turnoff;
+        accesslevel_service_args_t accesslevel;
+    };
+} post_message_t;
 static esp_err_t get_data_handler(httpd_req_t *req);
 static esp_err_t post_data_handler(httpd_req_t *req);
+static esp_err_t handle_post_json(httpd_req_t *req, const char *buf, post_message_t *post);
+static esp_err_t get_logs_handler(httpd_req_t *req);
+static esp_err_t get_occupancy_handler(httpd_req_t *req);
+// the handlers run one at a time in the server task, they share one arena buffer
+static uint8_t json_arena_buffer[HTTPS_JSON_ARENA_SIZE];
 static const httpd_uri_t get_data = {
     .uri = "/get-data",
     .method = HTTP_GET,
@@ -33,6 +52,18 @@ static const httpd_uri_t post_data = {
     .method = HTTP_POST,
     .handler = post_data_handler,
 };
+static const httpd_uri_t get_logs = {
+    .uri = "/logs",
+    .method = HTTP_GET,
+    .handler = get_logs_handler,
+};
+static const httpd_uri_t get_occupancy_uri = {
+    .uri = "/occupancy",
+    .method = HTTP_GET,
+    .handler = get_occupancy_handler,
+};
+static const char *log_query_filters[] = {"from", "to", "tag", "device", "key", "ibutton", "limit", "offset"};
+static esp_err_t url_decode(char *value);
 static httpd_handle_t start_webserver(void);
 static esp_err_t stop_webserver(httpd_handle_t server);
 
@@ -77,6 +108,23 @@ static esp_err_t post_data_handler(httpd_req_t *req) {
     // Null-terminate the received buffer
     buf[ret] = '\0';
 
+    // the parsed request lives in the arena, it goes at once when the handler is done
+    post_message_t post = {.pending = false};
+    json_arena_t arena;
+    json_arena_begin(&arena, json_arena_buffer, sizeof(json_arena_buffer));
+    esp_err_t err = handle_post_json(req, buf, &post);
+    json_arena_end(&arena);
+    if (!post.pending) {
+        return err;
+    }
+
+    // handled outside the scope, a SYNC upload opens an arena of its own in this task
+    handle_service_message(post.type, post.args);
+    httpd_resp_sendstr(req, "Success");
+    return ESP_OK;
+}
+
+static esp_err_t handle_post_json(httpd_req_t *req, const char *buf, post_message_t *post) {
     // Parse the JSON object
     cJSON *root = cJSON_Parse(buf);
     if (root == NULL) {
@@ -115,12 +163,10 @@ static esp_err_t post_data_handler(httpd_req_t *req) {
     {
     case TURNON_SERVICE:
     case TURNOFF_SERVICE:{
-            char log_message[LOGGER_QUEUE_ITEM_LEN];
             if(message_type == TURNON_SERVICE)
-                snprintf(log_message, LOGGER_QUEUE_ITEM_LEN, "TURNON message received from ID: %d", userID);
+                log_event(LOG_TAG_HTTPS_SERVER, LOG_EVENT_TURNON_REQUEST, 0, userID, NULL);
             else
-                snprintf(log_message, LOGGER_QUEUE_ITEM_LEN, "TURNOFF message received from ID: %d", userID);
-            log_item(HTTPS_SERVER_TAG, log_message);
+                log_event(LOG_TAG_HTTPS_SERVER, LOG_EVENT_TURNOFF_REQUEST, 0, userID, NULL);
             cJSON *device_id_json = cJSON_GetObjectItem(root, "device_id");
             if (device_id_json == NULL) {
                 ESP_LOGE(HTTPS_SERVER_TAG, "Error: device_id not found in JSON");
@@ -136,25 +182,21 @@ static esp_err_t post_data_handler(httpd_req_t *req) {
                 return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid device id");
             }
 
-            turnon_turnoff_service_args_t message = {
+            post->turnon_turnoff = (turnon_turnoff_service_args_t) {
                 .device_id = device_id,
             };
-            handle_service_message(message_type, &message);
+            post->args = &post->turnon_turnoff;
         }
         break;
     
     case SYNC_SERVICE:{
-            char log_message[LOGGER_QUEUE_ITEM_LEN];
-            snprintf(log_message, LOGGER_QUEUE_ITEM_LEN, "SYNC message received from ID: %d", userID);
-            log_item(HTTPS_SERVER_TAG, log_message);
-            handle_service_message(message_type, NULL);
+            log_event(LOG_TAG_HTTPS_SERVER, LOG_EVENT_SYNC_REQUEST, 0, userID, NULL);
+            post->args = NULL;
         }
         break;
 
     case ACCESSLEVEL_SERVICE:{
-            char log_message[LOGGER_QUEUE_ITEM_LEN];
-            snprintf(log_message, LOGGER_QUEUE_ITEM_LEN, "ACCESSLEVEL message received from ID: %d", userID);
-            log_item(HTTPS_SERVER_TAG, log_message);
+            log_event(LOG_TAG_HTTPS_SERVER, LOG_EVENT_ACCESSLEVEL_REQUEST, 0, userID, NULL);
             cJSON *change_type_json = cJSON_GetObjectItem(root, "change_type");
             cJSON *target_type_json = cJSON_GetObjectItem(root, "target_type");
             cJSON *target_id_json = cJSON_GetObjectItem(root, target_type_json->valueint == 0 ? "device_id" : "key_id");
@@ -211,7 +253,8 @@ static esp_err_t post_data_handler(httpd_req_t *req) {
                 args.target.key_id[8] = '\0';
             }
 
-            handle_service_message(message_type, &args);
+            post->accesslevel = args;
+            post->args = &post->accesslevel;
         }
         break;
 
@@ -223,7 +266,172 @@ static esp_err_t post_data_handler(httpd_req_t *req) {
     }
 
     cJSON_Delete(root);
-    httpd_resp_sendstr(req, "Success");
+    post->type = message_type;
+    post->pending = true;
+    return ESP_OK;
+}
+
+// An HTTP GET handler for log queries, e.g. /logs?id=1&tag=ACCESS&from=2024-05-01&limit=50
+static esp_err_t get_logs_handler(httpd_req_t *req) {
+    char query_str[LOGS_QUERY_LEN];
+    char id[20];
+    char value[40];
+
+    memset(query_str, 0, sizeof(query_str));
+    memset(id, 0, sizeof(id));
+
+    if (httpd_req_get_url_query_str(req, query_str, sizeof(query_str)) != ESP_OK) {
+        ESP_LOGI(HTTPS_SERVER_TAG, "Query string not found");
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Query string not found");
+    }
+    if (httpd_query_key_value(query_str, "id", id, sizeof(id)) != ESP_OK || atoi(id) <= 0) {
+        ESP_LOGI(HTTPS_SERVER_TAG, "Client ID not found");
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Client ID not found");
+    }
+    int userID = atoi(id);
+
+    log_query_t query;
+    init_log_query(&query);
+    for (int i = 0; i < sizeof(log_query_filters) / sizeof(log_query_filters[0]); ++i) {
+        if (httpd_query_key_value(query_str, log_query_filters[i], value, sizeof(value)) != ESP_OK) {
+            continue;
+        }
+        // httpd_query_key_value() leaves the value encoded, e.g. from=2024-05-01%2012:00:00
+        if (url_decode(value) != ESP_OK || set_log_query_filter(&query, log_query_filters[i], value) != ESP_OK) {
+            ESP_LOGE(HTTPS_SERVER_TAG, "Error: Invalid log filter %s", log_query_filters[i]);
+            return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid log filter");
+        }
+    }
+    log_event(LOG_TAG_HTTPS_SERVER, LOG_EVENT_SHOW_LOGS_REQUEST, 0, userID, NULL);
+
+    log_t *logs = malloc(LOGS_PAGE_LEN * sizeof(log_t));
+    if (logs == NULL) {
+        ESP_LOGE(HTTPS_SERVER_TAG, "Error allocating memory for logs");
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+    }
+
+    // the result is streamed as a chunked json array, one page of logs at a time, every log reuses the same arena
+    json_arena_t arena;
+    json_arena_begin(&arena, json_arena_buffer, sizeof(json_arena_buffer));
+    httpd_resp_set_type(req, "application/json");
+    esp_err_t ret = httpd_resp_send_chunk(req, "[", 1);
+    bool first = true;
+    while (!query.done && ret == ESP_OK) {
+        int amount = query_logs(&query, logs, LOGS_PAGE_LEN);
+        if (amount < 0) {
+            ret = ESP_FAIL;
+            break;
+        }
+        for (int i = 0; i < amount && ret == ESP_OK; ++i) {
+            cJSON *log_json = cJSON_CreateObject();
+            cJSON_AddStringToObject(log_json, "TAG", logs[i].tag);
+            cJSON_AddStringToObject(log_json, "date_time", logs[i].date_time);
+            cJSON_AddStringToObject(log_json, "info", logs[i].info);
+            char *log_str = cJSON_PrintUnformatted(log_json);
+            cJSON_Delete(log_json);
+            if (log_str == NULL) {
+                ret = ESP_FAIL;
+                break;
+            }
+            if (!first) {
+                ret = httpd_resp_send_chunk(req, ",", 1);
+            }
+            if (ret == ESP_OK) {
+                ret = httpd_resp_send_chunk(req, log_str, HTTPD_RESP_USE_STRLEN);
+            }
+            cJSON_free(log_str);
+            json_arena_reset(&arena);
+            first = false;
+        }
+    }
+    json_arena_end(&arena);
+    free(logs);
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(HTTPS_SERVER_TAG, "Error sending logs");
+        // an empty chunk ends the response, the client sees an unterminated array
+        httpd_resp_send_chunk(req, NULL, 0);
+        return ESP_FAIL;
+    }
+    httpd_resp_send_chunk(req, "]", 1);
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// An HTTP GET handler for the devices in use, e.g. /occupancy?id=1
+static esp_err_t get_occupancy_handler(httpd_req_t *req) {
+    char query_str[LOGS_QUERY_LEN];
+    char id[20];
+
+    memset(query_str, 0, sizeof(query_str));
+    memset(id, 0, sizeof(id));
+
+    if (httpd_req_get_url_query_str(req, query_str, sizeof(query_str)) != ESP_OK) {
+        ESP_LOGI(HTTPS_SERVER_TAG, "Query string not found");
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Query string not found");
+    }
+    if (httpd_query_key_value(query_str, "id", id, sizeof(id)) != ESP_OK || atoi(id) <= 0) {
+        ESP_LOGI(HTTPS_SERVER_TAG, "Client ID not found");
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Client ID not found");
+    }
+    log_event(LOG_TAG_HTTPS_SERVER, LOG_EVENT_SHOW_OCCUPANCY_REQUEST, 0, atoi(id), NULL);
+
+    // with many devices in use the arena fills up, the rest of the document goes to the heap
+    json_arena_t arena;
+    json_arena_begin(&arena, json_arena_buffer, sizeof(json_arena_buffer));
+    cJSON *occupancy_json = cJSON_CreateArray();
+    occupancy_t occupancy;
+    for (int device = 0; device < OCCUPANCY_MAX_DEVICES; ++device) {
+        if (!get_device_occupancy(device, &occupancy)) {
+            continue;
+        }
+        char ibutton[17];
+        char since[50];
+        snprintf(ibutton, sizeof(ibutton), "%016llX", (unsigned long long)occupancy.key);
+        format_log_stamp(occupancy.since, since, sizeof(since));
+
+        cJSON *device_json = cJSON_CreateObject();
+        cJSON_AddNumberToObject(device_json, "device", occupancy.device);
+        cJSON_AddStringToObject(device_json, "ibutton", ibutton);
+        cJSON_AddStringToObject(device_json, "since", since);
+        cJSON_AddItemToArray(occupancy_json, device_json);
+    }
+    char *occupancy_str = cJSON_PrintUnformatted(occupancy_json);
+    cJSON_Delete(occupancy_json);
+    if (occupancy_str == NULL) {
+        json_arena_end(&arena);
+        ESP_LOGE(HTTPS_SERVER_TAG, "Error building occupancy");
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    esp_err_t ret = httpd_resp_send(req, occupancy_str, HTTPD_RESP_USE_STRLEN);
+    cJSON_free(occupancy_str);
+    json_arena_end(&arena);
+    return ret;
+}
+
+// Decodes a query value in place, '+' is a space and %XX a byte
+static esp_err_t url_decode(char *value) {
+    char *out = value;
+    for (const char *in = value; *in != '\0'; ++in) {
+        if (*in == '+') {
+            *out++ = ' ';
+        } else if (*in == '%') {
+            if (!isxdigit((unsigned char)in[1]) || !isxdigit((unsigned char)in[2])) {
+                return ESP_FAIL;
+            }
+            char hex[3] = {in[1], in[2], '\0'};
+            char byte = (char)strtol(hex, NULL, 16);
+            if (byte == '\0') {
+                return ESP_FAIL;
+            }
+            *out++ = byte;
+            in += 2;
+        } else {
+            *out++ = *in;
+        }
+    }
+    *out = '\0';
     return ESP_OK;
 }
 
@@ -255,6 +463,8 @@ static httpd_handle_t start_webserver(void) {
     ESP_LOGI(HTTPS_SERVER_TAG, "Registering URI handlers");
     httpd_register_uri_handler(server, &get_data);
     httpd_register_uri_handler(server, &post_data);
+    httpd_register_uri_handler(server, &get_logs);
+    httpd_register_uri_handler(server, &get_occupancy_uri);
     return server;
 }
 
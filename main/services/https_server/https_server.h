@@ -6,6 +6,9 @@
 #define HTTPS_SERVER_H
 
 #define POST_BUF_SIZE 256
+#define LOGS_QUERY_LEN 200  // url query string of /logs
+#define LOGS_PAGE_LEN 16    // logs read from the store per chunk of the /logs response
+#define HTTPS_JSON_ARENA_SIZE 4096  // cJSON memory of one request, see json_arena.h
 #define HTTPS_SERVER_TAG "https_server"
 
 void disconnect_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
@@ -6,6 +6,7 @@
 #include <freertos/task.h>
 #include <freertos/semphr.h>
 #include <esp_system.h>
+#include <esp_heap_caps.h>
 #include <esp_wifi.h>
 #include <esp_event.h>
 #include <esp_log.h>
@@ -16,9 +17,18 @@
 #include <lwip/sockets.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "../../logger/logger.h"
+#include "../../logger/sntp.h"
+#include "../../logger/log_sink.h"
+#include "../../logger/log_compress.h"
+#include "../../SQL_server/api_client.h"
+#include "../../SQL_server/log_uploader.h"
+#include "../../wifi_events/wifi_events.h"
+#include "../../json_arena/json_arena.h"
 #include "../service_message_handler.h"
 #include "../../access/access.h"
+#include "../../access/occupancy.h"
 #include "tcp_server.h"
 
 
@@ -211,9 +221,7 @@ int identification_handle(char *id, int id_len, int conn_sock){
     ESP_LOGI(TCP_TAG, "Succesfull login, conn: %d -> ID: %d", conn_sock, int_id);
 
     // log
-    char info[LOGGER_QUEUE_ITEM_LEN];
-    snprintf(info, LOGGER_QUEUE_ITEM_LEN, "Succesfull TCP login by ID: %d", int_id);
-    log_item(TCP_TAG, (char *)info);
+    log_event(LOG_TAG_TCP, LOG_EVENT_LOGIN, 0, int_id, NULL);
 
     send_help(conn_sock);
 
@@ -250,11 +258,11 @@ void opened_handle(char *message, int message_len, int conn_sock, int userID){
 
     message_type_service message_type = -1;
     void *args = NULL;
-    char log_message[LOGGER_QUEUE_ITEM_LEN];
+    log_event_code log_event_type = LOG_EVENT_TEXT;
 
     if (strcmp(command, "TURNON") == 0) {
         // log
-        snprintf(log_message, LOGGER_QUEUE_ITEM_LEN, "TURNON message received from ID: %d", userID);
+        log_event_type = LOG_EVENT_TURNON_REQUEST;
 
         message_type = TURNON_SERVICE;
         char *next_token = strtok(NULL, " ");
@@ -288,7 +296,7 @@ void opened_handle(char *message, int message_len, int conn_sock, int userID){
         }
     } else if (strcmp(command, "TURNOFF") == 0) {
         // log
-        snprintf(log_message, LOGGER_QUEUE_ITEM_LEN, "TURNOFF message received from ID: %d", userID);
+        log_event_type = LOG_EVENT_TURNOFF_REQUEST;
 
         message_type = TURNOFF_SERVICE;
         char *next_token = strtok(NULL, " ");
@@ -320,12 +328,12 @@ void opened_handle(char *message, int message_len, int conn_sock, int userID){
         }
     } else if (strcmp(command, "SYNC") == 0) {
         // log
-        snprintf(log_message, LOGGER_QUEUE_ITEM_LEN, "SYNC message received from ID: %d", userID);
+        log_event_type = LOG_EVENT_SYNC_REQUEST;
         
         message_type = SYNC_SERVICE;
     } else if (strcmp(command, "ACCESSLEVEL") == 0) {
         // log
-        snprintf(log_message, LOGGER_QUEUE_ITEM_LEN, "ACCESSLEVEL message received from ID: %d", userID);
+        log_event_type = LOG_EVENT_ACCESSLEVEL_REQUEST;
 
         message_type = ACCESSLEVEL_SERVICE;
 
@@ -378,7 +386,7 @@ void opened_handle(char *message, int message_len, int conn_sock, int userID){
     } else if(strcmp(command, "SHOW") == 0){
         char *resource = strtok(NULL, " ");
         if (resource == NULL) {
-            if (send(conn_sock, "Error: Missing resource type. Use SHOW KEYS, SHOW DEVICES, or SHOW LOGS.\n", strlen("Error: Missing resource type. Use SHOW KEYS, SHOW DEVICES, or SHOW LOGS.\n"),0) < 0) {
+            if (send(conn_sock, "Error: Missing resource type. Use SHOW KEYS, SHOW DEVICES, SHOW LOGS, SHOW OCCUPANCY or SHOW STATS.\n", strlen("Error: Missing resource type. Use SHOW KEYS, SHOW DEVICES, SHOW LOGS, SHOW OCCUPANCY or SHOW STATS.\n"),0) < 0) {
                 ESP_LOGW(TCP_TAG, "Error sending data: errno %d", errno);
             }
             return;
@@ -386,25 +394,34 @@ void opened_handle(char *message, int message_len, int conn_sock, int userID){
 
         if (strcmp(resource, "KEYS") == 0) {
             // log
-            snprintf(log_message, LOGGER_QUEUE_ITEM_LEN, "SHOW KEYS message received from ID: %d", userID);
+            log_event_type = LOG_EVENT_SHOW_KEYS_REQUEST;
             // Display the list of keys
             show_keys(conn_sock);
         } else if (strcmp(resource, "DEVICES") == 0) {
             // log
-            snprintf(log_message, LOGGER_QUEUE_ITEM_LEN, "SHOW DEVICES message received from ID: %d", userID);
+            log_event_type = LOG_EVENT_SHOW_DEVICES_REQUEST;
             // Display the list of devices
             show_devices(conn_sock);
         } else if (strcmp(resource, "LOGS") == 0) {
             // log
-            snprintf(log_message, LOGGER_QUEUE_ITEM_LEN, "SHOW LOGS message received from ID: %d", userID);
-            // Display the logs
-            show_logs(conn_sock);
+            log_event_type = LOG_EVENT_SHOW_LOGS_REQUEST;
+            // Display the logs, optionally filtered
+            show_logs(conn_sock, strtok(NULL, ""));
+        } else if (strcmp(resource, "OCCUPANCY") == 0) {
+            // log
+            log_event_type = LOG_EVENT_SHOW_OCCUPANCY_REQUEST;
+            // Display which key is using which device
+            show_occupancy(conn_sock);
+        } else if (strcmp(resource, "STATS") == 0) {
+            // Display the runtime statistics, not logged as it is only a read of counters
+            show_stats(conn_sock);
+            return;
         } else {
-            send(conn_sock, "Error: Invalid resource type. Use SHOW KEYS, SHOW DEVICES, or SHOW LOGS.\n", strlen("Error: Invalid resource type. Use SHOW KEYS, SHOW DEVICES, or SHOW LOGS.\n"),0);
+            send(conn_sock, "Error: Invalid resource type. Use SHOW KEYS, SHOW DEVICES, SHOW LOGS, SHOW OCCUPANCY or SHOW STATS.\n", strlen("Error: Invalid resource type. Use SHOW KEYS, SHOW DEVICES, SHOW LOGS, SHOW OCCUPANCY or SHOW STATS.\n"),0);
             return;
         }
         // log
-        log_item(TCP_TAG, log_message);
+        log_event(LOG_TAG_TCP, log_event_type, 0, userID, NULL);
         return;
     } else if(strcmp(command, "CLOSE") == 0){
         close_conn(conn_sock);
@@ -417,7 +434,7 @@ void opened_handle(char *message, int message_len, int conn_sock, int userID){
     }
 
     // log
-    log_item(TCP_TAG, log_message);
+    log_event(LOG_TAG_TCP, log_event_type, 0, userID, NULL);
 
     if(handle_service_message(message_type, args) != ESP_OK){
         // return failed message
@@ -491,8 +508,16 @@ esp_err_t send_help(int conn_sock){
         "    <target_id>         : The ID of the device (1-99) or key (16byte) to change the access level.\n"
         "\n"
         "  SHOW <resource>\n"
-        "    Shows the list of the specified resource (KEYS, DEVICES, LOGS).\n"
-        "    <resource> : The type of resource to display (KEYS, DEVICES, LOGS).\n"
+        "    Shows the list of the specified resource (KEYS, DEVICES, LOGS, OCCUPANCY, STATS).\n"
+        "    <resource> : The type of resource to display (KEYS, DEVICES, LOGS, OCCUPANCY, STATS).\n"
+        "\n"
+        "  SHOW LOGS [<filter>=<value> ...]\n"
+        "    Shows the logs matching all given filters.\n"
+        "    from, to    : Time range, epoch or YYYY-mm-dd[THH:MM:SS].\n"
+        "    tag         : Log tag (e.g. ACCESS, NRF_MESSAGE_HANDLER, TCP).\n"
+        "    device      : Device number.\n"
+        "    key/ibutton : User ID (decimal) or iButton key (hex).\n"
+        "    limit/offset: Amount of logs to show and to skip.\n"
         "\n"
         "  CLOSE\n"
         "    Closes the connection.\n";
@@ -556,22 +581,222 @@ esp_err_t show_devices(int conn_sock){
     return ret;
 }
 
-esp_err_t show_logs(int conn_sock) {
+esp_err_t show_logs(int conn_sock, char *filters) {
+    log_query_t query;
+    init_log_query(&query);
+
+    // filters are "name=value" pairs separated by spaces
+    char *saveptr;
+    char *filter = filters == NULL ? NULL : strtok_r(filters, " \r\n", &saveptr);
+    while (filter != NULL) {
+        char *value = strchr(filter, '=');
+        if (value != NULL) {
+            *value++ = '\0';
+        }
+        if (value == NULL || set_log_query_filter(&query, filter, value) != ESP_OK) {
+            char error_message[80];
+            snprintf(error_message, sizeof(error_message), "show logs: invalid filter '%s'\n", filter);
+            send(conn_sock, error_message, strlen(error_message), 0);
+            return ESP_FAIL;
+        }
+        filter = strtok_r(NULL, " \r\n", &saveptr);
+    }
+
+    log_t *logs = malloc(TCP_SHOW_LOGS_PAGE * sizeof(log_t));
+    if (logs == NULL) {
+        ESP_LOGE(TCP_TAG, "Error allocating memory for logs");
+        const char *error_message = "show logs: failed\n";
+        send(conn_sock, error_message, strlen(error_message), 0);
+        return ESP_FAIL;
+    }
+
+    // the query keeps its position, every page continues where the previous one ended
     int ret = ESP_OK;
-    int logs_count = get_log_lines();
-    for (int i = 1; i <= logs_count; ++i) {
-        char log[LOGGER_QUEUE_ITEM_LEN+2];
-        get_log(i, log, LOGGER_QUEUE_ITEM_LEN);
-        log[LOGGER_QUEUE_ITEM_LEN] = '\n';
-        log[LOGGER_QUEUE_ITEM_LEN+1] = '\0';
-        if (send(conn_sock, log, strlen(log), 0) < 0) {
-            ESP_LOGW(TCP_TAG, "Error sending data: errno %d", errno);
+    while (!query.done && ret == ESP_OK) {
+        int amount = query_logs(&query, logs, TCP_SHOW_LOGS_PAGE);
+        if (amount < 0) {
+            const char *error_message = "show logs: failed\n";
+            send(conn_sock, error_message, strlen(error_message), 0);
             ret = ESP_FAIL;
+            break;
+        }
+        for (int i = 0; i < amount; ++i) {
+            char log[LOG_LINE_LEN+2];
+            snprintf(log, sizeof(log), "%s,%s,%s\n", logs[i].tag, logs[i].date_time, logs[i].info);
+            if (send(conn_sock, log, strlen(log), 0) < 0) {
+                ESP_LOGW(TCP_TAG, "Error sending data: errno %d", errno);
+                ret = ESP_FAIL;
+                break;
+            }
         }
     }
+    free(logs);
     return ret;
 }
 
+esp_err_t show_occupancy(int conn_sock) {
+    int amount = 0;
+    occupancy_t occupancy;
+
+    // one device at a time, the table is never copied as a whole
+    for (int device = 0; device < OCCUPANCY_MAX_DEVICES; ++device) {
+        if (!get_device_occupancy(device, &occupancy)) {
+            continue;
+        }
+        char since[50];
+        format_log_stamp(occupancy.since, since, sizeof(since));
+        char occupancy_info[80];
+        snprintf(occupancy_info, sizeof(occupancy_info), "device: %d\tibutton: %016llX\tsince: %s\n",
+                 occupancy.device, (unsigned long long)occupancy.key, since);
+        if (send(conn_sock, occupancy_info, strlen(occupancy_info), 0) < 0) {
+            ESP_LOGW(TCP_TAG, "Error sending data: errno %d", errno);
+            return ESP_FAIL;
+        }
+        amount++;
+    }
+
+    if (amount == 0) {
+        const char *message = "no devices in use\n";
+        if (send(conn_sock, message, strlen(message), 0) < 0) {
+            ESP_LOGW(TCP_TAG, "Error sending data: errno %d", errno);
+            return ESP_FAIL;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t show_stats(int conn_sock) {
+    logger_stats_t logger_stats;
+    get_logger_stats(&logger_stats);
+
+    char stats_info[300];
+    snprintf(stats_info, sizeof(stats_info),
+             "logger: %u records in %u batches, %u failed writes\n"
+             "logger: %u records/s, peak %u records/s\n"
+             "logger batch sizes: 1: %u, 2-3: %u, 4-7: %u, 8-15: %u, 16-31: %u, 32+: %u\n",
+             (unsigned)logger_stats.records_written, (unsigned)logger_stats.batches_written, (unsigned)logger_stats.write_failures,
+             (unsigned)logger_stats.records_per_second, (unsigned)logger_stats.peak_records_per_second,
+             (unsigned)logger_stats.batch_size_histogram[0], (unsigned)logger_stats.batch_size_histogram[1],
+             (unsigned)logger_stats.batch_size_histogram[2], (unsigned)logger_stats.batch_size_histogram[3],
+             (unsigned)logger_stats.batch_size_histogram[4], (unsigned)logger_stats.batch_size_histogram[5]);
+    if (send(conn_sock, stats_info, strlen(stats_info), 0) < 0) {
+        ESP_LOGW(TCP_TAG, "Error sending data: errno %d", errno);
+        return ESP_FAIL;
+    }
+
+    // drop counters, only tags that actually lost records
+    int len = snprintf(stats_info, sizeof(stats_info), "logger ring: high water %u bytes, dropped:",
+                       (unsigned)logger_stats.ring_high_water);
+    int dropped_tags = 0;
+    for (int tag_id = 0; tag_id < LOG_TAG_COUNT && len < sizeof(stats_info); tag_id++) {
+        if (logger_stats.dropped[tag_id] > 0) {
+            len += snprintf(stats_info + len, sizeof(stats_info) - len, " %s: %u",
+                            log_tag_name(tag_id), (unsigned)logger_stats.dropped[tag_id]);
+            dropped_tags++;
+        }
+    }
+    if (dropped_tags == 0 && len < sizeof(stats_info)) {
+        len += snprintf(stats_info + len, sizeof(stats_info) - len, " none");
+    }
+    if (len < sizeof(stats_info) - 1) {
+        strcat(stats_info, "\n");
+    }
+    if (send(conn_sock, stats_info, strlen(stats_info), 0) < 0) {
+        ESP_LOGW(TCP_TAG, "Error sending data: errno %d", errno);
+        return ESP_FAIL;
+    }
+
+    // extra log sinks, flash is covered by the logger lines above
+    log_sink_stats_t sink_stats[LOG_SINK_MAX];
+    int amount_sinks = get_log_sink_stats(sink_stats, LOG_SINK_MAX);
+    for (int i = 0; i < amount_sinks; i++) {
+        snprintf(stats_info, sizeof(stats_info), "log sink %s: %u written, %u failed writes, %u dropped, queue high water %u bytes\n",
+                 sink_stats[i].name, (unsigned)sink_stats[i].records_written, (unsigned)sink_stats[i].write_failures,
+                 (unsigned)sink_stats[i].dropped, (unsigned)sink_stats[i].queue_high_water);
+        if (send(conn_sock, stats_info, strlen(stats_info), 0) < 0) {
+            ESP_LOGW(TCP_TAG, "Error sending data: errno %d", errno);
+            return ESP_FAIL;
+        }
+    }
+
+    // ratio in hundredths, the CPU cost per KB of what went in and came out
+    log_compress_stats_t compress_stats;
+    get_log_compress_stats(&compress_stats);
+    unsigned ratio = compress_stats.packed_bytes > 0 ? (uint64_t)compress_stats.raw_bytes * 100 / compress_stats.packed_bytes : 0;
+    unsigned compress_cost = compress_stats.raw_bytes > 0 ? (uint64_t)compress_stats.compress_us * 1024 / compress_stats.raw_bytes : 0;
+    unsigned decompress_cost = compress_stats.unpacked_bytes > 0 ? (uint64_t)compress_stats.decompress_us * 1024 / compress_stats.unpacked_bytes : 0;
+    snprintf(stats_info, sizeof(stats_info), "log compression: %u to %u bytes, ratio %u.%02u, %u us/KB compress, %u us/KB decompress\n",
+             (unsigned)compress_stats.raw_bytes, (unsigned)compress_stats.packed_bytes, ratio / 100, ratio % 100,
+             compress_cost, decompress_cost);
+    if (send(conn_sock, stats_info, strlen(stats_info), 0) < 0) {
+        ESP_LOGW(TCP_TAG, "Error sending data: errno %d", errno);
+        return ESP_FAIL;
+    }
+
+    // handshakes should stay far below requests, every other request reused an open connection
+    api_client_stats_t api_stats;
+    get_api_client_stats(&api_stats);
+    snprintf(stats_info, sizeof(stats_info), "api client: %u requests, %u failed, %u handshakes (avg %u ms, last %u ms, max %u ms), %u reconnects, %u KB sent\n",
+             (unsigned)api_stats.requests, (unsigned)api_stats.failures, (unsigned)api_stats.handshakes,
+             api_stats.handshakes > 0 ? (unsigned)(api_stats.handshake_ms_total / api_stats.handshakes) : 0,
+             (unsigned)api_stats.handshake_ms_last, (unsigned)api_stats.handshake_ms_max, (unsigned)api_stats.reconnects,
+             (unsigned)(api_stats.bytes_sent / 1024));
+    if (send(conn_sock, stats_info, strlen(stats_info), 0) < 0) {
+        ESP_LOGW(TCP_TAG, "Error sending data: errno %d", errno);
+        return ESP_FAIL;
+    }
+
+    wifi_connectivity_stats_t wifi_stats;
+    get_wifi_connectivity_stats(&wifi_stats);
+    snprintf(stats_info, sizeof(stats_info), "wifi: %s, %u incidents, %u attempts (%u total), backoff %u ms, offline %u ms (last %u ms, max %u ms, total %u s), last reason %u\n",
+             wifi_state_name(wifi_stats.state), (unsigned)wifi_stats.incidents, (unsigned)wifi_stats.attempts,
+             (unsigned)wifi_stats.attempts_total, (unsigned)wifi_stats.backoff_ms, (unsigned)wifi_stats.offline_ms,
+             (unsigned)wifi_stats.offline_ms_last, (unsigned)wifi_stats.offline_ms_max, (unsigned)wifi_stats.offline_s_total,
+             (unsigned)wifi_stats.last_reason);
+    if (send(conn_sock, stats_info, strlen(stats_info), 0) < 0) {
+        ESP_LOGW(TCP_TAG, "Error sending data: errno %d", errno);
+        return ESP_FAIL;
+    }
+
+    // the lag should stay around one upload interval while WiFi is up
+    log_uploader_stats_t uploader_stats;
+    get_log_uploader_stats(&uploader_stats);
+    snprintf(stats_info, sizeof(stats_info), "log uploader: %s, lag %d logs / %d s, batch %u, rtt %u ms, %u logs/s, %u requests, %u failed, backoff %u ms\n",
+             uploader_stats.paused ? "paused" : "running", uploader_stats.lag_logs, uploader_stats.lag_seconds,
+             (unsigned)uploader_stats.batch_size, (unsigned)uploader_stats.rtt_ms, (unsigned)uploader_stats.logs_per_second,
+             (unsigned)uploader_stats.requests, (unsigned)uploader_stats.failures, (unsigned)uploader_stats.backoff_ms);
+    if (send(conn_sock, stats_info, strlen(stats_info), 0) < 0) {
+        ESP_LOGW(TCP_TAG, "Error sending data: errno %d", errno);
+        return ESP_FAIL;
+    }
+
+    time_service_status_t time_status;
+    get_time_service_status(&time_status);
+    snprintf(stats_info, sizeof(stats_info), "time: %s, %u syncs, last step %d ms, drift %d ppm\n",
+             time_status.valid ? "valid" : "not synced", (unsigned)time_status.syncs,
+             (int)time_status.last_step_ms, (int)time_status.drift_ppm);
+    if (send(conn_sock, stats_info, strlen(stats_info), 0) < 0) {
+        ESP_LOGW(TCP_TAG, "Error sending data: errno %d", errno);
+        return ESP_FAIL;
+    }
+
+    // fragmentation is the share of the free heap that is not in the largest block
+    size_t heap_free = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    size_t heap_largest = heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT);
+    json_arena_stats_t arena_stats;
+    get_json_arena_stats(&arena_stats);
+    snprintf(stats_info, sizeof(stats_info), "heap: %u free, largest block %u, fragmentation %u%%, minimum free %u\n"
+             "json arena: %u scopes, %u allocations, %u fallbacks, peak %u bytes\n",
+             (unsigned)heap_free, (unsigned)heap_largest, heap_free > 0 ? (unsigned)(100 - heap_largest * 100 / heap_free) : 0,
+             (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT), (unsigned)arena_stats.scopes,
+             (unsigned)arena_stats.allocations, (unsigned)arena_stats.fallbacks, (unsigned)arena_stats.peak_bytes);
+    if (send(conn_sock, stats_info, strlen(stats_info), 0) < 0) {
+        ESP_LOGW(TCP_TAG, "Error sending data: errno %d", errno);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
 void close_conn(int conn_sock){
     ESP_LOGE(TCP_TAG, "closing connection: conn_sock %d", conn_sock);
 
@@ -11,6 +11,7 @@
 #define MAX_CONNECTIONS 5
 #define CONNECTION_TIMEOUT_MS 300000 // 5 minutes
 #define MAX_DATA_LENGTH 250
+#define TCP_SHOW_LOGS_PAGE 16 // logs read from the store per query page
 #define USERNAMEID "root"
 #define PASSWORDID "password"
 
@@ -39,7 +40,11 @@ esp_err_t show_keys(int conn_sock);
 
 esp_err_t show_devices(int conn_sock);
 
-esp_err_t show_logs(int conn_sock);
+esp_err_t show_logs(int conn_sock, char *filters);
+
+esp_err_t show_occupancy(int conn_sock);
+
+esp_err_t show_stats(int conn_sock);
 
 void close_conn(int conn_sock);
 
@@ -3,26 +3,35 @@
 //
 
 
-#include "wifi_events.h" 
-#include "esp_log.h"  
-#include "esp_wifi.h"  
-#include "esp_event.h"  
-#include "freertos/FreeRTOS.h"  
-#include "freertos/timers.h"
-#include "esp_wifi.h"  
-#include "protocol_examples_common.h"
-#include "../logger/sntp.h"
+#include <string.h>
 #include "wifi_events.h"
+#include "esp_log.h"
+#include "esp_wifi.h"
+#include "esp_netif.h"
+#include "esp_event.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/timers.h"
 
+ESP_EVENT_DEFINE_BASE(WIFI_CONNECTIVITY_EVENT);
 
 static TimerHandle_t wifi_reconnect_timer = NULL;
+static portMUX_TYPE state_lock = portMUX_INITIALIZER_UNLOCKED;
+static wifi_connectivity_stats_t stats = {
+    .state = WIFI_STATE_STARTING,
+};
+static int64_t offline_since;   // esp_timer time the current incident started, 0 while online
 
 static void wifi_reconnect_timer_cb(TimerHandle_t xTimer);
+static void connection_lost(uint8_t reason);
+static void schedule_attempt();
+static uint32_t backoff_delay(uint32_t attempts);
 
 void connect_wifi() {
     // Only create the timer if it hasn't been created yet
     if (wifi_reconnect_timer == NULL) {
-        wifi_reconnect_timer = xTimerCreate("wifiReconnectTimer", pdMS_TO_TICKS(3600000), 
+        wifi_reconnect_timer = xTimerCreate("wifiReconnectTimer", pdMS_TO_TICKS(WIFI_RECONNECT_BACKOFF_BASE_MS),
                                             pdFALSE, (void *) 0, wifi_reconnect_timer_cb);
         if (wifi_reconnect_timer == NULL) {
             ESP_LOGE(WIFI_EVENTS_TAG, "Failed to create wifi reconnect timer");
@@ -30,40 +39,159 @@ void connect_wifi() {
         }
     }
 
-    if(example_connect() != ESP_OK){
-        ESP_LOGE(WIFI_EVENTS_TAG, "Failed to reconnect to WiFi, starting timer to retry in 1 hour");
-        // Check if timer is already running, if so stop it
-        if (xTimerIsTimerActive(wifi_reconnect_timer) != pdFALSE) {
-            xTimerStop(wifi_reconnect_timer, 0);
-        }
-        // Start the timer
-        if (xTimerStart(wifi_reconnect_timer, 0) != pdPASS) {
-            ESP_LOGE(WIFI_EVENTS_TAG, "Failed to start wifi reconnect timer");
+    // the driver is set up here and not with example_connect(), whose disconnect handler would reconnect
+    // on its own and race the state machine below
+    esp_netif_create_default_wifi_sta();
+    wifi_init_config_t init_config = WIFI_INIT_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(esp_wifi_init(&init_config));
+    ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+
+    wifi_config_t wifi_config = {0};
+    strncpy((char *) wifi_config.sta.ssid, CONFIG_EXAMPLE_WIFI_SSID, sizeof(wifi_config.sta.ssid));
+    strncpy((char *) wifi_config.sta.password, CONFIG_EXAMPLE_WIFI_PASSWORD, sizeof(wifi_config.sta.password));
+#ifdef CONFIG_EXAMPLE_WIFI_SCAN_METHOD_ALL_CHANNEL
+    wifi_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+#endif
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+    ESP_ERROR_CHECK(esp_wifi_start());
+
+    // the first attempt, a failure or timeout is handled like a lost connection
+    ESP_LOGI(WIFI_EVENTS_TAG, "Connecting to %s", CONFIG_EXAMPLE_WIFI_SSID);
+    xTimerChangePeriod(wifi_reconnect_timer, pdMS_TO_TICKS(WIFI_CONNECT_TIMEOUT_MS), 0);
+    esp_err_t err = esp_wifi_connect();
+    if (err != ESP_OK) {
+        ESP_LOGE(WIFI_EVENTS_TAG, "Failed to start WiFi connect: %s", esp_err_to_name(err));
+        connection_lost(0);
+    }
+}
+
+// Event handler function for wifi connects/disconnects
+void wifi_events_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
+    if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
+        // the incident, if any, ends here, even when the driver reconnected on its own
+        int64_t now = esp_timer_get_time();
+        wifi_online_event_t online = {0};
+        portENTER_CRITICAL(&state_lock);
+        if (offline_since != 0) {
+            online.offline_ms = (now - offline_since) / 1000;
+            stats.offline_ms_last = online.offline_ms;
+            stats.offline_ms_max = online.offline_ms > stats.offline_ms_max ? online.offline_ms : stats.offline_ms_max;
+            stats.offline_s_total += online.offline_ms / 1000;
         }
-    } else {
-        // If connection is successful and timer is running, stop it
-        if (xTimerIsTimerActive(wifi_reconnect_timer) != pdFALSE) {
-            xTimerStop(wifi_reconnect_timer, 0);
+        online.attempts = stats.attempts;
+        offline_since = 0;
+        stats.state = WIFI_STATE_ONLINE;
+        stats.attempts = 0;
+        stats.backoff_ms = 0;
+        portEXIT_CRITICAL(&state_lock);
+
+        xTimerStop(wifi_reconnect_timer, 0);
+        ESP_LOGI(WIFI_EVENTS_TAG, "WiFi online after %u ms offline and %u attempts", (unsigned)online.offline_ms,
+                 (unsigned)online.attempts);
+        esp_event_post(WIFI_CONNECTIVITY_EVENT, WIFI_CONNECTIVITY_ONLINE, &online, sizeof(online), 0);
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
+        wifi_event_sta_disconnected_t *disconnected = (wifi_event_sta_disconnected_t *)event_data;
+        portENTER_CRITICAL(&state_lock);
+        wifi_state_t state = stats.state;
+        stats.last_reason = disconnected->reason;
+        portEXIT_CRITICAL(&state_lock);
+
+        if (state == WIFI_STATE_ONLINE || state == WIFI_STATE_STARTING) {
+            connection_lost(disconnected->reason);
+        } else if (state == WIFI_STATE_CONNECTING) {
+            // the attempt failed, the next one after a longer delay
+            schedule_attempt();
         }
+        // in backoff the timer is already running
+#ifdef CONFIG_EXAMPLE_CONNECT_IPV6
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+        // the tcp server also listens on IPv6, the link-local address is not kept over a reconnect
+        esp_netif_create_ip6_linklocal(esp_netif_get_handle_from_ifkey("WIFI_STA_DEF"));
+#endif
+    }
+}
+
+void get_wifi_connectivity_stats(wifi_connectivity_stats_t *stats_copy) {
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&state_lock);
+    *stats_copy = stats;
+    stats_copy->offline_ms = offline_since != 0 ? (now - offline_since) / 1000 : 0;
+    portEXIT_CRITICAL(&state_lock);
+}
+
+const char *wifi_state_name(wifi_state_t state) {
+    switch (state) {
+        case WIFI_STATE_STARTING: return "starting";
+        case WIFI_STATE_ONLINE: return "online";
+        case WIFI_STATE_BACKOFF: return "backoff";
+        case WIFI_STATE_CONNECTING: return "connecting";
     }
+    return "unknown";
 }
 
 static void wifi_reconnect_timer_cb(TimerHandle_t xTimer) {
-    if(example_connect() != ESP_OK){
-        ESP_LOGE(WIFI_EVENTS_TAG, "Failed to reconnect to WiFi, starting timer to retry in 1 hour");
-        if (xTimerStart(wifi_reconnect_timer, 0) != pdPASS) {
-            ESP_LOGE(WIFI_EVENTS_TAG, "Failed to start wifi reconnect timer");
+    // runs in the timer task, esp_wifi_connect() only starts the attempt
+    portENTER_CRITICAL(&state_lock);
+    wifi_state_t state = stats.state;
+    if (state == WIFI_STATE_BACKOFF) {
+        stats.state = WIFI_STATE_CONNECTING;
+        stats.attempts++;
+        stats.attempts_total++;
+    }
+    portEXIT_CRITICAL(&state_lock);
+
+    if (state == WIFI_STATE_BACKOFF) {
+        esp_err_t err = esp_wifi_connect();
+        if (err != ESP_OK) {
+            ESP_LOGW(WIFI_EVENTS_TAG, "Failed to start WiFi connect: %s", esp_err_to_name(err));
+            schedule_attempt();
+            return;
         }
+        // an attempt that hangs, e.g. without DHCP answer, is given up by the same timer
+        xTimerChangePeriod(wifi_reconnect_timer, pdMS_TO_TICKS(WIFI_CONNECT_TIMEOUT_MS), 0);
+    } else if (state == WIFI_STATE_CONNECTING) {
+        ESP_LOGW(WIFI_EVENTS_TAG, "WiFi connect attempt timed out");
+        schedule_attempt();
+        esp_wifi_disconnect();
+    } else if (state == WIFI_STATE_STARTING) {
+        ESP_LOGE(WIFI_EVENTS_TAG, "Failed to connect to WiFi at boot, retrying with backoff");
+        connection_lost(0);
+        esp_wifi_disconnect();
     }
 }
 
-// Event handler function for wifi connects/disconnects
-void wifi_events_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
-    if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
-        // A WiFi connection has been established, so we try to set the time using SNTP
-        //set_time_using_sntp();
-    } else if(event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        // A WiFi connection has been lost, so we try to reconnect
-        connect_wifi();
+static void connection_lost(uint8_t reason) {
+    portENTER_CRITICAL(&state_lock);
+    offline_since = esp_timer_get_time();
+    stats.incidents++;
+    stats.attempts = 0;
+    portEXIT_CRITICAL(&state_lock);
+
+    ESP_LOGW(WIFI_EVENTS_TAG, "WiFi connection lost, reason %u", (unsigned)reason);
+    wifi_offline_event_t offline = {.reason = reason};
+    esp_event_post(WIFI_CONNECTIVITY_EVENT, WIFI_CONNECTIVITY_OFFLINE, &offline, sizeof(offline), 0);
+    schedule_attempt();
+}
+
+static void schedule_attempt() {
+    portENTER_CRITICAL(&state_lock);
+    uint32_t delay_ms = backoff_delay(stats.attempts);
+    stats.state = WIFI_STATE_BACKOFF;
+    stats.backoff_ms = delay_ms;
+    portEXIT_CRITICAL(&state_lock);
+
+    ESP_LOGI(WIFI_EVENTS_TAG, "next WiFi connect attempt in %u ms", (unsigned)delay_ms);
+    if (xTimerChangePeriod(wifi_reconnect_timer, pdMS_TO_TICKS(delay_ms), 0) != pdPASS) {
+        ESP_LOGE(WIFI_EVENTS_TAG, "Failed to start wifi reconnect timer");
     }
-}
\ No newline at end of file
+}
+
+static uint32_t backoff_delay(uint32_t attempts) {
+    // doubles per attempt up to the maximum, half of it is random ("equal jitter")
+    uint32_t delay_ms = WIFI_RECONNECT_BACKOFF_MAX_MS;
+    if (attempts < 16 && (WIFI_RECONNECT_BACKOFF_BASE_MS << attempts) < WIFI_RECONNECT_BACKOFF_MAX_MS) {
+        delay_ms = WIFI_RECONNECT_BACKOFF_BASE_MS << attempts;
+    }
+    return delay_ms / 2 + esp_random() % (delay_ms / 2 + 1);
+}
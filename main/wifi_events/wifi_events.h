@@ -2,9 +2,33 @@
 // Created by Vincent.
 //
 
+/*
+    WiFi connectivity. connect_wifi() sets up the driver and the station
+    interface with the credentials of the example_connect Kconfig menu and
+    starts the first attempt. A failed first attempt and every lost
+    connection after it are handled by a state machine that never blocks the
+    event loop, it is the only code that calls esp_wifi_connect() again:
+
+        ONLINE --disconnect--> BACKOFF --timer--> CONNECTING --got ip--> ONLINE
+                                  ^                    |
+                                  +-- fail / timeout --+
+
+    Attempts are esp_wifi_connect() calls, the delay between them doubles
+    from WIFI_RECONNECT_BACKOFF_BASE_MS up to WIFI_RECONNECT_BACKOFF_MAX_MS,
+    half of it random so nodes behind the same access point do not all come
+    back at once. A rebooting access point costs seconds, not an hour.
+
+    Modules follow the connection through WIFI_CONNECTIVITY_EVENT on the
+    default event loop: WIFI_CONNECTIVITY_OFFLINE once when a connection is
+    lost, WIFI_CONNECTIVITY_ONLINE with wifi_online_event_t when it is back.
+    Every incident, from losing the connection until the next IP address,
+    is timed in wifi_connectivity_stats_t.
+*/
+
 #ifndef WIFI_EVENTS_H
 #define WIFI_EVENTS_H
 
+#include <stdint.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/timers.h"
 #include "esp_event.h"
@@ -14,8 +38,52 @@
 
 #define WIFI_EVENTS_TAG "WIFI_EVENTS"
 
+#define WIFI_RECONNECT_BACKOFF_BASE_MS 1000
+#define WIFI_RECONNECT_BACKOFF_MAX_MS (CONFIG_WIFI_RECONNECT_BACKOFF_MAX_S * 1000)
+#define WIFI_CONNECT_TIMEOUT_MS 20000       // an attempt that gets no IP address by then has failed
+
+ESP_EVENT_DECLARE_BASE(WIFI_CONNECTIVITY_EVENT);
+
+enum {
+    WIFI_CONNECTIVITY_ONLINE,       // wifi_online_event_t
+    WIFI_CONNECTIVITY_OFFLINE,      // wifi_offline_event_t
+};
+
+typedef struct wifi_online_event_t {
+    uint32_t offline_ms;    // length of the incident that ended, 0 for the first connection
+    uint32_t attempts;      // reconnect attempts it took
+} wifi_online_event_t;
+
+typedef struct wifi_offline_event_t {
+    uint8_t reason;         // wifi_err_reason_t of the disconnect, 0 if the connection never came up
+} wifi_offline_event_t;
+
+typedef enum {
+    WIFI_STATE_STARTING,    // the first attempt at boot, up to WIFI_CONNECT_TIMEOUT_MS
+    WIFI_STATE_ONLINE,
+    WIFI_STATE_BACKOFF,     // waiting for the next attempt
+    WIFI_STATE_CONNECTING,
+} wifi_state_t;
+
+typedef struct wifi_connectivity_stats_t {
+    wifi_state_t state;
+    uint32_t incidents;         // connections lost
+    uint32_t attempts;          // reconnect attempts of the current incident
+    uint32_t attempts_total;
+    uint32_t backoff_ms;        // delay before the next attempt
+    uint32_t offline_ms;        // of the current incident, 0 while online
+    uint32_t offline_ms_last;   // of the last incident that ended
+    uint32_t offline_ms_max;
+    uint32_t offline_s_total;
+    uint8_t last_reason;        // of the last disconnect
+} wifi_connectivity_stats_t;
+
 void connect_wifi();
 
 void wifi_events_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
 
-#endif //WIFI_EVENTS_H
\ No newline at end of file
+void get_wifi_connectivity_stats(wifi_connectivity_stats_t *stats_copy);
+
+const char *wifi_state_name(wifi_state_t state);
+
+#endif //WIFI_EVENTS_H
@@ -4,14 +4,284 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
 #include "esp_http_client.h"
 #include "cJSON.h"
 #include "../main/SQL_server/SQL_server.h"
+#include "../main/SQL_server/api_client.h"
+#include "../main/SQL_server/log_uploader.h"
+#include "../main/SQL_server/log_msgpack.h"
+#include "../main/json_arena/json_arena.h"
+
+#define JSON_SOAK_ROUNDS 2000
+#define JSON_SOAK_PINNED 40
+
+static uint8_t msgpack_body[4096];
+static int msgpack_body_len;
+static uint8_t soak_arena_buffer[8192];
+static void *soak_pinned[JSON_SOAK_PINNED];
+
+static esp_err_t write_msgpack_body(const char *data, int len)
+{
+    if (msgpack_body_len + len > sizeof(msgpack_body)) {
+        return ESP_FAIL;
+    }
+    memcpy(&msgpack_body[msgpack_body_len], data, len);
+    msgpack_body_len += len;
+    return ESP_OK;
+}
+
+static void json_soak_round(int round)
+{
+    // a rollup sized document built, printed and parsed again, like a request and its answer
+    cJSON *array = cJSON_CreateArray();
+    for (int i = 0; i < 8; i++) {
+        cJSON *rollup = cJSON_CreateObject();
+        cJSON_AddStringToObject(rollup, "type", "device_hour");
+        cJSON_AddNumberToObject(rollup, "period", 1718000000 + round);
+        cJSON_AddStringToObject(rollup, "id", "0123456789ABCDEF");
+        cJSON_AddNumberToObject(rollup, "grants", i);
+        cJSON_AddItemToArray(array, rollup);
+    }
+
+    // other tasks keep small allocations for longer, they land between the nodes of the request
+    if (round % (JSON_SOAK_ROUNDS / JSON_SOAK_PINNED) == 0) {
+        soak_pinned[round / (JSON_SOAK_ROUNDS / JSON_SOAK_PINNED)] = malloc(24 + round % 40);
+    }
+
+    char *text = cJSON_PrintUnformatted(array);
+    cJSON_Delete(array);
+    cJSON *parsed = cJSON_Parse(text);
+    cJSON_Delete(parsed);
+    cJSON_free(text);
+}
+
+static void json_soak(bool use_arena)
+{
+    size_t free_before = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    size_t largest_before = heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT);
+    for (int round = 0; round < JSON_SOAK_ROUNDS; round++) {
+        json_arena_t arena;
+        if (use_arena) {
+            TEST_ASSERT_EQUAL(ESP_OK, json_arena_begin(&arena, soak_arena_buffer, sizeof(soak_arena_buffer)));
+        }
+        json_soak_round(round);
+        if (use_arena) {
+            json_arena_end(&arena);
+        }
+    }
+    size_t free_after = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    size_t largest_after = heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT);
+
+    // printf, the log output is off while tests run
+    printf("json soak %s arena: free %u -> %u, largest block %u -> %u, fragmentation %u%% -> %u%%\n",
+           use_arena ? "with" : "without", (unsigned)free_before, (unsigned)free_after, (unsigned)largest_before,
+           (unsigned)largest_after, (unsigned)(100 - largest_before * 100 / free_before),
+           (unsigned)(100 - largest_after * 100 / free_after));
+
+    for (int i = 0; i < JSON_SOAK_PINNED; i++) {
+        free(soak_pinned[i]);
+        soak_pinned[i] = NULL;
+    }
+    // nothing of the requests stays behind, other tasks may have moved a little meanwhile
+    TEST_ASSERT_GREATER_OR_EQUAL(free_before - 1024, heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
+}
+
+void test_json_arena_soak()
+{
+    json_arena_stats_t before;
+    get_json_arena_stats(&before);
+    json_soak(false);
+    json_soak(true);
+    json_arena_stats_t after;
+    get_json_arena_stats(&after);
+    TEST_ASSERT_EQUAL(before.scopes + JSON_SOAK_ROUNDS, after.scopes);
+    TEST_ASSERT_EQUAL(before.fallbacks, after.fallbacks);
+    TEST_ASSERT_LESS_OR_EQUAL(sizeof(soak_arena_buffer), after.peak_bytes);
+
+    // a second scope in the same task is refused, the first one stays usable
+    json_arena_t outer, inner;
+    TEST_ASSERT_EQUAL(ESP_OK, json_arena_begin(&outer, soak_arena_buffer, sizeof(soak_arena_buffer)));
+    TEST_ASSERT_EQUAL(ESP_FAIL, json_arena_begin(&inner, NULL, 1024));
+    cJSON *item = cJSON_CreateObject();
+    TEST_ASSERT_TRUE((uint8_t *)item >= soak_arena_buffer && (uint8_t *)item < soak_arena_buffer + sizeof(soak_arena_buffer));
+    cJSON_Delete(item);
+    json_arena_end(&inner);
+    json_arena_end(&outer);
+}
 
 void test_send_log_to_api()
 {
     TEST_ASSERT_EQUAL(ESP_OK, send_log_to_api("Test", "2023-05-01T15:30:45", "Test message"));
 }
+
+void test_api_client_reuses_connection()
+{
+    // three requests back to back share one connection, at most the first one needs a handshake
+    api_client_stats_t before;
+    get_api_client_stats(&before);
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL(ESP_OK, send_log_to_api("Test", "2023-05-01T15:30:45", "keep-alive test"));
+    }
+    api_client_stats_t after;
+    get_api_client_stats(&after);
+    // the log uploader shares the client and may send its own batches in between, only lower bounds hold
+    TEST_ASSERT_GREATER_OR_EQUAL(before.requests + 3, after.requests);
+    TEST_ASSERT_LESS_OR_EQUAL(before.handshakes + 1, after.handshakes);
+    close_api_client();
+}
+
+void test_send_logs_to_api_streamed()
+{
+    // more rows than one upload buffer holds, with characters the serializer has to escape
+    static log_t logs[40];
+    for (int i = 0; i < 40; i++) {
+        snprintf(logs[i].tag, sizeof(logs[i].tag), "Test");
+        snprintf(logs[i].date_time, sizeof(logs[i].date_time), "2023-05-01T15:30:%02d", i);
+        snprintf(logs[i].info, sizeof(logs[i].info), "streamed \"row\" %d\\\t%*s", i, 150, "end");
+    }
+    api_client_stats_t before;
+    get_api_client_stats(&before);
+    TEST_ASSERT_EQUAL(ESP_OK, send_logs_to_api(logs, 40));
+    api_client_stats_t after;
+    get_api_client_stats(&after);
+    // one request for all rows, requests of the log uploader in between only add to it
+    TEST_ASSERT_GREATER_OR_EQUAL(before.requests + 1, after.requests);
+}
+
+void test_log_msgpack_blocks()
+{
+    uint8_t packed[MSGPACK_HEADER_MAX];
+    TEST_ASSERT_EQUAL(1, msgpack_pack_int(packed, -1));
+    TEST_ASSERT_EQUAL_HEX8(0xff, packed[0]);
+    TEST_ASSERT_EQUAL(3, msgpack_pack_uint(packed, 300));
+    TEST_ASSERT_EQUAL_HEX8(0xcd, packed[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x01, packed[1]);
+    TEST_ASSERT_EQUAL_HEX8(0x2c, packed[2]);
+    TEST_ASSERT_EQUAL(5, msgpack_pack_int(packed, -40000));
+    TEST_ASSERT_EQUAL_HEX8(0xd2, packed[0]);
+
+    // 40 logs of the store make a full block and one of 8, each map starts with the seq of its first log
+    log_t log = {.tag = "TEST", .info = "msgpack block test"};
+    msgpack_body_len = 0;
+    log_msgpack_start(write_msgpack_body);
+    for (int i = 0; i < 40; i++) {
+        TEST_ASSERT_EQUAL(ESP_OK, log_msgpack_add(&log, LOG_EPOCH_VALID_MIN + 60 * i, 100 + i));
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, log_msgpack_finish());
+    TEST_ASSERT_EQUAL_HEX8(0x85, msgpack_body[0]);
+    TEST_ASSERT_EQUAL_HEX8(0xa3, msgpack_body[1]);
+    TEST_ASSERT_EQUAL_MEMORY("seq", &msgpack_body[2], 3);
+    TEST_ASSERT_EQUAL_HEX8(100, msgpack_body[5]);
+
+    // the tag name went once and every time after the first one is a single byte, far below json rows of ~80 bytes
+    TEST_ASSERT_LESS_THAN(40 * 30, msgpack_body_len);
+}
+
+void test_send_log_batch_to_api()
+{
+    // a batch never goes past its size, whatever it sent is no longer part of the lag
+    // the uploader task would otherwise send the new logs before the test does
+    TEST_ASSERT_EQUAL(ESP_OK, log_uploader_hold());
+    for (int i = 0; i < 10; i++) {
+        TEST_ASSERT_EQUAL(ESP_OK, log_item("TEST", "uploader batch test"));
+    }
+    vTaskDelay(500 / portTICK_PERIOD_MS);
+    log_cursor_t before;
+    get_log_upload_cursor(&before);
+    int sent;
+    esp_err_t ret = send_log_batch_to_api(5, &sent);
+    log_cursor_t after;
+    get_log_upload_cursor(&after);
+    log_uploader_release();
+    TEST_ASSERT_EQUAL(ESP_OK, ret);
+    TEST_ASSERT_EQUAL(5, sent);
+
+    // every log the api committed used up one sequence number
+    TEST_ASSERT_EQUAL(before.log_seq + 5, after.log_seq);
+
+    log_uploader_stats_t stats;
+    get_log_uploader_stats(&stats);
+    TEST_ASSERT_GREATER_OR_EQUAL(0, stats.lag_logs);
+    TEST_ASSERT_GREATER_OR_EQUAL(LOG_UPLOADER_MIN_BATCH, stats.batch_size);
+    TEST_ASSERT_LESS_OR_EQUAL(LOG_UPLOADER_MAX_BATCH, stats.batch_size);
+    if (stats.lag_logs == 0) {
+        TEST_ASSERT_EQUAL(0, stats.lag_seconds);
+    }
+}
+
+void test_send_log_batch_reuses_connection()
+{
+    // the connection of the first batch is still open for the second one, at most the first one needs a handshake
+    TEST_ASSERT_EQUAL(ESP_OK, log_uploader_hold());
+    for (int i = 0; i < 10; i++) {
+        TEST_ASSERT_EQUAL(ESP_OK, log_item("TEST", "uploader keep-alive test"));
+    }
+    vTaskDelay(500 / portTICK_PERIOD_MS);
+    api_client_stats_t before;
+    get_api_client_stats(&before);
+    int sent_first, sent_second;
+    esp_err_t ret_first = send_log_batch_to_api(5, &sent_first);
+    esp_err_t ret_second = send_log_batch_to_api(5, &sent_second);
+    api_client_stats_t after;
+    get_api_client_stats(&after);
+    log_uploader_release();
+    TEST_ASSERT_EQUAL(ESP_OK, ret_first);
+    TEST_ASSERT_EQUAL(ESP_OK, ret_second);
+    TEST_ASSERT_EQUAL(5, sent_first);
+    TEST_ASSERT_EQUAL(5, sent_second);
+    TEST_ASSERT_LESS_OR_EQUAL(before.handshakes + 1, after.handshakes);
+}
+
+#ifdef CONFIG_TEST_UPLOAD_BENCHMARK
+void test_upload_benchmark()
+{
+    // the store starts out uploaded, the benchmark only measures its own logs
+    TEST_ASSERT_EQUAL(ESP_OK, send_all_logs_to_api(false));
+    for (int i = 0; i < CONFIG_TEST_UPLOAD_BENCHMARK_LOGS; i++) {
+        char info[64];
+        snprintf(info, sizeof(info), "Access denied for device %d, key 0123456789ABCDEF", i % 9);
+        TEST_ASSERT_EQUAL(ESP_OK, log_item("NRF_MESSAGE_HANDLER", info));
+        if (i % 50 == 49) {
+            // lets the logger task commit the ring before it fills up
+            vTaskDelay(100 / portTICK_PERIOD_MS);
+        }
+    }
+    vTaskDelay(1000 / portTICK_PERIOD_MS);
+
+    log_cursor_t cursor_before;
+    get_log_upload_cursor(&cursor_before);
+    api_client_stats_t before;
+    get_api_client_stats(&before);
+    size_t free_before = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    heap_caps_monitor_local_minimum_free_size_start();
+    int64_t start = esp_timer_get_time();
+
+    esp_err_t ret = send_all_logs_to_api(false);
+
+    int64_t elapsed_us = esp_timer_get_time() - start;
+    size_t free_min = heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+    heap_caps_monitor_local_minimum_free_size_stop();
+    api_client_stats_t after;
+    get_api_client_stats(&after);
+    log_cursor_t cursor_after;
+    get_log_upload_cursor(&cursor_after);
+
+    // printf, the log output is off while tests run
+    uint32_t uploaded = cursor_after.log_seq - cursor_before.log_seq;
+    uint32_t bytes = after.bytes_sent - before.bytes_sent;
+    printf("upload benchmark: %u logs in %u ms, %u logs/s, %u bytes sent (%u per log), %u requests, %u handshakes, "
+           "peak heap %u bytes\n", (unsigned)uploaded, (unsigned)(elapsed_us / 1000),
+           elapsed_us > 0 ? (unsigned)(uploaded * 1000000LL / elapsed_us) : 0, (unsigned)bytes,
+           uploaded > 0 ? (unsigned)(bytes / uploaded) : 0, (unsigned)(after.requests - before.requests),
+           (unsigned)(after.handshakes - before.handshakes), (unsigned)(free_before - free_min));
+
+    TEST_ASSERT_EQUAL(ESP_OK, ret);
+    TEST_ASSERT_GREATER_OR_EQUAL(CONFIG_TEST_UPLOAD_BENCHMARK_LOGS, uploaded);
+}
+#endif
@@ -3,6 +3,9 @@
 //
 
 #include "../main/access/access.h"
+#include "../main/access/brute_force.h"
+#include "../main/access/occupancy.h"
+#include "../main/logger/log_clock.h"
 
 void test_add_key() 
 {
@@ -166,3 +169,70 @@ void test_delete_all_devices(void)
     TEST_ASSERT_EQUAL(0, get_devices(NULL, NULL));
 }
 
+void test_brute_force_detector(void)
+{
+    brute_force_reset();
+
+    // denied swipes with different keys only add up per device
+    for (int i = 0; i < BRUTE_FORCE_DEVICE_THRESHOLD - 1; i++) {
+        brute_force_record_deny(98, 0x1000 + i);
+    }
+    TEST_ASSERT_FALSE(brute_force_locked(98));
+    brute_force_record_deny(98, 0x2000);
+    TEST_ASSERT_EQUAL(BRUTE_FORCE_LOCKOUT_S > 0, brute_force_locked(98));
+
+    // other devices are not affected, a lockout can be lifted
+    TEST_ASSERT_FALSE(brute_force_locked(97));
+    brute_force_clear_lockout(98);
+    TEST_ASSERT_FALSE(brute_force_locked(98));
+
+    // one key denied on several devices does not lock any of them
+    for (int i = 0; i < BRUTE_FORCE_KEY_THRESHOLD; i++) {
+        brute_force_record_deny(90 + i, 0xDEADBEEF);
+    }
+    for (int i = 0; i < BRUTE_FORCE_KEY_THRESHOLD; i++) {
+        TEST_ASSERT_FALSE(brute_force_locked(90 + i));
+    }
+
+    // out of range devices are ignored
+    brute_force_record_deny(-1, 0);
+    brute_force_record_deny(BRUTE_FORCE_MAX_DEVICES, 0);
+    TEST_ASSERT_FALSE(brute_force_locked(BRUTE_FORCE_MAX_DEVICES));
+    brute_force_reset();
+}
+
+void test_occupancy(void)
+{
+    occupancy_reset();
+    occupancy_t occupancy[OCCUPANCY_MAX_DEVICES];
+
+    TEST_ASSERT_EQUAL(0, get_occupancy(occupancy, OCCUPANCY_MAX_DEVICES));
+
+    // a grant opens a session, listed in device order
+    occupancy_granted(12, 0xAA);
+    occupancy_granted(3, 0xBB);
+    TEST_ASSERT_EQUAL(2, get_occupancy(occupancy, OCCUPANCY_MAX_DEVICES));
+    TEST_ASSERT_EQUAL(3, occupancy[0].device);
+    TEST_ASSERT_EQUAL_HEX64(0xBB, occupancy[0].key);
+    TEST_ASSERT_EQUAL(12, occupancy[1].device);
+    TEST_ASSERT_EQUAL_HEX64(0xAA, occupancy[1].key);
+    TEST_ASSERT_TRUE(occupancy[1].since <= log_clock_now());
+
+    // a new grant on a device in use takes it over
+    occupancy_granted(12, 0xCC);
+    TEST_ASSERT_TRUE(get_device_occupancy(12, &occupancy[0]));
+    TEST_ASSERT_EQUAL_HEX64(0xCC, occupancy[0].key);
+
+    // the turn off acknowledgement frees the device
+    occupancy_released(12);
+    TEST_ASSERT_FALSE(get_device_occupancy(12, &occupancy[0]));
+    TEST_ASSERT_EQUAL(1, get_occupancy(occupancy, OCCUPANCY_MAX_DEVICES));
+    TEST_ASSERT_EQUAL(1, get_occupancy(occupancy, 1));
+    TEST_ASSERT_EQUAL(0, get_occupancy(occupancy, 0));
+
+    // out of range devices are ignored
+    occupancy_granted(OCCUPANCY_MAX_DEVICES, 0xDD);
+    occupancy_released(-1);
+    TEST_ASSERT_EQUAL(1, get_occupancy(occupancy, OCCUPANCY_MAX_DEVICES));
+    occupancy_reset();
+}
@@ -9,6 +9,14 @@
 #include <time.h>
 #include <sys/time.h>
 #include "../main/logger/logger.h"
+#include "../main/logger/log_limiter.h"
+#include "../main/logger/log_clock.h"
+#include "../main/logger/sntp.h"
+#include "../main/logger/log_rollup.h"
+#include "../main/logger/log_sink.h"
+#include "../main/logger/log_syslog.h"
+#include "../main/logger/log_compress.h"
+#include "esp_timer.h"
 
 void test_log_item(void) {
     // Test implementation for log_item function
@@ -16,13 +24,20 @@ void test_log_item(void) {
     esp_err_t result = log_item("TEST", "TEST ITEM");
     TEST_ASSERT_EQUAL(ESP_OK, result);
 
-    TEST_ASSERT((get_log_lines() == amount_logs_before + 1) || (amount_logs_before+1 > MAX_LOG_LINES && get_log_lines() == MAX_LOG_LINES));
+    // a full log store drops its oldest segment, which removes more logs than were added
+    TEST_ASSERT((get_log_lines() == amount_logs_before + 1) || (get_log_lines() < amount_logs_before));
 }
 
 void stress_test_log_item(void) {
     // Stress test implementation for log_item function
     clear_logs();
     int amount_logs_before = get_log_lines();
+    // a full store drops its oldest segment, at most that many logs can go missing on the way
+    static log_segment_t segments[LOG_MAX_SEGMENTS];
+    int amount_segments = get_log_segments(segments, LOG_MAX_SEGMENTS);
+    int droppable = amount_segments >= LOG_MAX_SEGMENTS ? segments[0].records : 0;
+    logger_stats_t stats_before;
+    get_logger_stats(&stats_before);
     esp_err_t result;
     for (int count = 0; count < 50; count++) {
         char item[200];
@@ -36,7 +51,13 @@ void stress_test_log_item(void) {
 
     TEST_ASSERT_EQUAL(ESP_OK, result);
 
-    TEST_ASSERT((get_log_lines() == amount_logs_before + 50) || (amount_logs_before+50 > MAX_LOG_LINES && get_log_lines() == MAX_LOG_LINES));
+    // every item reached the store, other tasks may have logged in between
+    logger_stats_t stats_after;
+    get_logger_stats(&stats_after);
+    TEST_ASSERT_GREATER_OR_EQUAL(stats_before.records_written + 50, stats_after.records_written);
+    TEST_ASSERT_EQUAL(stats_before.write_failures, stats_after.write_failures);
+    int amount_logs_after = get_log_lines();
+    TEST_ASSERT_GREATER_OR_EQUAL(amount_logs_before + 50 - droppable, amount_logs_after);
 }
 
 void test_delete_logs(void) {
@@ -52,4 +73,453 @@ void test_delete_logs(void) {
     TEST_ASSERT_EQUAL(ESP_OK, delete_logs(2, 4));
 
     TEST_ASSERT_EQUAL(2, get_log_lines());
-}
\ No newline at end of file
+}
+
+void test_seal_and_drop_log_segment(void) {
+
+    clear_logs();
+
+    log_item("TEST", "TEST_ITEM1");
+    log_event(LOG_TAG_NRF_MESSAGE_HANDLER, LOG_EVENT_PING_OK, 12, 0, NULL);
+    vTaskDelay(500 / portTICK_PERIOD_MS);
+
+    TEST_ASSERT_EQUAL(ESP_OK, seal_logs());
+    log_item("TEST3", "TEST_ITEM3");
+    vTaskDelay(500 / portTICK_PERIOD_MS);
+
+    log_segment_t segments[LOG_MAX_SEGMENTS];
+    int amount_segments = get_log_segment_list(segments, LOG_MAX_SEGMENTS);
+    TEST_ASSERT_EQUAL(2, amount_segments);
+    TEST_ASSERT_EQUAL(2, segments[0].records);
+
+    log_t logs[2];
+    TEST_ASSERT_EQUAL(2, parse_segment_logs(segments[0].seq, 1, logs, 2));
+    TEST_ASSERT_EQUAL_STRING("TEST", logs[0].tag);
+    TEST_ASSERT_EQUAL_STRING("TEST_ITEM1", logs[0].info);
+    TEST_ASSERT_EQUAL_STRING("received PING from device: 12, successful", logs[1].info);
+
+    TEST_ASSERT_EQUAL(ESP_OK, drop_log_segment(segments[0].seq));
+    TEST_ASSERT_EQUAL(1, get_log_lines());
+}
+
+void test_log_record_size(void) {
+    // structured events carry no text, only the fixed header goes to flash
+    log_record_t record = {
+        .tag_id = LOG_TAG_NRF_MESSAGE_HANDLER,
+        .event = LOG_EVENT_ACCESS_DENIED,
+        .device = 7,
+        .key = 0x0123456789ABCDEFULL,
+    };
+    set_log_record_text(&record, NULL);
+    TEST_ASSERT_EQUAL(LOG_RECORD_HEADER_LEN, log_record_size(&record));
+
+    log_t log;
+    format_log_record(&record, &log);
+    TEST_ASSERT_EQUAL_STRING("NRF_MESSAGE_HANDLER", log.tag);
+    TEST_ASSERT_EQUAL_STRING("received ACCESS from device: 7, ibutton: 0123456789ABCDEF, access denied", log.info);
+}
+
+void test_parse_log_info(void) {
+    // migrated legacy lines become the event they were logged as
+    log_record_t record = {
+        .tag_id = LOG_TAG_NRF_MESSAGE_HANDLER,
+    };
+    TEST_ASSERT_TRUE(parse_log_info("received ACCESS from device: 7, ibutton: 0123456789ABCDEF, access denied", &record));
+    TEST_ASSERT_EQUAL(LOG_EVENT_ACCESS_DENIED, record.event);
+    TEST_ASSERT_EQUAL(7, record.device);
+    TEST_ASSERT_TRUE(record.key == 0x0123456789ABCDEFULL);
+
+    TEST_ASSERT_TRUE(parse_log_info("SYNC message received from ID: 5", &record));
+    TEST_ASSERT_EQUAL(LOG_EVENT_SYNC_REQUEST, record.event);
+    TEST_ASSERT_TRUE(record.key == 5);
+
+    TEST_ASSERT_FALSE(parse_log_info("received PING from device: -1, successful", &record));
+    TEST_ASSERT_FALSE(parse_log_info("sending TURNON to device: 7 twice", &record));
+    TEST_ASSERT_FALSE(parse_log_info("free text", &record));
+}
+
+void test_group_commit(void) {
+    // a burst of records should be written in fewer batches than records
+    logger_stats_t before;
+    get_logger_stats(&before);
+
+    for (int count = 0; count < LOGGER_BATCH_MAX; count++) {
+        TEST_ASSERT_EQUAL(ESP_OK, log_event(LOG_TAG_TEST, LOG_EVENT_PING_OK, count, 0, NULL));
+    }
+    vTaskDelay(1000 / portTICK_PERIOD_MS);
+
+    logger_stats_t after;
+    get_logger_stats(&after);
+    TEST_ASSERT_EQUAL(before.records_written + LOGGER_BATCH_MAX, after.records_written);
+    TEST_ASSERT_LESS_THAN(LOGGER_BATCH_MAX, after.batches_written - before.batches_written);
+}
+
+void test_ring_overflow_policies(void) {
+    // fill the ring faster than the logger task can drain it, every lost record must be counted
+    logger_stats_t before;
+    get_logger_stats(&before);
+
+    set_logger_overflow_policy(LOGGER_OVERFLOW_DROP_NEWEST);
+    int burst = LOGGER_RING_SIZE / 32 * 2;
+    int accepted = 0;
+    for (int count = 0; count < burst; count++) {
+        if (log_event(LOG_TAG_TEST, LOG_EVENT_PING_OK, count, 0, NULL) == ESP_OK) {
+            accepted++;
+        }
+    }
+    vTaskDelay(2000 / portTICK_PERIOD_MS);
+
+    logger_stats_t after;
+    get_logger_stats(&after);
+    TEST_ASSERT_EQUAL(burst - accepted, after.dropped[LOG_TAG_TEST] - before.dropped[LOG_TAG_TEST]);
+    TEST_ASSERT_EQUAL(before.records_written + accepted, after.records_written);
+
+    // the priority lane keeps security events while the shared ring overflows
+    set_logger_overflow_policy(LOGGER_OVERFLOW_PRIORITY_LANE);
+    get_logger_stats(&before);
+    for (int count = 0; count < burst; count++) {
+        log_event(LOG_TAG_TEST, LOG_EVENT_PING_OK, count, 0, NULL);
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, log_event(LOG_TAG_ACCESS, LOG_EVENT_ACCESS_DENIED, 1, 0x0123456789ABCDEF, NULL));
+    vTaskDelay(2000 / portTICK_PERIOD_MS);
+    get_logger_stats(&after);
+    TEST_ASSERT_EQUAL(before.dropped[LOG_TAG_ACCESS], after.dropped[LOG_TAG_ACCESS]);
+}
+
+void test_query_logs(void) {
+    // only the records of one device should come back, in pages
+    for (int count = 0; count < 5; count++) {
+        TEST_ASSERT_EQUAL(ESP_OK, log_event(LOG_TAG_TEST, LOG_EVENT_PING_OK, 4242, 0, NULL));
+        TEST_ASSERT_EQUAL(ESP_OK, log_event(LOG_TAG_TEST, LOG_EVENT_PING_OK, 4243, 0, NULL));
+    }
+    vTaskDelay(1000 / portTICK_PERIOD_MS);
+
+    log_query_t query;
+    init_log_query(&query);
+    TEST_ASSERT_EQUAL(ESP_OK, set_log_query_filter(&query, "tag", "TEST"));
+    TEST_ASSERT_EQUAL(ESP_OK, set_log_query_filter(&query, "device", "4242"));
+    TEST_ASSERT_EQUAL(ESP_OK, set_log_query_filter(&query, "offset", "1"));
+    TEST_ASSERT_NOT_EQUAL(ESP_OK, set_log_query_filter(&query, "device", "not a number"));
+    TEST_ASSERT_NOT_EQUAL(ESP_OK, set_log_query_filter(&query, "unknown", "1"));
+
+    log_t logs[2];
+    int total = 0;
+    while (!query.done) {
+        int amount = query_logs(&query, logs, 2);
+        TEST_ASSERT_GREATER_OR_EQUAL(0, amount);
+        for (int i = 0; i < amount; i++) {
+            TEST_ASSERT_EQUAL_STRING("received PING from device: 4242, successful", logs[i].info);
+        }
+        total += amount;
+    }
+    TEST_ASSERT_EQUAL(4, total);
+
+    // a time range in the future skips every segment
+    init_log_query(&query);
+    TEST_ASSERT_EQUAL(ESP_OK, set_log_query_filter(&query, "from", "2100-01-01"));
+    TEST_ASSERT_EQUAL(0, query_logs(&query, logs, 2));
+}
+
+void test_upload_cursor(void) {
+    // the cursor only moves forward and reclaiming keeps the logs that were not uploaded
+    TEST_ASSERT_EQUAL(ESP_OK, log_event(LOG_TAG_TEST, LOG_EVENT_PING_OK, 1, 0, NULL));
+    vTaskDelay(1000 / portTICK_PERIOD_MS);
+    TEST_ASSERT_EQUAL(ESP_OK, seal_logs());
+
+    log_cursor_t cursor;
+    get_log_upload_cursor(&cursor);
+    log_cursor_t backwards = cursor;
+    if (backwards.offset > 0) {
+        backwards.offset--;
+        TEST_ASSERT_NOT_EQUAL(ESP_OK, advance_log_upload_cursor(&backwards));
+    }
+
+    // mark everything up to the active segment as uploaded
+    log_segment_t segments[LOG_MAX_SEGMENTS];
+    int amount = get_log_segment_list(segments, LOG_MAX_SEGMENTS);
+    TEST_ASSERT_GREATER_THAN(1, amount);
+    log_cursor_t uploaded = { .seq = segments[amount - 1].seq, .offset = 0, .log_seq = cursor.log_seq };
+    TEST_ASSERT_EQUAL(ESP_OK, advance_log_upload_cursor(&uploaded));
+    TEST_ASSERT_EQUAL(ESP_OK, reclaim_logs());
+
+    TEST_ASSERT_EQUAL(1, get_log_segment_list(segments, LOG_MAX_SEGMENTS));
+    get_log_upload_cursor(&cursor);
+    TEST_ASSERT_EQUAL(uploaded.seq, cursor.seq);
+
+    // sequence numbers are never handed out twice
+    log_cursor_t renumbered = cursor;
+    renumbered.log_seq--;
+    TEST_ASSERT_NOT_EQUAL(ESP_OK, advance_log_upload_cursor(&renumbered));
+}
+
+void test_log_limiter(void) {
+    // 1 in 5 sampling keeps 2 of 10 events, the other 8 come back as one summary record
+    TEST_ASSERT_EQUAL(ESP_OK, set_log_limit(LOG_TAG_TEST, LOG_EVENT_PING_ERROR, 0, 0, 5));
+    flush_log_summaries();
+    vTaskDelay(1000 / portTICK_PERIOD_MS);
+
+    logger_stats_t before;
+    get_logger_stats(&before);
+    time_t start = time(NULL);
+    for (int count = 0; count < 10; count++) {
+        TEST_ASSERT_EQUAL(ESP_OK, log_event(LOG_TAG_TEST, LOG_EVENT_PING_ERROR, 77, 3, NULL));
+    }
+    flush_log_summaries();
+    vTaskDelay(1000 / portTICK_PERIOD_MS);
+
+    logger_stats_t after;
+    get_logger_stats(&after);
+    TEST_ASSERT_EQUAL(before.records_written + 3, after.records_written);
+
+    log_query_t query;
+    init_log_query(&query);
+    set_log_query_filter(&query, "tag", "TEST");
+    set_log_query_filter(&query, "device", "77");
+    query.from_epoch = start;
+    log_t logs[4];
+    TEST_ASSERT_EQUAL(3, query_logs(&query, logs, 4));
+    char expected[80];
+    snprintf(expected, sizeof(expected), "PING_ERROR device 77: 8 suppressed in last %d min", LOG_SUMMARY_INTERVAL_MIN);
+    TEST_ASSERT_EQUAL_STRING(expected, logs[2].info);
+
+    // sampling 1 in 1 without a bucket lets everything through again
+    TEST_ASSERT_EQUAL(ESP_OK, set_log_limit(LOG_TAG_TEST, LOG_EVENT_PING_ERROR, 0, 0, 1));
+}
+
+void test_log_limiter_per_device(void) {
+    // a device that used up its bucket does not hold back the events of another one
+    TEST_ASSERT_EQUAL(ESP_OK, set_log_limit(LOG_TAG_TEST, LOG_EVENT_PING_ERROR, 1, 1, 1));
+    TEST_ASSERT_TRUE(log_limiter_allow(LOG_TAG_TEST, LOG_EVENT_PING_ERROR, 77));
+    TEST_ASSERT_FALSE(log_limiter_allow(LOG_TAG_TEST, LOG_EVENT_PING_ERROR, 77));
+    TEST_ASSERT_TRUE(log_limiter_allow(LOG_TAG_TEST, LOG_EVENT_PING_ERROR, 78));
+
+    // a new limit starts every device over
+    TEST_ASSERT_EQUAL(ESP_OK, set_log_limit(LOG_TAG_TEST, LOG_EVENT_PING_ERROR, 0, 0, 1));
+    TEST_ASSERT_TRUE(log_limiter_allow(LOG_TAG_TEST, LOG_EVENT_PING_ERROR, 77));
+    flush_log_summaries();
+}
+
+void test_monotonic_timestamps(void) {
+    // a record stamped before the time sync shows its boot and uptime
+    uint32_t boot_id = log_clock_boot_id();
+    log_record_t record = {
+        .epoch = LOG_MONOTONIC_STAMP(boot_id, 90061),
+        .tag_id = LOG_TAG_TEST,
+        .event = LOG_EVENT_PING_OK,
+        .device = 3,
+    };
+    log_t log;
+    format_log_record(&record, &log);
+    char expected[50];
+    snprintf(expected, sizeof(expected), "boot %u +25:01:01", (unsigned)(boot_id & LOG_STAMP_BOOT_MASK));
+    TEST_ASSERT_EQUAL_STRING(expected, log.date_time);
+
+    if (!log_clock_is_synced()) {
+        TEST_IGNORE_MESSAGE("time not synced, correction not tested");
+    }
+    TEST_ASSERT_FALSE(LOG_STAMP_IS_MONOTONIC(log_clock_now()));
+
+    // once synced, stamps of this boot turn into wall-clock time, other boots are left alone
+    logger_time_synced();
+    record.epoch = LOG_MONOTONIC_STAMP(boot_id, esp_timer_get_time() / 1000000);
+    TEST_ASSERT_TRUE(log_clock_correct(&record));
+    TEST_ASSERT_UINT32_WITHIN(2, time(NULL), record.epoch);
+
+    record.epoch = LOG_MONOTONIC_STAMP(boot_id + 1, 10);
+    TEST_ASSERT_FALSE(log_clock_correct(&record));
+}
+
+void test_time_service(void) {
+    // the service is started by the logger, a sync within a minute of boot is expected with WiFi up
+    TEST_ASSERT_NOT_NULL(get_time_event_group());
+    TEST_ASSERT_TRUE(wait_for_valid_time(60000 / portTICK_PERIOD_MS));
+    TEST_ASSERT_TRUE(time_is_valid());
+
+    time_service_status_t status;
+    get_time_service_status(&status);
+    TEST_ASSERT_TRUE(status.valid);
+    TEST_ASSERT_GREATER_THAN(0, status.syncs);
+    TEST_ASSERT_TRUE(status.last_sync >= LOG_EPOCH_VALID_MIN);
+    // a crystal is off by tens of ppm, anything near a percent means the estimate is broken
+    TEST_ASSERT_INT32_WITHIN(10000, 0, get_time_drift_ppm());
+
+    // asking for a sync returns immediately, the answer comes through the callback
+    int64_t start = esp_timer_get_time();
+    TEST_ASSERT_EQUAL(ESP_OK, request_time_sync());
+    TEST_ASSERT_TRUE(esp_timer_get_time() - start < 100000);
+}
+
+void test_usage_rollups(void) {
+    // device 99 and this key are not used by real nodes
+    uint64_t key = 0x0123456789ABCDEFULL;
+    log_rollup_t before[LOG_ROLLUP_MAX_DEVICES + LOG_ROLLUP_MAX_KEYS + 1];
+    int amount = get_open_log_rollups(before, LOG_ROLLUP_MAX_DEVICES + LOG_ROLLUP_MAX_KEYS + 1);
+    TEST_ASSERT_TRUE(amount >= 0);
+    uint16_t grants = 0;
+    for (int i = 0; i < amount; i++) {
+        if (before[i].type == LOG_ROLLUP_DEVICE_HOUR && before[i].id == 99) {
+            grants = before[i].grants;
+        }
+    }
+
+    rollup_access(99, key, true);
+    rollup_device_state(99, true);
+    vTaskDelay(1100 / portTICK_PERIOD_MS);
+    rollup_device_state(99, false);
+    rollup_access(99, key, false);
+
+    log_rollup_t after[LOG_ROLLUP_MAX_DEVICES + LOG_ROLLUP_MAX_KEYS + 1];
+    amount = get_open_log_rollups(after, LOG_ROLLUP_MAX_DEVICES + LOG_ROLLUP_MAX_KEYS + 1);
+    log_rollup_t *device_hour = NULL;
+    log_rollup_t *key_day = NULL;
+    for (int i = 0; i < amount; i++) {
+        if (after[i].type == LOG_ROLLUP_DEVICE_HOUR && after[i].id == 99) {
+            device_hour = &after[i];
+        } else if (after[i].type == LOG_ROLLUP_KEY_DAY && after[i].id == key) {
+            key_day = &after[i];
+        }
+    }
+    TEST_ASSERT_NOT_NULL(device_hour);
+    TEST_ASSERT_NOT_NULL(key_day);
+    TEST_ASSERT_EQUAL(grants + 1, device_hour->grants);
+    TEST_ASSERT_TRUE(device_hour->denies >= 1);
+    TEST_ASSERT_TRUE(device_hour->on_seconds >= 1);
+    TEST_ASSERT_EQUAL(0, device_hour->period % 3600);
+    TEST_ASSERT_TRUE(key_day->on_seconds >= 1);
+
+    // the open periods are checkpointed, closed ones appended
+    TEST_ASSERT_EQUAL(ESP_OK, persist_log_rollups());
+}
+
+static _Atomic int captured_records;
+static _Atomic bool capture_failed;
+
+static esp_err_t capture_sink_write(const log_record_t *records, int amount, int *written) {
+    // the first batch fails after two records, like a datagram that could not be sent
+    bool fail = amount > 2 && !capture_failed;
+    *written = fail ? 2 : amount;
+    capture_failed |= fail;
+    for (int i = 0; i < *written; i++) {
+        if (records[i].tag_id == LOG_TAG_TEST && records[i].device == 77) {
+            captured_records++;
+        }
+    }
+    return fail ? ESP_FAIL : ESP_OK;
+}
+
+static esp_err_t stuck_sink_write(const log_record_t *records, int amount, int *written) {
+    // an offline sink: slow and failing
+    vTaskDelay(2000 / portTICK_PERIOD_MS);
+    *written = 0;
+    return ESP_FAIL;
+}
+
+void test_log_sinks(void) {
+    const log_sink_t capture_sink = {
+        .name = "test capture",
+        .write = capture_sink_write,
+        .batch_max = 4,
+        .interval_ms = 0,
+        .retry_max_ms = 1000,
+        .stack_size = 1024*3,
+        .priority = 1,
+    };
+    const log_sink_t stuck_sink = {
+        .name = "test stuck",
+        .write = stuck_sink_write,
+        .batch_max = 1,
+        .interval_ms = 0,
+        .retry_max_ms = 1000,
+        .stack_size = 1024*3,
+        .priority = 1,
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, register_log_sink(&capture_sink));
+    TEST_ASSERT_EQUAL(ESP_OK, register_log_sink(&stuck_sink));
+
+    logger_stats_t before;
+    get_logger_stats(&before);
+    for (int count = 0; count < 10; count++) {
+        TEST_ASSERT_EQUAL(ESP_OK, log_event(LOG_TAG_TEST, LOG_EVENT_PING_OK, 77, 0, NULL));
+    }
+    vTaskDelay(1000 / portTICK_PERIOD_MS);
+
+    // flash and the capture sink got everything while the stuck sink is still on its first record,
+    // the records written before the capture sink failed were not sent again
+    logger_stats_t after;
+    get_logger_stats(&after);
+    TEST_ASSERT_EQUAL(before.records_written + 10, after.records_written);
+    TEST_ASSERT_EQUAL(10, captured_records);
+
+    log_sink_stats_t stats[LOG_SINK_MAX];
+    int amount = get_log_sink_stats(stats, LOG_SINK_MAX);
+    TEST_ASSERT_TRUE(amount >= 2);
+    TEST_ASSERT_EQUAL_STRING("test stuck", stats[amount - 1].name);
+    TEST_ASSERT_EQUAL(0, stats[amount - 1].records_written);
+    TEST_ASSERT_TRUE(stats[amount - 2].records_written >= 10);
+}
+
+void test_syslog_format(void) {
+    char message[LOG_LINE_LEN + 128];
+    log_record_t record = {
+        .epoch = 1717243200,
+        .tag_id = LOG_TAG_NRF_MESSAGE_HANDLER,
+        .event = LOG_EVENT_ACCESS_DENIED,
+        .device = 7,
+        .key = 0x0123456789ABCDEFULL,
+    };
+    set_log_record_text(&record, NULL);
+
+    // local0.notice, UTC timestamp and the sequence number in the meta element
+    format_syslog_message(&record, 12, message, sizeof(message));
+    TEST_ASSERT_EQUAL_STRING("<133>1 2024-06-01T12:00:00Z " LOG_SYSLOG_NODE_NAME " NRF_MESSAGE_HANDLER - ACCESS_DENIED [meta sequenceId=\"12\"] "
+                             "received ACCESS from device: 7, ibutton: 0123456789ABCDEF, access denied", message);
+
+    // without wall-clock time the boot and uptime go in a structured data element
+    record.epoch = LOG_MONOTONIC_STAMP(3, 125);
+    record.event = LOG_EVENT_PING_OK;
+    format_syslog_message(&record, 13, message, sizeof(message));
+    TEST_ASSERT_EQUAL_STRING("<134>1 - " LOG_SYSLOG_NODE_NAME " NRF_MESSAGE_HANDLER - PING_OK [meta sequenceId=\"13\"][boot@32473 id=\"3\" uptime=\"125\"] "
+                             "received PING from device: 7, successful", message);
+}
+
+void test_log_compression(void) {
+    // rendered log lines repeat most of their text, the codec has to get at least 2:1 on them
+    static char lines[40 * LOG_LINE_LEN];
+    static uint8_t packed[LOG_COMPRESS_BOUND(sizeof(lines))];
+    static char unpacked[sizeof(lines)];
+    static uint32_t table[LOG_COMPRESS_HASH_SIZE];
+    int used = 0;
+    for (int i = 0; i < 40; i++) {
+        used += snprintf(&lines[used], sizeof(lines) - used, "NRF_MESSAGE_HANDLER,2024-06-01 12:00:%02d,received PING from device: %d, successful\n", i, i % 7);
+    }
+    int packed_len = log_compress((const uint8_t *)lines, used, packed, sizeof(packed), table);
+    TEST_ASSERT_GREATER_THAN(0, packed_len);
+    TEST_ASSERT_LESS_THAN(used / 2, packed_len);
+    TEST_ASSERT_EQUAL(used, log_decompress(packed, packed_len, (uint8_t *)unpacked, sizeof(unpacked)));
+    TEST_ASSERT_EQUAL_MEMORY(lines, unpacked, used);
+
+    // a sealed segment is stored compressed and still reads back record by record,
+    // the TEST tag has no rate limit that would hold back most of the pings
+    clear_logs();
+    for (int i = 0; i < 40; i++) {
+        TEST_ASSERT_EQUAL(ESP_OK, log_event(LOG_TAG_TEST, LOG_EVENT_PING_OK, i % 7, 0, NULL));
+    }
+    vTaskDelay(500 / portTICK_PERIOD_MS);
+    TEST_ASSERT_EQUAL(ESP_OK, seal_logs());
+
+    log_segment_t segments[LOG_MAX_SEGMENTS];
+    TEST_ASSERT_EQUAL(2, get_log_segment_list(segments, LOG_MAX_SEGMENTS));
+#ifdef CONFIG_LOGGER_COMPRESS_SEGMENTS
+    TEST_ASSERT_TRUE(segments[0].compressed);
+#endif
+    TEST_ASSERT_EQUAL(40, segments[0].records);
+
+    log_t logs[3];
+    TEST_ASSERT_EQUAL(3, parse_segment_logs(segments[0].seq, 37, logs, 3));
+    TEST_ASSERT_EQUAL_STRING("received PING from device: 1, successful", logs[0].info);
+    TEST_ASSERT_EQUAL_STRING("received PING from device: 3, successful", logs[2].info);
+
+    log_compress_stats_t stats;
+    get_log_compress_stats(&stats);
+    TEST_ASSERT_GREATER_THAN(stats.packed_bytes, stats.raw_bytes);
+}
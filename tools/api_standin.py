@@ -0,0 +1,395 @@
+#!/usr/bin/env python3
+#
+# Created by Vincent.
+#
+# Stand-in for api.php on a host, speaks the same protocol over HTTPS with
+# the test certificate main/certs/standin_cert.pem: single logs as GET, log
+# uploads as json rows or columnar MessagePack blocks (log_msgpack.h), plain
+# or LZ4 compressed, sequence numbered uploads of a node with committed_seq
+# in the answer, and rollups. Nothing is stored in a database, the logs are
+# kept per node in memory and optionally appended to a jsonl file.
+#
+# Build the firmware with CONFIG_API_ENDPOINT_OVERRIDE and CONFIG_API_ENDPOINT_URL
+# pointing at this host. Every request is printed with its logs and bytes on
+# the wire, the totals when the server stops.
+#
+#   python3 tools/api_standin.py --port 8443
+#   python3 tools/api_standin.py --port 8443 --latency-ms 80 --fail-every 10 --jsonl logs.jsonl
+#
+
+import argparse
+import itertools
+import json
+import os
+import ssl
+import struct
+import sys
+import threading
+import time
+from datetime import datetime, timezone
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qs, urlparse
+
+CERT_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "main", "certs")
+MSGPACK_CONTENT_TYPE = "application/x-msgpack"
+EPOCH_VALID_MIN = 1 << 30
+
+
+class BadRequest(Exception):
+    pass
+
+
+def lz4_block_decompress(src, expected_len):
+    # lz4_block_decompress() of api.php, one raw LZ4 block of a streamed upload, without frame
+    dst = bytearray()
+    ip = 0
+    while ip < len(src):
+        token = src[ip]
+        ip += 1
+        literal_len = token >> 4
+        if literal_len == 15:
+            while True:
+                if ip >= len(src):
+                    raise BadRequest("truncated LZ4 block")
+                more = src[ip]
+                ip += 1
+                literal_len += more
+                if more != 255:
+                    break
+        if ip + literal_len > len(src):
+            raise BadRequest("truncated LZ4 block")
+        dst += src[ip:ip + literal_len]
+        ip += literal_len
+        if ip == len(src):
+            break
+
+        if ip + 2 > len(src):
+            raise BadRequest("truncated LZ4 block")
+        offset = src[ip] | (src[ip + 1] << 8)
+        ip += 2
+        match_len = (token & 0x0F) + 4
+        if token & 0x0F == 15:
+            while True:
+                if ip >= len(src):
+                    raise BadRequest("truncated LZ4 block")
+                more = src[ip]
+                ip += 1
+                match_len += more
+                if more != 255:
+                    break
+        start = len(dst) - offset
+        if offset == 0 or start < 0 or len(dst) + match_len > expected_len:
+            raise BadRequest("invalid LZ4 match")
+        # the match may overlap the bytes it produces
+        for i in range(match_len):
+            dst.append(dst[start + i])
+    if len(dst) != expected_len:
+        raise BadRequest("LZ4 block has the wrong length")
+    return bytes(dst)
+
+
+def lz4_blocks_decompress(src):
+    # streamed uploads, blocks of [uint16 raw length][uint16 packed length][LZ4 block]
+    dst = bytearray()
+    position = 0
+    while position < len(src):
+        if position + 4 > len(src):
+            raise BadRequest("truncated LZ4 block header")
+        raw, packed = struct.unpack_from("<HH", src, position)
+        dst += lz4_block_decompress(src[position + 4:position + 4 + packed], raw)
+        position += 4 + packed
+    return bytes(dst)
+
+
+def msgpack_read(data, pos):
+    # only the types the master sends, returns the value and the position after it
+    if pos >= len(data):
+        raise BadRequest("truncated MessagePack")
+    kind = data[pos]
+    pos += 1
+    if kind < 0x80:
+        return kind, pos
+    if kind >= 0xe0:
+        return kind - 0x100, pos
+    if kind & 0xf0 == 0x80:
+        return msgpack_read_map(data, pos, kind & 0x0f)
+    if kind & 0xf0 == 0x90:
+        return msgpack_read_array(data, pos, kind & 0x0f)
+    if kind & 0xe0 == 0xa0:
+        return msgpack_read_str(data, pos, kind & 0x1f)
+    if kind == 0xc0:
+        return None, pos
+    if kind in (0xc2, 0xc3):
+        return kind == 0xc3, pos
+    if 0xcc <= kind <= 0xd3:
+        size = 1 << ((kind - 0xcc) % 4)
+        return msgpack_read_number(data, pos, size, kind >= 0xd0)
+    if kind in (0xd9, 0xda, 0xdb):
+        length, pos = msgpack_read_number(data, pos, 1 << (kind - 0xd9), False)
+        return msgpack_read_str(data, pos, length)
+    if kind in (0xdc, 0xdd):
+        amount, pos = msgpack_read_number(data, pos, 2 if kind == 0xdc else 4, False)
+        return msgpack_read_array(data, pos, amount)
+    if kind in (0xde, 0xdf):
+        amount, pos = msgpack_read_number(data, pos, 2 if kind == 0xde else 4, False)
+        return msgpack_read_map(data, pos, amount)
+    raise BadRequest("unsupported MessagePack type 0x%02x" % kind)
+
+
+def msgpack_read_number(data, pos, size, signed):
+    if pos + size > len(data):
+        raise BadRequest("truncated MessagePack")
+    return int.from_bytes(data[pos:pos + size], "big", signed=signed), pos + size
+
+
+def msgpack_read_str(data, pos, length):
+    if pos + length > len(data):
+        raise BadRequest("truncated MessagePack")
+    return data[pos:pos + length].decode("utf-8", "replace"), pos + length
+
+
+def msgpack_read_array(data, pos, amount):
+    array = []
+    for _ in range(amount):
+        value, pos = msgpack_read(data, pos)
+        array.append(value)
+    return array, pos
+
+
+def msgpack_read_map(data, pos, amount):
+    result = {}
+    for _ in range(amount):
+        key, pos = msgpack_read(data, pos)
+        result[key], pos = msgpack_read(data, pos)
+    return result, pos
+
+
+def format_log_stamp(stamp):
+    # format_log_stamp() of api.php, a wall-clock time arrives as local time counted like UTC
+    if stamp < EPOCH_VALID_MIN:
+        uptime = stamp & 0xFFFFFF
+        return "boot %u +%02u:%02u:%02u" % ((stamp >> 24) & 0x3F, uptime // 3600, uptime // 60 % 60, uptime % 60)
+    return datetime.fromtimestamp(stamp, timezone.utc).strftime("%Y-%m-%d %H:%M:%S")
+
+
+def decode_msgpack_logs(body):
+    # decode_msgpack_logs() of api.php, columnar blocks back into json rows
+    logs = []
+    tags = []
+    pos = 0
+    while pos < len(body):
+        block, pos = msgpack_read(body, pos)
+        if not isinstance(block, dict) or not all(isinstance(block.get(c), list) for c in ("tags", "tag", "time", "info")):
+            raise BadRequest("invalid MessagePack block")
+        if not len(block["tag"]) == len(block["time"]) == len(block["info"]):
+            raise BadRequest("MessagePack columns of different length")
+        tags += block["tags"]
+        stamp = 0
+        for i, info in enumerate(block["info"]):
+            if block["tag"][i] >= len(tags):
+                raise BadRequest("unknown tag index")
+            stamp = block["time"][0] if i == 0 else stamp + block["time"][i]
+            log = {"TAG": tags[block["tag"][i]], "date_time": format_log_stamp(stamp), "info": info}
+            if "seq" in block:
+                log["seq"] = block["seq"] + i
+            logs.append(log)
+    return logs
+
+
+class Store:
+    # the logs and upload_nodes tables of api.php, per node the stored sequence numbers above committed_seq
+
+    def __init__(self, jsonl):
+        self.lock = threading.Lock()
+        self.nodes = {}
+        self.jsonl = open(jsonl, "a") if jsonl else None
+        self.requests = 0
+        self.failed = 0
+        self.logs = 0
+        self.duplicates = 0
+        self.wire_bytes = 0
+        self.body_bytes = 0
+        self.first_request = None
+        self.last_request = None
+
+    def insert(self, logs, node=None, acked=0):
+        with self.lock:
+            stored = logs
+            committed = None
+            if node is not None:
+                state = self.nodes.setdefault(node, {"committed": 0, "pending": set()})
+                state["committed"] = max(state["committed"], acked)
+                stored = []
+                for log in logs:
+                    seq = int(log["seq"])
+                    if seq <= state["committed"] or seq in state["pending"]:
+                        self.duplicates += 1
+                        continue
+                    state["pending"].add(seq)
+                    stored.append(log)
+                # follow the stored numbers up to the first gap
+                while state["committed"] + 1 in state["pending"]:
+                    state["committed"] += 1
+                    state["pending"].discard(state["committed"])
+                committed = state["committed"]
+            if self.jsonl:
+                for log in stored:
+                    self.jsonl.write(json.dumps(dict(log, node=node) if node else log) + "\n")
+                self.jsonl.flush()
+            self.logs += len(stored)
+            return committed
+
+    def count(self, start, end, wire_bytes, body_bytes, failed):
+        with self.lock:
+            self.requests += 1
+            self.failed += failed
+            self.wire_bytes += wire_bytes
+            self.body_bytes += body_bytes
+            self.first_request = start if self.first_request is None else self.first_request
+            self.last_request = end
+
+    def summary(self):
+        busy = (self.last_request - self.first_request) if self.requests else 0
+        return ("%d requests (%d failed), %d logs stored, %d duplicates skipped, %d bytes on the wire (%d of bodies), "
+                "%.0f logs/s over %.1f s" % (self.requests, self.failed, self.logs, self.duplicates, self.wire_bytes,
+                                             self.body_bytes, self.logs / busy if busy > 0 else 0, busy))
+
+
+class StandinHandler(BaseHTTPRequestHandler):
+    # keep-alive like the live server, the api client reuses its connection
+    protocol_version = "HTTP/1.1"
+    server_version = "api-standin"
+
+    def log_message(self, format, *args):
+        pass
+
+    def do_GET(self):
+        start = time.perf_counter()
+        query = parse_qs(urlparse(self.path).query)
+        log = {key: query.get(key, [""])[0] for key in ("TAG", "date_time", "info")}
+        self.server.store.insert([log])
+        self.finish_request(start, 0, 200, {"result": "log inserted"}, 1)
+
+    def do_POST(self):
+        start = time.perf_counter()
+        query = parse_qs(urlparse(self.path).query)
+        raw = self.read_raw_body()
+        options = self.server.options
+        sequence = next(self.server.sequence)
+        if options.latency_ms > 0:
+            time.sleep(options.latency_ms / 1000)
+        if options.fail_every > 0 and sequence % options.fail_every == 0:
+            self.finish_request(start, raw[1], 500, {"error": "unable to insert logs"}, 0)
+            return
+
+        try:
+            body = self.decode_body(raw[0])
+            if query.get("type") == ["rollups"]:
+                # like api.php, rows are numbered per node
+                rollups = json.loads(body)
+                if "node" not in query or not isinstance(rollups, list) or any("seq" not in r for r in rollups):
+                    raise BadRequest("invalid rollups")
+                self.finish_request(start, raw[1], 200, {"result": "rollups inserted", "inserted": len(rollups)},
+                                    len(rollups))
+                return
+            if self.headers.get("Content-Type", "").startswith(MSGPACK_CONTENT_TYPE):
+                logs = decode_msgpack_logs(body)
+            else:
+                logs = json.loads(body)
+            if not isinstance(logs, list):
+                raise BadRequest("invalid logs")
+        except (BadRequest, ValueError) as e:
+            self.finish_request(start, raw[1], 400, {"error": str(e)}, 0)
+            return
+
+        if "node" in query:
+            acked = int(query.get("acked", ["0"])[0] or 0)
+            if any("seq" not in log for log in logs):
+                self.finish_request(start, raw[1], 400, {"error": "invalid logs"}, 0)
+                return
+            committed = self.server.store.insert(logs, query["node"][0], acked)
+            self.finish_request(start, raw[1], 200, {"result": "logs inserted", "committed_seq": committed}, len(logs))
+        else:
+            self.server.store.insert(logs)
+            self.finish_request(start, raw[1], 200, {"result": "logs inserted"}, len(logs))
+
+    def read_raw_body(self):
+        # the body and how many bytes it took on the wire, chunk framing included
+        if self.headers.get("Transfer-Encoding", "").lower() == "chunked":
+            body = bytearray()
+            wire = 0
+            while True:
+                size_line = self.rfile.readline()
+                wire += len(size_line)
+                size = int(size_line.split(b";")[0].strip() or b"0", 16)
+                if size == 0:
+                    trailer = self.rfile.readline()
+                    wire += len(trailer)
+                    while trailer not in (b"\r\n", b"\n", b""):
+                        trailer = self.rfile.readline()
+                        wire += len(trailer)
+                    return bytes(body), wire
+                body += self.rfile.read(size)
+                wire += size + len(self.rfile.readline())
+        length = int(self.headers.get("Content-Length", "0"))
+        body = self.rfile.read(length)
+        return body, length
+
+    def decode_body(self, body):
+        encoding = self.headers.get("Content-Encoding", "")
+        if encoding == "x-lz4-blocks":
+            return lz4_blocks_decompress(body)
+        return body
+
+    def finish_request(self, start, body_wire_bytes, status, message, items):
+        answer = json.dumps(message).encode()
+        self.send_response(status)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(answer)))
+        self.end_headers()
+        self.wfile.write(answer)
+
+        # request line and headers as they came in, plus the body
+        header_bytes = len(self.requestline) + 2 + sum(len(k) + len(v) + 4 for k, v in self.headers.items()) + 2
+        end = time.perf_counter()
+        self.server.store.count(start, end, header_bytes + body_wire_bytes, body_wire_bytes, status != 200)
+        encoding = ", ".join(filter(None, [self.headers.get("Content-Type", ""), self.headers.get("Content-Encoding", "")]))
+        print("%s %s %s: %d, %d items, %d bytes on the wire%s, %.0f ms" % (
+            self.client_address[0], self.command, self.path, status, items, header_bytes + body_wire_bytes,
+            " (%s)" % encoding if encoding else "", (end - start) * 1000), flush=True)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Host stand-in for api.php over HTTPS")
+    parser.add_argument("--host", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=8443)
+    parser.add_argument("--cert", default=os.path.join(CERT_DIR, "standin_cert.pem"))
+    parser.add_argument("--key", default=os.path.join(CERT_DIR, "standin_key.pem"))
+    parser.add_argument("--latency-ms", type=int, default=0, help="added to every POST, as a database would")
+    parser.add_argument("--fail-every", type=int, default=0, help="answer every Nth POST with 500")
+    parser.add_argument("--jsonl", help="append the stored logs to this file")
+    parser.add_argument("--duration", type=float, default=0, help="stop after this many seconds")
+    options = parser.parse_args()
+
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    context.load_cert_chain(options.cert, options.key)
+    server = ThreadingHTTPServer((options.host, options.port), StandinHandler)
+    server.socket = context.wrap_socket(server.socket, server_side=True)
+    server.options = options
+    server.store = Store(options.jsonl)
+    server.sequence = itertools.count(1)
+    print("api stand-in on https://%s:%d/api.php" % (options.host, options.port), flush=True)
+
+    if options.duration > 0:
+        threading.Timer(options.duration, server.shutdown).start()
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    server.server_close()
+    print(server.store.summary())
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,173 @@
+#!/usr/bin/env python3
+#
+# Created by Vincent.
+#
+# Rows per second of the log inserts in api.php, the old path (one INSERT and
+# commit per log) against the bulk path (multi-row INSERTs of --chunk-size
+# rows in one transaction per upload batch). The sequenced path is what a
+# node upload (?node=) costs: INSERT IGNORE of (node, seq, ...) rows, with
+# --resend percent of every batch repeating the end of the previous one like
+# a retried request, and the committed_seq scan of upload_nodes in the same
+# transaction. The statements are built the same way insert_logs() and the
+# node branch of api.php build them. Runs against SQLite as a stand-in, or
+# against MySQL with --mysql when PyMySQL is installed.
+#
+#   python3 tools/insert_benchmark.py
+#   python3 tools/insert_benchmark.py --rows 50000 --batch 50 500 5000 --chunk-size 500 --resend 20
+#   python3 tools/insert_benchmark.py --mysql localhost --user root --password secret --database access
+#
+
+import argparse
+import os
+import sys
+import tempfile
+import time
+
+SCHEMA_SQLITE = """CREATE TABLE logs (id INTEGER PRIMARY KEY AUTOINCREMENT, node VARCHAR(12), seq BIGINT,
+                   TAG VARCHAR(20), date_time VARCHAR(50), info VARCHAR(220), UNIQUE (node, seq))"""
+SCHEMA_MYSQL = """CREATE TABLE logs (id INT AUTO_INCREMENT PRIMARY KEY, node VARCHAR(12), seq BIGINT,
+                  TAG VARCHAR(20), date_time VARCHAR(50), info VARCHAR(220), UNIQUE KEY (node, seq))"""
+NODES_SCHEMA = "CREATE TABLE upload_nodes (node VARCHAR(12) PRIMARY KEY, committed_seq BIGINT)"
+NODE = "A0B1C2D3E4F5"
+
+
+def make_logs(amount):
+    # rows as the master sends them, about 100 bytes each
+    return [("NRF_MESSAGE_HANDLER", "2024-06-01T12:%02d:%02d" % (i // 60 % 60, i % 60),
+             "Access denied for device %d, key 0123456789ABCDEF" % (i % 9)) for i in range(amount)]
+
+
+def insert_per_row(conn, param, logs):
+    # api.php before: one execute per log, every row commits on its own
+    cursor = conn.cursor()
+    sql = "INSERT INTO logs (TAG, date_time, info) VALUES (%s, %s, %s)" % ((param,) * 3)
+    for log in logs:
+        cursor.execute(sql, log)
+        conn.commit()
+
+
+def insert_bulk(conn, param, logs, chunk_size):
+    # insert_logs(): multi-row INSERTs of chunk_size rows, one commit for the batch
+    cursor = conn.cursor()
+    row = "(%s, %s, %s)" % ((param,) * 3)
+    for start in range(0, len(logs), chunk_size):
+        chunk = logs[start:start + chunk_size]
+        sql = "INSERT INTO logs (TAG, date_time, info) VALUES " + ", ".join([row] * len(chunk))
+        cursor.execute(sql, [value for log in chunk for value in log])
+    conn.commit()
+
+
+def insert_sequenced(conn, param, ignore, logs, first_seq, chunk_size):
+    # the node branch of api.php: insert_logs() with a node, then committed_seq follows the stored numbers
+    cursor = conn.cursor()
+    row = "(%s, %s, %s, %s, %s)" % ((param,) * 5)
+    for start in range(0, len(logs), chunk_size):
+        chunk = logs[start:start + chunk_size]
+        sql = ignore + " INTO logs (node, seq, TAG, date_time, info) VALUES " + ", ".join([row] * len(chunk))
+        values = []
+        for seq, log in enumerate(chunk, first_seq + start):
+            values.extend((NODE, seq) + log)
+        cursor.execute(sql, values)
+
+    cursor.execute(ignore + " INTO upload_nodes (node, committed_seq) VALUES (%s, 0)" % param, (NODE,))
+    lock = " FOR UPDATE" if param == "%s" else ""
+    cursor.execute("SELECT committed_seq FROM upload_nodes WHERE node = %s%s" % (param, lock), (NODE,))
+    committed = int(cursor.fetchone()[0])
+    cursor.execute("SELECT seq FROM logs WHERE node = %s AND seq > %s ORDER BY seq" % (param, param), (NODE, committed))
+    for (seq,) in cursor.fetchall():
+        if int(seq) != committed + 1:
+            break
+        committed += 1
+    cursor.execute("UPDATE upload_nodes SET committed_seq = %s WHERE node = %s" % (param, param), (committed, NODE))
+    conn.commit()
+    return committed
+
+
+def run(conn, param, rows, batch, chunk_size, per_row):
+    logs = make_logs(rows)
+    start = time.perf_counter()
+    for offset in range(0, rows, batch):
+        if per_row:
+            insert_per_row(conn, param, logs[offset:offset + batch])
+        else:
+            insert_bulk(conn, param, logs[offset:offset + batch], chunk_size)
+    return rows / (time.perf_counter() - start)
+
+
+def run_sequenced(conn, param, ignore, rows, batch, chunk_size, resend):
+    # every batch after the first starts with resend percent of the one before, those rows are skipped
+    logs = make_logs(rows)
+    repeat = batch * resend // 100
+    start = time.perf_counter()
+    committed = 0
+    for offset in range(0, rows, batch):
+        first = max(0, offset - repeat)
+        committed = insert_sequenced(conn, param, ignore, logs[first:offset + batch], first + 1, chunk_size)
+    elapsed = time.perf_counter() - start
+    if committed != rows:
+        sys.exit("committed_seq %d after %d rows" % (committed, rows))
+    return rows / elapsed
+
+
+def connect(args):
+    if args.mysql:
+        try:
+            import pymysql
+        except ImportError:
+            sys.exit("--mysql needs PyMySQL (pip install pymysql)")
+        conn = pymysql.connect(host=args.mysql, user=args.user, password=args.password, database=args.database,
+                               autocommit=False)
+        return conn, "%s", "INSERT IGNORE", SCHEMA_MYSQL, "MySQL %s" % args.mysql
+
+    import sqlite3
+    # a file, not :memory:, so a commit costs what it costs on a disk
+    path = args.sqlite or os.path.join(tempfile.mkdtemp(), "logs.db")
+    conn = sqlite3.connect(path)
+    return conn, "?", "INSERT OR IGNORE", SCHEMA_SQLITE, "SQLite %s (%s)" % (sqlite3.sqlite_version, path)
+
+
+def reset(conn):
+    cursor = conn.cursor()
+    cursor.execute("DELETE FROM logs")
+    cursor.execute("DELETE FROM upload_nodes")
+    conn.commit()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="rows per second of per-row, multi-row and sequenced log inserts")
+    parser.add_argument("--rows", type=int, default=20000, help="logs inserted per measurement")
+    parser.add_argument("--batch", type=int, nargs="+", default=[50, 500, 5000], help="logs per upload request")
+    parser.add_argument("--chunk-size", type=int, default=500, help="rows per INSERT, $insert_chunk_size in api.php")
+    parser.add_argument("--resend", type=int, default=10, help="percent of a sequenced batch sent again in the next one")
+    parser.add_argument("--sqlite", help="database file, a temporary one by default")
+    parser.add_argument("--mysql", help="MySQL host instead of SQLite")
+    parser.add_argument("--user", default="root")
+    parser.add_argument("--password", default="")
+    parser.add_argument("--database", default="access_benchmark")
+    args = parser.parse_args()
+
+    conn, param, ignore, schema, name = connect(args)
+    cursor = conn.cursor()
+    cursor.execute("DROP TABLE IF EXISTS logs")
+    cursor.execute("DROP TABLE IF EXISTS upload_nodes")
+    cursor.execute(schema)
+    cursor.execute(NODES_SCHEMA)
+    conn.commit()
+
+    print("%s, %d rows per measurement, %d rows per INSERT, %d%% resent" % (name, args.rows, args.chunk_size, args.resend))
+    print("%8s %14s %14s %8s %14s" % ("batch", "per row/s", "bulk/s", "speedup", "sequenced/s"))
+    for batch in args.batch:
+        # the per-row path commits every log, it is measured on fewer rows to keep the run short
+        per_row_rows = min(args.rows, 2000)
+        reset(conn)
+        per_row = run(conn, param, per_row_rows, batch, args.chunk_size, True)
+        reset(conn)
+        bulk = run(conn, param, args.rows, batch, args.chunk_size, False)
+        reset(conn)
+        sequenced = run_sequenced(conn, param, ignore, args.rows, batch, args.chunk_size, args.resend)
+        print("%8d %14.0f %14.0f %7.1fx %14.0f" % (batch, per_row, bulk, bulk / per_row, sequenced))
+    conn.close()
+
+
+if __name__ == "__main__":
+    main()
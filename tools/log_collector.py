@@ -0,0 +1,170 @@
+#!/usr/bin/env python3
+#
+# Created by Vincent.
+#
+# Host side collector for the UDP log stream of the master nodes (log_syslog.c).
+# Accepts RFC 5424 messages and the compact binary form from any number of
+# nodes, prints one line per record and counts lost datagrams per node from
+# the sequence numbers.
+#
+#   python3 tools/log_collector.py --port 5514
+#   python3 tools/log_collector.py --port 5514 --jsonl out.jsonl --count 100 --timeout 30
+#
+
+import argparse
+import json
+import re
+import socket
+import struct
+import sys
+import time
+from datetime import datetime, timezone
+
+# mirrors log_tag_names and log_event_names in main/logger/log_record.c
+TAG_NAMES = ["UNKNOWN", "LOGGER", "NRF_MESSAGE_HANDLER", "TCP", "https_server", "ACCESS",
+             "SQL_SERVER", "WIFI_EVENTS", "SNTP", "TEST"]
+EVENT_NAMES = ["TEXT", "PING_OK", "PING_ERROR", "SEND_TURNON", "SEND_TURNOFF", "ACCESS_GRANTED",
+               "ACCESS_DENIED", "LOGIN", "TURNON_REQUEST", "TURNOFF_REQUEST", "SYNC_REQUEST",
+               "ACCESSLEVEL_REQUEST", "SHOW_KEYS_REQUEST", "SHOW_DEVICES_REQUEST", "SHOW_LOGS_REQUEST",
+               "SUMMARY", "BRUTE_FORCE_DEVICE", "BRUTE_FORCE_KEY", "ACCESS_LOCKED", "SHOW_OCCUPANCY_REQUEST"]
+
+BINARY_MAGIC = b"LG"
+BINARY_VERSION = 1
+BINARY_HEADER = struct.Struct("<2sBBII16s")
+RECORD_HEADER = struct.Struct("<IBBHQB")
+EPOCH_VALID_MIN = 1 << 30
+
+RFC5424 = re.compile(r'^<(?P<pri>\d+)>1 (?P<timestamp>\S+) (?P<node>\S+) (?P<tag>\S+) \S+ (?P<event>\S+) '
+                     r'(?P<sd>(?:-|(?:\[[^\]]*\])+)) ?(?P<info>.*)$', re.S)
+
+
+def name(names, index):
+    return names[index] if index < len(names) else str(index)
+
+
+def stamp_to_text(epoch):
+    if epoch < EPOCH_VALID_MIN:
+        boot, uptime = (epoch >> 24) & 0x3F, epoch & 0xFFFFFF
+        return "boot %d +%02d:%02d:%02d" % (boot, uptime // 3600, uptime // 60 % 60, uptime % 60)
+    return datetime.fromtimestamp(epoch, timezone.utc).strftime("%Y-%m-%dT%H:%M:%SZ")
+
+
+def parse_binary(data):
+    magic, version, count, boot_id, seq, node = BINARY_HEADER.unpack_from(data)
+    if magic != BINARY_MAGIC or version != BINARY_VERSION:
+        raise ValueError("unknown binary datagram")
+    node = node.split(b"\0", 1)[0].decode(errors="replace")
+    records = []
+    offset = BINARY_HEADER.size
+    for _ in range(count):
+        epoch, tag_id, event, device, key, text_len = RECORD_HEADER.unpack_from(data, offset)
+        offset += RECORD_HEADER.size
+        text = data[offset:offset + text_len].decode(errors="replace")
+        offset += text_len
+        if text:
+            info = text
+        elif event in (1, 3, 4):
+            info = "device: %d" % device
+        else:
+            info = "device: %d, key: %016X" % (device, key)
+        records.append({"node": node, "time": stamp_to_text(epoch), "tag": name(TAG_NAMES, tag_id),
+                        "event": name(EVENT_NAMES, event), "device": device, "key": "%016X" % key, "info": info})
+    return node, boot_id, seq, records
+
+
+def parse_rfc5424(data):
+    match = RFC5424.match(data.decode(errors="replace"))
+    if match is None:
+        raise ValueError("not an RFC 5424 message")
+    seq = None
+    boot_id = None
+    timestamp = match.group("timestamp")
+    params = {}
+    for element in re.findall(r'\[([^\]]*)\]', match.group("sd")):
+        element_id, _, rest = element.partition(" ")
+        for key, value in re.findall(r'(\w+)="([^"]*)"', rest):
+            params[element_id + "." + key] = value
+    if "meta.sequenceId" in params:
+        seq = int(params["meta.sequenceId"])
+    if "boot@32473.id" in params:
+        boot_id = int(params["boot@32473.id"])
+        uptime = int(params.get("boot@32473.uptime", 0))
+        timestamp = "boot %d +%02d:%02d:%02d" % (boot_id, uptime // 3600, uptime // 60 % 60, uptime % 60)
+    record = {"node": match.group("node"), "time": timestamp, "tag": match.group("tag"),
+              "event": match.group("event"), "severity": int(match.group("pri")) % 8, "info": match.group("info")}
+    return match.group("node"), boot_id, seq, [record]
+
+
+class NodeStats:
+    def __init__(self):
+        self.boot_id = None
+        self.last_seq = None
+        self.datagrams = 0
+        self.records = 0
+        self.lost = 0
+
+    def update(self, boot_id, seq, records):
+        self.datagrams += 1
+        self.records += records
+        if seq is None:
+            return
+        # sequence numbers restart with every boot, a reset to a low number is a reboot not a loss
+        restarted = (boot_id is not None and boot_id != self.boot_id) or (self.last_seq is not None and seq <= self.last_seq)
+        if self.last_seq is not None and not restarted and seq > self.last_seq + 1:
+            self.lost += seq - self.last_seq - 1
+        if boot_id is not None:
+            self.boot_id = boot_id
+        self.last_seq = seq
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Collect the UDP log stream of master nodes")
+    parser.add_argument("--bind", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=514)
+    parser.add_argument("--jsonl", help="append every record as a json line to this file")
+    parser.add_argument("--count", type=int, default=0, help="exit after this many records")
+    parser.add_argument("--timeout", type=float, default=0, help="exit after this many seconds")
+    parser.add_argument("--quiet", action="store_true", help="do not print records")
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind((args.bind, args.port))
+    sock.settimeout(0.5)
+    out = open(args.jsonl, "a") if args.jsonl else None
+    stats = {}
+    total = 0
+    start = time.monotonic()
+
+    try:
+        while (args.count == 0 or total < args.count) and (args.timeout == 0 or time.monotonic() - start < args.timeout):
+            try:
+                data, addr = sock.recvfrom(2048)
+            except socket.timeout:
+                continue
+            try:
+                parse = parse_binary if data.startswith(BINARY_MAGIC) else parse_rfc5424
+                node, boot_id, seq, records = parse(data)
+            except (ValueError, struct.error) as error:
+                print("%s: dropped datagram, %s" % (addr[0], error), file=sys.stderr)
+                continue
+            stats.setdefault(node, NodeStats()).update(boot_id, seq, len(records))
+            for record in records:
+                record["from"] = addr[0]
+                if not args.quiet:
+                    print("%-16s %-20s %-20s %-22s %s" % (record["node"], record["time"], record["tag"], record["event"], record["info"]))
+                if out:
+                    out.write(json.dumps(record) + "\n")
+            total += len(records)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if out:
+            out.close()
+        for node, node_stats in sorted(stats.items()):
+            print("%s: %d records in %d datagrams, %d datagrams lost" % (node, node_stats.records, node_stats.datagrams, node_stats.lost),
+                  file=sys.stderr)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())